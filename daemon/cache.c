@@ -0,0 +1,403 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "cache.h"
+#include "output.h"
+#include "template.h"
+
+/* En-tte des fichiers du cache */
+#define CACHE_MAGIC "CADICACHE1\n"
+
+/** Un fichier du cache, pour l'viction */
+typedef struct
+{
+
+  char name[32];
+  off_t size;
+  struct timespec mtime;
+
+} cachefile_t;
+
+static const char *cache_dir = CACHE_DEFAULT_DIR;
+static size_t cache_max_size = CACHE_DEFAULT_SIZE;
+
+void cache_configure(const char *dir, size_t max_size)
+{
+  cache_dir = dir;
+  cache_max_size = max_size;
+}
+
+/**
+ * FNV-1a 64 bits, en continuant depuis un hash prcdent.
+ */
+static unsigned long long fnv1a(unsigned long long hash, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+
+  while (len--)
+    {
+      hash ^= *p++;
+      hash *= 0x100000001b3ULL;
+    }
+
+  return hash;
+}
+
+/**
+ * Ajoute un champ (termin par '\0')  la cl.
+ */
+static bool key_append(cachekey_t *key, const char *field)
+{
+  size_t len = strlen(field) + 1;
+  char *data = realloc(key->data, key->len + len);
+
+  if (data == NULL)
+    {
+      perror("realloc");
+      return false;
+    }
+
+  memcpy(data + key->len, field, len);
+  key->data = data;
+  key->len += len;
+  return true;
+}
+
+/**
+ * Ajoute  la cl l'identit d'un fichier : chemin, taille, date de
+ * modification et inode. Un fichier absent est not comme tel.
+ */
+static bool key_append_file(cachekey_t *key, const char *kind, const char *path)
+{
+  char field[128];
+  struct stat st;
+
+  if (stat(path, &st) == -1)
+    snprintf(field, sizeof field, "absent");
+  else
+    snprintf(field, sizeof field, "%lld %lld.%09ld %llu",
+	     (long long) st.st_size, (long long) st.st_mtim.tv_sec,
+	     st.st_mtim.tv_nsec, (unsigned long long) st.st_ino);
+
+  return key_append(key, kind) && key_append(key, path) && key_append(key, field);
+}
+
+/**
+ * Ajoute  la cl le contenu de l'entre standard (son hash).
+ */
+static bool key_append_stdin(cachekey_t *key, const char *path)
+{
+  char buffer[8192], field[32];
+  unsigned long long hash = 0xcbf29ce484222325ULL;
+  ssize_t n;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+    return false;
+
+  while ((n = read(fd, buffer, sizeof buffer)) > 0)
+    hash = fnv1a(hash, buffer, n);
+
+  close(fd);
+  if (n == -1)
+    return false;
+
+  snprintf(field, sizeof field, "%016llx", hash);
+  return key_append(key, "stdin") && key_append(key, path) && key_append(key, field);
+}
+
+/**
+ * Construit la cl d'une commande. L'excutable est rsolu dans le $PATH
+ * comme le fera execvp, et son identit en fait partie : un programme
+ * rinstall ne sert pas les rsultats de l'ancien.
+ *
+ * @param key la cl  construire
+ * @param args arguments de la commande, termins par NULL
+ * @param stdin_path fichier servant d'entre standard, ou NULL
+ * @param inputs fichiers lus par la commande, termins par NULL
+ * @return false si la cl n'a pas pu tre construite
+ */
+bool cache_key(cachekey_t *key, char *const args[], const char *stdin_path, char *const inputs[])
+{
+  char path[PATH_MAX];
+  struct stat st;
+
+  memset(key, 0, sizeof *key);
+
+  if (!key_append_file(key, "exec", resolve_executable(args[0], path, &st) ? path : args[0]))
+    goto fail;
+
+  for (int i = 0; args[i] != NULL; i++)
+    if (!key_append(key, "arg") || !key_append(key, args[i]))
+      goto fail;
+
+  if (stdin_path != NULL && !key_append_stdin(key, stdin_path))
+    goto fail;
+
+  for (int i = 0; inputs[i] != NULL; i++)
+    if (!key_append_file(key, "input", inputs[i]))
+      goto fail;
+
+  key->hash = fnv1a(0xcbf29ce484222325ULL, key->data, key->len);
+  return true;
+
+ fail:
+  cache_key_free(key);
+  return false;
+}
+
+void cache_key_free(cachekey_t *key)
+{
+  free(key->data);
+  memset(key, 0, sizeof *key);
+}
+
+/**
+ * Chemin du fichier d'une cl dans le cache.
+ */
+static void cache_path(char *path, size_t size, const cachekey_t *key)
+{
+  snprintf(path, size, "%s/%016llx", cache_dir, key->hash);
+}
+
+/**
+ * Lit exactement len octets, ou choue.
+ */
+static bool read_full(int fd, void *data, size_t len)
+{
+  char *p = data;
+
+  while (len > 0)
+    {
+      ssize_t n = read(fd, p, len);
+      if (n <= 0)
+	return false;
+      p += n;
+      len -= n;
+    }
+
+  return true;
+}
+
+static bool write_full(int fd, const void *data, size_t len)
+{
+  const char *p = data;
+
+  while (len > 0)
+    {
+      ssize_t n = write(fd, p, len);
+      if (n <= 0)
+	return false;
+      p += n;
+      len -= n;
+    }
+
+  return true;
+}
+
+/**
+ * crit tout un buffer de sortie, morceau par morceau s'il est scell.
+ */
+static bool write_output(int fd, const outbuf_t *buf)
+{
+  const char *data;
+  size_t n;
+
+  for (size_t offset = 0; (n = outbuf_span(buf, offset, &data)) > 0; offset += n)
+    if (!write_full(fd, data, n))
+      return false;
+
+  return true;
+}
+
+/**
+ * Lit size octets du fichier  la suite d'un buffer de sortie.
+ */
+static bool read_output(int fd, outbuf_t *buf, size_t size)
+{
+  char chunk[8192];
+
+  while (size > 0)
+    {
+      size_t n = size < sizeof chunk ? size : sizeof chunk;
+
+      if (!read_full(fd, chunk, n) || !outbuf_append(buf, chunk, n))
+	return false;
+      size -= n;
+    }
+
+  return true;
+}
+
+/**
+ * Cherche le rsultat d'une commande dans le cache.
+ *
+ * @param key cl de la commande
+ * @param ret reoit le code de retour
+ * @param out reoit la sortie standard
+ * @param err reoit la sortie d'erreur
+ * @return true si le rsultat tait en cache
+ */
+bool cache_lookup(const cachekey_t *key, int *ret, outbuf_t *out, outbuf_t *err)
+{
+  char path[PATH_MAX], magic[sizeof CACHE_MAGIC - 1];
+  unsigned long long key_len, out_len, err_len;
+  int fd;
+
+  cache_path(path, sizeof path, key);
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+    return false;
+
+  char *stored = NULL;
+  bool hit = read_full(fd, magic, sizeof magic)
+    && !memcmp(magic, CACHE_MAGIC, sizeof magic)
+    && read_full(fd, &key_len, sizeof key_len)
+    && key_len == key->len
+    && (stored = malloc(key_len)) != NULL
+    && read_full(fd, stored, key_len)
+    && !memcmp(stored, key->data, key_len)   /* Pas de collision de hash */
+    && read_full(fd, ret, sizeof *ret)
+    && read_full(fd, &out_len, sizeof out_len)
+    && read_full(fd, &err_len, sizeof err_len)
+    && read_output(fd, out, out_len)
+    && read_output(fd, err, err_len);
+
+  free(stored);
+  close(fd);
+
+  /* La date de modification sert  l'viction LRU */
+  if (hit)
+    utimes(path, NULL);
+
+  return hit;
+}
+
+static int compare_mtime(const void *a, const void *b)
+{
+  const struct timespec *ta = &((const cachefile_t *) a)->mtime;
+  const struct timespec *tb = &((const cachefile_t *) b)->mtime;
+
+  if (ta->tv_sec != tb->tv_sec)
+    return ta->tv_sec < tb->tv_sec ? -1 : 1;
+  return ta->tv_nsec < tb->tv_nsec ? -1 : ta->tv_nsec > tb->tv_nsec;
+}
+
+/**
+ * Supprime les entres les moins rcemment utilises jusqu' repasser
+ * sous la taille maximale du cache.
+ */
+static void cache_evict()
+{
+  DIR *dir;
+  struct dirent *entry;
+  cachefile_t *files = NULL;
+  size_t nfiles = 0, cap = 0;
+  unsigned long long total = 0;
+  char path[PATH_MAX];
+
+  if ((dir = opendir(cache_dir)) == NULL)
+    return;
+
+  while ((entry = readdir(dir)) != NULL)
+    {
+      struct stat st;
+
+      if (entry->d_name[0] == '.' || strlen(entry->d_name) >= sizeof files->name)
+	continue;
+
+      snprintf(path, sizeof path, "%s/%s", cache_dir, entry->d_name);
+      if (stat(path, &st) == -1 || !S_ISREG(st.st_mode))
+	continue;
+
+      if (nfiles == cap)
+	{
+	  cap = cap ? cap * 2 : 64;
+	  cachefile_t *more = realloc(files, cap * sizeof *files);
+	  if (more == NULL)
+	    break;
+	  files = more;
+	}
+
+      snprintf(files[nfiles].name, sizeof files->name, "%s", entry->d_name);
+      files[nfiles].size = st.st_size;
+      files[nfiles].mtime = st.st_mtim;
+      total += st.st_size;
+      nfiles++;
+    }
+
+  closedir(dir);
+
+  if (total > cache_max_size)
+    {
+      qsort(files, nfiles, sizeof *files, compare_mtime);
+
+      for (size_t i = 0; i < nfiles && total > cache_max_size; i++)
+	{
+	  snprintf(path, sizeof path, "%s/%s", cache_dir, files[i].name);
+	  if (unlink(path) == 0)
+	    total -= files[i].size;
+	}
+    }
+
+  free(files);
+}
+
+/**
+ * Enregistre le rsultat d'une commande dans le cache. Le fichier est
+ * crit  part puis renomm, pour qu'un lecteur ne le voie jamais partiel.
+ */
+void cache_store(const cachekey_t *key, int ret, const outbuf_t *out, const outbuf_t *err)
+{
+  char path[PATH_MAX], tmp[PATH_MAX];
+  unsigned long long key_len = key->len, out_len = out->len, err_len = err->len;
+  int fd;
+
+  /* Trop gros pour le cache : inutile d'vincer tout le reste */
+  if (key_len + out_len + err_len > cache_max_size)
+    return;
+
+  if (mkdir(cache_dir, 0700) == -1 && errno != EEXIST)
+    {
+      perror("mkdir");
+      return;
+    }
+
+  cache_path(path, sizeof path, key);
+  snprintf(tmp, sizeof tmp, "%s.tmp", path);
+
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1)
+    {
+      perror("open");
+      return;
+    }
+
+  bool ok = write_full(fd, CACHE_MAGIC, sizeof CACHE_MAGIC - 1)
+    && write_full(fd, &key_len, sizeof key_len)
+    && write_full(fd, key->data, key->len)
+    && write_full(fd, &ret, sizeof ret)
+    && write_full(fd, &out_len, sizeof out_len)
+    && write_full(fd, &err_len, sizeof err_len)
+    && write_output(fd, out)
+    && write_output(fd, err);
+
+  if (close(fd) == -1 || !ok || rename(tmp, path) == -1)
+    {
+      perror("cache_store");
+      unlink(tmp);
+      return;
+    }
+
+  cache_evict();
+}
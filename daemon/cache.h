@@ -0,0 +1,33 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "output.h"
+
+/* Rpertoire et taille maximale (octets) du cache par dfaut */
+#define CACHE_DEFAULT_DIR "/tmp/cadid-cache"
+#define CACHE_DEFAULT_SIZE (64 * 1024 * 1024)
+
+/*
+ * Cl d'un rsultat en cache : tout ce dont dpend le rsultat d'une
+ * commande dterministe (excutable, arguments, entre standard,
+ * fichiers lus).
+ */
+typedef struct
+{
+
+  char *data;
+  size_t len;
+  unsigned long long hash;
+
+} cachekey_t;
+
+extern void cache_configure(const char *, size_t);
+extern bool cache_key(cachekey_t *, char *const[], const char *, char *const[]);
+extern void cache_key_free(cachekey_t *);
+extern bool cache_lookup(const cachekey_t *, int *, outbuf_t *, outbuf_t *);
+extern void cache_store(const cachekey_t *, int, const outbuf_t *, const outbuf_t *);
+
+#endif
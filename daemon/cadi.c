@@ -4,16 +4,16 @@
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
-#include <signal.h>
-#include <sys/wait.h>
-#include <sys/socket.h>
+#include <errno.h>
+#include <poll.h>
 #include <arpa/inet.h>
-#include <stdarg.h>
 #include <netdb.h>
 #include <ctype.h>
 
 #include "cadid.h"
 #include "config.h"
+#include "runner.h"
+#include "libcadi.h"
 
 /** L'adresse du serveur */
 static in_addr_t server_in_addr;
@@ -21,9 +21,34 @@ static in_addr_t server_in_addr;
 /** Le port de connection sur le serveur */
 static unsigned port;
 
+/** Lanceur de tches (-j) : nombre de tches simultanes, 0 en interactif */
+static unsigned jobs;
+
+/** Fichier des tches (-f), "-" pour l'entre standard */
+static const char *jobs_file = "-";
+
+/** Rsultats des tches dans l'ordre du fichier (-k) */
+static bool keep_order;
+
+/** Sorties des tches compresses par le dmon (-z) */
+static bool compress;
+
 /** La version du client */
 static const char *client_version = "Doom Client v0.5a";
 
+/** Les connections au dmon */
+static cadi_pool_t *pool;
+
+/** Le dmon a rpondu "OK QUIT" */
+static bool quit;
+
+/** Tap, pas encore envoy */
+static char typed[MESSAGE_BUFFER_SIZE];
+static size_t typed_len;
+
+/** Une commande attend sa rponse : les suivantes attendent leur tour */
+static bool replying;
+
 /**
  * Affiche l'aide du client.
  *
@@ -32,9 +57,13 @@ static const char *client_version = "Doom Client v0.5a";
 static void usage(const char *prog)
 {
   puts(client_version);
-  printf("Usage : %s [ -h | -v | -s adresse_serveur [ -p port ] ]\n", prog);
+  printf("Usage : %s [ -h | -v | -s adresse_serveur [ -p port ] [ -j n [ -f fichier ] [ -k ] [ -z ] ] ]\n", prog);
   puts("\t-s adresse_serveur . . l'adresse du serveur o se connecter (dfaut: localhost)");
   printf("\t-p port  . . . . . . . le port sur lequel se connecter (dfaut: %d)\n", DEFAULT_PORT);
+  puts("\t-j n . . . . . . . . . lancer les commandes du fichier, n  la fois");
+  puts("\t-f fichier . . . . . . une commande par ligne (dfaut: entre standard)");
+  puts("\t-k . . . . . . . . . . afficher les rsultats dans l'ordre du fichier");
+  puts("\t-z . . . . . . . . . . recevoir les sorties compresses, si le dmon le propose");
   puts("\t-v . . . . . . . . . . afficher la version du client");
   puts("\t-h . . . . . . . . . . afficher cette aide");
 }
@@ -80,6 +109,34 @@ static void parse_command_line(int argc, char *argv[])
 	  port = atoi(*++argv);
 	}
 
+      /* Lanceur de tches */
+      else if (!strcmp(*argv, "-j") || !strcmp(*argv, "-f"))
+	{
+	  if (*(argv + 1) == NULL)
+	    {
+	      usage(prog);
+	      exit(EXIT_FAILURE);
+	    }
+
+	  if (argv[0][1] == 'f')
+	    {
+	      jobs_file = *++argv;
+	      if (jobs == 0)
+		jobs = 1;
+	    }
+	  else if ((jobs = atoi(*++argv)) == 0)
+	    {
+	      fprintf(stderr, "Nombre de tches \"%s\" invalide\n", *argv);
+	      exit(EXIT_FAILURE);
+	    }
+	}
+
+      else if (!strcmp(*argv, "-k"))
+	keep_order = true;
+
+      else if (!strcmp(*argv, "-z"))
+	compress = true;
+
       /* Serveur */
       else if (!strcmp(*argv, "-s"))
 	{
@@ -109,107 +166,182 @@ static void parse_command_line(int argc, char *argv[])
     }
 }
 
+/**
+ * Affiche la rponse  une commande, puis le prompt.
+ */
+static void print_reply(void *arg, unsigned id, const cadi_result_t *result)
+{
+  arg = arg;
+  id = id;
+
+  fwrite(result->body, 1, result->body_len, stdout);
+  printf("%s%s%s\n$ ", result->ok ? "OK" : "ERR", *result->reply ? " " : "", result->reply);
+  fflush(stdout);
+
+  if (result->ok && !strcmp(result->reply, DETAIL_RET_QUIT))
+    quit = true;
+  replying = false;
+}
+
+/**
+ * Fin d'une sortie (GetOutput/GetError) affiche au fil de l'eau : la
+ * rponse ne donnait que son canal.
+ */
+static void print_end(void *arg, unsigned id, const cadi_result_t *result)
+{
+  arg = arg;
+  id = id;
+
+  if (result->ok)
+    fputs("OK\n$ ", stdout);
+  else
+    printf("ERR %s\n$ ", result->reply);
+  fflush(stdout);
+  replying = false;
+}
+
+static void print_data(void *arg, unsigned id, const char *data, size_t len)
+{
+  arg = arg;
+  id = id;
+  fwrite(data, 1, len, stdout);
+}
+
+/**
+ * Envoie au dmon une ligne tape, sans ses espaces de dbut et de fin.
+ *
+ * @return false pour une ligne vide, qui n'est pas envoye
+ */
+static bool send_line(char *line)
+{
+  char *p = line + strlen(line);
+
+  while (p > line && isspace(p[-1])) /* Suppression des trailing spaces */
+    *--p = '\0';
+
+  while (isspace(*line)) /* Dcalage du dbut de chane jusque le premier non-espace */
+    line++;
+
+  if (*line == '\0')
+    return false;
+
+  bool stream = (!strncmp(line, CMD_GET_OUTPUT, strlen(CMD_GET_OUTPUT))
+		 || !strncmp(line, CMD_GET_ERROR, strlen(CMD_GET_ERROR)));
+  return cadi_send(pool, line, stream ? print_end : print_reply, print_data, NULL) != 0;
+}
+
+/**
+ * Envoie la ligne tape suivante, une fois la rponse  la prcdente
+ * affiche : les rponses restent dans l'ordre des commandes.
+ *
+ * @param input false une fois l'entre finie : une dernire ligne sans
+ * '\n' part aussi
+ */
+static void send_next(bool input)
+{
+  while (!replying && typed_len > 0)
+    {
+      char *eol = memchr(typed, '\n', typed_len);
+      size_t len;
+
+      /* Ligne trop longue : envoye telle quelle, tronque */
+      if (eol != NULL)
+	len = eol - typed;
+      else if (!input || typed_len == sizeof typed - 1)
+	len = typed_len;
+      else
+	return;
+
+      char line[sizeof typed];
+      memcpy(line, typed, len);
+      line[len] = '\0';
+      typed_len -= len < typed_len ? len + 1 : len;
+      memmove(typed, typed + (eol != NULL ? len + 1 : len), typed_len);
+
+      /* Le rappel peut venir ds l'envoi, si le dmon est injoignable */
+      replying = true;
+      if (!send_line(line))
+	replying = false;
+    }
+}
+
 /**
  * Point d'entre du programme.
  */
 int main(int argc, char *argv[])
 {
   parse_command_line(argc, argv);
-  
-  /* On cre un socket pour se connecter sur un serveur */
-  int server_socket;
-  if ((server_socket = socket(PF_INET, SOCK_STREAM, 0)) == -1)
-    {
-      perror("socket");
-      return EXIT_FAILURE;
-    }
-  
-  /* On initialise la structure pour savoir o/comment se connecter */
-  struct sockaddr_in server_address;
-  memset(&server_address, 0, sizeof server_address);
-  server_address.sin_family = AF_INET;
-  server_address.sin_addr.s_addr = server_in_addr; /* Adresse de connection */
-  server_address.sin_port = htons(port); /* Le port */
-
-  /* On se connecte */
-  if (connect(server_socket, (struct sockaddr *) &server_address, sizeof server_address) == -1)
+
+  /* Le lanceur garde un WaitAny en cours : il lui faut plusieurs connections */
+  if ((pool = cadi_open(server_in_addr, port, jobs > 0 ? RUNNER_CONNECTIONS : 1,
+			compress ? CADI_COMPRESS : 0)) == NULL)
     {
-      perror("connect");
-      if (close(server_socket) == -1)
-	perror("close");
+      perror("cadi_open");
       return EXIT_FAILURE;
     }
 
-  /* Buffer qui contiendra les messages serveur -> client, et client -> serveur (fork) */
-  char buffer[MESSAGE_BUFFER_SIZE];
-
-  /* On fork pour l'coute et l'envoi */
-  switch (fork()) {
+  /* On attend la connection ; la premire n'est pas retente */
+  while (cadi_ready(pool, -1) == 0)
+    if (cadi_error(pool, -1) != NULL || cadi_poll(pool, -1) == -1)
+      {
+	fprintf(stderr, "cadi : %s\n", cadi_error(pool, -1) ? cadi_error(pool, -1) : strerror(errno));
+	cadi_close(pool);
+	return EXIT_FAILURE;
+      }
 
-  case -1: /* Erreur */
+  /* Lanceur de tches : pas d'interaction */
+  if (jobs > 0)
     {
-      perror("fork");
-      break;
-    }
+      FILE *file = strcmp(jobs_file, "-") ? fopen(jobs_file, "r") : stdin;
+      if (file == NULL)
+	{
+	  perror(jobs_file);
+	  return EXIT_FAILURE;
+	}
 
-  case 0: /* Fils -- Envoie au serveur les messages taps par le client */
-    {
-      
-      /* A chaque saisie, on envoie au serveur */
-      while (fgets(buffer, MESSAGE_BUFFER_SIZE, stdin)) {
-	
-	/* On se place en fin de chane */
-	char *p = buffer + strlen(buffer) - 1; 
-
-	while (isspace(*p)) /* Suppression des trailing spaces */
-	  *p-- = '\0';
-	
-	p = buffer; /* Dcalage du dbut de chane jusque le premier non-espace */
-	while (isspace(*p))
-	  p++;
-	
-	/* On envoie avec un '\0' */
-	if (send(server_socket, p, strlen(p) + 1, 0) < 0)
-	  perror("send");
-      }
+      if (compress && strstr(cadi_welcome(pool), "[ " COMPRESS_LZ " ]") == NULL)
+	fputs("cadi : le dmon ne propose pas la compression\n", stderr);
 
-      break; /* Lors d'un Ctrl+D */
+      int ret = run_jobs(pool, file, jobs, keep_order);
+      cadi_close(pool);
+      return ret;
     }
 
-  default: /* Pre -- Affiche les messages issus du serveur */
+  printf("%s\n$ ", cadi_welcome(pool));
+  fflush(stdout);
+
+  /* Une connection perdue est rouverte : la commande en cours choue, les suivantes passent */
+  bool input = true;
+  while (!quit && (input || replying || typed_len > 0))
     {
-      
-      /* Important de le mettre en pre car il peut tuer son fils (fgets bloquant sinon) */
-      
-      int i;
-      
-      while ((i = recv(server_socket, buffer, MESSAGE_BUFFER_SIZE - 1, 0)) > 0)
+      struct pollfd fds[2];
+      unsigned n = cadi_pollfds(pool, fds, 1);
+      bool room = input && typed_len < sizeof typed - 1;
+
+      fds[n].fd = STDIN_FILENO;
+      fds[n].events = POLLIN;
+      fds[n].revents = 0;
+
+      if (poll(fds, n + room, cadi_timeout(pool)) == -1 && errno != EINTR)
 	{
-	  /* On ne voudrait pas afficher toute la mmoire quand mme */
-	  buffer[i] = '\0';
-	  
-	  /* On affiche le message reu */
-	  printf("%s", buffer);
-	  fflush(stdout);
-
-	  /*
-	   * Le serveur renvoie "OK QUIT" s'il a reu QUIT. On prfrera 
-	   * cela pour quitter proprement, plutt que d'envoyer QUIT au
-	   * serveur et de quitter ct client sans attendre de rponse. 
-	   */
-	  if (sscanf(buffer, "OK %s", buffer) == 1 && !strcmp(buffer, DETAIL_RET_QUIT))
-	    break;
+	  perror("poll");
+	  break;
 	}
 
+      cadi_events(pool, fds, n);
+
+      if (room && fds[n].revents)
+	{
+	  ssize_t got = read(STDIN_FILENO, typed + typed_len, sizeof typed - 1 - typed_len);
+	  if (got > 0)
+	    typed_len += got;
+	  else if (got == 0 || errno != EINTR)
+	    input = false; /* Ctrl+D */
+	}
+
+      send_next(input);
     }
-  }
-  
-  /* Fermeture de la connection */
-  if (close(server_socket) == -1)
-    {
-      perror("Impossible de fermer la connection au serveur");
-      return EXIT_FAILURE;
-    }
-  
+
+  cadi_close(pool);
   return EXIT_SUCCESS;
 }
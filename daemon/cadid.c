@@ -14,20 +14,112 @@
 #include <limits.h>
 #include <signal.h>
 #include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <time.h>
 
 #include "config.h"
 #include "process.h"
+#include "template.h"
+#include "uring.h"
+#include "cache.h"
+#include "state.h"
+#include "capture.h"
+#include "pool.h"
+#include "output.h"
+#include "status.h"
+#include "shaper.h"
+#include "trace.h"
+#include "lz.h"
+#include "fdlimit.h"
+#include "chunk.h"
 #include "cadid.h"
 
+/*
+ * Transfert par trames de la sortie d'un processus (mode Framed) : la
+ * sortie n'est pas copie, on garde sa position dans le buffer du
+ * processus.
+ */
+typedef struct {
+  unsigned chan;      /* Canal du transfert, 0 pour une place libre */
+  pid_t pid;
+  int stream;         /* STREAM_OUT ou STREAM_ERR */
+  size_t offset;      /* Prochain octet  envoyer */
+  size_t end;         /* Fin de la sortie demande */
+} transfer_t;
+
 /*
  * Contient les informations sur un socket (son id et sa structure de
- * connection) 
+ * connection), ainsi que les commandes reues pas encore traites et
+ * les rponses pas encore envoyes.
  */
 typedef struct {
   int socket;
   struct sockaddr_in address;
+  char in[MESSAGE_BUFFER_SIZE];
+  unsigned in_len;
+  char *out;
+  size_t out_len;
+  size_t out_cap;
+  size_t out_sent;
+  char *flight;       /* io_uring : rponses en cours d'envoi par le noyau */
+  size_t flight_len;
+  size_t flight_sent;
+  bool recv_armed;    /* io_uring : rception multishot en cours */
+  char *held;         /* io_uring : reu quand in tait plein, trait aprs l'attente */
+  size_t held_len;
+  size_t held_cap;
+  bool send_armed;    /* io_uring : envoi de flight en cours */
+  bool closing;       /* io_uring :  fermer une fois les oprations finies */
+  bool local;         /* Connect par le socket local (AF_UNIX) */
+  int pass_fd;        /* Descripteur  joindre au prochain envoi, ou -1 */
+  bool pass_armed;    /* io_uring : pass_fd part avec l'envoi en cours */
+  struct msghdr msg;  /* Envoi avec pass_fd (SCM_RIGHTS) */
+  struct iovec iov;
+  union {
+    size_t align;     /* Alignement d'un cmsghdr */
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  bool framed;        /* Rponses multiplexes en trames (Framed) */
+  bool compress;      /* Framed : trames des transferts compresses (Compress) */
+  char *ctl;          /* Framed : rponse en cours, pas encore mise en trame */
+  size_t ctl_len;
+  size_t ctl_cap;
+  transfer_t transfers[MAX_TRANSFERS];
+  unsigned next_chan;     /* Dernier canal attribu */
+  unsigned next_transfer; /* Prochain transfert servi (tourniquet) */
+  char *wait_tag;     /* WaitGroup en attente : commandes suspendues */
+  char *wait_pids;    /* WaitAny en attente : les pids attendus */
+  unsigned id;        /* Numro de la connection, pour la capture */
+  bucket_t bucket;    /* Dbit de la connection (-b) */
+  size_t deficit;     /* Crdit du deficit round robin, si le dbit total est limit */
+  size_t send_len;    /* io_uring : octets de l'envoi en cours, jetons dj pris */
 } socketinfo_t;
 
+/*
+ * Backend io_uring : chaque flux de processus a un buffer enregistr
+ * auprs du noyau, utilis par une seule opration  la fois.
+ */
+typedef struct {
+  bool busy;          /* Une opration utilise le buffer */
+  bool cancelled;     /* Son processus a disparu, l'opration est annule */
+  bool need_poll;     /* Le pipe tait vide/plein, attendre qu'il soit prt */
+  unsigned gen;       /* Gnration du processus vis par l'opration */
+  int fd;             /* Entre dtache  fermer aprs criture, sinon -1 */
+} staging_t;
+
+/* Type d'opration io_uring, dans les bits hauts du user_data */
+#define OP_ACCEPT 1
+#define OP_RECV   2
+#define OP_SEND   3
+#define OP_READ   4
+#define OP_WRITE  5
+#define OP_CLOSE  6
+#define OP_POLL   7
+#define OP_CANCEL 8
+#define OP_CHILD  9
+#define OP_TIMER  10
+
 extern char *strdup(const char *);
 extern int gethostname(char *, size_t);
 
@@ -38,25 +130,140 @@ static const char *prompt_client = "$ ";
 static const char *prompt_server = "! ";
 
 static const int HOST_SIZE = 100;
-static const int MAX_CLIENT = 1;
 
 static unsigned port;
 static bool verbose_flag;
+static bool uring_flag;
+static const char *cache_dir = CACHE_DEFAULT_DIR;
+static size_t cache_size = CACHE_DEFAULT_SIZE;
+static size_t output_budget = POOL_DEFAULT_BUDGET;
+static unsigned fd_wanted;
+
+/** Descripteurs que le dmon peut ouvrir au plus : pipes et page partage des processus, clients */
+#define FD_MOST (MAX_PROCESS * (FD_PER_PROCESS + 1) + MAX_CLIENT * 2)
+
+/** Dbits par connection (-b), total (-B) et par processus (-P), en octets/s, 0 pour illimit */
+static uint64_t client_rate, egress_rate, process_rate;
 
 static int server_socket;
-static int client_socket;
+static int local_socket = -1;
+static const char *local_path;
 struct sockaddr_in server_address;
-struct sockaddr_in client_address;
+
+/** Les clients connects (socket  -1 pour une place libre) */
+static socketinfo_t clients[MAX_CLIENT];
+
+/** Numro de la dernire connection accepte */
+static unsigned last_client_id;
+
+/** Fichier de capture des commandes (-r), ou NULL */
+static const char *capture_path;
+
+/** Dernire ligne OK/ERR envoye, pour la capture */
+static const char *last_notification;
+
+/** Page d'tat publie pour les moniteurs (cadi-top), ou NULL */
+static status_page_t *status_page;
+
+/** Nombre de commandes traites, publi dans la page d'tat */
+static unsigned long commands_processed;
+
+/** Seau de l'ensemble des envois (-B) */
+static bucket_t egress;
+
+/** Seaux des processus (-P), attribus  la demande */
+static struct {
+  pid_t pid;
+  bucket_t bucket;
+} process_buckets[MAX_PROCESS];
+
+/** Premier client servi au prochain tour (deficit round robin) */
+static unsigned drr_next;
+
+/**
+ * Dlai avant le prochain rveil de la boucle, en ms, ou -1 : un envoi
+ * retenu par un seau, une expiration de la rtention, ou la reprise des
+ * acceptations
+ */
+static int shaper_wait = -1;
+
+/** Rtention des processus termins (-t, -n, -o) */
+static retention_t retention;
+
+/** Acceptations suspendues jusqu' cette heure (shaper_now), aprs un EMFILE */
+static uint64_t accept_resume;
+
+/** Octets envoys aux clients, et envois retenus faute de jetons */
+static unsigned long long bytes_sent;
+static unsigned long sends_delayed;
+
+/** Octets des transferts compresss, avant et aprs, et blocs envoys tels quels */
+static unsigned long long compress_in, compress_out;
+static unsigned long compress_skipped;
+
+/** Fichier de la trace crite sur SIGUSR1 (-T active le traceur au dmarrage) */
+static const char *trace_path = TRACE_DEFAULT_PATH;
+static bool trace_flag;
+
+/** Trace demande par SIGUSR1, crite en fin de tour de boucle */
+static volatile sig_atomic_t trace_pending;
+
+/** Le backend io_uring, s'il est utilis */
+static uring_t ring;
+static staging_t staging[MAX_PROCESS * 3];
+static char *staging_data;
+static bool accept_armed[2];  /* Socket serveur, socket local */
+static bool sigchld_armed;
+static bool timer_armed;
+static struct __kernel_timespec timer_ts;
+
+/** Pipe par lequel les gestionnaires de SIGCHLD et SIGUSR2 rveillent la boucle */
+static int sigchld_pipe[2] = { -1, -1 };
+
+/** Ligne de commande du dmon, reprise par Reexec */
+static char **saved_argv;
+
+/** Reexec demand (commande ou SIGUSR2), fait en fin de tour de boucle */
+static volatile sig_atomic_t reexec_pending;
+
+/** tat laiss par l'ancien binaire (option interne -R), ou -1 */
+static int resume_fd = -1;
+static struct sockaddr_in accept_address;
+static socklen_t accept_address_size;
 
 static const char *help =
- DETAIL_RET_CREATE_PROCESS_SYNTAX                 " . . . Crer un processus\n"
+ DETAIL_RET_CREATE_PROCESS_SYNTAX ". . . Crer un processus\n"
+ "  " DETAIL_RET_TAG_OPTION ". . . . . . . . . . . . Ranger le processus dans un groupe\n"
+ "  " DETAIL_RET_CACHE_OPTIONS " . Rsultat en cache, selon l'entre et les fichiers lus\n"
+ "  " DETAIL_RET_AFTER_OPTION ". . Lancer  la fin d'un processus ou d'un groupe (succs par dfaut)\n"
+ "  " DETAIL_RET_REDIRECTIONS " . . . . . . . Rediriger les flux vers des fichiers du serveur\n"
+ DETAIL_RET_CREATE_PROCESS_BATCH_SYNTAX " . . . Crer n processus d'un coup (" DETAIL_RET_TAG_OPTION ", redirections)\n"
+ "  " DETAIL_RET_INSTANCE " . . . . . . . . . . . . . . . . . Numro de l'instance, de 0  n-1\n"
  DETAIL_RET_DESTROY_PROCESS_SYNTAX  " . . . . . . . . . . Dtruire un processus\n"
  DETAIL_RET_SEND_INPUT_SYNTAX          ". . . . . . . . . Envoyer des donnes sur l'entre standard d'un processus\n"
  DETAIL_RET_CLOSE_INPUT_SYNTAX  " . . . . . . . . . . . . Fermer le flux d'entre standard d'un processus\n"
  DETAIL_RET_GET_OUTPUT_SYNTAX  ". . . . . . . . . . . . . Rcuprer la sortie standard d'un processus\n"
  DETAIL_RET_GET_ERROR_SYNTAX  " . . . . . . . . . . . . . Rcuprer la sortie d'erreur d'un processus\n"
+ DETAIL_RET_GREP_OUTPUT_SYNTAX  " . . . . . . . . Filtrer la sortie standard d'un processus\n"
+ DETAIL_RET_HEAD_OUTPUT_SYNTAX  " . . . . . . . . . . Premires lignes de la sortie standard\n"
+ DETAIL_RET_TAIL_OUTPUT_SYNTAX  " . . . . . . . . . . Dernires lignes de la sortie standard\n"
+ DETAIL_RET_MAP_OUTPUT_SYNTAX  ". . . . . . . . . . . . . Partager la sortie standard (clients locaux)\n"
  DETAIL_RET_GET_RETURN_CODE_SYNTAX ". . . . . . . . . . . Rcuprer le code de retour d'un processus\n"
- DETAIL_RET_LIST_PROCESS_SYNTAX " . . . . . . . . . . . . . . Lister les processus excuts\n"
+ DETAIL_RET_LIST_PROCESS_SYNTAX ". . . . Lister les processus excuts\n"
+ DETAIL_RET_DESTROY_GROUP_SYNTAX " . . . . . . . . . Dtruire les processus d'un groupe\n"
+ DETAIL_RET_WAIT_GROUP_SYNTAX ". . . . . . . . . . . Attendre la fin d'un groupe (nombre d'checs)\n"
+ DETAIL_RET_WAIT_ANY_SYNTAX " . . . . . . . . . Attendre la fin d'un processus (pid et code)\n"
+ DETAIL_RET_LIST_GROUP_SYNTAX ". . . . . . . . . . . Lister les processus d'un groupe\n"
+ DETAIL_RET_COLLECT_GROUP_OUTPUT_SYNTAX " . . . . . . Sorties standard des processus d'un groupe\n"
+ DETAIL_RET_LIST_CHANGES_SYNTAX " . . . . . . . . . . . Lister les changements depuis <seq>\n"
+ CMD_GRAPH_STATUS    " . . . . . . . . . . . . . . Processus lis par --after et leur tat\n"
+ DETAIL_RET_DEFINE_TEMPLATE_SYNTAX " . . . . Dfinir un modle de commande\n"
+ DETAIL_RET_RUN_SYNTAX     ". . . . . . . . . . . . Lancer un processus depuis un modle\n"
+ CMD_FRAMED          ". . . . . . . . . . . . . . . . . Multiplexer les rponses en trames\n"
+ DETAIL_RET_COMPRESS_SYNTAX " . . . . . . . . . . . . Compresser les transferts en trames\n"
+ CMD_REEXEC          ". . . . . . . . . . . . . . . . . Relancer le binaire du dmon sans couper les sessions\n"
+ CMD_STATS           " . . . . . . . . . . . . . . . . . Occupation mmoire des buffers, dbits\n"
+ DETAIL_RET_TRACE_SYNTAX " . . . . . . Traceur intgr, trace au format Chrome\n"
  CMD_QUIT            ". . . . . . . . . . . . . . . . . . Quitter\n"
  CMD_GET_HELP        ". . . . . . . . . . . . . . . . . . Afficher cette aide\n";
 
@@ -68,10 +275,30 @@ static const char *help =
 static void usage(const char *prog)
 {
   puts(server_version);
-  printf("Usage : %s [ -v | -V | -h | -p port ]\n", prog);
+  printf("Usage : %s [ -v | -V | -h | -u | -p port | -U chemin | -c rp | -C Mo | -M Mo | -r fichier\n"
+	 "\t| -b ko/s | -B ko/s | -P ko/s | -T fichier | -F n | -t s | -n n | -o Mo ]\n", prog);
   printf("\t-p port . . . . . port local sur lequel se connecter (dfault %d)\n", DEFAULT_PORT);
+  puts("\t-U chemin . . . . couter aussi sur un socket local (AF_UNIX)");
+  printf("\t-c rp  . . . . . rpertoire du cache de rsultats (dfaut %s)\n", CACHE_DEFAULT_DIR);
+  printf("\t-C Mo . . . . . . taille maximale du cache (dfaut %d)\n", CACHE_DEFAULT_SIZE >> 20);
+  printf("\t-M Mo . . . . . . mmoire des buffers, sorties sur disque (" OUTBUF_SPILL_DIR ") au-del (dfaut %d, 0 illimit)\n",
+	 POOL_DEFAULT_BUDGET >> 20);
+  puts("\t-r fichier  . . . enregistrer les commandes reues (rejouables par cadi-replay)");
+  puts("\t-F n  . . . . . . descripteurs de fichiers ouverts au plus (dfaut : limite dure)");
+  puts("\t-t s  . . . . . . retirer les processus termins depuis s secondes (dfaut 0, jamais)");
+  puts("\t-n n  . . . . . . processus termins conservs au plus, les plus anciens partent (dfaut 0, illimit)");
+  puts("\t-o Mo . . . . . . sorties des processus termins conserves au plus (dfaut 0, illimit)");
+  puts("\t-b ko/s . . . . . dbit maximal de chaque connection (dfaut 0, illimit)");
+  puts("\t-B ko/s . . . . . dbit maximal de l'ensemble des connections, partag quitablement");
+  puts("\t-P ko/s . . . . . dbit maximal de la sortie de chaque processus (transferts Framed)");
+  printf("\t-T fichier  . . . activer le traceur intgr, trace crite sur SIGUSR1 (dfaut %s)\n",
+	 TRACE_DEFAULT_PATH);
   puts("\t-v  . . . . . . . afficher la version du serveur");
   puts("\t-V  . . . . . . . mode verbose");
+  puts("\t-u  . . . . . . . entres/sorties par io_uring (poll si indisponible)");
+  puts("\tSIGUSR1 . . . . . crire la trace du traceur intgr (comme Trace dump)");
+  puts("\tSIGUSR2 . . . . . relancer le binaire du dmon (comme Reexec)");
+  puts("\tL'tat du dmon est publi dans /dev/shm/cadid.<port>, lisible par cadi-top");
   puts("\t-h  . . . . . . . afficher cette aide");
 }
 
@@ -103,463 +330,3366 @@ static char *itoa(const int nb)
 }
 
 
-static void client_open_connection()
+/**
+ * Retourne le client correspondant  un socket.
+ *
+ * @return NULL si le socket n'est pas celui d'un client
+ */
+static socketinfo_t *client_of(const int socket)
 {
-  verbose("Connection de %s ...\n", inet_ntoa(client_address.sin_addr));
+  for (unsigned i = 0; i < sizeof clients / sizeof clients[0]; i++)
+    if (clients[i].socket == socket)
+      return clients + i;
+
+  return NULL;
 }
 
+/**
+ * Un WaitGroup ou un WaitAny du client attend-il sa rponse ? Ses
+ * commandes suivantes restent alors dans le socket.
+ */
+static bool client_waiting(const socketinfo_t *client)
+{
+  return client->wait_tag != NULL || client->wait_pids != NULL;
+}
 
-static void client_close_connection()
+/**
+ * Nom du client pour les messages.
+ */
+static const char *client_name(const socketinfo_t *client)
 {
-  verbose("Dconnection de %s ...\n", inet_ntoa(client_address.sin_addr));
-  if (close(client_socket) == -1)
-    perror("Impossible de fermer le socket client");
-  client_socket = -1;
+  return client->local ? "local" : inet_ntoa(client->address.sin_addr);
 }
 
-void send_basic(const int socket, const void *msg, unsigned sz)
+static void client_open_connection(socketinfo_t *client)
+{
+  verbose("Connection de %s ...\n", client_name(client));
+  bucket_init(&client->bucket, client_rate);
+  client->deficit = 0;
+}
+
+
+static void client_close_connection(socketinfo_t *client)
 {
-  if (send(socket, msg, sz, 0) == -1)
-    perror("send");
+  verbose("Dconnection de %s ...\n", client_name(client));
+  if (close(client->socket) == -1)
+    perror("Impossible de fermer le socket client");
+  client->socket = -1;
+
+  free(client->out);
+  client->out = NULL;
+  client->out_len = client->out_cap = client->out_sent = 0;
+  client->in_len = 0;
+  free(client->held);
+  client->held = NULL;
+  client->held_len = client->held_cap = 0;
+
+  free(client->flight);
+  client->flight = NULL;
+  client->closing = false;
+
+  if (client->pass_fd != -1)
+    close(client->pass_fd);
+  client->pass_fd = -1;
+  client->pass_armed = false;
+
+  free(client->ctl);
+  client->ctl = NULL;
+  client->ctl_len = client->ctl_cap = 0;
+  client->framed = false;
+  client->compress = false;
+  memset(client->transfers, 0, sizeof client->transfers);
+
+  free(client->wait_tag);
+  client->wait_tag = NULL;
+  free(client->wait_pids);
+  client->wait_pids = NULL;
 }
 
 /**
- * Envoie une notification vers le socket prcis, prcisant un succs ou une failure, avec des dtails ou non.
- *
- * @param socket un identifiant de socket
- * @param ok_or_fail MSG_OK ou MSG_ERR
- * @param param un message de dtail ou NULL
+ * Prpare l'envoi de data accompagn du descripteur pass_fd : le client
+ * le reoit (SCM_RIGHTS) avec ces octets.
  */
-static void send_notification(const int socket, const char *ok_or_fail, const char *param)
+static struct msghdr *client_fd_message(socketinfo_t *client, char *data, size_t len)
 {
-  static char msg[MESSAGE_BUFFER_SIZE];
-  snprintf(msg, MESSAGE_BUFFER_SIZE, "%s %s\n", ok_or_fail, (param != NULL ? param : ""));
-  send_basic(socket, msg, strlen(msg));
+  struct cmsghdr *cmsg;
+
+  memset(&client->msg, 0, sizeof client->msg);
+  client->iov.iov_base = data;
+  client->iov.iov_len = len;
+  client->msg.msg_iov = &client->iov;
+  client->msg.msg_iovlen = 1;
+  client->msg.msg_control = client->control.buffer;
+  client->msg.msg_controllen = sizeof client->control.buffer;
+
+  cmsg = CMSG_FIRSTHDR(&client->msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &client->pass_fd, sizeof(int));
+
+  return &client->msg;
 }
 
 /**
- * Envoie un message okas vers le socket prcis, avec des dtails ou non.
+ * Le descripteur joint est parti avec un envoi russi.
  */
-static void send_ok(const int socket, const char *param)
+static void client_fd_sent(socketinfo_t *client)
 {
-  send_notification(socket, RET_OK, param);
+  close(client->pass_fd);
+  client->pass_fd = -1;
 }
 
 /**
- * Envoie un message de failure vers le socket prcis, avec des dtails ou non.
+ * Ajoute des octets  un buffer extensible.
+ *
+ * @return false si la mmoire manque
  */
-static void send_failure(const int socket, const char *param)
+static bool buffer_append(char **buf, size_t *len, size_t *cap, const void *msg, size_t sz)
 {
-  send_notification(socket, RET_ERR, param);
+  if (*len + sz > *cap)
+    {
+      size_t new_cap = *cap ? *cap : MESSAGE_BUFFER_SIZE;
+      while (new_cap < *len + sz)
+	new_cap *= 2;
+
+      char *p = realloc(*buf, new_cap);
+      if (p == NULL)
+	{
+	  perror("realloc");
+	  return false;
+	}
+
+      *buf = p;
+      *cap = new_cap;
+    }
+
+  memcpy(*buf + *len, msg, sz);
+  *len += sz;
+  return true;
 }
 
-static int parse_client_line(const int client_socket, char *msg)
+/**
+ * Ajoute un message au buffer de sortie du client. L'envoi effectif a
+ * lieu une fois par tour de boucle, ce qui regroupe toutes les parties
+ * d'une rponse (et le prompt) dans un mme send().
+ */
+void send_basic(const int socket, const void *msg, unsigned sz)
 {
-  char *token;
-  
-  /* On rcupre le premier mot, s'il est vide, on retourne direct  */
-  if (!(token = strtok(msg, " ")))
-    return MSG_OK;
+  socketinfo_t *client = client_of(socket);
 
-  /*****************************************************************************
-   *                              CMD_QUIT
-   ****************************************************************************/
-  if (!strcmp(CMD_QUIT, token))
+  if (client == NULL)
     {
-      send_ok(client_socket, DETAIL_RET_QUIT);
-      return MSG_QUIT;
+      if (send(socket, msg, sz, MSG_NOSIGNAL) == -1)
+	perror("send");
+      return;
     }
-  
-  /*****************************************************************************  
-   *                          CMD_CREATE_PROCESS 
-   ****************************************************************************/
-  else if (!strcmp(CMD_CREATE_PROCESS, token))
-    {
-      char *args[MAX_ARGS];
-      char **pc = args;
 
-      /* On rcup le nom du prog */
-      if (!(token = strtok(NULL, " ")))
-	{
-	  send_failure(client_socket, DETAIL_RET_CREATE_PROCESS_SYNTAX);
-	  return MSG_ERR;
-	}
-      
-      /* strtok renvoie un buffer static, on le copie */
-      /* *pc = args[0] = nom du programme */
-      if (!(*pc++ = strdup(token))) 
-	{
-	  perror("strdup");
-	  return MSG_ERR;
-	}
-      
-      /* La suite devient optionelle, c'est les arguments */
-      while ((token = strtok(NULL, " ")))
-	{
-	  if ((*pc++ = strdup(token)) == NULL)
-	    {
-	      perror("strdup");
-	      return MSG_ERR;
-	    }
-	}
-      
-      *pc = NULL;             /* Fin des arguments */
-      
-      /* On cre le processus */
-      pid_t proc = create_process(args[0], args);
+  /* En mode Framed, la rponse formera une trame  elle seule */
+  if (client->framed)
+    buffer_append(&client->ctl, &client->ctl_len, &client->ctl_cap, msg, sz);
+  else
+    buffer_append(&client->out, &client->out_len, &client->out_cap, msg, sz);
+}
 
-      /* Le processus n'a pas pu tre cr */
-      if (proc == -1) {
-	send_failure(client_socket, DETAIL_RET_CREATE_PROCESS_ERROR);
-	return MSG_ERR;
-      }
+/**
+ * Ajoute une trame au buffer de sortie du client : l'entte
+ * "<canal> <taille>\n" puis les donnes.
+ */
+static void send_frame(socketinfo_t *client, unsigned chan, const char *data, size_t len)
+{
+  char header[32];
 
-      send_ok(client_socket, itoa(proc));
-      return MSG_OK;
-    }
+  snprintf(header, sizeof header, "%u %lu\n", chan, (unsigned long) len);
+  if (buffer_append(&client->out, &client->out_len, &client->out_cap, header, strlen(header))
+      && len > 0)
+    buffer_append(&client->out, &client->out_len, &client->out_cap, data, len);
+}
 
-  /*****************************************************************************  
-   *                          CMD_DESTROY_PROCESS 
-   ****************************************************************************/
-  else if (!strcmp(CMD_DESTROY_PROCESS, token))
+/**
+ * Ajoute une trame de transfert compresse, dont l'entte porte aussi la
+ * taille d'origine : "<canal> <taille> <taille d'origine>\n". Un bloc
+ * que la compression ne rduit pas part tel quel, en trame normale.
+ *
+ * @param len au plus FRAME_SIZE
+ */
+static void send_compressed(socketinfo_t *client, unsigned chan, const char *data, size_t len)
+{
+  static char block[FRAME_SIZE];
+  char header[48];
+  size_t n = lz_compress(data, len, block, len - 1);
+
+  compress_in += len;
+  if (n == 0)
     {
-      if ((token = strtok(NULL, " ")) == NULL)
-	{
-	  send_failure(client_socket, DETAIL_RET_DESTROY_PROCESS_SYNTAX);
-	  return MSG_ERR;
-	}
-      
-      pid_t process_to_kill = atoi(token);
-      
-      if (!process_exists(process_to_kill))
-	{
-	  send_failure(client_socket, DETAIL_RET_UNKNOWN_PROCESS);
-	  return MSG_ERR;
-	}
-      
-      destroy_process(process_to_kill);
-      send_ok(client_socket, NULL);
-      return MSG_OK;
+      compress_out += len;
+      compress_skipped++;
+      send_frame(client, chan, data, len);
+      return;
     }
 
-  /*****************************************************************************  
-   *                          CMD_SEND_INPUT      
-   ****************************************************************************/
-  else if (!strcmp(CMD_SEND_INPUT, token))
+  compress_out += n;
+  snprintf(header, sizeof header, "%u %lu %lu\n", chan, (unsigned long) n, (unsigned long) len);
+  if (buffer_append(&client->out, &client->out_len, &client->out_cap, header, strlen(header)))
+    buffer_append(&client->out, &client->out_len, &client->out_cap, block, n);
+}
+
+/**
+ * Octets du client en attente d'envoi, y compris ceux que le noyau
+ * n'a pas fini d'envoyer (io_uring).
+ */
+static size_t client_pending(const socketinfo_t *client)
+{
+  return client->out_len - client->out_sent
+    + (client->flight != NULL ? client->flight_len - client->flight_sent : 0);
+}
+
+/**
+ * Le client a-t-il des transferts par trames en cours ?
+ */
+static bool client_transferring(const socketinfo_t *client)
+{
+  for (unsigned i = 0; i < MAX_TRANSFERS; i++)
+    if (client->transfers[i].chan != 0)
+      return true;
+
+  return false;
+}
+
+/**
+ * Note qu'un envoi attend des jetons : la boucle d'vnements se
+ * rveillera  temps pour le faire partir.
+ *
+ * @param delay en ms
+ */
+static void shaper_note(int delay)
+{
+  if (delay < 1)
+    delay = 1;
+  if (shaper_wait == -1 || delay < shaper_wait)
+    shaper_wait = delay;
+  sends_delayed++;
+}
+
+/**
+ * Nouveau tour du deficit round robin : chaque connection ayant des
+ * envois en attente reoit un quantum de crdit, les autres perdent le
+ * leur. Le premier client servi change  chaque tour.
+ */
+static void shaper_round()
+{
+  for (unsigned i = 0; i < sizeof clients / sizeof clients[0]; i++)
     {
-      char buffer[MESSAGE_BUFFER_SIZE];
-      buffer[0] = '\0';
-      
-      /* On rcup le PID */
-      if ((token = strtok(NULL, " ")) == NULL)
-	{
-	  send_failure(client_socket, DETAIL_RET_SEND_INPUT_SYNTAX);
-	  return MSG_ERR;
-	}
-      
-      /* Il existe ? */
-      pid_t send_to_process = atoi(token);
-      if (!process_exists(send_to_process))
-	{
-	  send_failure(client_socket, DETAIL_RET_UNKNOWN_PROCESS);
-	  return MSG_ERR;
-	}
-      
-      /* Il est dj termin ? */
-      if (get_return_code(send_to_process) != PROCESS_NOT_TERMINATED)
-	{
-	  send_failure(client_socket, DETAIL_RET_PROCESS_TERMINATED);
-	  return MSG_ERR;
-	}
+      socketinfo_t *client = clients + i;
 
-      /* Son stdin est ouvert ? */
-      if (!input_open(send_to_process))
-	{
-	  send_failure(client_socket, DETAIL_RET_INPUT_CLOSE);
-	  return MSG_ERR;
-	}
+      if (client->socket == -1)
+	continue;
 
-      /* On rcup' le message  envoyer  */
-      /* TODO: Prendre la chane telle qu'elle, sans splitter puis merger avec un espace */
-      while ((token = strtok(NULL, " ")))
+      if (client_pending(client) > 0 || client_transferring(client) || client->ctl_len > 0)
 	{
-	  strcat(buffer, token);
-	  strcat(buffer, " ");
+	  client->deficit += SHAPER_QUANTUM;
+	  if (client->deficit > SHAPER_MAX_DEFICIT)
+	    client->deficit = SHAPER_MAX_DEFICIT;
 	}
-      
-      /* Si le message est vide, erreur ! */
-      if (strlen(buffer) == 0)
-	{
-	  send_failure(client_socket, DETAIL_RET_SEND_INPUT_SYNTAX);
-	  return MSG_ERR;
-        }
-      
-      /* Sinon on envoie ! */
-      send_input(send_to_process, buffer);
-      send_ok(client_socket, NULL);
-      return MSG_OK;
+      else
+	client->deficit = 0;
     }
 
+  drr_next = (drr_next + 1) % MAX_CLIENT;
+}
 
-  /*****************************************************************************  
-   *                          CMD_CLOSE_INPUT     
-   ****************************************************************************/
-  else if (!strcmp(CMD_CLOSE_INPUT, token))
+/**
+ * Applique la rtention aux processus termins,  chaque tour de boucle.
+ * Ceux dont la sortie part en trames sont gards, et ceux dont les
+ * sorties n'ont pas encore t demandes ont RETENTION_GRACE secondes.
+ * La boucle se rveille au plus une seconde plus tard : le minuteur
+ * io_uring dj arm n'est pas avanc, il ne doit donc pas retarder les
+ * envois.
+ */
+static void sweep_processes()
+{
+  pid_t busy[MAX_CLIENT * MAX_TRANSFERS];
+  unsigned nbusy = 0;
+
+  for (unsigned i = 0; i < sizeof clients / sizeof clients[0]; i++)
+    for (unsigned t = 0; clients[i].socket != -1 && t < MAX_TRANSFERS; t++)
+      if (clients[i].transfers[t].chan != 0)
+	busy[nbusy++] = clients[i].transfers[t].pid;
+
+  if (process_sweep(&retention, busy, nbusy) != -1
+      && (shaper_wait == -1 || shaper_wait > 1000))
+    shaper_wait = 1000;
+}
+
+/**
+ * Peut-on accepter une connection ce tour-ci ? Il faut des descripteurs,
+ * et ne pas tre dans la pause qui suit un chec faute de ressources :
+ * la connection reste en attente, le socket serveur restant prt, et
+ * l'accepter de nouveau tout de suite ferait tourner la boucle  vide.
+ */
+static bool accept_allowed()
+{
+  uint64_t now;
+
+  if (!fd_available(1))
+    return false;
+
+  if (accept_resume == 0 || (now = shaper_now()) >= accept_resume)
     {
-      if ((token = strtok(NULL, " ")) == NULL)
-	{
-	  send_failure(client_socket, DETAIL_RET_CLOSE_INPUT_SYNTAX);
-	  return MSG_ERR;
-        }
-      
-      pid_t process_to_close_input = atoi(token);
-      if (!process_exists(process_to_close_input))
-	{
-	  send_failure(client_socket, DETAIL_RET_UNKNOWN_PROCESS);
-	  return MSG_ERR;
-	}
+      accept_resume = 0;
+      return true;
+    }
 
-      close_input(process_to_close_input);
-      send_ok(client_socket, NULL);
-      return MSG_OK;
+  int delay = (accept_resume - now) / 1000000 + 1;
+  if (shaper_wait == -1 || delay < shaper_wait)
+    shaper_wait = delay;
+  return false;
+}
+
+/**
+ * Traite l'chec d'une acceptation.
+ *
+ * @param err le code d'erreur
+ * @return false si le socket serveur est inutilisable
+ */
+static bool accept_failed(int err)
+{
+  fprintf(stderr, "accept: %s\n", strerror(err));
+
+  switch (err)
+    {
+    case EBADF:
+    case EINVAL:
+    case ENOTSOCK:
+    case EOPNOTSUPP:
+      return false;
+
+    /* Plus de descripteurs ou de mmoire : une pause, le temps qu'il s'en libre */
+    case EMFILE:
+    case ENFILE:
+    case ENOBUFS:
+    case ENOMEM:
+      accept_resume = shaper_now() + (uint64_t) ACCEPT_BACKOFF * 1000000;
+      return true;
+
+    /* La connection a t abandonne avant d'tre accepte, ou signal */
+    default:
+      return true;
     }
-  
-  /*****************************************************************************  
-   *                          CMD_GET_OUTPUT
-   ****************************************************************************/
-  else if (!strcmp(CMD_GET_OUTPUT, token))
+}
+
+/**
+ * Octets que le client peut envoyer maintenant : ce que permettent son
+ * seau et celui de l'ensemble des connections, et, quand ce dernier est
+ * limit, son crdit du tour.
+ *
+ * @param want octets en attente
+ * @return au plus want, 0 si l'envoi doit attendre
+ */
+static size_t client_allowance(socketinfo_t *client, size_t want)
+{
+  size_t n = bucket_available(&client->bucket, want);
+
+  n = bucket_available(&egress, n);
+  if (egress.rate > 0 && n > client->deficit)
+    n = client->deficit;
+
+  if (n == 0 && want > 0)
     {
-      if ((token = strtok(NULL, " ")) == NULL)
-	{
-	  send_failure(client_socket, DETAIL_RET_GET_OUTPUT_SYNTAX);
-	  return MSG_ERR;
-	}
-      
-      pid_t process_to_get_output = atoi(token);
-      if (!process_exists(process_to_get_output))
-	{
-	  send_failure(client_socket, DETAIL_RET_UNKNOWN_PROCESS);
-	  return MSG_ERR;
-        }
-     
-      get_output(client_socket, process_to_get_output);
-      send_ok(client_socket, NULL);
-      return MSG_OK;
+      int delay = bucket_delay(&client->bucket);
+      shaper_note(delay > bucket_delay(&egress) ? delay : bucket_delay(&egress));
     }
 
+  return n;
+}
 
-  /*****************************************************************************  
-   *                          CMD_GET_ERROR
-   ****************************************************************************/
-  else if (!strcmp(CMD_GET_ERROR, token))
+/**
+ * Dcompte un envoi des seaux et du crdit du client.
+ */
+static void client_sent(socketinfo_t *client, size_t n)
+{
+  bucket_take(&client->bucket, n);
+  bucket_take(&egress, n);
+  client->deficit = n < client->deficit ? client->deficit - n : 0;
+  bytes_sent += n;
+}
+
+/**
+ * Rend au client les jetons d'un envoi qui n'est pas parti en entier.
+ */
+static void client_unsent(socketinfo_t *client, size_t n)
+{
+  bucket_give(&client->bucket, n);
+  bucket_give(&egress, n);
+  client->deficit += n;
+  bytes_sent -= n;
+}
+
+/**
+ * Seau de la sortie d'un processus (-P), pris au besoin  un processus
+ * disparu.
+ *
+ * @return NULL si le dbit des processus n'est pas limit
+ */
+static bucket_t *process_bucket(pid_t pid)
+{
+  int free_slot = -1;
+
+  if (process_rate == 0)
+    return NULL;
+
+  for (int i = 0; i < MAX_PROCESS; i++)
+    if (process_buckets[i].pid == pid)
+      return &process_buckets[i].bucket;
+    else if (free_slot == -1
+	     && (process_buckets[i].pid == 0 || !process_exists(process_buckets[i].pid)))
+      free_slot = i;
+
+  if (free_slot == -1)
+    return NULL;
+
+  process_buckets[free_slot].pid = pid;
+  bucket_init(&process_buckets[free_slot].bucket, process_rate);
+  return &process_buckets[free_slot].bucket;
+}
+
+/**
+ * Met en trames ce que le client doit recevoir (mode Framed). Une
+ * rponse reste en attente (Quit) passe en premier, sur le canal 0 ;
+ * les transferts ne reoivent ensuite qu'une trame chacun,  tour de
+ * rle, et seulement si peu de choses attendent dj l'envoi. Une
+ * commande reue pendant un gros transfert n'attend donc que quelques
+ * trames.
+ */
+static void client_frame(socketinfo_t *client)
+{
+  if (!client->framed)
+    return;
+
+  if (client->ctl_len > 0)
     {
-      if ((token = strtok(NULL, " ")) == NULL)
-	{
-	  send_failure(client_socket, DETAIL_RET_GET_ERROR_SYNTAX);
-	  return MSG_ERR;
-        }
-      
-      pid_t process_to_get_error = atoi(token);
-      if (!process_exists(process_to_get_error))
+      send_frame(client, 0, client->ctl, client->ctl_len);
+      client->ctl_len = 0;
+    }
+
+  /* Un client qui part ne reoit plus que ses rponses */
+  for (unsigned n = 0; n < MAX_TRANSFERS && !client->closing
+	 && client_pending(client) < FRAME_SIZE; n++)
+    {
+      transfer_t *t = client->transfers + client->next_transfer;
+      client->next_transfer = (client->next_transfer + 1) % MAX_TRANSFERS;
+
+      if (t->chan == 0)
+	continue;
+
+      const char *data = NULL;
+      size_t len = t->offset < t->end ? output_at(t->pid, t->stream, t->offset, &data) : 0;
+
+      if (len > t->end - t->offset)
+	len = t->end - t->offset;
+      if (len > FRAME_SIZE)
+	len = FRAME_SIZE;
+
+      /* Le seau du processus vide : la trame attendra, le canal reste ouvert */
+      bucket_t *bucket = len > 0 ? process_bucket(t->pid) : NULL;
+      if (bucket != NULL && (len = bucket_available(bucket, len)) == 0)
 	{
-	  send_failure(client_socket, DETAIL_RET_UNKNOWN_PROCESS);
-	  return MSG_ERR;
+	  shaper_note(bucket_delay(bucket));
+	  continue;
 	}
-      
-      get_error(client_socket, process_to_get_error);
-      send_ok(client_socket, NULL);
-      return MSG_OK;
+      if (bucket != NULL)
+	bucket_take(bucket, len);
+
+      /* Une trame vide termine le canal (fin, ou processus dtruit) */
+      if (client->compress && len > 0)
+	send_compressed(client, t->chan, data, len);
+      else
+	send_frame(client, t->chan, data, len);
+      t->offset += len;
+      if (len == 0)
+	t->chan = 0;
     }
+}
 
+/**
+ * Ouvre un transfert par trames de la sortie pas encore transmise d'un
+ * processus.
+ *
+ * @param stream STREAM_OUT ou STREAM_ERR
+ * @return le canal du transfert, ou 0 si le client en a trop en cours
+ */
+static unsigned client_transfer(socketinfo_t *client, pid_t pid, int stream)
+{
+  for (unsigned i = 0; i < MAX_TRANSFERS; i++)
+    {
+      transfer_t *t = client->transfers + i;
 
-  /*****************************************************************************  
-   *                          CMD_GET_RETURN_CODE
-   ****************************************************************************/
-  else if (!strcmp(CMD_GET_RETURN_CODE, token))
+      if (t->chan != 0)
+	continue;
+
+      if (!take_output(pid, stream, &t->offset, &t->end))
+	return 0;
+
+      /* Le canal 0 est celui des rponses */
+      if (++client->next_chan == 0)
+	client->next_chan = 1;
+
+      t->chan = client->next_chan;
+      t->pid = pid;
+      t->stream = stream;
+      return t->chan;
+    }
+
+  return 0;
+}
+
+/**
+ * Envoie ce qui est en attente dans le buffer de sortie du client, sans
+ * bloquer : ce que le socket n'accepte pas tout de suite attendra le
+ * prochain tour de boucle.
+ *
+ * @return false si la connection est perdue
+ */
+static bool client_flush(socketinfo_t *client)
+{
+  client_frame(client);
+
+  while (client->out_sent < client->out_len)
     {
-      if ((token = strtok(NULL, " ")) == NULL)
-	{
-	  send_failure(client_socket, DETAIL_RET_GET_RETURN_CODE_SYNTAX);
-	  return MSG_ERR;
-        }
-      
-      pid_t process_to_get_ret = atoi(token);
-      if (!process_exists(process_to_get_ret))
+      ssize_t n;
+      size_t len = client_allowance(client, client->out_len - client->out_sent);
+
+      /* Plus de jetons : la suite partira  un prochain tour */
+      if (len == 0)
+	return true;
+
+      TRACE_BEGIN(sending, send, client->socket);
+      if (client->pass_fd != -1)
+	n = sendmsg(client->socket,
+		    client_fd_message(client, client->out + client->out_sent, len),
+		    MSG_DONTWAIT | MSG_NOSIGNAL);
+      else
+	n = send(client->socket, client->out + client->out_sent, len,
+		 MSG_DONTWAIT | MSG_NOSIGNAL);
+      TRACE_END(sending, send, n);
+
+      if (n == -1)
 	{
-	  send_failure(client_socket, DETAIL_RET_UNKNOWN_PROCESS);
-	  return MSG_ERR;
+	  if (errno == EINTR)
+	    continue;
+
+	  if (errno == EAGAIN || errno == EWOULDBLOCK)
+	    return true;
+
+	  perror("send");
+	  return false;
 	}
-      
-      int ret = get_return_code(process_to_get_ret);
-      if (ret == PROCESS_NOT_TERMINATED)
+
+      if (client->pass_fd != -1)
+	client_fd_sent(client);
+      client->out_sent += n;
+      client_sent(client, n);
+    }
+
+  /* Tout est parti : on repart du dbut, et on rend un gros buffer */
+  client->out_len = client->out_sent = 0;
+  if (client->out_cap > OUTPUT_HIGH_WATER)
+    {
+      free(client->out);
+      client->out = NULL;
+      client->out_cap = 0;
+    }
+
+  return true;
+}
+
+/**
+ * Envoie une notification vers le socket prcis, prcisant un succs ou une failure, avec des dtails ou non.
+ *
+ * @param socket un identifiant de socket
+ * @param ok_or_fail MSG_OK ou MSG_ERR
+ * @param param un message de dtail ou NULL
+ */
+static void send_notification(const int socket, const char *ok_or_fail, const char *param)
+{
+  static char msg[MESSAGE_BUFFER_SIZE];
+  snprintf(msg, MESSAGE_BUFFER_SIZE, "%s %s\n", ok_or_fail, (param != NULL ? param : ""));
+  send_basic(socket, msg, strlen(msg));
+  last_notification = msg;
+}
+
+/**
+ * Envoie un message okas vers le socket prcis, avec des dtails ou non.
+ */
+static void send_ok(const int socket, const char *param)
+{
+  send_notification(socket, RET_OK, param);
+}
+
+/**
+ * Envoie un message de failure vers le socket prcis, avec des dtails ou non.
+ */
+static void send_failure(const int socket, const char *param)
+{
+  send_notification(socket, RET_ERR, param);
+}
+
+/**
+ * Reconnat une redirection de CreateProcess (<f, >f, >>f, 2>f ou 2>>f)
+ * et la note dans redir. Le fichier peut tre coll  l'oprateur ou tre
+ * le mot suivant ; s'il manque, le chemin not est vide.
+ *
+ * @param token un mot de la commande
+ * @param redir les redirections du processus
+ * @return false si token n'est pas une redirection
+ */
+static bool parse_redirection(char *token, redirect_t *redir)
+{
+  const char **path;
+
+  if (*token == '<')
+    path = &redir->in;
+
+  /* La sortie d'erreur dans la sortie standard */
+  else if (!strcmp(token, "2>&1"))
+    {
+      redir->err = NULL;
+      redir->merge_err = true;
+      return true;
+    }
+
+  else
+    {
+      bool err = !strncmp(token, "2>", 2);
+      bool *append = err ? &redir->err_append : &redir->out_append;
+
+      if (err)
 	{
-	  send_failure(client_socket, DETAIL_RET_GET_RETURN_CODE_ERROR);
-	  return MSG_ERR;
+	  redir->merge_err = false;
+	  token++;
 	}
-      
-      send_ok(client_socket, itoa(ret));
-      return MSG_OK;
+      if (*token != '>')
+	return false;
+
+      path = err ? &redir->err : &redir->out;
+      if ((*append = token[1] == '>'))
+	token++;
     }
 
-  /*****************************************************************************  
-   *                          CMD_LIST_PROCESS   
-   ****************************************************************************/
-  else if (!strcmp(CMD_LIST_PROCESS, token))
+  if (*++token == '\0' && (token = strtok(NULL, " ")) == NULL)
+    token = "";
+
+  *path = token;
+  return true;
+}
+
+/**
+ * Remplace chaque {i} d'un mot de CreateProcessBatch par le numro de
+ * l'instance. Le mot dvelopp est crit  la suite dans buf.
+ *
+ * @param token le mot de la commande
+ * @param i le numro de l'instance
+ * @param buf position d'criture, avance aprs le mot dvelopp
+ * @param end fin du buffer
+ * @return le mot dvelopp (token lui-mme s'il n'a pas de {i}),
+ * NULL si le buffer est trop petit
+ */
+static char *expand_instance(char *token, unsigned i, char **buf, const char *end)
+{
+  char *start = *buf;
+  char *p = token;
+  char *mark;
+
+  if (token == NULL || strstr(token, DETAIL_RET_INSTANCE) == NULL)
+    return token;
+
+  while ((mark = strstr(p, DETAIL_RET_INSTANCE)) != NULL)
+    {
+      int n = snprintf(*buf, end - *buf, "%.*s%u", (int) (mark - p), p, i);
+      if (n < 0 || n >= end - *buf)
+	return NULL;
+      *buf += n;
+      p = mark + strlen(DETAIL_RET_INSTANCE);
+    }
+
+  if (strlen(p) >= (size_t) (end - *buf))
+    return NULL;
+  strcpy(*buf, p);
+  *buf += strlen(p) + 1;
+
+  return start;
+}
+
+/**
+ * Cherche le premier processus termin d'une liste (WaitAny).
+ *
+ * @param pids les pids, spars par des espaces
+ * @param pid reoit le pid termin, ou le pid inconnu
+ * @param ret reoit son code de retour
+ * @return 1 si un processus est termin, 0 si aucun, -1 si un pid est inconnu
+ */
+static int wait_any(const char *pids, pid_t *pid, int *ret)
+{
+  const char *p = pids;
+  char *end;
+
+  while ((*pid = strtol(p, &end, 10)) != 0 || end != p)
+    {
+      /* Retir par la rtention : son code de retour est gard */
+      if (!process_exists(*pid))
+	return process_tombstone(*pid, ret) ? 1 : -1;
+      if ((*ret = process_finished(*pid)) != PROCESS_NOT_TERMINATED)
+	return 1;
+      p = end;
+    }
+
+  return 0;
+}
+
+/**
+ * Rpond  WaitAny : "OK <pid> <code de retour>". Le processus chappe
+ * alors  la rtention le temps que le client demande ses sorties.
+ */
+static void send_finished(const int socket, pid_t pid, int ret)
+{
+  char msg[32];
+
+  process_reported(pid);
+  snprintf(msg, sizeof msg, "%d %d", pid, ret);
+  send_ok(socket, msg);
+}
+
+/**
+ * Rpond  GetOutput/GetError. En mode Framed, la sortie part sur un
+ * canal  elle, par trames, et la rponse donne ce canal.
+ *
+ * @param stream STREAM_OUT ou STREAM_ERR
+ */
+static int send_output(const int client_socket, pid_t pid, int stream)
+{
+  socketinfo_t *client = client_of(client_socket);
+
+  if (client == NULL || !client->framed)
     {
-      list_process(client_socket);
+      if (stream == STREAM_OUT)
+	get_output(client_socket, pid);
+      else
+	get_error(client_socket, pid);
+
       send_ok(client_socket, NULL);
       return MSG_OK;
     }
 
-  /*****************************************************************************  
-   *                          CMD_GET_HELP
+  unsigned chan = client_transfer(client, pid, stream);
+  if (chan == 0)
+    {
+      send_failure(client_socket, DETAIL_RET_TRANSFERS_BUSY);
+      return MSG_ERR;
+    }
+
+  send_ok(client_socket, itoa(chan));
+  return MSG_OK;
+}
+
+static int parse_client_line(const int client_socket, char *msg)
+{
+  char *token;
+  
+  /* On rcupre le premier mot, s'il est vide, on retourne direct  */
+  if (!(token = strtok(msg, " ")))
+    return MSG_OK;
+
+  /*****************************************************************************
+   *                              CMD_QUIT
    ****************************************************************************/
-  else if (!strcmp(CMD_GET_HELP, token))
+  if (!strcmp(CMD_QUIT, token))
+    {
+      send_ok(client_socket, DETAIL_RET_QUIT);
+      return MSG_QUIT;
+    }
+  
+  /*****************************************************************************  
+   *                          CMD_CREATE_PROCESS 
+   ****************************************************************************/
+  else if (!strcmp(CMD_CREATE_PROCESS, token))
+    {
+      char *args[MAX_ARGS];
+      char **pc = args;
+      char *inputs[MAX_ARGS];
+      unsigned ninputs = 0;
+      char *stdin_path = NULL;
+      char *tag = NULL;
+      bool cache = false;
+      redirect_t redir = { NULL, NULL, NULL, false, false, false };
+      after_t after[MAX_AFTER];
+      int nafter = 0;
+
+      /* Options, puis le nom du prog */
+      while ((token = strtok(NULL, " ")) && !strncmp(token, "--", 2))
+	{
+	  if (!strcmp(token, "--cache"))
+	    cache = true;
+
+	  else if (!strcmp(token, "--tag"))
+	    {
+	      if (!(token = tag = strtok(NULL, " ")))
+		break;
+	    }
+
+	  else if (!strcmp(token, "--stdin"))
+	    {
+	      if (!(token = stdin_path = strtok(NULL, " ")))
+		break;
+	    }
+
+	  else if (!strcmp(token, "--input") && ninputs < MAX_ARGS - 1)
+	    {
+	      if (!(token = inputs[ninputs++] = strtok(NULL, " ")))
+		break;
+	    }
+
+	  /* --after <id|groupe>[:success|:any], les groupes tant pris tels qu'ils sont */
+	  else if (!strcmp(token, "--after"))
+	    {
+	      char *cond;
+	      bool any = false;
+
+	      if (!(token = strtok(NULL, " ")))
+		break;
+	      if ((cond = strrchr(token, ':')) != NULL)
+		{
+		  *cond++ = '\0';
+		  if (!(any = !strcmp(cond, AFTER_ANY)) && strcmp(cond, AFTER_SUCCESS))
+		    {
+		      token = NULL;
+		      break;
+		    }
+		}
+
+	      if ((nafter = resolve_after(token, any, after, nafter)) == -1)
+		{
+		  send_failure(client_socket, DETAIL_RET_UNKNOWN_AFTER);
+		  return MSG_ERR;
+		}
+	    }
+
+	  else
+	    break;
+	}
+      inputs[ninputs] = NULL;
+
+      /* --stdin et --input n'ont de sens qu'avec --cache, qui ne se combine pas avec --after */
+      if (!token || !strncmp(token, "--", 2)
+	  || (!cache && (stdin_path != NULL || ninputs > 0)) || (cache && nafter > 0))
+	{
+	  send_failure(client_socket, DETAIL_RET_CREATE_PROCESS_SYNTAX);
+	  return MSG_ERR;
+	}
+      
+      redir.in = stdin_path;
+
+      /* Le nom du prog puis ses arguments, les redirections tant mises  part */
+      for (; token; token = strtok(NULL, " "))
+	{
+	  if (parse_redirection(token, &redir))
+	    continue;
+
+	  if (pc == args + MAX_ARGS - 1)
+	    {
+	      send_failure(client_socket, DETAIL_RET_CREATE_PROCESS_SYNTAX);
+	      return MSG_ERR;
+	    }
+
+	  /* Les mots restent dans la ligne du client le temps de la commande */
+	  *pc++ = token;
+	}
+
+      *pc = NULL;             /* Fin des arguments */
+
+      /*
+       * Il faut un programme, et un fichier pour chaque redirection. Une
+       * commande en cache ne peut pas crire dans un fichier : sur un
+       * succs du cache, il ne serait pas crit.
+       */
+      if (pc == args
+	  || (redir.in != NULL && *redir.in == '\0')
+	  || (redir.out != NULL && (*redir.out == '\0' || cache))
+	  || (redir.err != NULL && (*redir.err == '\0' || cache))
+	  || (redir.merge_err && cache))
+	{
+	  send_failure(client_socket, DETAIL_RET_CREATE_PROCESS_SYNTAX);
+	  return MSG_ERR;
+	}
+
+      /* Table pleine : le client peut attendre une fin pour ressayer */
+      if (process_count() >= MAX_PROCESS)
+	{
+	  send_failure(client_socket, DETAIL_RET_PROCESS_TABLE_FULL);
+	  return MSG_ERR;
+	}
+
+      /* Trois pipes de plus : on s'arrte avant la limite */
+      if (!fd_available(FD_PER_PROCESS))
+	{
+	  send_failure(client_socket, DETAIL_RET_FD_BUDGET);
+	  return MSG_ERR;
+	}
+
+      /* On cre le processus */
+      pid_t proc = cache
+	? create_cached_process(args, &redir, inputs, tag)
+	: nafter > 0 ? create_after_process(args, &redir, tag, after, nafter)
+	: create_process(args[0], args, &redir, tag);
+
+      /* Le processus n'a pas pu tre cr */
+      if (proc == -1) {
+	send_failure(client_socket, DETAIL_RET_CREATE_PROCESS_ERROR);
+	return MSG_ERR;
+      }
+
+      send_ok(client_socket, itoa(proc));
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_CREATE_PROCESS_BATCH
+   ****************************************************************************/
+  else if (!strcmp(CMD_CREATE_PROCESS_BATCH, token))
+    {
+      char *words[MAX_ARGS];
+      unsigned nwords = 0;
+      char *tag = NULL;
+      unsigned count, started = 0;
+      redirect_t redir = { NULL, NULL, NULL, false, false, false };
+
+      if ((token = strtok(NULL, " ")) == NULL || (count = atoi(token)) == 0
+	  || count > MAX_PROCESS)
+	{
+	  send_failure(client_socket, DETAIL_RET_CREATE_PROCESS_BATCH_SYNTAX);
+	  return MSG_ERR;
+	}
+
+      if ((token = strtok(NULL, " ")) != NULL && !strcmp(token, "--tag"))
+	{
+	  tag = strtok(NULL, " ");
+	  token = strtok(NULL, " ");
+	}
+
+      /* La commande est dcoupe une seule fois pour toutes les instances */
+      for (; token && nwords < MAX_ARGS - 1; token = strtok(NULL, " "))
+	if (!parse_redirection(token, &redir))
+	  words[nwords++] = token;
+      words[nwords] = NULL;
+
+      if (nwords == 0 || token != NULL
+	  || (redir.in != NULL && *redir.in == '\0')
+	  || (redir.out != NULL && *redir.out == '\0')
+	  || (redir.err != NULL && *redir.err == '\0'))
+	{
+	  send_failure(client_socket, DETAIL_RET_CREATE_PROCESS_BATCH_SYNTAX);
+	  return MSG_ERR;
+	}
+
+      /* Une ligne par instance : son numro puis son pid, ou ERR et la raison */
+      for (unsigned i = 0; i < count; i++)
+	{
+	  char expanded[MESSAGE_BUFFER_SIZE];
+	  char *buf = expanded;
+	  const char *end = expanded + sizeof expanded;
+	  char *args[MAX_ARGS];
+	  redirect_t inst = redir;
+	  const char *error = NULL;
+	  char msg[MESSAGE_BUFFER_SIZE];
+	  bool fits = true;
+	  pid_t proc = -1;
+
+	  for (unsigned a = 0; a < nwords; a++)
+	    fits &= (args[a] = expand_instance(words[a], i, &buf, end)) != NULL;
+	  args[nwords] = NULL;
+	  fits &= (inst.in = expand_instance((char *) redir.in, i, &buf, end)) != NULL || !redir.in;
+	  fits &= (inst.out = expand_instance((char *) redir.out, i, &buf, end)) != NULL || !redir.out;
+	  fits &= (inst.err = expand_instance((char *) redir.err, i, &buf, end)) != NULL || !redir.err;
+
+	  if (!fits)
+	    error = DETAIL_RET_INSTANCE_TOO_LONG;
+	  else if (process_count() >= MAX_PROCESS)
+	    error = DETAIL_RET_PROCESS_TABLE_FULL;
+	  else if (!fd_available(FD_PER_PROCESS))
+	    error = DETAIL_RET_FD_BUDGET;
+	  else if ((proc = create_process(args[0], args, &inst, tag)) == -1)
+	    error = DETAIL_RET_CREATE_PROCESS_ERROR;
+
+	  if (error == NULL)
+	    {
+	      snprintf(msg, sizeof msg, "%u\t%d\n", i, proc);
+	      started++;
+	    }
+	  else
+	    snprintf(msg, sizeof msg, "%u\t" RET_ERR "\t%s\n", i, error);
+	  send_basic(client_socket, msg, strlen(msg));
+	}
+
+      if (started == 0)
+	{
+	  send_failure(client_socket, DETAIL_RET_CREATE_PROCESS_ERROR);
+	  return MSG_ERR;
+	}
+
+      send_ok(client_socket, itoa(started));
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_GRAPH_STATUS
+   ****************************************************************************/
+  else if (!strcmp(CMD_GRAPH_STATUS, token))
+    {
+      send_ok(client_socket, itoa(graph_status(client_socket)));
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_DESTROY_PROCESS 
+   ****************************************************************************/
+  else if (!strcmp(CMD_DESTROY_PROCESS, token))
+    {
+      if ((token = strtok(NULL, " ")) == NULL)
+	{
+	  send_failure(client_socket, DETAIL_RET_DESTROY_PROCESS_SYNTAX);
+	  return MSG_ERR;
+	}
+      
+      pid_t process_to_kill = atoi(token);
+      int ret;
+
+      /* Dj retir par la rtention : il n'y a plus rien  dtruire */
+      if (!process_exists(process_to_kill) && process_tombstone(process_to_kill, &ret))
+	{
+	  send_ok(client_socket, NULL);
+	  return MSG_OK;
+	}
+
+      if (!process_exists(process_to_kill))
+	{
+	  send_failure(client_socket, DETAIL_RET_UNKNOWN_PROCESS);
+	  return MSG_ERR;
+	}
+      
+      destroy_process(process_to_kill);
+      send_ok(client_socket, NULL);
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_SEND_INPUT      
+   ****************************************************************************/
+  else if (!strcmp(CMD_SEND_INPUT, token))
+    {
+      char buffer[MESSAGE_BUFFER_SIZE];
+      buffer[0] = '\0';
+      
+      /* On rcup le PID */
+      if ((token = strtok(NULL, " ")) == NULL)
+	{
+	  send_failure(client_socket, DETAIL_RET_SEND_INPUT_SYNTAX);
+	  return MSG_ERR;
+	}
+      
+      /* Il existe ? */
+      pid_t send_to_process = atoi(token);
+      if (!process_exists(send_to_process))
+	{
+	  send_failure(client_socket, DETAIL_RET_UNKNOWN_PROCESS);
+	  return MSG_ERR;
+	}
+      
+      /* Il est dj termin ? */
+      if (get_return_code(send_to_process) != PROCESS_NOT_TERMINATED)
+	{
+	  send_failure(client_socket, DETAIL_RET_PROCESS_TERMINATED);
+	  return MSG_ERR;
+	}
+
+      /* Son stdin est ouvert ? */
+      if (!input_open(send_to_process))
+	{
+	  send_failure(client_socket, DETAIL_RET_INPUT_CLOSE);
+	  return MSG_ERR;
+	}
+
+      /* On rcup' le message  envoyer  */
+      /* TODO: Prendre la chane telle qu'elle, sans splitter puis merger avec un espace */
+      while ((token = strtok(NULL, " ")))
+	{
+	  strcat(buffer, token);
+	  strcat(buffer, " ");
+	}
+      
+      /* Si le message est vide, erreur ! */
+      if (strlen(buffer) == 0)
+	{
+	  send_failure(client_socket, DETAIL_RET_SEND_INPUT_SYNTAX);
+	  return MSG_ERR;
+        }
+      
+      /* Sinon on envoie ! */
+      send_input(send_to_process, buffer);
+      send_ok(client_socket, NULL);
+      return MSG_OK;
+    }
+
+
+  /*****************************************************************************  
+   *                          CMD_CLOSE_INPUT     
+   ****************************************************************************/
+  else if (!strcmp(CMD_CLOSE_INPUT, token))
+    {
+      if ((token = strtok(NULL, " ")) == NULL)
+	{
+	  send_failure(client_socket, DETAIL_RET_CLOSE_INPUT_SYNTAX);
+	  return MSG_ERR;
+        }
+      
+      pid_t process_to_close_input = atoi(token);
+      if (!process_exists(process_to_close_input))
+	{
+	  send_failure(client_socket, DETAIL_RET_UNKNOWN_PROCESS);
+	  return MSG_ERR;
+	}
+
+      close_input(process_to_close_input);
+      send_ok(client_socket, NULL);
+      return MSG_OK;
+    }
+  
+  /*****************************************************************************  
+   *                          CMD_GET_OUTPUT
+   ****************************************************************************/
+  else if (!strcmp(CMD_GET_OUTPUT, token))
+    {
+      if ((token = strtok(NULL, " ")) == NULL)
+	{
+	  send_failure(client_socket, DETAIL_RET_GET_OUTPUT_SYNTAX);
+	  return MSG_ERR;
+	}
+      
+      pid_t process_to_get_output = atoi(token);
+      if (!process_exists(process_to_get_output))
+	{
+	  send_failure(client_socket, DETAIL_RET_UNKNOWN_PROCESS);
+	  return MSG_ERR;
+	}
+
+      return send_output(client_socket, process_to_get_output, STREAM_OUT);
+    }
+
+
+  /*****************************************************************************  
+   *                          CMD_GET_ERROR
+   ****************************************************************************/
+  else if (!strcmp(CMD_GET_ERROR, token))
+    {
+      if ((token = strtok(NULL, " ")) == NULL)
+	{
+	  send_failure(client_socket, DETAIL_RET_GET_ERROR_SYNTAX);
+	  return MSG_ERR;
+        }
+      
+      pid_t process_to_get_error = atoi(token);
+      if (!process_exists(process_to_get_error))
+	{
+	  send_failure(client_socket, DETAIL_RET_UNKNOWN_PROCESS);
+	  return MSG_ERR;
+	}
+
+      return send_output(client_socket, process_to_get_error, STREAM_ERR);
+    }
+
+
+  /*****************************************************************************  
+   *                          CMD_GREP_OUTPUT
+   ****************************************************************************/
+  else if (!strcmp(CMD_GREP_OUTPUT, token))
+    {
+      char *pattern;
+
+      /* Le motif est le reste de la ligne, espaces compris */
+      if ((token = strtok(NULL, " ")) == NULL
+	  || (pattern = strtok(NULL, "")) == NULL)
+	{
+	  send_failure(client_socket, DETAIL_RET_GREP_OUTPUT_SYNTAX);
+	  return MSG_ERR;
+	}
+
+      pid_t process_to_grep = atoi(token);
+      if (!process_exists(process_to_grep))
+	{
+	  send_failure(client_socket, DETAIL_RET_UNKNOWN_PROCESS);
+	  return MSG_ERR;
+	}
+
+      if (!grep_output(client_socket, process_to_grep, pattern))
+	{
+	  send_failure(client_socket, DETAIL_RET_GREP_OUTPUT_ERROR);
+	  return MSG_ERR;
+	}
+
+      send_ok(client_socket, NULL);
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                    CMD_HEAD_OUTPUT / CMD_TAIL_OUTPUT
+   ****************************************************************************/
+  else if (!strcmp(CMD_HEAD_OUTPUT, token) || !strcmp(CMD_TAIL_OUTPUT, token))
+    {
+      bool head = !strcmp(CMD_HEAD_OUTPUT, token);
+      char *count;
+
+      if ((token = strtok(NULL, " ")) == NULL
+	  || (count = strtok(NULL, " ")) == NULL || atoi(count) < 0)
+	{
+	  send_failure(client_socket, head ? DETAIL_RET_HEAD_OUTPUT_SYNTAX
+					   : DETAIL_RET_TAIL_OUTPUT_SYNTAX);
+	  return MSG_ERR;
+	}
+
+      pid_t process_to_read = atoi(token);
+      if (!process_exists(process_to_read))
+	{
+	  send_failure(client_socket, DETAIL_RET_UNKNOWN_PROCESS);
+	  return MSG_ERR;
+	}
+
+      if (head)
+	head_output(client_socket, process_to_read, atoi(count));
+      else
+	tail_output(client_socket, process_to_read, atoi(count));
+
+      send_ok(client_socket, NULL);
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_MAP_OUTPUT
+   ****************************************************************************/
+  else if (!strcmp(CMD_MAP_OUTPUT, token))
+    {
+      socketinfo_t *client = client_of(client_socket);
+
+      if ((token = strtok(NULL, " ")) == NULL)
+	{
+	  send_failure(client_socket, DETAIL_RET_MAP_OUTPUT_SYNTAX);
+	  return MSG_ERR;
+	}
+
+      /* SCM_RIGHTS ne passe que par un socket AF_UNIX */
+      if (client == NULL || !client->local)
+	{
+	  send_failure(client_socket, DETAIL_RET_MAP_OUTPUT_LOCAL);
+	  return MSG_ERR;
+	}
+
+      if (client->pass_fd != -1)
+	{
+	  send_failure(client_socket, DETAIL_RET_MAP_OUTPUT_BUSY);
+	  return MSG_ERR;
+	}
+
+      pid_t process_to_map = atoi(token);
+      if (!process_exists(process_to_map))
+	{
+	  send_failure(client_socket, DETAIL_RET_UNKNOWN_PROCESS);
+	  return MSG_ERR;
+	}
+
+      /* Le descripteur part avec la rponse */
+      if ((client->pass_fd = export_output(process_to_map)) == -1)
+	{
+	  send_failure(client_socket, DETAIL_RET_MAP_OUTPUT_ERROR);
+	  return MSG_ERR;
+	}
+
+      send_ok(client_socket, NULL);
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_FRAMED
+   ****************************************************************************/
+  else if (!strcmp(CMD_FRAMED, token))
+    {
+      socketinfo_t *client = client_of(client_socket);
+
+      /* La rponse est encore en clair, tout ce qui suit est en trames */
+      send_ok(client_socket, DETAIL_RET_FRAMED);
+      if (client != NULL)
+	client->framed = true;
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_COMPRESS
+   ****************************************************************************/
+  else if (!strcmp(CMD_COMPRESS, token))
+    {
+      socketinfo_t *client = client_of(client_socket);
+
+      if ((token = strtok(NULL, " ")) == NULL
+	  || (strcmp(token, COMPRESS_LZ) && strcmp(token, COMPRESS_OFF)))
+	{
+	  send_failure(client_socket, DETAIL_RET_COMPRESS_SYNTAX);
+	  return MSG_ERR;
+	}
+
+      /* Les trames dj prtes restent telles quelles */
+      if (client != NULL)
+	client->compress = !strcmp(token, COMPRESS_LZ);
+      send_ok(client_socket, token);
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_STATS
+   ****************************************************************************/
+  else if (!strcmp(CMD_STATS, token))
+    {
+      char msg[MESSAGE_BUFFER_SIZE];
+      pool_stats_t stats;
+      chunk_stats_t chunks;
+
+      pool_stats(&stats);
+      chunk_stats(&chunks);
+
+      snprintf(msg, sizeof msg, "Classe\tSlabs\tServis\tLibres\n");
+      send_basic(client_socket, msg, strlen(msg));
+      for (unsigned i = 0; i < POOL_CLASSES; i++)
+	{
+	  snprintf(msg, sizeof msg, "%lu\t%u\t%u\t%u\n", (unsigned long) stats.classes[i].size,
+		   stats.classes[i].slabs, stats.classes[i].used, stats.classes[i].free);
+	  send_basic(client_socket, msg, strlen(msg));
+	}
+
+      snprintf(msg, sizeof msg,
+	       "mmap\t-\t%u\t-\n"
+	       "Octets servis\t%lu\n"
+	       "Octets projets\t%lu\n"
+	       "Pic\t%lu\n"
+	       "Budget\t%lu\n"
+	       "Octets sur disque\t%lu\n"
+	       "Processus\t%u/%d\n"
+	       "Descripteurs\t%u/%u\n"
+	       "Pipes agrandis\t%lu\n"
+	       "Processus retirs\t%lu\n",
+	       stats.classes[POOL_CLASSES].used, (unsigned long) stats.in_use,
+	       (unsigned long) stats.mapped, (unsigned long) stats.peak,
+	       (unsigned long) stats.budget, (unsigned long) outbuf_spilled(),
+	       process_count(), MAX_PROCESS, fd_open_count(), fd_limit(), process_pipes_grown(),
+	       process_swept());
+      send_basic(client_socket, msg, strlen(msg));
+
+      /* Dbits en ko/s, 0 pour illimit */
+      snprintf(msg, sizeof msg,
+	       "Dbit par connection\t%lu\n"
+	       "Dbit total\t%lu\n"
+	       "Dbit par processus\t%lu\n"
+	       "Octets envoys\t%llu\n"
+	       "Envois retenus\t%lu\n"
+	       "Compression\t%llu -> %llu\n"
+	       "Blocs non compresss\t%lu\n"
+	       "Sorties scelles\t%lu -> %lu\n"
+	       "Morceaux\t%u\n"
+	       "Morceaux partags\t%u\n"
+	       "Octets conomiss\t%lu\n",
+	       (unsigned long) (client_rate / 1024), (unsigned long) (egress_rate / 1024),
+	       (unsigned long) (process_rate / 1024), bytes_sent, sends_delayed,
+	       compress_in, compress_out, compress_skipped,
+	       (unsigned long) chunks.referenced, (unsigned long) chunks.stored, chunks.chunks,
+	       chunks.shared, (unsigned long) (chunks.referenced > chunks.stored
+					       ? chunks.referenced - chunks.stored : 0));
+      send_basic(client_socket, msg, strlen(msg));
+
+      send_ok(client_socket, NULL);
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_TRACE
+   ****************************************************************************/
+  else if (!strcmp(CMD_TRACE, token))
+    {
+      if ((token = strtok(NULL, " ")) == NULL)
+	{
+	  send_failure(client_socket, DETAIL_RET_TRACE_SYNTAX);
+	  return MSG_ERR;
+	}
+
+      if (!strcmp(token, "on") || !strcmp(token, "off"))
+	{
+	  if (!trace_enable(token[1] == 'n'))
+	    {
+	      send_failure(client_socket, DETAIL_RET_TRACE_ERROR);
+	      return MSG_ERR;
+	    }
+	  send_ok(client_socket, NULL);
+	  return MSG_OK;
+	}
+
+      if (strcmp(token, "dump"))
+	{
+	  send_failure(client_socket, DETAIL_RET_TRACE_SYNTAX);
+	  return MSG_ERR;
+	}
+
+      if (!trace_enabled())
+	{
+	  send_failure(client_socket, DETAIL_RET_TRACE_DISABLED);
+	  return MSG_ERR;
+	}
+
+      /* Les intervalles crits sont retirs de l'anneau */
+      const char *path = (token = strtok(NULL, " ")) != NULL ? token : trace_path;
+      int count = trace_dump(path);
+      if (count == -1)
+	{
+	  send_failure(client_socket, DETAIL_RET_TRACE_ERROR);
+	  return MSG_ERR;
+	}
+
+      send_ok(client_socket, itoa(count));
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_REEXEC
+   ****************************************************************************/
+  else if (!strcmp(CMD_REEXEC, token))
+    {
+      /* Les commandes suivantes seront traites par le nouveau binaire */
+      send_ok(client_socket, DETAIL_RET_REEXEC);
+      reexec_pending = true;
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_GET_RETURN_CODE
+   ****************************************************************************/
+  else if (!strcmp(CMD_GET_RETURN_CODE, token))
+    {
+      if ((token = strtok(NULL, " ")) == NULL)
+	{
+	  send_failure(client_socket, DETAIL_RET_GET_RETURN_CODE_SYNTAX);
+	  return MSG_ERR;
+        }
+      
+      pid_t process_to_get_ret = atoi(token);
+      int ret;
+
+      if (!process_exists(process_to_get_ret))
+	{
+	  if (process_tombstone(process_to_get_ret, &ret))
+	    {
+	      send_ok(client_socket, itoa(ret));
+	      return MSG_OK;
+	    }
+
+	  send_failure(client_socket, DETAIL_RET_UNKNOWN_PROCESS);
+	  return MSG_ERR;
+	}
+
+      ret = get_return_code(process_to_get_ret);
+      if (ret == PROCESS_NOT_TERMINATED)
+	{
+	  send_failure(client_socket, DETAIL_RET_GET_RETURN_CODE_ERROR);
+	  return MSG_ERR;
+	}
+      
+      send_ok(client_socket, itoa(ret));
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_LIST_PROCESS   
+   ****************************************************************************/
+  else if (!strcmp(CMD_LIST_PROCESS, token))
+    {
+      int filter = LIST_ALL;
+      unsigned offset = 0, count = 0;
+
+      /* Filtre optionnel, puis pagination optionnelle */
+      if ((token = strtok(NULL, " ")) != NULL && !isdigit(*token))
+	{
+	  if (!strcmp(FILTER_RUNNING, token))
+	    filter = LIST_RUNNING;
+	  else if (!strcmp(FILTER_EXITED, token))
+	    filter = LIST_EXITED;
+	  else if (strcmp(FILTER_ALL, token))
+	    {
+	      send_failure(client_socket, DETAIL_RET_UNKNOWN_FILTER);
+	      return MSG_ERR;
+	    }
+
+	  token = strtok(NULL, " ");
+	}
+
+      if (token != NULL)
+	{
+	  offset = atoi(token);
+	  if ((token = strtok(NULL, " ")) != NULL)
+	    count = atoi(token);
+	}
+
+      list_process(client_socket, filter, offset, count);
+
+      /* Le numro de changement courant, point de dpart de ListChanges */
+      char seq[24];
+      snprintf(seq, sizeof seq, "%lu", last_change());
+
+      send_ok(client_socket, seq);
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_LIST_CHANGES
+   ****************************************************************************/
+  else if (!strcmp(CMD_LIST_CHANGES, token))
+    {
+      if ((token = strtok(NULL, " ")) == NULL)
+	{
+	  send_failure(client_socket, DETAIL_RET_LIST_CHANGES_SYNTAX);
+	  return MSG_ERR;
+	}
+
+      if (!list_changes(client_socket, strtoul(token, NULL, 10)))
+	{
+	  send_failure(client_socket, DETAIL_RET_LIST_CHANGES_ERROR);
+	  return MSG_ERR;
+	}
+
+      char seq[24];
+      snprintf(seq, sizeof seq, "%lu", last_change());
+
+      send_ok(client_socket, seq);
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                 CMD_DESTROY_GROUP / CMD_LIST_GROUP
+   *                      CMD_COLLECT_GROUP_OUTPUT
+   ****************************************************************************/
+  else if (!strcmp(CMD_DESTROY_GROUP, token) || !strcmp(CMD_LIST_GROUP, token)
+	   || !strcmp(CMD_COLLECT_GROUP_OUTPUT, token))
+    {
+      const char *cmd = token;
+      unsigned n;
+
+      if ((token = strtok(NULL, " ")) == NULL)
+	{
+	  send_failure(client_socket, !strcmp(CMD_DESTROY_GROUP, cmd) ? DETAIL_RET_DESTROY_GROUP_SYNTAX
+		       : !strcmp(CMD_LIST_GROUP, cmd) ? DETAIL_RET_LIST_GROUP_SYNTAX
+		       : DETAIL_RET_COLLECT_GROUP_OUTPUT_SYNTAX);
+	  return MSG_ERR;
+	}
+
+      if (!strcmp(CMD_DESTROY_GROUP, cmd))
+	n = destroy_group(token);
+      else if (!strcmp(CMD_LIST_GROUP, cmd))
+	n = list_group(client_socket, token);
+      else
+	n = collect_group_output(client_socket, token);
+
+      if (n == 0)
+	{
+	  send_failure(client_socket, DETAIL_RET_UNKNOWN_GROUP);
+	  return MSG_ERR;
+	}
+
+      send_ok(client_socket, itoa(n));
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_WAIT_GROUP
+   ****************************************************************************/
+  else if (!strcmp(CMD_WAIT_GROUP, token))
+    {
+      socketinfo_t *client = client_of(client_socket);
+      unsigned failed;
+
+      if ((token = strtok(NULL, " ")) == NULL)
+	{
+	  send_failure(client_socket, DETAIL_RET_WAIT_GROUP_SYNTAX);
+	  return MSG_ERR;
+	}
+
+      if (wait_group(token, &failed) == -1)
+	{
+	  send_failure(client_socket, DETAIL_RET_UNKNOWN_GROUP);
+	  return MSG_ERR;
+	}
+
+      /* La rponse sera envoye par client_wait_done,  la fin du groupe */
+      if (client == NULL || (client->wait_tag = strdup(token)) == NULL)
+	{
+	  perror("strdup");
+	  send_failure(client_socket, DETAIL_RET_WAIT_ERROR);
+	  return MSG_ERR;
+	}
+
+      return MSG_WAIT;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_WAIT_ANY
+   ****************************************************************************/
+  else if (!strcmp(CMD_WAIT_ANY, token))
+    {
+      socketinfo_t *client = client_of(client_socket);
+      char pids[MESSAGE_BUFFER_SIZE] = "";
+      size_t len = 0;
+      pid_t pid;
+      int ret;
+
+      while ((token = strtok(NULL, " ")) != NULL && len < sizeof pids && atoi(token) > 0)
+	len += snprintf(pids + len, sizeof pids - len, "%d ", atoi(token));
+
+      if (len == 0 || token != NULL)
+	{
+	  send_failure(client_socket, DETAIL_RET_WAIT_ANY_SYNTAX);
+	  return MSG_ERR;
+	}
+
+      switch (wait_any(pids, &pid, &ret))
+	{
+	case -1:
+	  send_failure(client_socket, DETAIL_RET_UNKNOWN_PROCESS);
+	  return MSG_ERR;
+
+	case 1:
+	  send_finished(client_socket, pid, ret);
+	  return MSG_OK;
+	}
+
+      /* La rponse sera envoye par client_wait_done,  la premire fin */
+      if (client == NULL || (client->wait_pids = strdup(pids)) == NULL)
+	{
+	  perror("strdup");
+	  send_failure(client_socket, DETAIL_RET_WAIT_ERROR);
+	  return MSG_ERR;
+	}
+
+      return MSG_WAIT;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_DEFINE_TEMPLATE
+   ****************************************************************************/
+  else if (!strcmp(CMD_DEFINE_TEMPLATE, token))
+    {
+      char *name;
+      char *args[MAX_ARGS];
+      char **pc = args;
+
+      /* Le nom du modle, puis au moins le nom du prog */
+      if (!(name = strtok(NULL, " ")) || !(*pc++ = strtok(NULL, " ")))
+	{
+	  send_failure(client_socket, DETAIL_RET_DEFINE_TEMPLATE_SYNTAX);
+	  return MSG_ERR;
+	}
+
+      /* define_template copie les arguments, pas besoin de strdup */
+      while (pc < args + MAX_ARGS - 1 && (*pc = strtok(NULL, " ")))
+	pc++;
+
+      *pc = NULL;
+
+      const char *path = define_template(name, args);
+      if (path == NULL)
+	{
+	  send_failure(client_socket, DETAIL_RET_DEFINE_TEMPLATE_ERROR);
+	  return MSG_ERR;
+	}
+
+      send_ok(client_socket, path);
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_RUN
+   ****************************************************************************/
+  else if (!strcmp(CMD_RUN, token))
+    {
+      char *name;
+      char *args[MAX_ARGS];
+      char **pc = args;
+
+      if (!(name = strtok(NULL, " ")))
+	{
+	  send_failure(client_socket, DETAIL_RET_RUN_SYNTAX);
+	  return MSG_ERR;
+	}
+
+      if (!template_exists(name))
+	{
+	  send_failure(client_socket, DETAIL_RET_UNKNOWN_TEMPLATE);
+	  return MSG_ERR;
+	}
+
+      /* Les arguments supplmentaires, recopis par run_template */
+      while (pc < args + MAX_ARGS - 1 && (*pc = strtok(NULL, " ")))
+	pc++;
+
+      *pc = NULL;
+
+      if (!fd_available(FD_PER_PROCESS))
+	{
+	  send_failure(client_socket, DETAIL_RET_FD_BUDGET);
+	  return MSG_ERR;
+	}
+
+      pid_t proc = run_template(name, args);
+      if (proc == -1)
+	{
+	  send_failure(client_socket, DETAIL_RET_CREATE_PROCESS_ERROR);
+	  return MSG_ERR;
+	}
+
+      send_ok(client_socket, itoa(proc));
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                          CMD_GET_HELP
+   ****************************************************************************/
+  else if (!strcmp(CMD_GET_HELP, token))
+    {
+      send_basic(client_socket, help, strlen(help));
+      send_ok(client_socket, NULL);
+      return MSG_OK;
+    }
+
+  /*****************************************************************************  
+   *                        COMMANDE INCONNUE
+   ****************************************************************************/
+  else
+    {
+      send_failure(client_socket, DETAIL_RET_UNKNOWN_COMMAND);
+      return MSG_UNKNOWN_COMMAND;
+    }
+}
+
+/**
+ * Accueille un nouveau client.
+ */
+static void accept_client(socketinfo_t *client)
+{
+  char buffer[MESSAGE_BUFFER_SIZE];
+  char host[HOST_SIZE];
+
+  /* Le client vient de se connecter */
+  client->pass_fd = -1;
+  client->pass_armed = false;
+  client->id = ++last_client_id;
+  client_open_connection(client);
+
+  if (gethostname(host, sizeof host) == -1 && errno == EINVAL)
+    host[sizeof host - 1] = '\0';
+
+  /* On envoie un message de bienvenue et le prompt */
+  snprintf(buffer, sizeof buffer, "%s [ %s ] [ " COMPRESS_LZ " ]\n", welcome, host);
+  send_basic(client->socket, buffer, strlen(buffer));
+  send_basic(client->socket, prompt_client, strlen(prompt_client));
+}
+
+/**
+ * Termine la rponse  une commande : par le prompt, ou en mode Framed
+ * par sa mise en trame sur le canal 0. Une trame y est exactement une
+ * rponse, que le client n'a pas  chercher dans le texte ; une commande
+ * sans rponse (ligne blanche) y donne une trame vide.
+ *
+ * @param framed le client tait en mode Framed  la rception de la commande
+ */
+static void client_reply_done(socketinfo_t *client, bool framed)
+{
+  if (!framed)
+    {
+      send_basic(client->socket, prompt_client, strlen(prompt_client));
+      return;
+    }
+
+  send_frame(client, 0, client->ctl, client->ctl_len);
+  client->ctl_len = 0;
+}
+
+/**
+ * Traite toutes les commandes compltes (termines par '\0' ou '\n')
+ * reues du client, n octets venant d'tre ajouts  son buffer.
+ *
+ * @return false si le client a quitt
+ */
+static bool client_received(socketinfo_t *client, size_t n)
+{
+  client->in_len += n;
+
+  char *line = client->in;
+  char *end = client->in + client->in_len;
+  char *eol;
+
+  /* Un WaitGroup ou un WaitAny en attente, ou un Reexec, suspend les commandes suivantes */
+  while (!client_waiting(client) && !reexec_pending)
+    {
+      /* On cherche la fin de la commande */
+      for (eol = line; eol < end && *eol != '\0' && *eol != '\n'; eol++)
+	;
+
+      if (eol == end)
+	{
+	  /* Commande trop longue : on la traite telle quelle, tronque */
+	  if (line != client->in || client->in_len < sizeof client->in)
+	    break;
+
+	  eol = end - 1;
+	}
+
+      *eol = '\0';
+      if (eol > line && eol[-1] == '\r')
+	eol[-1] = '\0';
+
+      verbose("Client # %s\n", line);
+
+      /* On traite la commande  */
+      last_notification = NULL;
+      capture_begin(line);
+      commands_processed++;
+      TRACE_PROBE2(command__begin, client->socket, line);
+      uint64_t span = trace_begin();
+      /* La rponse  Framed est encore en clair, sans prompt */
+      bool framed = client->framed;
+      int ret = parse_client_line(client->socket, line);
+      /* parse_client_line a coup la ligne : il ne reste que le nom de la commande */
+      trace_end(line, span, client->socket);
+      TRACE_PROBE2(command__end, client->socket, ret);
+      capture_end(client->id, last_notification);
+      if (ret == MSG_QUIT)
+	return false;
+
+      line = eol + 1;
+      if (ret != MSG_WAIT && (framed || !client->framed))
+	client_reply_done(client, framed);
+    }
+
+  /* On garde le dbut de la commande suivante */
+  client->in_len = end - line;
+  memmove(client->in, line, client->in_len);
+  return true;
+}
+
+/**
+ * Passe au buffer de commandes ce que le backend io_uring a reu pendant
+ * qu'il tait plein, tant que les commandes ne sont pas suspendues.
+ *
+ * @return false si le client a quitt
+ */
+static bool client_feed_held(socketinfo_t *client)
+{
+  size_t done = 0;
+
+  while (done < client->held_len && !client_waiting(client) && !reexec_pending)
+    {
+      size_t n = sizeof client->in - client->in_len;
+      if (n > client->held_len - done)
+	n = client->held_len - done;
+
+      memcpy(client->in + client->in_len, client->held + done, n);
+      done += n;
+      if (!client_received(client, n))
+	return false;
+    }
+
+  client->held_len -= done;
+  memmove(client->held, client->held + done, client->held_len);
+  return true;
+}
+
+/**
+ * Rpond au WaitGroup du client si son groupe a fini, ou  son WaitAny
+ * si l'un des processus a fini, puis traite les commandes reues
+ * entre-temps. Appel  chaque tour de boucle, la fin d'un fils
+ * rveillant la boucle.
+ *
+ * @return false si le client a quitt
+ */
+static bool client_wait_done(socketinfo_t *client)
+{
+  unsigned failed;
+  pid_t pid;
+  int ret;
+
+  if (client->wait_tag != NULL)
+    {
+      if (wait_group(client->wait_tag, &failed) > 0)
+	return true;
+
+      group_reported(client->wait_tag);
+      send_ok(client->socket, itoa(failed));
+    }
+  else if (client->wait_pids != NULL)
+    {
+      switch (wait_any(client->wait_pids, &pid, &ret))
+	{
+	case 0:
+	  return true;
+
+	case -1: /* Dtruit par un autre client */
+	  send_failure(client->socket, DETAIL_RET_UNKNOWN_PROCESS);
+	  break;
+
+	default:
+	  send_finished(client->socket, pid, ret);
+	}
+    }
+  else
+    return client_feed_held(client);
+
+  free(client->wait_tag);
+  client->wait_tag = NULL;
+  free(client->wait_pids);
+  client->wait_pids = NULL;
+
+  client_reply_done(client, client->framed);
+  return client_received(client, 0) && client_feed_held(client);
+}
+
+/**
+ * Lit ce que le client a envoy et traite ses commandes.
+ *
+ * @return false si le client a quitt
+ */
+static bool process_client(socketinfo_t *client)
+{
+  ssize_t n = recv(client->socket, client->in + client->in_len,
+		   sizeof client->in - client->in_len, MSG_DONTWAIT);
+
+  if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return true;
+
+  if (n <= 0)
+    return false;
+
+  return client_received(client, n);
+}
+
+/**
+ * Parse la ligne de commande.
+ */
+static void parse_command_line(int argc, char *argv[])
+{
+  char *prog = argv[0];
+  argc = argc; /* Evite un warning */
+  port = DEFAULT_PORT;
+  
+  while (*++argv) {
+    /* Version */
+    if (!strcmp(*argv, "-v"))
+      {
+	puts(server_version);
+	exit(EXIT_SUCCESS);
+      }
+    
+    /* Verbose */
+    if (!strcmp(*argv, "-V"))
+      {
+	verbose_flag = true;
+      }
+
+    /* io_uring */
+    else if (!strcmp(*argv, "-u"))
+      {
+	uring_flag = true;
+      }
+
+    /* Aide  */
+    else if (!strcmp(*argv, "-h"))
+      {
+	usage(prog);
+	exit(EXIT_SUCCESS);
+      }
+    
+    /* Port  */
+    else if (!strcmp(*argv, "-p"))
+      {
+	if (*(argv + 1) == NULL)
+	  {
+	    usage(prog);
+	    exit(EXIT_FAILURE);
+	  }
+	port = atoi(*++argv);
+      }
+
+    /* Socket local */
+    else if (!strcmp(*argv, "-U"))
+      {
+	if (*(argv + 1) == NULL)
+	  {
+	    usage(prog);
+	    exit(EXIT_FAILURE);
+	  }
+	local_path = *++argv;
+      }
+
+    /* Reprise aprs Reexec : option interne, ajoute par l'ancien binaire */
+    else if (!strcmp(*argv, "-R") && *(argv + 1) != NULL)
+      {
+	resume_fd = atoi(*++argv);
+      }
+
+    /* Capture */
+    else if (!strcmp(*argv, "-r"))
+      {
+	if (*(argv + 1) == NULL)
+	  {
+	    usage(prog);
+	    exit(EXIT_FAILURE);
+	  }
+	capture_path = *++argv;
+      }
+
+    /* Budget des buffers */
+    else if (!strcmp(*argv, "-M"))
+      {
+	if (*(argv + 1) == NULL)
+	  {
+	    usage(prog);
+	    exit(EXIT_FAILURE);
+	  }
+	output_budget = (size_t) atoi(*++argv) << 20;
+      }
+
+    /* Descripteurs de fichiers */
+    else if (!strcmp(*argv, "-F"))
+      {
+	if (*(argv + 1) == NULL)
+	  {
+	    usage(prog);
+	    exit(EXIT_FAILURE);
+	  }
+	fd_wanted = atoi(*++argv);
+      }
+
+    /* Rtention des processus termins */
+    else if (!strcmp(*argv, "-t") || !strcmp(*argv, "-n") || !strcmp(*argv, "-o"))
+      {
+	if (*(argv + 1) == NULL)
+	  {
+	    usage(prog);
+	    exit(EXIT_FAILURE);
+	  }
+	if (argv[0][1] == 't')
+	  retention.ttl = atoi(argv[1]);
+	else if (argv[0][1] == 'n')
+	  retention.max_finished = atoi(argv[1]);
+	else
+	  retention.max_output = (size_t) atoi(argv[1]) << 20;
+	argv++;
+      }
+
+    /* Dbits */
+    else if (!strcmp(*argv, "-b") || !strcmp(*argv, "-B") || !strcmp(*argv, "-P"))
+      {
+	if (*(argv + 1) == NULL)
+	  {
+	    usage(prog);
+	    exit(EXIT_FAILURE);
+	  }
+	uint64_t rate = (uint64_t) atoi(argv[1]) * 1024;
+	if (argv[0][1] == 'b')
+	  client_rate = rate;
+	else if (argv[0][1] == 'B')
+	  egress_rate = rate;
+	else
+	  process_rate = rate;
+	argv++;
+      }
+
+    /* Traceur */
+    else if (!strcmp(*argv, "-T"))
+      {
+	if (*(argv + 1) == NULL)
+	  {
+	    usage(prog);
+	    exit(EXIT_FAILURE);
+	  }
+	trace_path = *++argv;
+	trace_flag = true;
+      }
+
+    /* Cache */
+    else if (!strcmp(*argv, "-c") || !strcmp(*argv, "-C"))
+      {
+	if (*(argv + 1) == NULL)
+	  {
+	    usage(prog);
+	    exit(EXIT_FAILURE);
+	  }
+	if (argv[0][1] == 'c')
+	  cache_dir = *++argv;
+	else
+	  cache_size = (size_t) atoi(*++argv) << 20;
+      }
+
+    /* Option inconnue */
+    else
+      {
+	fprintf(stderr, "Option \"%s\" inconnue\n\n", *argv);
+	usage(prog);
+	exit(EXIT_FAILURE);
+      }
+  }
+}
+
+/**
+ * Met  jour la page d'tat, une fois par tour de boucle.
+ */
+static void publish_status()
+{
+  pool_stats_t stats;
+
+  if (status_page == NULL)
+    return;
+
+  pool_stats(&stats);
+  status_begin(status_page);
+
+  status_page->daemon_pid = getpid();
+  status_page->updated = time(NULL);
+  if (status_page->started == 0)
+    status_page->started = status_page->updated;
+  status_page->commands = commands_processed;
+  status_page->connections = last_client_id;
+  status_page->clients = 0;
+  for (unsigned i = 0; i < sizeof clients / sizeof clients[0]; i++)
+    if (clients[i].socket != -1)
+      status_page->clients++;
+  status_page->max_process = MAX_PROCESS;
+  status_page->change_seq = last_change();
+  status_page->buffered = stats.in_use;
+  status_page->budget = stats.budget;
+  status_page->suspended = pool_over_budget();
+  process_status(status_page);
+
+  status_end(status_page);
+}
+
+/**
+ * Arrte le serveur proprement en dconnectant les clients et lui mme.
+ */
+static void shutdown_server() {
+  puts("Fermeture du dmon ...");
+
+  /* Fermeture des clients */
+  for (unsigned i = 0; i < sizeof clients / sizeof clients[0]; i++)
+    if (clients[i].socket != -1)
+      client_close_connection(clients + i);
+
+  capture_close();
+  status_remove(port);
+
+  /* Fermeture du socket local */
+  if (local_socket != -1)
+    {
+      close(local_socket);
+      unlink(local_path);
+    }
+
+  /* Fermeture du serveur */
+  if (close(server_socket) == -1)
+    {
+      perror("Impossible de fermer le socket serveur");
+      exit(EXIT_FAILURE);
+    }
+  
+  exit(EXIT_SUCCESS);
+}
+
+
+/**
+ * Fonction de callback appele lors d'un ctrl+c.
+ */
+static void trap_ctrlc(int sig)
+{
+  sig = sig;                  /* Evite un warning */
+  shutdown_server();
+}
+
+/**
+ * Fonction de callback appele  la fin d'un fils : elle rveille la
+ * boucle d'vnements, qui relvera la fin du processus (cache_finished).
+ * Un simple EINTR ne suffit pas, le signal pouvant arriver juste avant
+ * l'attente.
+ */
+static void trap_sigchld(int sig)
+{
+  int saved_errno = errno;
+  ssize_t n = write(sigchld_pipe[1], "", 1);
+
+  /* En C99 strict, signal() a la smantique System V : on se rinstalle */
+  signal(SIGCHLD, trap_sigchld);
+
+  sig = sig; n = n;           /* Evite un warning */
+  errno = saved_errno;
+}
+
+/**
+ * Fonction de callback appele sur SIGUSR1 : criture de la trace.
+ */
+static void trap_trace(int sig)
+{
+  int saved_errno = errno;
+  ssize_t n = write(sigchld_pipe[1], "", 1);
+
+  trace_pending = true;
+  signal(SIGUSR1, trap_trace);
+
+  sig = sig; n = n;           /* Evite un warning */
+  errno = saved_errno;
+}
+
+/**
+ * crit la trace demande par SIGUSR1, en fin de tour de boucle.
+ */
+static void dump_trace()
+{
+  if (!trace_pending)
+    return;
+
+  trace_pending = false;
+  if (!trace_enabled())
+    fputs("SIGUSR1 : le traceur n'est pas actif\n", stderr);
+  else
+    verbose("Trace : %d intervalles dans %s\n", trace_dump(trace_path), trace_path);
+}
+
+/**
+ * Fonction de callback appele sur SIGUSR2 : Reexec.
+ */
+static void trap_reexec(int sig)
+{
+  int saved_errno = errno;
+  ssize_t n = write(sigchld_pipe[1], "", 1);
+
+  reexec_pending = true;
+  signal(SIGUSR2, trap_reexec);
+
+  sig = sig; n = n;           /* Evite un warning */
+  errno = saved_errno;
+}
+
+/**
+ * Sauvegarde ce qu'il faut d'un client pour Reexec : son socket, la fin
+ * de commande pas encore reue et les rponses pas encore envoyes.
+ */
+static void client_save(state_t *state, const socketinfo_t *client)
+{
+  state_put_fd(state, client->socket);
+  state_put(state, &client->address, sizeof client->address);
+  state_put_int(state, client->local);
+  state_put_int(state, client->in_len);
+  state_put(state, client->in, client->in_len);
+  state_put_int(state, client->held_len);
+  state_put(state, client->held, client->held_len);
+
+  /* io_uring : ce que le noyau n'a pas envoy passe avant le reste */
+  if (client->flight != NULL)
+    {
+      state_put_int(state, client->flight_len - client->flight_sent + client->out_len - client->out_sent);
+      state_put(state, client->flight + client->flight_sent, client->flight_len - client->flight_sent);
+    }
+  else
+    state_put_int(state, client->out_len - client->out_sent);
+  state_put(state, client->out + client->out_sent, client->out_len - client->out_sent);
+
+  state_put_fd(state, client->pass_fd);
+  state_put_int(state, client->framed);
+  state_put_int(state, client->compress);
+  state_put_int(state, client->ctl_len);
+  state_put(state, client->ctl, client->ctl_len);
+  for (unsigned i = 0; i < MAX_TRANSFERS; i++)
+    {
+      state_put_int(state, client->transfers[i].chan);
+      state_put_int(state, client->transfers[i].pid);
+      state_put_int(state, client->transfers[i].stream);
+      state_put_int(state, client->transfers[i].offset);
+      state_put_int(state, client->transfers[i].end);
+    }
+  state_put_int(state, client->next_chan);
+  state_put_int(state, client->next_transfer);
+  state_put_str(state, client->wait_tag);
+  state_put_str(state, client->wait_pids);
+  state_put_int(state, client->id);
+}
+
+/**
+ * Relit un client sauvegard par client_save.
+ */
+static void client_restore(state_t *state, socketinfo_t *client)
+{
+  client->socket = state_get_fd(state);
+  state_get(state, &client->address, sizeof client->address);
+  client->local = state_get_int(state);
+  client->in_len = state_get_int(state);
+  if (client->in_len > sizeof client->in)
+    {
+      client->in_len = 0;
+      state->ok = false;
+    }
+  state_get(state, client->in, client->in_len);
+  client->held_len = client->held_cap = state_get_int(state);
+  client->held = state_get_data(state, client->held_len);
+  if (client->held == NULL)
+    client->held_len = client->held_cap = 0;
+
+  client->out_len = client->out_cap = state_get_int(state);
+  client->out = state_get_data(state, client->out_len);
+  if (client->out == NULL)
+    client->out_len = client->out_cap = 0;
+
+  client->pass_fd = state_get_fd(state);
+  client->framed = state_get_int(state);
+  client->compress = state_get_int(state);
+  client->ctl_len = client->ctl_cap = state_get_int(state);
+  client->ctl = state_get_data(state, client->ctl_len);
+  if (client->ctl == NULL)
+    client->ctl_len = client->ctl_cap = 0;
+  for (unsigned i = 0; i < MAX_TRANSFERS; i++)
+    {
+      client->transfers[i].chan = state_get_int(state);
+      client->transfers[i].pid = state_get_int(state);
+      client->transfers[i].stream = state_get_int(state);
+      client->transfers[i].offset = state_get_int(state);
+      client->transfers[i].end = state_get_int(state);
+    }
+  client->next_chan = state_get_int(state);
+  client->next_transfer = state_get_int(state) % MAX_TRANSFERS;
+  client->wait_tag = state_get_str(state);
+  client->wait_pids = state_get_str(state);
+  client->id = state_get_int(state);
+  bucket_init(&client->bucket, client_rate);
+}
+
+/**
+ * Remplace le binaire du dmon par celui qui est sur le disque, sans
+ * couper les sessions : l'tat (clients, processus, modles) est crit
+ * dans un memfd, et execve garde les sockets et les pipes. Le dmon garde
+ * aussi son pid, les processus lancs restent donc ses fils. Ne revient
+ * qu'en cas d'chec, le dmon continuant alors tel quel.
+ *
+ * Les oprations en cours doivent tre termines (io_uring).
+ */
+static void reexec()
+{
+  char **args;
+  char fd_arg[16];
+  state_t state;
+  unsigned n = 0, nargs = 0;
+  int fd;
+
+  reexec_pending = false;
+  verbose("Reexec de %s ...\n", saved_argv[0]);
+
+  if (!state_create(&state))
+    return;
+
+  state_put_fd(&state, server_socket);
+  state_put_fd(&state, local_socket);
+  state_put_int(&state, last_client_id);
+  state_put_int(&state, fd_original_limit());
+
+  for (unsigned i = 0; i < sizeof clients / sizeof clients[0]; i++)
+    if (clients[i].socket != -1)
+      n++;
+
+  state_put_int(&state, n);
+  for (unsigned i = 0; i < sizeof clients / sizeof clients[0]; i++)
+    if (clients[i].socket != -1)
+      client_save(&state, clients + i);
+
+  process_save(&state);
+  template_save(&state);
+
+  if ((fd = state_finish(&state)) == -1)
+    return;
+
+  /* Mme ligne de commande, l'tat en plus (sans celui d'un Reexec prcdent) */
+  while (saved_argv[nargs] != NULL)
+    nargs++;
+
+  if ((args = malloc((nargs + 3) * sizeof *args)) == NULL)
+    {
+      perror("malloc");
+      close(fd);
+      return;
+    }
+
+  nargs = 0;
+  for (char **arg = saved_argv; *arg != NULL; arg++)
+    if (!strcmp(*arg, "-R") && arg[1] != NULL)
+      arg++;
+    else
+      args[nargs++] = *arg;
+
+  snprintf(fd_arg, sizeof fd_arg, "%d", fd);
+  args[nargs++] = "-R";
+  args[nargs++] = fd_arg;
+  args[nargs] = NULL;
+
+  /* La capture est close-on-exec : le nouveau binaire la rouvre */
+  fflush(stdout);
+  capture_flush();
+  publish_status();
+  state_exec(&state, args);
+
+  free(args);
+  close(fd);
+}
+
+/**
+ * Reprend l'tat laiss par l'ancien binaire (Reexec).
+ *
+ * @return false si l'tat est illisible
+ */
+static bool resume()
+{
+  state_t state;
+
+  if (!state_open(&state, resume_fd))
+    return false;
+
+  server_socket = state_get_fd(&state);
+  local_socket = state_get_fd(&state);
+  last_client_id = state_get_int(&state);
+  fd_raise_limit(fd_wanted, state_get_int(&state), FD_MOST);
+
+  for (long long n = state_get_int(&state); n > 0 && state.ok; n--)
+    {
+      socketinfo_t *client = NULL;
+
+      for (unsigned i = 0; i < sizeof clients / sizeof clients[0] && client == NULL; i++)
+	if (clients[i].socket == -1)
+	  client = clients + i;
+
+      if (client == NULL)
+	return false;
+
+      client_restore(&state, client);
+    }
+
+  bool ok = state.ok && process_restore(&state) && template_restore(&state);
+  state_close(&state);
+
+  verbose("Reprise aprs Reexec sur le port %d ...\n", port);
+  return ok;
+}
+
+/**
+ * Vide le pipe de rveil du gestionnaire de SIGCHLD.
+ */
+static void drain_sigchld()
+{
+  char buffer[64];
+
+  while (read(sigchld_pipe[0], buffer, sizeof buffer) > 0)
+    ;
+}
+
+/**
+ * Accepte une connection en attente sur le socket serveur ou local.
+ *
+ * @param listener server_socket ou local_socket
+ * @return false en cas d'erreur fatale
+ */
+static bool poll_accept(socketinfo_t *free_client, int listener)
+{
+  /* Variable concrte car il faut pouvoir en avoir l'adresse pour accept() */
+  socklen_t client_address_size = sizeof free_client->address;
+
+  free_client->local = listener == local_socket;
+  if ((free_client->socket = free_client->local
+       ? accept(listener, NULL, NULL)
+       : accept(listener, (struct sockaddr *) &free_client->address, &client_address_size)) == -1)
+    {
+      if (accept_failed(errno))
+	return true;
+
+      if (close(listener) == -1)
+	perror("Impossible de fermer le socket serveur");
+      return false;
+    }
+
+  /* Les processus lancs n'ont pas  hriter de la connection */
+  if (fcntl(free_client->socket, F_SETFD, FD_CLOEXEC) == -1)
+    perror("fcntl");
+
+  accept_client(free_client);
+  return true;
+}
+
+/**
+ * Boucle d'vnements du backend poll : sockets des clients, socket
+ * serveur et pipes des processus.
+ */
+static int poll_loop()
+{
+  for (;;) {
+    struct pollfd fds[MAX_PROCESS * 3 + MAX_CLIENT + 1];
+    socketinfo_t *polled[MAX_PROCESS * 3 + MAX_CLIENT + 1];
+    unsigned streams[MAX_PROCESS * 3];
+    socketinfo_t *free_client = NULL;
+    nfds_t nfds = 0, npipes;
+
+    reap_children();
+    cache_finished();
+    shaper_wait = -1;
+    shaper_round();
+    sweep_processes();
+
+    for (unsigned i = 0; i < sizeof clients / sizeof clients[0]; i++)
+      if (clients[i].socket != -1 && !client_wait_done(clients + i))
+	{
+	  client_flush(clients + i);
+	  client_close_connection(clients + i);
+	}
+
+    /*
+     * Les pipes d'abord : la sortie disponible est lue avant que les
+     * commandes du mme tour ne la demandent.
+     */
+    for (unsigned slot = 0; slot < MAX_PROCESS; slot++)
+      for (int stream = STREAM_IN; stream <= STREAM_ERR; stream++)
+	{
+	  int fd = stream_fd(slot, stream);
+	  if (fd == -1)
+	    continue;
+
+	  fds[nfds].fd = fd;
+	  fds[nfds].events = stream == STREAM_IN ? POLLOUT : POLLIN;
+	  streams[nfds++] = slot * 3 + stream;
+	}
+
+    npipes = nfds;
+
+    for (unsigned i = 0; i < sizeof clients / sizeof clients[0]; i++)
+      {
+	socketinfo_t *client = clients + i;
+
+	if (client->socket == -1)
+	  {
+	    if (free_client == NULL)
+	      free_client = client;
+	    continue;
+	  }
+
+	/*
+	 * On attend que le client ait lu ses rponses avant de traiter
+	 * d'autres commandes, pour ne pas accumuler sans fin. Pendant un
+	 * WaitGroup, ses commandes attendent dans le socket.
+	 */
+	fds[nfds].fd = client->socket;
+	fds[nfds].events = 0;
+	if (client->out_len - client->out_sent < OUTPUT_HIGH_WATER
+	    && !client_waiting(client))
+	  fds[nfds].events |= POLLIN;
+
+	/* Sans jetons, c'est le dlai de poll qui rveillera l'envoi */
+	client_frame(client);
+	if (client->out_sent < client->out_len
+	    && client_allowance(client, client->out_len - client->out_sent) > 0)
+	  fds[nfds].events |= POLLOUT;
+	polled[nfds++] = client;
+      }
+
+    /* On n'accepte de connection que s'il reste de la place, et des descripteurs */
+    if (free_client != NULL && accept_allowed())
+      {
+	fds[nfds].fd = server_socket;
+	fds[nfds].events = POLLIN;
+	polled[nfds++] = NULL;
+
+	if (local_socket != -1)
+	  {
+	    fds[nfds].fd = local_socket;
+	    fds[nfds].events = POLLIN;
+	    polled[nfds++] = NULL;
+	  }
+      }
+
+    fds[nfds].fd = sigchld_pipe[0];
+    fds[nfds].events = POLLIN;
+    polled[nfds++] = NULL;
+
+    TRACE_BEGIN(waiting, poll, nfds);
+    int ready = poll(fds, nfds, shaper_wait);
+    TRACE_END(waiting, poll, ready);
+    if (ready == -1)
+      {
+	if (errno != EINTR)
+	  perror("poll");
+	continue;
+      }
+
+    for (nfds_t i = 0; i < nfds; i++)
+      {
+	if (!fds[i].revents)
+	  continue;
+
+	/* Sortie d'un processus  lire ou entre  crire */
+	if (i < npipes)
+	  stream_ready(streams[i] / 3, streams[i] % 3);
+
+	/* Fin d'un fils, releve au prochain tour */
+	else if (fds[i].fd == sigchld_pipe[0])
+	  drain_sigchld();
+
+	/* Nouvelle connection, s'il reste de la place ce tour-ci */
+	else if (polled[i] == NULL)
+	  {
+	    if (free_client == NULL)
+	      continue;
+	    if (!poll_accept(free_client, fds[i].fd))
+	      return EXIT_FAILURE;
+	    free_client = NULL;
+	  }
+
+	/* Commandes du client, ou dconnection */
+	else if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)
+		 && !process_client(polled[i]))
+	  {
+	    client_flush(polled[i]);
+	    client_close_connection(polled[i]);
+	  }
+      }
+
+    /*
+     * Une seule criture par client et par tour, pour toute sa rponse.
+     * Le premier servi change  chaque tour, pour partager le dbit.
+     */
+    for (unsigned k = 0; k < sizeof clients / sizeof clients[0]; k++)
+      {
+	unsigned i = (drr_next + k) % MAX_CLIENT;
+	if (clients[i].socket != -1 && !client_flush(clients + i))
+	  client_close_connection(clients + i);
+      }
+
+    capture_flush();
+    publish_status();
+    dump_trace();
+
+    if (reexec_pending)
+      reexec();
+  }
+}
+
+/**
+ * Construit le user_data d'une opration io_uring.
+ */
+static unsigned long long op_data(unsigned op, unsigned index, unsigned gen)
+{
+  return (unsigned long long) op << 56 | (unsigned long long) index << 32 | gen;
+}
+
+/**
+ * Prpare une opration sur un flux de processus, dans le buffer
+ * enregistr qui lui est associ.
+ */
+static struct io_uring_sqe *uring_stream_sqe(unsigned index, int op, int fd, size_t len, unsigned gen)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+  if (sqe == NULL)
+    return NULL;
+
+  sqe->opcode = op == OP_READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long) (staging_data + (size_t) index * URING_BUFFER_SIZE);
+  sqe->len = len;
+  sqe->off = (unsigned long long) -1;
+  sqe->buf_index = index;
+  sqe->user_data = op_data(op, index, gen);
+  return sqe;
+}
+
+/**
+ * Si le pipe n'tait pas prt, on lie une attente  l'opration : le
+ * noyau ne la lancera qu'une fois le pipe prt. La place de toute la
+ * chane a t rserve (uring_reserve).
+ */
+static bool uring_wait_ready(staging_t *st, int fd, unsigned events)
+{
+  if (!st->need_poll)
+    return true;
+
+  struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+  if (sqe == NULL)
+    return false;
+
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = events;
+  sqe->flags = IOSQE_IO_LINK;
+  sqe->user_data = op_data(OP_POLL, st - staging, 0);
+  st->need_poll = false;
+  return true;
+}
+
+/**
+ * Soumet les oprations sur les pipes des processus : une lecture par
+ * sortie ouverte, une criture par entre en attente. La place d'une
+ * chane lie (attente, opration, fermeture) est rserve avant d'en
+ * prparer la premire SQE : un lien ne reste jamais sans suite.
+ */
+static void uring_arm_streams()
+{
+  for (unsigned slot = 0; slot < MAX_PROCESS; slot++)
+    for (int stream = STREAM_IN; stream <= STREAM_ERR; stream++)
+      {
+	unsigned index = slot * 3 + stream;
+	staging_t *st = staging + index;
+	unsigned gen = stream_generation(slot);
+	struct io_uring_sqe *sqe;
+
+	if (st->busy)
+	  {
+	    /* Le processus a t dtruit : inutile d'attendre son pipe */
+	    if (st->gen != gen && !st->cancelled
+		&& (sqe = uring_get_sqe(&ring)) != NULL)
+	      {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = op_data(stream == STREAM_IN ? OP_WRITE : OP_READ, index, st->gen);
+		sqe->user_data = op_data(OP_CANCEL, 0, 0);
+		st->cancelled = true;
+	      }
+	    continue;
+	  }
+
+	if (stream != STREAM_IN)
+	  {
+	    int fd = stream_fd(slot, stream);
+
+	    if (fd == -1 || !uring_reserve(&ring, st->need_poll + 1)
+		|| !uring_wait_ready(st, fd, POLLIN)
+		|| uring_stream_sqe(index, OP_READ, fd, URING_BUFFER_SIZE, gen) == NULL)
+	      continue;
+	  }
+	else
+	  {
+	    const char *data;
+	    bool close_after;
+	    int fd = st->fd != -1 ? st->fd : stream_fd(slot, stream);
+	    size_t len = fd == -1 ? 0 : stream_input(slot, &data, &close_after);
+
+	    if (len == 0)
+	      continue;
+
+	    if (len > URING_BUFFER_SIZE)
+	      {
+		len = URING_BUFFER_SIZE;
+		close_after = false;
+	      }
+
+	    memcpy(staging_data + (size_t) index * URING_BUFFER_SIZE, data, len);
+
+	    if (!uring_reserve(&ring, st->need_poll + 1 + close_after)
+		|| !uring_wait_ready(st, fd, POLLOUT)
+		|| (sqe = uring_stream_sqe(index, OP_WRITE, fd, len, gen)) == NULL)
+	      continue;
+
+	    /* Dernire criture avant CloseInput : la fermeture lui est lie */
+	    if (close_after)
+	      {
+		struct io_uring_sqe *close_sqe = uring_get_sqe(&ring);
+
+		sqe->flags |= IOSQE_IO_LINK;
+		if (st->fd == -1)
+		  st->fd = stream_detach_input(slot);
+
+		close_sqe->opcode = IORING_OP_CLOSE;
+		close_sqe->fd = st->fd;
+		close_sqe->user_data = op_data(OP_CLOSE, index, gen);
+	      }
+	  }
+
+	st->busy = true;
+	st->cancelled = false;
+	st->gen = gen;
+      }
+}
+
+/**
+ * Soumet les oprations sur les sockets : acceptation, rception
+ * multishot et envoi des rponses de chaque client.
+ */
+static void uring_arm_clients()
+{
+  socketinfo_t *free_client = NULL;
+  struct io_uring_sqe *sqe;
+
+  shaper_round();
+
+  /* Le premier servi change  chaque tour, pour partager le dbit */
+  for (unsigned k = 0; k < sizeof clients / sizeof clients[0]; k++)
+    {
+      unsigned i = (drr_next + k) % MAX_CLIENT;
+      socketinfo_t *client = clients + i;
+
+      if (client->socket == -1)
+	{
+	  if (free_client == NULL)
+	    free_client = client;
+	  continue;
+	}
+
+      if (!client->closing && !client_wait_done(client))
+	{
+	  client->closing = true;
+	  shutdown(client->socket, SHUT_RD);
+	}
+
+      /* Ce qui a t mis de ct passe avant toute nouvelle rception */
+      if (!client->closing && !client->recv_armed && client->held_len == 0
+	  && client->out_len - client->out_sent < OUTPUT_HIGH_WATER
+	  && !client_waiting(client)
+	  && (sqe = uring_get_sqe(&ring)) != NULL)
+	{
+	  sqe->opcode = IORING_OP_RECV;
+	  sqe->fd = client->socket;
+	  sqe->ioprio = IORING_RECV_MULTISHOT;
+	  sqe->flags = IOSQE_BUFFER_SELECT;
+	  sqe->buf_group = 0;
+	  sqe->user_data = op_data(OP_RECV, i, 0);
+	  client->recv_armed = true;
+	}
+
+      client_frame(client);
+
+      /*
+       * Le noyau lit flight jusqu' la compltion : les nouvelles
+       * rponses s'accumulent dans un autre buffer en attendant.
+       */
+      if (client->flight == NULL && client->out_sent < client->out_len)
+	{
+	  client->flight = client->out;
+	  client->flight_len = client->out_len;
+	  client->flight_sent = client->out_sent;
+	  client->out = NULL;
+	  client->out_len = client->out_cap = client->out_sent = 0;
+	}
+
+      /* Les jetons sont pris  la soumission, ceux de la part non envoye rendus  la compltion */
+      size_t len;
+      if (client->flight != NULL && !client->send_armed
+	  && (len = client_allowance(client, client->flight_len - client->flight_sent)) > 0
+	  && (sqe = uring_get_sqe(&ring)) != NULL)
+	{
+	  /* Un descripteur  joindre : sendmsg, le message restant valide jusqu' la compltion */
+	  if (client->pass_fd != -1)
+	    {
+	      sqe->opcode = IORING_OP_SENDMSG;
+	      sqe->addr = (unsigned long) client_fd_message(client, client->flight + client->flight_sent, len);
+	      sqe->len = 1;
+	      client->pass_armed = true;
+	    }
+	  else
+	    {
+	      sqe->opcode = IORING_OP_SEND;
+	      sqe->addr = (unsigned long) (client->flight + client->flight_sent);
+	      sqe->len = len;
+	    }
+	  sqe->fd = client->socket;
+	  sqe->msg_flags = MSG_NOSIGNAL;
+	  sqe->user_data = op_data(OP_SEND, i, 0);
+	  client->send_armed = true;
+	  client->send_len = len;
+	  client_sent(client, len);
+	}
+
+      /* Plus aucune opration en cours : on peut fermer */
+      if (client->closing && !client->recv_armed && !client->send_armed
+	  && client->flight == NULL)
+	client_close_connection(client);
+    }
+
+  if (free_client != NULL && !accept_armed[0] && accept_allowed()
+      && (sqe = uring_get_sqe(&ring)) != NULL)
     {
-      send_basic(client_socket, help, strlen(help));
-      return MSG_OK;
+      accept_address_size = sizeof accept_address;
+      sqe->opcode = IORING_OP_ACCEPT;
+      sqe->fd = server_socket;
+      sqe->addr = (unsigned long) &accept_address;
+      sqe->addr2 = (unsigned long) &accept_address_size;
+      sqe->accept_flags = SOCK_CLOEXEC;
+      sqe->user_data = op_data(OP_ACCEPT, 0, 0);
+      accept_armed[0] = true;
     }
 
-  /*****************************************************************************  
-   *                        COMMANDE INCONNUE
-   ****************************************************************************/
-  else
+  if (free_client != NULL && local_socket != -1 && !accept_armed[1] && accept_allowed()
+      && (sqe = uring_get_sqe(&ring)) != NULL)
     {
-      send_failure(client_socket, DETAIL_RET_UNKNOWN_COMMAND);
-      return MSG_UNKNOWN_COMMAND;
+      sqe->opcode = IORING_OP_ACCEPT;
+      sqe->fd = local_socket;
+      sqe->accept_flags = SOCK_CLOEXEC;
+      sqe->user_data = op_data(OP_ACCEPT, 1, 0);
+      accept_armed[1] = true;
     }
 }
 
 /**
- * Traite la connection avec le client.
+ * Annule une opration io_uring.
  */
-void process_client()
+static void uring_cancel(unsigned long long user_data)
 {
-  char buffer[MESSAGE_BUFFER_SIZE];
-  char host[HOST_SIZE];
-  
-  /* Le client vient de se connecter */
-  client_open_connection();
-  
-  if (gethostname(host, sizeof host) == -1 && errno == EINVAL)
-    host[sizeof host - 1] = '\0';
-  
-  /* On envoie un message de bienvenue et le prompt */
-  snprintf(buffer, sizeof buffer, "%s [ %s ]\n", welcome, host);
-  send_basic(client_socket, buffer, strlen(buffer));
-  send_basic(client_socket, prompt_client, strlen(prompt_client));
-  
-  /* On traite tous les messages du client */
-  while (recv(client_socket, buffer, MESSAGE_BUFFER_SIZE, 0) > 0)
-    {
-      verbose("Client # %s\n", buffer);
-      
-      /* On traite la commande  */
-      if (parse_client_line(client_socket, buffer) == MSG_QUIT)
-	break;
-      
-      send_basic(client_socket, prompt_client, strlen(prompt_client));
-    }
-  
-  /* Si on arrive ici, c'est que le client a quitt. */
-  client_close_connection();
+  struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+
+  if (sqe == NULL)
+    return;
+
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = user_data;
+  sqe->user_data = op_data(OP_CANCEL, 0, 0);
 }
 
 /**
- * Parse la ligne de commande.
+ * Avant un Reexec : annule les oprations qui peuvent attendre
+ * indfiniment (lectures, rceptions, acceptations), et laisse les
+ * autres se terminer. Les donnes dj lues arrivent avec leur
+ * compltion, rien n'est perdu.
+ *
+ * @return true quand plus aucune opration n'est en cours
  */
-static void parse_command_line(int argc, char *argv[])
+static bool uring_quiesce()
 {
-  char *prog = argv[0];
-  argc = argc; /* Evite un warning */
-  port = DEFAULT_PORT;
-  
-  while (*++argv) {
-    /* Version */
-    if (!strcmp(*argv, "-v"))
-      {
-	puts(server_version);
-	exit(EXIT_SUCCESS);
-      }
-    
-    /* Verbose */
-    if (!strcmp(*argv, "-V"))
+  static bool cancelled;
+  bool idle = true;
+
+  for (unsigned index = 0; index < MAX_PROCESS * 3; index++)
+    if (staging[index].busy)
       {
-	verbose_flag = true;
+	idle = false;
+	if (!cancelled)
+	  {
+	    /* L'attente lie d'abord : l'opration qui suit est annule avec elle */
+	    uring_cancel(op_data(OP_POLL, index, 0));
+	    uring_cancel(op_data(index % 3 == STREAM_IN ? OP_WRITE : OP_READ, index, staging[index].gen));
+	  }
       }
 
-    /* Aide  */
-    else if (!strcmp(*argv, "-h"))
+  for (unsigned i = 0; i < sizeof clients / sizeof clients[0]; i++)
+    {
+      if (clients[i].recv_armed)
+	{
+	  idle = false;
+	  if (!cancelled)
+	    uring_cancel(op_data(OP_RECV, i, 0));
+	}
+
+      if (clients[i].send_armed)
+	idle = false;
+    }
+
+  for (unsigned i = 0; i < 2; i++)
+    if (accept_armed[i])
       {
-	usage(prog);
-	exit(EXIT_SUCCESS);
+	idle = false;
+	if (!cancelled)
+	  uring_cancel(op_data(OP_ACCEPT, i, 0));
       }
-    
-    /* Port  */
-    else if (!strcmp(*argv, "-p"))
+
+  if (sigchld_armed)
+    {
+      idle = false;
+      if (!cancelled)
+	uring_cancel(op_data(OP_CHILD, 0, 0));
+    }
+
+  /* Un rveil du dbit : il expire de lui-mme */
+  if (timer_armed)
+    idle = false;
+
+  cancelled = !idle;
+  return idle;
+}
+
+/**
+ * Traite une compltion concernant un client.
+ */
+static void uring_client_done(unsigned op, socketinfo_t *client, struct io_uring_cqe *cqe)
+{
+  switch (op)
+    {
+    case OP_RECV:
       {
-	if (*(argv + 1) == NULL)
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+	  client->recv_armed = false;
+
+	if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER))
 	  {
-	    usage(prog);
-	    exit(EXIT_FAILURE);
+	    unsigned id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	    const char *data = uring_buf(&ring, id);
+	    size_t len = cqe->res;
+
+	    /* Le buffer de commandes est plus petit : par morceaux */
+	    while (len > 0 && !client->closing)
+	      {
+		size_t n = sizeof client->in - client->in_len;
+		if (n > len)
+		  n = len;
+
+		/*
+		 * Buffer plein de commandes suspendues (WaitGroup, WaitAny,
+		 * Reexec), ou donnes dj mises de ct : la suite attend
+		 * dans held, et la rception s'arrte jusqu' ce qu'il soit
+		 * vid, comme le backend poll cesse d'attendre POLLIN.
+		 */
+		if (n == 0 || client->held_len > 0)
+		  {
+		    if (!buffer_append(&client->held, &client->held_len, &client->held_cap, data, len))
+		      client->closing = true;
+		    else if (client->recv_armed)
+		      uring_cancel(op_data(OP_RECV, client - clients, 0));
+		    break;
+		  }
+
+		memcpy(client->in + client->in_len, data, n);
+		data += n;
+		len -= n;
+
+		if (!client_received(client, n))
+		  {
+		    client->closing = true;
+		    shutdown(client->socket, SHUT_RD);
+		  }
+	      }
+
+	    uring_buf_recycle(&ring, id);
 	  }
-	port = atoi(*++argv);
+
+	/* Plus de buffer disponible, ou Reexec : on rarmera au prochain tour */
+	else if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+	  client->closing = true;
+	break;
       }
 
-    /* Option inconnue */
-    else
+    case OP_SEND:
       {
-	fprintf(stderr, "Option \"%s\" inconnue\n\n", *argv);
-	usage(prog);
-	exit(EXIT_FAILURE);
+	client->send_armed = false;
+
+	/* Le client ne lit plus : ses rponses sont perdues */
+	if (cqe->res < 0)
+	  {
+	    client->flight_sent = client->flight_len;
+	    client->out_len = client->out_sent = 0;
+	    client->closing = true;
+	  }
+	else
+	  {
+	    /* Un envoi par sendmsg : le descripteur est parti */
+	    if (client->pass_armed)
+	      client_fd_sent(client);
+	    client->flight_sent += cqe->res;
+	    if ((size_t) cqe->res < client->send_len)
+	      client_unsent(client, client->send_len - cqe->res);
+	  }
+	client->pass_armed = false;
+
+	if (client->flight_sent == client->flight_len)
+	  {
+	    free(client->flight);
+	    client->flight = NULL;
+	  }
+	break;
       }
-  }
+    }
 }
 
 /**
- * Arrte le serveur proprement en dconnectant les clients et lui mme.
+ * Traite une compltion concernant un flux de processus.
  */
-static void shutdown_server() {
-  puts("Fermeture du dmon ...");
-
-  /* Fermeture du client */
-  if (client_socket > 0)
-    client_close_connection(client_socket);
+static void uring_stream_done(unsigned op, unsigned index, unsigned gen, struct io_uring_cqe *cqe)
+{
+  staging_t *st = staging + index;
+  unsigned slot = index / 3;
+  int stream = index % 3;
+  bool alive = gen == stream_generation(slot);
 
-  /* Fermeture du serveur */
-  if (close(server_socket) == -1)
+  switch (op)
     {
-      perror("Impossible de fermer le socket serveur");
-      exit(EXIT_FAILURE);
+    case OP_READ:
+      st->busy = false;
+
+      if (alive && cqe->res == -EAGAIN)
+	st->need_poll = true;
+      else if (alive && cqe->res != -ECANCELED)
+	stream_received(slot, stream, staging_data + (size_t) index * URING_BUFFER_SIZE,
+			cqe->res < 0 ? -1 : cqe->res);
+      break;
+
+    case OP_WRITE:
+      /* Si une fermeture est lie, on attend aussi sa compltion */
+      if (st->fd == -1)
+	st->busy = false;
+
+      if (alive && cqe->res == -EAGAIN)
+	st->need_poll = true;
+      else if (alive && cqe->res > 0)
+	stream_input_written(slot, cqe->res);
+      else if (alive && cqe->res != -ECANCELED)
+	{
+	  /* Le fils a ferm son entre : ce qui reste est perdu */
+	  const char *data;
+	  bool close_after;
+	  stream_input_written(slot, stream_input(slot, &data, &close_after));
+	}
+      break;
+
+    case OP_CLOSE:
+      st->busy = false;
+
+      if (cqe->res != -ECANCELED)
+	st->fd = -1;
+
+      /* criture incomplte : la fermeture a t annule, on recommence */
+      else if (!alive)
+	{
+	  close(st->fd);
+	  st->fd = -1;
+	}
+      break;
     }
-  
-  exit(EXIT_SUCCESS);
 }
 
+/**
+ * Boucle d'vnements du backend io_uring : toutes les oprations d'un
+ * tour sont soumises, et les compltions attendues, en un seul appel.
+ *
+ * @return EXIT_FAILURE si io_uring n'est pas disponible
+ */
+static int uring_loop()
+{
+  struct iovec iov[MAX_PROCESS * 3];
+
+  if (!uring_init(&ring, URING_ENTRIES))
+    return EXIT_FAILURE;
+
+  if ((staging_data = malloc(sizeof iov / sizeof iov[0] * URING_BUFFER_SIZE)) == NULL)
+    {
+      uring_exit(&ring);
+      return EXIT_FAILURE;
+    }
+
+  for (unsigned i = 0; i < sizeof iov / sizeof iov[0]; i++)
+    {
+      iov[i].iov_base = staging_data + (size_t) i * URING_BUFFER_SIZE;
+      iov[i].iov_len = URING_BUFFER_SIZE;
+      staging[i].fd = -1;
+    }
+
+  if (!uring_register_buffers(&ring, iov, sizeof iov / sizeof iov[0])
+      || !uring_setup_buf_ring(&ring, 0, URING_RECV_BUFFERS, URING_BUFFER_SIZE))
+    {
+      uring_exit(&ring);
+      free(staging_data);
+      return EXIT_FAILURE;
+    }
+
+  verbose("Backend io_uring actif\n");
+
+  for (;;)
+    {
+      struct io_uring_sqe *sqe;
+      struct io_uring_cqe *cqe;
+
+      reap_children();
+      cache_finished();
+      capture_flush();
+      publish_status();
+      dump_trace();
+      shaper_wait = -1;
+      sweep_processes();
+
+      /* Reexec une fois les oprations en cours termines */
+      if (reexec_pending && uring_quiesce())
+	{
+	  /* Entres dtaches dont la fermeture lie a t annule */
+	  for (unsigned index = 0; index < MAX_PROCESS * 3; index += 3)
+	    if (staging[index].fd != -1)
+	      {
+		stream_attach_input(index / 3, staging[index].fd);
+		staging[index].fd = -1;
+	      }
+
+	  for (unsigned i = 0; i < sizeof clients / sizeof clients[0]; i++)
+	    if (clients[i].socket != -1 && clients[i].closing)
+	      client_close_connection(clients + i);
+
+	  reexec();
+	  continue;
+	}
+
+      if (!reexec_pending)
+	{
+	  uring_arm_streams();
+	  uring_arm_clients();
+	}
+
+      if (!sigchld_armed && !reexec_pending && (sqe = uring_get_sqe(&ring)) != NULL)
+	{
+	  sqe->opcode = IORING_OP_POLL_ADD;
+	  sqe->fd = sigchld_pipe[0];
+	  sqe->poll32_events = POLLIN;
+	  sqe->user_data = op_data(OP_CHILD, 0, 0);
+	  sigchld_armed = true;
+	}
+
+      /* Des envois attendent des jetons, la rtention ou une acceptation : un rveil  temps */
+      if (shaper_wait != -1 && !timer_armed && (sqe = uring_get_sqe(&ring)) != NULL)
+	{
+	  timer_ts.tv_sec = shaper_wait / 1000;
+	  timer_ts.tv_nsec = (long long) (shaper_wait % 1000) * 1000000;
+	  sqe->opcode = IORING_OP_TIMEOUT;
+	  sqe->fd = -1;
+	  sqe->addr = (unsigned long) &timer_ts;
+	  sqe->len = 1;
+	  sqe->user_data = op_data(OP_TIMER, 0, 0);
+	  timer_armed = true;
+	}
+
+      TRACE_BEGIN(waiting, uring_wait, 0);
+      int ready = uring_submit_and_wait(&ring, 1);
+      TRACE_END(waiting, uring_wait, ready);
+      if (ready == -1 && errno != EINTR)
+	return EXIT_FAILURE;
+
+      while ((cqe = uring_peek_cqe(&ring)) != NULL)
+	{
+	  unsigned op = cqe->user_data >> 56;
+	  unsigned index = (cqe->user_data >> 32) & 0xffffff;
+	  unsigned gen = cqe->user_data & 0xffffffff;
+
+	  switch (op)
+	    {
+	    case OP_ACCEPT:
+	      accept_armed[index] = false;
+
+	      if (cqe->res == -ECANCELED)
+		break;
+	      else if (cqe->res < 0)
+		accept_failed(-cqe->res);
+	      else
+		{
+		  socketinfo_t *client = NULL;
+
+		  for (unsigned i = 0; i < sizeof clients / sizeof clients[0] && client == NULL; i++)
+		    if (clients[i].socket == -1)
+		      client = clients + i;
+
+		  /* Les deux sockets ont accept pour la dernire place */
+		  if (client == NULL)
+		    {
+		      close(cqe->res);
+		      break;
+		    }
+
+		  client->socket = cqe->res;
+		  client->local = index == 1;
+		  client->address = accept_address;
+		  accept_client(client);
+		}
+	      break;
+
+	    case OP_RECV:
+	    case OP_SEND:
+	      uring_client_done(op, clients + index, cqe);
+	      break;
+
+	    case OP_READ:
+	    case OP_WRITE:
+	    case OP_CLOSE:
+	      uring_stream_done(op, index, gen, cqe);
+	      break;
+
+	    case OP_CHILD:
+	      sigchld_armed = false;
+	      drain_sigchld();
+	      break;
+
+	    case OP_TIMER:
+	      timer_armed = false;
+	      break;
+	    }
+
+	  uring_cqe_seen(&ring);
+	}
+    }
+}
 
 /**
- * Fonction de callback appele lors d'un ctrl+c.
+ * Met en coute le socket local, par lequel les clients du mme hte
+ * peuvent recevoir des descripteurs (MapOutput).
+ *
+ * @return false en cas d'erreur
  */
-static void trap_ctrlc(int sig)
+static bool listen_local()
 {
-  sig = sig;                  /* Evite un warning */
-  shutdown_server();
+  struct sockaddr_un address;
+
+  if (strlen(local_path) >= sizeof address.sun_path)
+    {
+      fprintf(stderr, "Chemin du socket local trop long : %s\n", local_path);
+      return false;
+    }
+
+  memset(&address, 0, sizeof address);
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, local_path);
+
+  /* Un socket laiss par une excution prcdente */
+  unlink(local_path);
+
+  if ((local_socket = socket(PF_UNIX, SOCK_STREAM, 0)) == -1)
+    {
+      perror("socket");
+      return false;
+    }
+
+  if (fcntl(local_socket, F_SETFD, FD_CLOEXEC) == -1)
+    perror("fcntl");
+
+  if (bind(local_socket, (struct sockaddr *) &address, sizeof address) == -1
+      || listen(local_socket, MAX_CLIENT) == -1)
+    {
+      perror(local_path);
+      close(local_socket);
+      local_socket = -1;
+      return false;
+    }
+
+  return true;
 }
 
 /**
- * Point d'entre du programme.
+ * Met en coute le socket serveur, et le socket local s'il est demand.
+ *
+ * @return false en cas d'erreur
  */
-int main(int argc, char *argv[])
+static bool listen_server()
 {
-  parse_command_line(argc, argv);
-  
   /* On cre un socket pour se connecter sur un serveur */
   if ((server_socket = socket(PF_INET, SOCK_STREAM, 0)) == -1)
     {
       perror("socket");
-      return EXIT_FAILURE;
+      return false;
     }
-  
+
+  if (fcntl(server_socket, F_SETFD, FD_CLOEXEC) == -1)
+    perror("fcntl");
+
   /* Initialisation du bind */
   memset(&server_address, 0, sizeof server_address);
   server_address.sin_family = AF_INET;
@@ -572,42 +3702,103 @@ int main(int argc, char *argv[])
       perror("bind");
       if (close(server_socket) == -1)
 	perror("Impossible de fermer le socket serveur");
-      return EXIT_FAILURE;
+      return false;
     }
-  
+
   /* On le dfinit comme couteur */
   if (listen(server_socket, MAX_CLIENT) == -1)
     {
       perror("Impossible de mettre le socket serveur en coute");
       if (close(server_socket) == -1)
 	perror("Impossible de fermer le socket serveur");
-      return EXIT_FAILURE;
+      return false;
     }
-  
+
+  if (local_path != NULL && !listen_local())
+    {
+      if (close(server_socket) == -1)
+	perror("Impossible de fermer le socket serveur");
+      return false;
+    }
+
   verbose("Dmarrage du dmon sur le port %d ...\n", port);
-  
+  return true;
+}
+
+/**
+ * Point d'entre du programme.
+ */
+int main(int argc, char *argv[])
+{
+  saved_argv = argv;
+  parse_command_line(argc, argv);
+  cache_configure(cache_dir, cache_size);
+  pool_set_budget(output_budget);
+  bucket_init(&egress, egress_rate);
+  verbose("Descripteurs de fichiers : %u au plus\n", fd_raise_limit(fd_wanted, 0, FD_MOST));
+  if (trace_flag && !trace_enable(true))
+    return EXIT_FAILURE;
+
+  if (capture_path != NULL && !capture_open(capture_path))
+    return EXIT_FAILURE;
+
+  for (unsigned i = 0; i < sizeof clients / sizeof clients[0]; i++)
+    clients[i].socket = -1;
+
+  /* Aprs un Reexec, les sockets sont dj l */
+  if (resume_fd != -1)
+    {
+      if (!resume())
+	{
+	  fputs("tat de Reexec illisible\n", stderr);
+	  return EXIT_FAILURE;
+	}
+    }
+  else if (!listen_server())
+    return EXIT_FAILURE;
+
   /* Pour quitter le serveur proprement  */
   signal(SIGINT, trap_ctrlc);
-  
-  for (;;) {
-    
-    /* Variable concrte car il faut pouvoir en avoir l'adresse pour accept() */
-    socklen_t client_address_size = sizeof client_address;
-    
-    /* On attend une connection */
-    if ((client_socket = accept(server_socket, (struct sockaddr *) &client_address, &client_address_size)) == -1)
+
+  /* Un fils qui ferme son entre ne doit pas nous tuer */
+  signal(SIGPIPE, SIG_IGN);
+
+  /* La fin d'un fils rveille la boucle d'vnements */
+  if (pipe(sigchld_pipe) == -1
+      || fcntl(sigchld_pipe[0], F_SETFL, O_NONBLOCK) == -1
+      || fcntl(sigchld_pipe[1], F_SETFL, O_NONBLOCK) == -1
+      || fcntl(sigchld_pipe[0], F_SETFD, FD_CLOEXEC) == -1
+      || fcntl(sigchld_pipe[1], F_SETFD, FD_CLOEXEC) == -1)
+    {
+      perror("pipe");
+      return EXIT_FAILURE;
+    }
+  signal(SIGCHLD, trap_sigchld);
+  signal(SIGUSR2, trap_reexec);
+  signal(SIGUSR1, trap_trace);
+
+  /* Aprs un Reexec, la page d'tat garde ses compteurs */
+  if ((status_page = status_create(port, resume_fd != -1)) != NULL)
+    {
+      commands_processed = status_page->commands;
+      publish_status();
+    }
+
+  /* Les commandes reues aprs le Reexec, ou pendant */
+  for (unsigned i = 0; i < sizeof clients / sizeof clients[0]; i++)
+    if (clients[i].socket != -1 && !client_received(clients + i, 0))
       {
-	perror("accept");
-	if (close(server_socket) == -1)
-	  perror("Impossible de fermer le socket serveur");
-	return EXIT_FAILURE;
+	client_flush(clients + i);
+	client_close_connection(clients + i);
       }
-    
-    /* On traite ce client */
-    process_client();
-  }
-  
-  shutdown_server(); /* N'arrivera jamais */
-  
-  return EXIT_FAILURE;
+
+  if (uring_flag)
+    {
+      if (uring_loop() == EXIT_SUCCESS)
+	return EXIT_SUCCESS;
+
+      fputs("io_uring indisponible, utilisation de poll\n", stderr);
+    }
+
+  return poll_loop();
 }
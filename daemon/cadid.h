@@ -5,6 +5,14 @@
 
 #define MESSAGE_BUFFER_SIZE 1024  /* Taille maximale des messages transmis */
 #define MAX_ARGS 128 /* Nombre max d'args dans CreateProcess x1 x2 ... xn */
+#define MAX_CLIENT 16 /* Nombre de clients connects simultanment */
+#define ACCEPT_BACKOFF 100 /* ms sans accepter aprs un manque de descripteurs ou de mmoire */
+#define OUTPUT_HIGH_WATER (256 * 1024) /* Rponses en attente avant de ne plus lire le client */
+#define URING_ENTRIES 256 /* Taille de la file de soumission io_uring */
+#define URING_BUFFER_SIZE (16 * 1024) /* Taille des buffers enregistrs auprs du noyau */
+#define URING_RECV_BUFFERS 64 /* Nombre de buffers fournis pour les rceptions */
+#define FRAME_SIZE (16 * 1024) /* Taille maximale d'une trame de transfert */
+#define MAX_TRANSFERS 8 /* Transferts par trames simultans d'un client */
 
 /*
  * Type de la commande reue 
@@ -13,6 +21,7 @@
 #define MSG_ERR             1
 #define MSG_OK              2
 #define MSG_UNKNOWN_COMMAND 3
+#define MSG_WAIT            4 /* Rponse diffre (WaitGroup, WaitAny) */
 
 /*
  * Commandes
@@ -27,6 +36,36 @@
 #define CMD_QUIT            "Quit"
 #define CMD_GET_HELP        "Help"
 #define CMD_LIST_PROCESS    "ListProcess"
+#define CMD_DEFINE_TEMPLATE "DefineTemplate"
+#define CMD_RUN             "Run"
+#define CMD_GREP_OUTPUT     "GrepOutput"
+#define CMD_HEAD_OUTPUT     "HeadOutput"
+#define CMD_TAIL_OUTPUT     "TailOutput"
+#define CMD_LIST_CHANGES    "ListChanges"
+#define CMD_MAP_OUTPUT      "MapOutput"
+#define CMD_FRAMED          "Framed"
+#define CMD_DESTROY_GROUP   "DestroyGroup"
+#define CMD_WAIT_GROUP      "WaitGroup"
+#define CMD_WAIT_ANY        "WaitAny"
+#define CMD_LIST_GROUP      "ListGroup"
+#define CMD_COLLECT_GROUP_OUTPUT "CollectGroupOutput"
+#define CMD_REEXEC          "Reexec"
+#define CMD_STATS           "Stats"
+#define CMD_TRACE           "Trace"
+#define CMD_COMPRESS        "Compress"
+#define CMD_CREATE_PROCESS_BATCH "CreateProcessBatch"
+#define CMD_GRAPH_STATUS    "GraphStatus"
+
+/*
+ * Codec de compression des transferts (Compress), annonc par le
+ * message d'accueil : "Welcome ... [ hte ] [ lz ]"
+ */
+#define COMPRESS_LZ         "lz"
+#define COMPRESS_OFF        "off"
+
+/* Conditions de CreateProcess --after */
+#define AFTER_SUCCESS       "success"
+#define AFTER_ANY           "any"
 
 /*
  * Retour au client de sa commande 
@@ -39,13 +78,35 @@
  */
 #define DETAIL_RET_QUIT "QUIT"
 #define DETAIL_RET_DESTROY_PROCESS_SYNTAX CMD_DESTROY_PROCESS " <id>"
-#define DETAIL_RET_CREATE_PROCESS_SYNTAX  CMD_CREATE_PROCESS " <ligne de commande>"
+#define DETAIL_RET_CREATE_PROCESS_SYNTAX  CMD_CREATE_PROCESS " [options] <commande>"
+#define DETAIL_RET_TAG_OPTION             "--tag <groupe>"
+#define DETAIL_RET_CACHE_OPTIONS          "--cache [--stdin <f>] [--input <f>]"
+#define DETAIL_RET_AFTER_OPTION           "--after <id|groupe>[:" AFTER_SUCCESS "|:" AFTER_ANY "]"
+#define DETAIL_RET_REDIRECTIONS           "<f >f >>f 2>f 2>>f 2>&1"
 #define DETAIL_RET_SEND_INPUT_SYNTAX      CMD_SEND_INPUT " <id> <input>"
 #define DETAIL_RET_CLOSE_INPUT_SYNTAX     CMD_CLOSE_INPUT " <id>"
 #define DETAIL_RET_GET_OUTPUT_SYNTAX      CMD_GET_OUTPUT " <id>"
 #define DETAIL_RET_GET_ERROR_SYNTAX       CMD_GET_ERROR " <id>"
 #define DETAIL_RET_GET_RETURN_CODE_SYNTAX CMD_GET_RETURN_CODE " <id>"
-#define DETAIL_RET_LIST_PROCESS_SYNTAX    CMD_LIST_PROCESS
+#define DETAIL_RET_LIST_PROCESS_SYNTAX    CMD_LIST_PROCESS " [filtre] [dbut [n]]"
+#define DETAIL_RET_LIST_CHANGES_SYNTAX    CMD_LIST_CHANGES " <seq>"
+#define DETAIL_RET_DEFINE_TEMPLATE_SYNTAX CMD_DEFINE_TEMPLATE " <nom> <commande>"
+#define DETAIL_RET_RUN_SYNTAX             CMD_RUN " <nom> [args]"
+#define DETAIL_RET_GREP_OUTPUT_SYNTAX     CMD_GREP_OUTPUT " <id> <motif>"
+#define DETAIL_RET_HEAD_OUTPUT_SYNTAX     CMD_HEAD_OUTPUT " <id> <n>"
+#define DETAIL_RET_TAIL_OUTPUT_SYNTAX     CMD_TAIL_OUTPUT " <id> <n>"
+#define DETAIL_RET_MAP_OUTPUT_SYNTAX      CMD_MAP_OUTPUT " <id>"
+#define DETAIL_RET_FRAMED                 "FRAMED"
+#define DETAIL_RET_DESTROY_GROUP_SYNTAX   CMD_DESTROY_GROUP " <groupe>"
+#define DETAIL_RET_WAIT_GROUP_SYNTAX      CMD_WAIT_GROUP " <groupe>"
+#define DETAIL_RET_WAIT_ANY_SYNTAX        CMD_WAIT_ANY " <id> [id ...]"
+#define DETAIL_RET_LIST_GROUP_SYNTAX      CMD_LIST_GROUP " <groupe>"
+#define DETAIL_RET_COLLECT_GROUP_OUTPUT_SYNTAX CMD_COLLECT_GROUP_OUTPUT " <groupe>"
+#define DETAIL_RET_REEXEC                 "REEXEC"
+#define DETAIL_RET_TRACE_SYNTAX           CMD_TRACE " on|off|dump [fichier]"
+#define DETAIL_RET_COMPRESS_SYNTAX        CMD_COMPRESS " " COMPRESS_LZ "|" COMPRESS_OFF
+#define DETAIL_RET_CREATE_PROCESS_BATCH_SYNTAX CMD_CREATE_PROCESS_BATCH " <n> <commande>"
+#define DETAIL_RET_INSTANCE               "{i}"
 
 #define DETAIL_RET_CREATE_PROCESS_ERROR  "Impossible de crer le processus"
 #define DETAIL_RET_SEND_INPUT_ERROR      "Impossible d'envoyer sur l'entre standard du processus"
@@ -55,9 +116,33 @@
 #define DETAIL_RET_GET_RETURN_CODE_ERROR "Impossible de rcuprer le code de retour du processus"
 #define DETAIL_RET_PROCESS_TERMINATED    "Le processus a termin son excution"
 #define DETAIL_RET_INPUT_CLOSE           "L'entre standard du processus est ferme"
+#define DETAIL_RET_DEFINE_TEMPLATE_ERROR "Impossible de rsoudre l'excutable du modle"
+#define DETAIL_RET_GREP_OUTPUT_ERROR     "Expression rgulire invalide"
+#define DETAIL_RET_LIST_CHANGES_ERROR    "Historique insuffisant, relister les processus"
+#define DETAIL_RET_MAP_OUTPUT_ERROR      "Impossible de partager la sortie standard du processus"
+#define DETAIL_RET_MAP_OUTPUT_LOCAL      "Rserv aux clients connects par le socket local"
+#define DETAIL_RET_MAP_OUTPUT_BUSY       "Un descripteur est dj en cours d'envoi"
+#define DETAIL_RET_TRANSFERS_BUSY        "Trop de transferts en cours"
+#define DETAIL_RET_FD_BUDGET             "Plus assez de descripteurs de fichiers"
+#define DETAIL_RET_TRACE_ERROR           "Impossible d'crire la trace"
+#define DETAIL_RET_TRACE_DISABLED        "Le traceur n'est pas actif"
+#define DETAIL_RET_PROCESS_TABLE_FULL    "Table des processus pleine"
+#define DETAIL_RET_INSTANCE_TOO_LONG     "Commande trop longue une fois {i} remplac"
+#define DETAIL_RET_UNKNOWN_AFTER         "Dpendance inconnue, ou trop de dpendances"
+#define DETAIL_RET_WAIT_ERROR            "Impossible de mettre l'attente en place"
 
 #define DETAIL_RET_UNKNOWN_COMMAND "Commande inconnue"
 #define DETAIL_RET_UNKNOWN_PROCESS "PID inconnu"
+#define DETAIL_RET_UNKNOWN_TEMPLATE "Modle inconnu"
+#define DETAIL_RET_UNKNOWN_GROUP "Groupe inconnu"
+#define DETAIL_RET_UNKNOWN_FILTER "Filtre inconnu (all, running, exited)"
+
+/*
+ * Filtres de ListProcess
+ */
+#define FILTER_ALL     "all"
+#define FILTER_RUNNING "running"
+#define FILTER_EXITED  "exited"
 
 extern void send_basic(const int, const void *, unsigned);
 
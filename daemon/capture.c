@@ -0,0 +1,116 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+#include "cadid.h"
+
+/** Le fichier de capture, NULL si la capture est dsactive */
+static FILE *capture;
+
+/** La commande en cours de traitement, copie avant d'tre dcoupe */
+static char command[MESSAGE_BUFFER_SIZE];
+static uint64_t command_time;
+
+/**
+ * Heure de l'horloge monotone, en ns.
+ */
+static uint64_t now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Ouvre le fichier de capture. Il est complt s'il existe dj (par
+ * exemple aprs un Reexec) : l'horloge monotone continue.
+ *
+ * @return false en cas d'erreur
+ */
+bool capture_open(const char *path)
+{
+  /* "e" : close-on-exec, les processus lancs n'en hritent pas */
+  if ((capture = fopen(path, "abe")) == NULL)
+    {
+      perror(path);
+      return false;
+    }
+
+  if (ftell(capture) == 0)
+    fwrite(CAPTURE_MAGIC, strlen(CAPTURE_MAGIC), 1, capture);
+
+  return true;
+}
+
+bool capture_enabled()
+{
+  return capture != NULL;
+}
+
+/**
+ * Dbut du traitement d'une commande : parse_client_line la dcoupe, on
+ * la copie avant.
+ */
+void capture_begin(const char *line)
+{
+  if (capture == NULL)
+    return;
+
+  snprintf(command, sizeof command, "%s", line);
+  command_time = now();
+}
+
+/**
+ * Fin du traitement de la commande commence par capture_begin.
+ *
+ * @param conn numro de la connection
+ * @param reply dernire ligne de rponse envoye (avec son '\n'), ou NULL
+ */
+void capture_end(unsigned conn, const char *reply)
+{
+  capture_record_t rec;
+
+  if (capture == NULL || command[0] == '\0')
+    return;
+
+  if (reply == NULL)
+    reply = "";
+
+  rec.time = command_time;
+  rec.conn = conn;
+  rec.service = (now() - command_time) / 1000;
+  rec.cmd_len = strlen(command);
+  rec.reply_len = strcspn(reply, "\n");
+
+  if (fwrite(&rec, sizeof rec, 1, capture) != 1
+      || fwrite(command, rec.cmd_len, 1, capture) != 1
+      || (rec.reply_len > 0 && fwrite(reply, rec.reply_len, 1, capture) != 1))
+    {
+      perror("capture");
+      capture_close();
+    }
+}
+
+/**
+ * crit ce qui est en attente, une fois par tour de boucle.
+ */
+void capture_flush()
+{
+  if (capture != NULL && fflush(capture) == EOF)
+    {
+      perror("capture");
+      capture_close();
+    }
+}
+
+void capture_close()
+{
+  if (capture != NULL)
+    fclose(capture);
+  capture = NULL;
+}
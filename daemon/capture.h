@@ -0,0 +1,35 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Dbut d'un fichier de capture */
+#define CAPTURE_MAGIC "CADICAP1"
+
+/*
+ * Un fichier de capture (cadid -r) est CAPTURE_MAGIC suivi d'un
+ * enregistrement par commande traite, dans l'ordre de traitement :
+ * cette structure telle quelle, puis la commande (cmd_len octets), puis
+ * la ligne de rponse "OK ..." ou "ERR ..." sans son '\n' (reply_len
+ * octets). cadi-replay les rejoue.
+ */
+typedef struct
+{
+
+  uint64_t time;      /* Rception, en ns (CLOCK_MONOTONIC) */
+  uint32_t conn;      /* Numro de la connection, unique pour le dmon */
+  uint32_t service;   /* Temps de traitement par le dmon, en s */
+  uint16_t cmd_len;
+  uint16_t reply_len;
+
+} capture_record_t;
+
+extern bool capture_open(const char *);
+extern bool capture_enabled();
+extern void capture_begin(const char *);
+extern void capture_end(unsigned, const char *);
+extern void capture_flush();
+extern void capture_close();
+
+#endif
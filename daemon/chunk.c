@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "pool.h"
+
+/** Table des morceaux, par hash de leur contenu */
+static chunk_t *buckets[CHUNK_BUCKETS];
+
+/** Une valeur alatoire par octet, pour le hash roulant */
+static uint64_t gear[256];
+static bool gear_ready;
+
+static chunk_stats_t stats;
+
+/**
+ * Remplit la table du gear hash (splitmix64, graine fixe).
+ */
+static void gear_init()
+{
+  uint64_t x = 0x9e3779b97f4a7c15ULL;
+
+  for (unsigned i = 0; i < 256; i++)
+    {
+      uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      gear[i] = z ^ (z >> 31);
+    }
+
+  gear_ready = true;
+}
+
+/**
+ * Longueur du premier morceau de data. Le hash ne porte que sur les 64
+ * derniers octets : on le commence juste avant la taille minimale.
+ *
+ * @param len octets disponibles
+ * @return entre CHUNK_MIN_SIZE et CHUNK_MAX_SIZE, ou len s'il est plus petit
+ */
+size_t chunk_cut(const char *data, size_t len)
+{
+  const unsigned char *p = (const unsigned char *) data;
+  size_t limit = len < CHUNK_MAX_SIZE ? len : CHUNK_MAX_SIZE;
+  uint64_t hash = 0;
+
+  if (len <= CHUNK_MIN_SIZE)
+    return len;
+
+  if (!gear_ready)
+    gear_init();
+
+  for (size_t i = CHUNK_MIN_SIZE - 64; i < limit; i++)
+    {
+      hash = (hash << 1) + gear[p[i]];
+      if (i >= CHUNK_MIN_SIZE && hash >> (64 - CHUNK_BITS) == 0)
+	return i + 1;
+    }
+
+  return limit;
+}
+
+/**
+ * FNV-1a 64 bits.
+ */
+static unsigned long long fnv1a(const char *data, size_t len)
+{
+  unsigned long long hash = 0xcbf29ce484222325ULL;
+
+  while (len-- > 0)
+    {
+      hash ^= (unsigned char) *data++;
+      hash *= 0x100000001b3ULL;
+    }
+
+  return hash;
+}
+
+/**
+ * Retourne le morceau de contenu data, cr s'il n'existe pas encore, et
+ * en prend une rfrence.
+ *
+ * @return NULL si la mmoire manque
+ */
+chunk_t *chunk_get(const char *data, size_t len)
+{
+  unsigned long long hash = fnv1a(data, len);
+  chunk_t **bucket = buckets + hash % CHUNK_BUCKETS;
+  chunk_t *c;
+
+  for (c = *bucket; c != NULL; c = c->next)
+    if (c->hash == hash && c->len == len && !memcmp(c->data, data, len))
+      break;
+
+  if (c == NULL)
+    {
+      if ((c = malloc(sizeof *c)) == NULL)
+	return NULL;
+
+      c->cap = len;
+      if ((c->data = pool_alloc(&c->cap)) == NULL)
+	{
+	  free(c);
+	  return NULL;
+	}
+
+      memcpy(c->data, data, len);
+      c->hash = hash;
+      c->len = len;
+      c->refs = 0;
+      c->next = *bucket;
+      *bucket = c;
+
+      stats.chunks++;
+      stats.stored += c->cap;
+    }
+
+  if (++c->refs == 2)
+    stats.shared++;
+  stats.referenced += len;
+  return c;
+}
+
+/**
+ * Rend une rfrence sur un morceau, libr  la dernire.
+ */
+void chunk_put(chunk_t *chunk)
+{
+  stats.referenced -= chunk->len;
+  if (--chunk->refs == 1)
+    stats.shared--;
+  if (chunk->refs > 0)
+    return;
+
+  chunk_t **c = buckets + chunk->hash % CHUNK_BUCKETS;
+  while (*c != chunk)
+    c = &(*c)->next;
+  *c = chunk->next;
+
+  stats.chunks--;
+  stats.stored -= chunk->cap;
+  pool_free(chunk->data, chunk->cap);
+  free(chunk);
+}
+
+/**
+ * Occupation de la table des morceaux, pour Stats.
+ */
+void chunk_stats(chunk_stats_t *s)
+{
+  *s = stats;
+}
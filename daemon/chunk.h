@@ -0,0 +1,49 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Dcoupage des sorties selon leur contenu (gear hash) : une coupure
+ * tombe l o les CHUNK_BITS bits hauts du hash roulant sont nuls, soit
+ * un morceau de 8 Ko en moyenne au-del du minimum. Une diffrence ne
+ * dplace que les coupures voisines : le reste de deux sorties presque
+ * identiques tombe sur les mmes morceaux.
+ */
+#define CHUNK_MIN_SIZE 4096
+#define CHUNK_MAX_SIZE 65536
+#define CHUNK_BITS 13
+
+/* Cases de la table des morceaux */
+#define CHUNK_BUCKETS 4096
+
+/* Un morceau de sortie, partag par toutes les sorties qui le contiennent */
+typedef struct chunk
+{
+
+  struct chunk *next;     /* Suivant dans la mme case de la table */
+  unsigned long long hash;
+  size_t len;
+  size_t cap;             /* Taille servie par la pool */
+  unsigned refs;
+  char *data;
+
+} chunk_t;
+
+typedef struct
+{
+
+  unsigned chunks;        /* Morceaux distincts */
+  unsigned shared;        /* Dont ceux utiliss par plus d'une sortie */
+  size_t stored;          /* Octets qu'ils occupent (classes du pool comprises) */
+  size_t referenced;      /* Octets des sorties qui les utilisent */
+
+} chunk_stats_t;
+
+extern size_t chunk_cut(const char *, size_t);
+extern chunk_t *chunk_get(const char *, size_t);
+extern void chunk_put(chunk_t *);
+extern void chunk_stats(chunk_stats_t *);
+
+#endif
@@ -0,0 +1,109 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <dirent.h>
+#include <sys/resource.h>
+
+#include "fdlimit.h"
+
+/** Limite souple avant le dmarrage du dmon, rendue aux processus lancs */
+static struct rlimit original;
+
+/** Limite souple en vigueur */
+static unsigned limit;
+
+/** Descripteurs dont le dmon peut avoir besoin au plus, hors rserve */
+static unsigned needed;
+
+/**
+ * Relve la limite souple du nombre de descripteurs, sans dpasser la
+ * limite dure.
+ *
+ * @param wanted limite souhaite, 0 pour la limite dure
+ * @param before limite d'avant le dmarrage, 0 si c'est l'actuelle (un
+ * Reexec hrite de la limite dj releve)
+ * @param most descripteurs dont le dmon peut avoir besoin au plus : si
+ * la limite le permet, inutile de les compter
+ * @return la limite obtenue
+ */
+unsigned fd_raise_limit(unsigned wanted, unsigned before, unsigned most)
+{
+  struct rlimit rl;
+
+  needed = most;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+    {
+      perror("getrlimit");
+      return limit = 1024;
+    }
+
+  original = rl;
+  if (before != 0)
+    original.rlim_cur = before;
+
+  if (wanted == 0 || (rl.rlim_max != RLIM_INFINITY && wanted > rl.rlim_max))
+    rl.rlim_cur = rl.rlim_max;
+  else
+    rl.rlim_cur = wanted;
+
+  /* Sans limite dure, on garde une valeur raisonnable */
+  if (rl.rlim_cur == RLIM_INFINITY)
+    rl.rlim_cur = 1 << 20;
+
+  if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+    {
+      perror("setrlimit");
+      getrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+  return limit = rl.rlim_cur;
+}
+
+unsigned fd_original_limit()
+{
+  return original.rlim_cur;
+}
+
+/**
+ * Dans un fils : rend la limite d'avant le dmarrage, certains
+ * programmes parcourant tous les descripteurs possibles.
+ */
+void fd_restore_limit()
+{
+  if (original.rlim_cur != 0)
+    setrlimit(RLIMIT_NOFILE, &original);
+}
+
+unsigned fd_limit()
+{
+  return limit;
+}
+
+/**
+ * Compte les descripteurs ouverts par le dmon.
+ */
+unsigned fd_open_count()
+{
+  DIR *dir = opendir("/proc/self/fd");
+  unsigned n = 0;
+
+  if (dir == NULL)
+    return 0;
+
+  while (readdir(dir) != NULL)
+    n++;
+  closedir(dir);
+
+  /* ".", ".." et le descripteur du rpertoire lui-mme */
+  return n > 3 ? n - 3 : 0;
+}
+
+/**
+ * Reste-t-il n descripteurs, en plus de la rserve ? Ils ne sont compts
+ * que si la limite est trop basse pour tout ce que le dmon peut ouvrir.
+ */
+bool fd_available(unsigned n)
+{
+  return limit >= needed + FD_RESERVE || fd_open_count() + n + FD_RESERVE <= limit;
+}
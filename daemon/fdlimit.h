@@ -0,0 +1,25 @@
+#ifndef FDLIMIT_H
+#define FDLIMIT_H
+
+#include <stdbool.h>
+
+/*
+ * Budget de descripteurs de fichiers : la limite RLIMIT_NOFILE est
+ * releve au dmarrage, et les crations de processus et les
+ * acceptations de clients s'arrtent avant de l'atteindre.
+ */
+
+/* Descripteurs gards pour le reste du dmon (cache, capture, Reexec...) */
+#define FD_RESERVE 32
+
+/* Descripteurs ouverts par le dmon pour un processus, le temps du fork */
+#define FD_PER_PROCESS 6
+
+extern unsigned fd_raise_limit(unsigned, unsigned, unsigned);
+extern unsigned fd_original_limit();
+extern void fd_restore_limit();
+extern unsigned fd_limit();
+extern unsigned fd_open_count();
+extern bool fd_available(unsigned);
+
+#endif
@@ -0,0 +1,1016 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "libcadi.h"
+#include "cadid.h"
+#include "lz.h"
+
+/* tats d'une connection */
+#define CONN_DOWN       0 /* Ferme, rouverte  retry_at */
+#define CONN_CONNECTING 1 /* connect() en cours */
+#define CONN_WELCOME    2 /* Attend l'accueil */
+#define CONN_FRAMED     3 /* Framed envoy, attend sa rponse en clair */
+#define CONN_READY      4 /* Tout arrive en trames */
+#define CONN_CLOSED     5 /* Quitte, ou dmon sans Framed : n'est plus rouverte */
+
+/* Raisons d'chec d'une requte */
+#define LOST        "connection au dmon perdue"
+#define UNREACHABLE "dmon injoignable"
+#define UNKNOWN     "requte inconnue"
+
+/** Un texte extensible */
+typedef struct
+{
+
+  char *data;
+  size_t len;
+  size_t cap;
+
+} text_t;
+
+/** Une requte */
+typedef struct request
+{
+
+  struct request *next;
+  unsigned id;
+  char *cmd;            /* Termine par '\n' */
+  int conn;             /* Connection impose, -1 pour la moins charge */
+  bool stream;          /* GetOutput ou GetError : la sortie suit sur un canal */
+  bool blocking;        /* WaitAny ou WaitGroup : bloque la connection */
+  bool quit;
+  unsigned chan;        /* Canal de la sortie en cours de transfert */
+  cadi_reply_t reply;
+  cadi_data_t data;
+  void *arg;
+  text_t body;
+  cadi_result_t result;
+
+} request_t;
+
+/** Une file de requtes */
+typedef struct
+{
+
+  request_t *head;
+  request_t *tail;
+
+} queue_t;
+
+/** Une connection au dmon */
+typedef struct
+{
+
+  int socket;           /* -1 si ferme */
+  int state;
+  unsigned failures;    /* checs depuis la dernire ouverture russie */
+  char *error;          /* Pourquoi elle a t ferme, NULL une fois rouverte */
+  uint64_t retry_at;    /* En ms */
+  text_t raw;           /* Reu, pas encore dcoup en trames */
+  text_t out;           /* Pas encore envoy */
+  unsigned skip;        /* Rponse  Compress,  sauter */
+  bool quit;            /* Quit envoy : ne sera pas rouverte */
+  queue_t sent;         /* Envoyes, leurs rponses arriveront dans cet ordre */
+  queue_t streams;      /* Sorties en cours de transfert */
+  unsigned pending;     /* Requtes envoyes pas encore termines */
+  unsigned blocking;    /* Dont WaitAny et WaitGroup */
+
+} conn_t;
+
+struct cadi_pool
+{
+
+  struct sockaddr_in address;
+  int flags;
+  conn_t **conns;
+  unsigned nconns;
+  unsigned last_id;
+  queue_t queue;        /* Pas encore confies  une connection */
+  queue_t done;         /* Termines sans rappel, en attente de cadi_wait */
+  char *welcome;
+  bool busy;            /* Dans cadi_events : les envois attendent la fin */
+
+};
+
+/**
+ * Heure de l'horloge monotone, en ms.
+ */
+static uint64_t now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool text_append(text_t *text, const void *data, size_t len)
+{
+  if (text->len + len + 1 > text->cap)
+    {
+      size_t cap = text->cap ? text->cap : MESSAGE_BUFFER_SIZE;
+      while (cap < text->len + len + 1)
+	cap *= 2;
+
+      char *p = realloc(text->data, cap);
+      if (p == NULL)
+	return false;
+
+      text->data = p;
+      text->cap = cap;
+    }
+
+  memcpy(text->data + text->len, data, len);
+  text->len += len;
+  text->data[text->len] = '\0';
+  return true;
+}
+
+/**
+ * Retire les n premiers octets d'un texte.
+ */
+static void text_consume(text_t *text, size_t n)
+{
+  memmove(text->data, text->data + n, text->len - n);
+  text->len -= n;
+  text->data[text->len] = '\0';
+}
+
+static void text_free(text_t *text)
+{
+  free(text->data);
+  memset(text, 0, sizeof *text);
+}
+
+static void queue_push(queue_t *queue, request_t *r)
+{
+  r->next = NULL;
+  if (queue->tail != NULL)
+    queue->tail->next = r;
+  else
+    queue->head = r;
+  queue->tail = r;
+}
+
+static request_t *queue_pop(queue_t *queue)
+{
+  request_t *r = queue->head;
+
+  if (r != NULL && (queue->head = r->next) == NULL)
+    queue->tail = NULL;
+  return r;
+}
+
+/**
+ * Retire une requte d'une file, prev tant celle qui la prcde (NULL
+ * en tte).
+ */
+static void queue_remove(queue_t *queue, request_t *prev, request_t *r)
+{
+  if (prev != NULL)
+    prev->next = r->next;
+  else
+    queue->head = r->next;
+  if (queue->tail == r)
+    queue->tail = prev;
+}
+
+/**
+ * Vrai si la commande commence par le mot name.
+ */
+static bool is_command(const char *cmd, const char *name)
+{
+  size_t n = strlen(name);
+  return !strncmp(cmd, name, n) && (cmd[n] == ' ' || cmd[n] == '\0');
+}
+
+static void request_free(request_t *r)
+{
+  free(r->cmd);
+  text_free(&r->body);
+  cadi_result_free(&r->result);
+  free(r);
+}
+
+/**
+ * Termine une requte : appelle son rappel, ou la garde pour cadi_wait.
+ */
+static void finish(cadi_pool_t *pool, request_t *r)
+{
+  if (r->result.reply == NULL)
+    r->result.reply = strdup("");
+  r->result.body = r->body.data != NULL ? r->body.data : strdup("");
+  r->result.body_len = r->body.len;
+  memset(&r->body, 0, sizeof r->body);
+
+  free(r->cmd);
+  r->cmd = NULL;
+
+  if (r->reply == NULL)
+    {
+      queue_push(&pool->done, r);
+      return;
+    }
+
+  r->reply(r->arg, r->id, &r->result);
+  request_free(r);
+}
+
+/**
+ * Fait chouer une requte.
+ */
+static void fail(cadi_pool_t *pool, request_t *r, const char *reason)
+{
+  r->result.ok = false;
+  free(r->result.reply);
+  r->result.reply = strdup(reason);
+  text_free(&r->body);
+  finish(pool, r);
+}
+
+/**
+ * Ferme une connection et fait chouer ses requtes envoyes : elles
+ * ne sont pas renvoyes, une commande pouvant avoir eu lieu. La
+ * connection est rouverte plus tard, sauf si closed.
+ */
+static void conn_lost(cadi_pool_t *pool, conn_t *c, const char *reason, bool closed)
+{
+  queue_t sent = c->sent, streams = c->streams;
+  request_t *r;
+
+  if (c->socket != -1)
+    close(c->socket);
+  c->socket = -1;
+
+  /* Quit ferme normalement la connection */
+  free(c->error);
+  c->error = c->quit ? NULL : strdup(reason);
+
+  unsigned shift = c->failures < CADI_RETRY_MAX_SHIFT ? c->failures : CADI_RETRY_MAX_SHIFT;
+  c->state = closed || c->quit ? CONN_CLOSED : CONN_DOWN;
+  c->retry_at = now() + ((uint64_t) CADI_RETRY_MS << shift);
+  c->failures++;
+  c->raw.len = c->out.len = 0;
+  c->skip = c->pending = c->blocking = 0;
+  memset(&c->sent, 0, sizeof c->sent);
+  memset(&c->streams, 0, sizeof c->streams);
+
+  /* Les rappels peuvent envoyer d'autres requtes : la connection est dj ferme */
+  while ((r = queue_pop(&sent)) != NULL)
+    fail(pool, r, reason);
+  while ((r = queue_pop(&streams)) != NULL)
+    fail(pool, r, reason);
+}
+
+/**
+ * Ouvre (sans attendre) une connection sur le dmon.
+ */
+static void conn_open(cadi_pool_t *pool, conn_t *c)
+{
+  if ((c->socket = socket(PF_INET, SOCK_STREAM, 0)) == -1
+      || fcntl(c->socket, F_SETFD, FD_CLOEXEC) == -1
+      || fcntl(c->socket, F_SETFL, O_NONBLOCK) == -1)
+    {
+      conn_lost(pool, c, strerror(errno), false);
+      return;
+    }
+
+  c->quit = false;
+  if (connect(c->socket, (struct sockaddr *) &pool->address, sizeof pool->address) == 0)
+    c->state = CONN_WELCOME;
+  else if (errno == EINPROGRESS)
+    c->state = CONN_CONNECTING;
+  else
+    conn_lost(pool, c, strerror(errno), false);
+}
+
+/**
+ * Envoie ce qui peut l'tre sans bloquer.
+ */
+static void conn_flush(cadi_pool_t *pool, conn_t *c)
+{
+  while (c->out.len > 0 && c->socket != -1 && c->state != CONN_CONNECTING)
+    {
+      ssize_t n = send(c->socket, c->out.data, c->out.len, MSG_NOSIGNAL);
+      if (n == -1)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  if (errno != EAGAIN && errno != EWOULDBLOCK)
+	    conn_lost(pool, c, LOST, false);
+	  return;
+	}
+      text_consume(&c->out, n);
+    }
+}
+
+/**
+ * Vrai si une connection peut recevoir des requtes (Framed dj parti).
+ */
+static bool conn_accepts(const conn_t *c)
+{
+  return (c->state == CONN_FRAMED || c->state == CONN_READY) && !c->quit;
+}
+
+/**
+ * Vrai si une connection ne recevra plus de requtes avant longtemps.
+ */
+static bool conn_hopeless(const conn_t *c)
+{
+  return c->state == CONN_CLOSED || (c->state == CONN_DOWN && c->failures >= CADI_MAX_FAILURES);
+}
+
+/**
+ * Confie les requtes en attente aux connections : la moins charge,
+ * une connection bloque par une attente ne servant qu'en dernier
+ * recours, ou celle impose. Celles qu'aucune connection ne pourra
+ * prendre chouent.
+ */
+static void dispatch(cadi_pool_t *pool)
+{
+  queue_t failed = { NULL, NULL };
+  request_t *prev = NULL, *r = pool->queue.head;
+
+  while (r != NULL)
+    {
+      request_t *next = r->next;
+      conn_t *best = NULL;
+      bool hopeless = true;
+
+      for (unsigned i = 0; i < pool->nconns; i++)
+	{
+	  conn_t *c = pool->conns[i];
+
+	  if (r->conn >= 0 && (unsigned) r->conn != i)
+	    continue;
+	  if (!conn_hopeless(c))
+	    hopeless = false;
+	  if (!conn_accepts(c))
+	    continue;
+	  if (best == NULL || (c->blocking > 0) < (best->blocking > 0)
+	      || ((c->blocking > 0) == (best->blocking > 0) && c->pending < best->pending))
+	    best = c;
+	}
+
+      if (best != NULL || hopeless)
+	{
+	  queue_remove(&pool->queue, prev, r);
+	  if (best == NULL)
+	    queue_push(&failed, r);
+	  else
+	    {
+	      if (!text_append(&best->out, r->cmd, strlen(r->cmd)))
+		queue_push(&failed, r);
+	      else
+		{
+		  queue_push(&best->sent, r);
+		  best->pending++;
+		  best->blocking += r->blocking;
+		  best->quit |= r->quit;
+		}
+	    }
+	}
+      else
+	prev = r;
+
+      r = next;
+    }
+
+  if (!pool->busy)
+    for (unsigned i = 0; i < pool->nconns; i++)
+      conn_flush(pool, pool->conns[i]);
+
+  while ((r = queue_pop(&failed)) != NULL)
+    fail(pool, r, UNREACHABLE);
+}
+
+/**
+ * Une rponse complte est arrive (une trame du canal 0) : elle
+ * termine la plus ancienne requte envoye, ou lui ouvre le canal de sa
+ * sortie.
+ */
+static void conn_reply(cadi_pool_t *pool, conn_t *c, const char *text, size_t len)
+{
+  request_t *r = queue_pop(&c->sent);
+  const char *line = text, *p;
+
+  if (r == NULL)
+    return;
+
+  /* La dernire ligne est OK ou ERR, les prcdentes font le corps */
+  while (len > 0 && text[len - 1] == '\n')
+    len--;
+  for (p = text; (p = memchr(p, '\n', text + len - p)) != NULL; p++)
+    line = p + 1;
+
+  /* Une ligne blanche n'a pas de rponse */
+  r->result.ok = len == 0 || !strncmp(line, "OK", 2);
+  p = line + (r->result.ok ? 2 : 3);
+  if (p > text + len)
+    p = text + len;
+  if (p < text + len && *p == ' ')
+    p++;
+  r->result.reply = strndup(p, text + len - p);
+  text_append(&r->body, text, line - text);
+
+  /* GetOutput/GetError : la sortie suit sur le canal donn */
+  if (r->stream && r->result.ok && (r->chan = atoi(r->result.reply)) > 0)
+    {
+      queue_push(&c->streams, r);
+      return;
+    }
+
+  c->pending--;
+  c->blocking -= r->blocking;
+  finish(pool, r);
+}
+
+/**
+ * Une trame d'une sortie est arrive ; la trame vide termine la requte.
+ */
+static void conn_stream(cadi_pool_t *pool, conn_t *c, unsigned chan, const char *data, size_t len)
+{
+  request_t *prev = NULL, *r;
+
+  for (r = c->streams.head; r != NULL && r->chan != chan; r = r->next)
+    prev = r;
+  if (r == NULL)
+    return;
+
+  if (len > 0)
+    {
+      if (r->data != NULL)
+	r->data(r->arg, r->id, data, len);
+      else
+	text_append(&r->body, data, len);
+      return;
+    }
+
+  queue_remove(&c->streams, prev, r);
+  c->pending--;
+  if (r->data != NULL)
+    r->data(r->arg, r->id, "", 0);
+  finish(pool, r);
+}
+
+/**
+ * Dcoupe ce qui a t reu en trames.
+ */
+static void conn_frames(cadi_pool_t *pool, conn_t *c)
+{
+  while (c->state == CONN_READY)
+    {
+      char *eol = memchr(c->raw.data, '\n', c->raw.len);
+      unsigned chan;
+      unsigned long len, orig_len = 0;
+      int end = 0;
+
+      if (eol == NULL)
+	{
+	  if (c->raw.len > 64)
+	    conn_lost(pool, c, "trame invalide", false);
+	  return;
+	}
+
+      /* Une trame compresse donne aussi sa taille d'origine */
+      if (sscanf(c->raw.data, "%u %lu%n", &chan, &len, &end) != 2
+	  || (chan != 0 && len > FRAME_SIZE)
+	  || (c->raw.data[end] == ' ' && (sscanf(c->raw.data + end, "%lu", &orig_len) != 1
+					  || orig_len > FRAME_SIZE)))
+	{
+	  conn_lost(pool, c, "trame invalide", false);
+	  return;
+	}
+
+      size_t header = eol + 1 - c->raw.data;
+      if (c->raw.len - header < len)
+	return;
+
+      /* Une sortie est copie : les rappels peuvent faire arriver autre chose */
+      char block[FRAME_SIZE];
+      const char *data = c->raw.data + header;
+      size_t data_len = len;
+
+      if (orig_len > 0)
+	{
+	  if (lz_decompress(data, len, block, orig_len) != (long) orig_len)
+	    {
+	      conn_lost(pool, c, "trame compresse invalide", false);
+	      return;
+	    }
+	  data = block;
+	  data_len = orig_len;
+	}
+      else if (chan != 0)
+	data = memcpy(block, data, len);
+
+      /* Le canal 0 porte une rponse par trame */
+      if (chan == 0 && c->skip > 0)
+	{
+	  c->skip--;
+	  text_consume(&c->raw, header + len);
+	}
+      else if (chan == 0)
+	{
+	  /* La rponse est copie avant les rappels, qui peuvent fermer la connection */
+	  char *text = malloc(data_len + 1);
+	  if (text != NULL)
+	    {
+	      memcpy(text, data, data_len);
+	      text[data_len] = '\0';
+	    }
+	  text_consume(&c->raw, header + len);
+	  if (text == NULL)
+	    {
+	      conn_lost(pool, c, LOST, false);
+	      return;
+	    }
+	  conn_reply(pool, c, text, data_len);
+	  free(text);
+	}
+      else
+	{
+	  text_consume(&c->raw, header + len);
+	  conn_stream(pool, c, chan, data, data_len);
+	}
+    }
+}
+
+/**
+ * Traite ce qui a t reu, selon l'tat de la connection.
+ */
+static void conn_parse(cadi_pool_t *pool, conn_t *c)
+{
+  char *p;
+
+  /* Accueil, puis passage en trames (et compression si le dmon la propose) */
+  if (c->state == CONN_WELCOME)
+    {
+      if ((p = memmem(c->raw.data, c->raw.len, "\n$ ", 3)) == NULL)
+	return;
+
+      free(pool->welcome);
+      pool->welcome = strndup(c->raw.data, p - c->raw.data);
+      text_consume(&c->raw, p + 3 - c->raw.data);
+
+      bool compress = (pool->flags & CADI_COMPRESS) && pool->welcome != NULL
+	&& strstr(pool->welcome, "[ " COMPRESS_LZ " ]") != NULL;
+      const char *cmd = compress ? CMD_FRAMED "\n" CMD_COMPRESS " " COMPRESS_LZ "\n" : CMD_FRAMED "\n";
+
+      text_append(&c->out, cmd, strlen(cmd));
+      c->skip = compress ? 1 : 0;
+      c->state = CONN_FRAMED;
+    }
+
+  /* La rponse  Framed est encore en clair */
+  if (c->state == CONN_FRAMED)
+    {
+      if ((p = memchr(c->raw.data, '\n', c->raw.len)) == NULL)
+	return;
+
+      *p = '\0';
+      if (strcmp(c->raw.data, "OK " DETAIL_RET_FRAMED))
+	{
+	  char reason[MESSAGE_BUFFER_SIZE];
+	  snprintf(reason, sizeof reason, "%s", c->raw.data);
+	  conn_lost(pool, c, reason, true);
+	  return;
+	}
+
+      text_consume(&c->raw, p + 1 - c->raw.data);
+      c->state = CONN_READY;
+      c->failures = 0;
+      free(c->error);
+      c->error = NULL;
+    }
+
+  conn_frames(pool, c);
+}
+
+/**
+ * Lit ce que le dmon a envoy sur une connection.
+ */
+static void conn_read(cadi_pool_t *pool, conn_t *c)
+{
+  char buffer[FRAME_SIZE * 4];
+  ssize_t n = read(c->socket, buffer, sizeof buffer);
+
+  if (n == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+    return;
+
+  if (n <= 0)
+    {
+      conn_lost(pool, c, LOST, false);
+      return;
+    }
+
+  if (!text_append(&c->raw, buffer, n))
+    {
+      conn_lost(pool, c, LOST, false);
+      return;
+    }
+  conn_parse(pool, c);
+}
+
+/**
+ * Cre un ensemble de connections au dmon. Elles s'ouvrent sans
+ * attendre ; les requtes envoyes entre-temps partent  l'ouverture.
+ *
+ * @param addr adresse du dmon
+ * @param port son port
+ * @param n nombre de connections
+ * @param flags CADI_COMPRESS ou 0
+ * @return l'ensemble, NULL si la mmoire manque
+ */
+cadi_pool_t *cadi_open(in_addr_t addr, unsigned port, unsigned n, int flags)
+{
+  cadi_pool_t *pool = calloc(1, sizeof *pool);
+
+  if (pool == NULL)
+    return NULL;
+
+  pool->address.sin_family = AF_INET;
+  pool->address.sin_addr.s_addr = addr;
+  pool->address.sin_port = htons(port);
+  pool->flags = flags;
+
+  while (n-- > 0)
+    if (cadi_connect(pool) == -1)
+      {
+	cadi_close(pool);
+	return NULL;
+      }
+
+  return pool;
+}
+
+/**
+ * Ajoute une connection  l'ensemble.
+ *
+ * @return son numro, pour cadi_send_on, -1 si la mmoire manque
+ */
+int cadi_connect(cadi_pool_t *pool)
+{
+  conn_t **bigger = realloc(pool->conns, (pool->nconns + 1) * sizeof *pool->conns);
+  if (bigger == NULL)
+    return -1;
+  pool->conns = bigger;
+
+  conn_t *c = calloc(1, sizeof *c);
+  if (c == NULL)
+    return -1;
+  c->socket = -1;
+  pool->conns[pool->nconns] = c;
+
+  conn_open(pool, c);
+  return pool->nconns++;
+}
+
+/**
+ * Ferme toutes les connections ; les requtes en cours sont abandonnes
+ * sans appeler leurs rappels.
+ */
+void cadi_close(cadi_pool_t *pool)
+{
+  request_t *r;
+
+  for (unsigned i = 0; i < pool->nconns; i++)
+    {
+      conn_t *c = pool->conns[i];
+
+      if (c->socket != -1)
+	close(c->socket);
+      while ((r = queue_pop(&c->sent)) != NULL)
+	request_free(r);
+      while ((r = queue_pop(&c->streams)) != NULL)
+	request_free(r);
+      text_free(&c->raw);
+      text_free(&c->out);
+      free(c->error);
+      free(c);
+    }
+
+  while ((r = queue_pop(&pool->queue)) != NULL)
+    request_free(r);
+  while ((r = queue_pop(&pool->done)) != NULL)
+    request_free(r);
+
+  free(pool->conns);
+  free(pool->welcome);
+  free(pool);
+}
+
+/**
+ * Envoie une commande sur une connection donne : utile quand l'ordre
+ * des commandes compte, ou pour y garder un tat (Compress).
+ *
+ * @param conn numro de la connection, -1 pour la moins charge
+ * @param cmd la commande, sans '\n'
+ * @param reply appel  la fin de la requte, NULL pour cadi_wait
+ * @param data reoit la sortie de GetOutput/GetError au fil de l'eau,
+ * NULL pour la trouver dans le corps du rsultat
+ * @param arg pass aux rappels
+ * @return le numro de la requte, 0 si la mmoire manque
+ */
+unsigned cadi_send_on(cadi_pool_t *pool, int conn, const char *cmd, cadi_reply_t reply,
+		      cadi_data_t data, void *arg)
+{
+  request_t *r = calloc(1, sizeof *r);
+  size_t len = strlen(cmd);
+
+  if (r == NULL || (r->cmd = malloc(len + 2)) == NULL)
+    {
+      free(r);
+      return 0;
+    }
+
+  memcpy(r->cmd, cmd, len);
+  strcpy(r->cmd + len, "\n");
+  if (++pool->last_id == 0)
+    pool->last_id = 1;
+  r->id = pool->last_id;
+  r->conn = conn;
+  r->stream = is_command(cmd, CMD_GET_OUTPUT) || is_command(cmd, CMD_GET_ERROR);
+  r->blocking = is_command(cmd, CMD_WAIT_ANY) || is_command(cmd, CMD_WAIT_GROUP);
+  r->quit = is_command(cmd, CMD_QUIT);
+  r->reply = reply;
+  r->data = data;
+  r->arg = arg;
+
+  /* Une connection qui a renonc retente tout de suite ; un nouvel chec fera chouer la requte */
+  for (unsigned i = 0; i < pool->nconns; i++)
+    {
+      conn_t *c = pool->conns[i];
+
+      if ((conn < 0 || (unsigned) conn == i) && c->state == CONN_DOWN
+	  && c->failures >= CADI_MAX_FAILURES)
+	{
+	  c->failures = CADI_MAX_FAILURES - 1;
+	  c->retry_at = now();
+	}
+    }
+
+  queue_push(&pool->queue, r);
+  dispatch(pool);
+  return r->id;
+}
+
+/**
+ * Envoie une commande sur la connection la moins charge.
+ *
+ * @see cadi_send_on
+ */
+unsigned cadi_send(cadi_pool_t *pool, const char *cmd, cadi_reply_t reply, cadi_data_t data,
+		   void *arg)
+{
+  return cadi_send_on(pool, -1, cmd, reply, data, arg);
+}
+
+/**
+ * Vrai si une requte n'est pas encore termine.
+ */
+static bool in_flight(const cadi_pool_t *pool, unsigned id)
+{
+  const request_t *r;
+
+  for (r = pool->queue.head; r != NULL; r = r->next)
+    if (r->id == id)
+      return true;
+
+  for (unsigned i = 0; i < pool->nconns; i++)
+    {
+      for (r = pool->conns[i]->sent.head; r != NULL; r = r->next)
+	if (r->id == id)
+	  return true;
+      for (r = pool->conns[i]->streams.head; r != NULL; r = r->next)
+	if (r->id == id)
+	  return true;
+    }
+
+  return false;
+}
+
+/**
+ * Attend la fin d'une requte envoye sans rappel.
+ *
+ * @param result reoit le rsultat,  librer par cadi_result_free
+ * @return result->ok
+ */
+bool cadi_wait(cadi_pool_t *pool, unsigned id, cadi_result_t *result)
+{
+  for (;;)
+    {
+      request_t *prev = NULL, *r;
+
+      for (r = pool->done.head; r != NULL && r->id != id; r = r->next)
+	prev = r;
+
+      if (r != NULL)
+	{
+	  queue_remove(&pool->done, prev, r);
+	  *result = r->result;
+	  memset(&r->result, 0, sizeof r->result);
+	  request_free(r);
+	  return result->ok;
+	}
+
+      if (!in_flight(pool, id))
+	{
+	  result->ok = false;
+	  result->reply = strdup(UNKNOWN);
+	  result->body = strdup("");
+	  result->body_len = 0;
+	  return false;
+	}
+
+      cadi_poll(pool, -1);
+    }
+}
+
+void cadi_result_free(cadi_result_t *result)
+{
+  free(result->reply);
+  free(result->body);
+  memset(result, 0, sizeof *result);
+}
+
+/**
+ * Donne les descripteurs  surveiller, pour une boucle poll() externe.
+ *
+ * @param max taille de fds
+ * @return le nombre de descripteurs remplis
+ */
+unsigned cadi_pollfds(cadi_pool_t *pool, struct pollfd *fds, unsigned max)
+{
+  unsigned n = 0;
+
+  for (unsigned i = 0; i < pool->nconns && n < max; i++)
+    {
+      conn_t *c = pool->conns[i];
+
+      if (c->socket == -1)
+	continue;
+
+      fds[n].fd = c->socket;
+      fds[n].events = c->state == CONN_CONNECTING ? POLLOUT
+	: POLLIN | (c->out.len > 0 ? POLLOUT : 0);
+      fds[n].revents = 0;
+      n++;
+    }
+
+  return n;
+}
+
+/**
+ * Dlai avant la prochaine rouverture d'une connection.
+ *
+ * @return en ms, -1 s'il n'y en a pas
+ */
+int cadi_timeout(const cadi_pool_t *pool)
+{
+  uint64_t t = now();
+  int timeout = -1;
+
+  for (unsigned i = 0; i < pool->nconns; i++)
+    {
+      const conn_t *c = pool->conns[i];
+
+      if (c->state != CONN_DOWN)
+	continue;
+
+      int delay = c->retry_at > t ? (int) (c->retry_at - t) : 0;
+      if (timeout == -1 || delay < timeout)
+	timeout = delay;
+    }
+
+  return timeout;
+}
+
+/**
+ * Traite les vnements rendus par poll() sur les descripteurs de
+ * cadi_pollfds, puis rouvre les connections dont le dlai est pass.
+ * Les rappels sont appels d'ici.
+ */
+void cadi_events(cadi_pool_t *pool, const struct pollfd *fds, unsigned n)
+{
+  pool->busy = true;
+
+  for (unsigned j = 0; j < n; j++)
+    for (unsigned i = 0; i < pool->nconns && fds[j].revents; i++)
+      {
+	conn_t *c = pool->conns[i];
+
+	if (c->socket != fds[j].fd)
+	  continue;
+
+	if (c->state == CONN_CONNECTING)
+	  {
+	    int err = 0;
+	    socklen_t len = sizeof err;
+
+	    if (getsockopt(c->socket, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+	      err = errno;
+	    if (err != 0)
+	      conn_lost(pool, c, strerror(err), false);
+	    else
+	      c->state = CONN_WELCOME;
+	    break;
+	  }
+
+	if (fds[j].revents & (POLLIN | POLLHUP | POLLERR))
+	  conn_read(pool, c);
+	break;
+      }
+
+  uint64_t t = now();
+  for (unsigned i = 0; i < pool->nconns; i++)
+    if (pool->conns[i]->state == CONN_DOWN && pool->conns[i]->retry_at <= t)
+      conn_open(pool, pool->conns[i]);
+
+  pool->busy = false;
+  dispatch(pool);
+}
+
+/**
+ * Un tour de boucle : attend au plus timeout ms un vnement et le
+ * traite.
+ *
+ * @return le nombre de requtes pas encore termines
+ */
+int cadi_poll(cadi_pool_t *pool, int timeout)
+{
+  struct pollfd fds[pool->nconns + 1];
+  unsigned n = cadi_pollfds(pool, fds, pool->nconns);
+  int delay = cadi_timeout(pool);
+
+  if (delay >= 0 && (timeout < 0 || delay < timeout))
+    timeout = delay;
+
+  if (poll(fds, n, timeout) == -1 && errno != EINTR)
+    return -1;
+  cadi_events(pool, fds, n);
+
+  return cadi_pending(pool);
+}
+
+/**
+ * Nombre de requtes pas encore termines (celles gardes pour
+ * cadi_wait ne comptent plus).
+ */
+unsigned cadi_pending(const cadi_pool_t *pool)
+{
+  unsigned pending = 0;
+
+  for (const request_t *r = pool->queue.head; r != NULL; r = r->next)
+    pending++;
+  for (unsigned i = 0; i < pool->nconns; i++)
+    pending += pool->conns[i]->pending;
+
+  return pending;
+}
+
+/**
+ * Nombre de connections passes en trames.
+ *
+ * @param conn numro d'une connection, -1 pour toutes
+ */
+unsigned cadi_ready(const cadi_pool_t *pool, int conn)
+{
+  unsigned n = 0;
+
+  for (unsigned i = 0; i < pool->nconns; i++)
+    if ((conn < 0 || (unsigned) conn == i) && pool->conns[i]->state == CONN_READY)
+      n++;
+
+  return n;
+}
+
+/**
+ * Le message d'accueil du dmon, "" avant la premire connection.
+ */
+const char *cadi_welcome(const cadi_pool_t *pool)
+{
+  return pool->welcome != NULL ? pool->welcome : "";
+}
+
+/**
+ * Pourquoi une connection s'est ferme, tant qu'elle n'a pas t rouverte.
+ *
+ * @param conn numro d'une connection, -1 pour la premire en erreur
+ * @return NULL si elle n'a pas chou depuis sa dernire ouverture, ou a t quitte
+ */
+const char *cadi_error(const cadi_pool_t *pool, int conn)
+{
+  for (unsigned i = 0; i < pool->nconns; i++)
+    if ((conn < 0 || (unsigned) conn == i) && pool->conns[i]->error != NULL)
+      return pool->conns[i]->error;
+
+  return NULL;
+}
@@ -0,0 +1,72 @@
+#ifndef LIBCADI_H
+#define LIBCADI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <poll.h>
+#include <netinet/in.h>
+
+/*
+ * libcadi : accs asynchrone  cadid, par un ensemble de connections.
+ *
+ * Chaque connection passe en mode Framed ds l'accueil. Les commandes y
+ * sont envoyes  la suite, sans attendre les rponses : le dmon
+ * rpondant dans l'ordre, chaque trame du canal 0, qui porte une
+ * rponse entire, revient  la plus ancienne requte envoye. Une
+ * requte est identifie par un numro donn  l'envoi ; sa fin appelle
+ * son rappel, ou, sans rappel, attend d'tre lue par cadi_wait.
+ *
+ * GetOutput et GetError rpondent par un canal : la sortie arrive par
+ * trames sur ce canal et la requte ne se termine qu'avec lui. Une
+ * connection perdue fait chouer ses requtes envoyes ; elle est
+ * rouverte aprs un dlai doublant  chaque chec.
+ */
+
+/* Premier dlai avant de rouvrir une connection, en ms */
+#define CADI_RETRY_MS 100
+
+/* Le dlai cesse de doubler aprs ce nombre d'checs... */
+#define CADI_RETRY_MAX_SHIFT 5
+
+/* ...et les requtes en attente chouent quand toutes les connections en sont l */
+#define CADI_MAX_FAILURES 5
+
+/* Options de cadi_open */
+#define CADI_COMPRESS 1   /* Sorties compresses, si le dmon le propose */
+
+/* Fin d'une requte */
+typedef struct
+{
+
+  bool ok;            /* Rponse OK */
+  char *reply;        /* Ligne OK/ERR, sans "OK " ni "ERR " */
+  char *body;         /* Lignes qui la prcdent, ou sortie rapatrie */
+  size_t body_len;
+
+} cadi_result_t;
+
+/* Appel  la fin d'une requte ; le rsultat est libr au retour */
+typedef void (*cadi_reply_t)(void *, unsigned, const cadi_result_t *);
+
+/* Appel  chaque trame d'une sortie, puis avec une taille nulle  sa fin */
+typedef void (*cadi_data_t)(void *, unsigned, const char *, size_t);
+
+typedef struct cadi_pool cadi_pool_t;
+
+extern cadi_pool_t *cadi_open(in_addr_t, unsigned, unsigned, int);
+extern int cadi_connect(cadi_pool_t *);
+extern void cadi_close(cadi_pool_t *);
+extern unsigned cadi_send(cadi_pool_t *, const char *, cadi_reply_t, cadi_data_t, void *);
+extern unsigned cadi_send_on(cadi_pool_t *, int, const char *, cadi_reply_t, cadi_data_t, void *);
+extern bool cadi_wait(cadi_pool_t *, unsigned, cadi_result_t *);
+extern void cadi_result_free(cadi_result_t *);
+extern int cadi_poll(cadi_pool_t *, int);
+extern unsigned cadi_pollfds(cadi_pool_t *, struct pollfd *, unsigned);
+extern int cadi_timeout(const cadi_pool_t *);
+extern void cadi_events(cadi_pool_t *, const struct pollfd *, unsigned);
+extern unsigned cadi_pending(const cadi_pool_t *);
+extern unsigned cadi_ready(const cadi_pool_t *, int);
+extern const char *cadi_welcome(const cadi_pool_t *);
+extern const char *cadi_error(const cadi_pool_t *, int);
+
+#endif
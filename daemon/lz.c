@@ -0,0 +1,203 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+/* Table des dernires positions de chaque empreinte de 4 octets */
+#define LZ_HASH_BITS 12
+
+/* Distance maximale d'une copie */
+#define LZ_MAX_OFFSET 65535
+
+static uint32_t read32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof v);
+  return v;
+}
+
+static unsigned lz_hash(uint32_t v)
+{
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * crit la suite d'une longueur d'au moins 15.
+ *
+ * @return la fin de ce qui est crit, NULL si la place manque
+ */
+static uint8_t *lz_length(uint8_t *op, const uint8_t *oend, size_t len)
+{
+  for (len -= 15; len >= 255; len -= 255)
+    {
+      if (op >= oend)
+	return NULL;
+      *op++ = 255;
+    }
+
+  if (op >= oend)
+    return NULL;
+  *op++ = len;
+  return op;
+}
+
+/**
+ * crit une squence : des littraux, puis une copie.
+ *
+ * @param offset distance de la copie, 0 pour la dernire squence
+ * @param match longueur de la copie, moins LZ_MIN_MATCH
+ * @return la fin de ce qui est crit, NULL si la place manque
+ */
+static uint8_t *lz_sequence(uint8_t *op, const uint8_t *oend, const uint8_t *lit, size_t lit_len,
+			    size_t offset, size_t match)
+{
+  if (op >= oend)
+    return NULL;
+
+  uint8_t *token = op++;
+  *token = (lit_len < 15 ? lit_len : 15) << 4;
+  if (lit_len >= 15 && (op = lz_length(op, oend, lit_len)) == NULL)
+    return NULL;
+
+  if ((size_t) (oend - op) < lit_len)
+    return NULL;
+  memcpy(op, lit, lit_len);
+  op += lit_len;
+
+  if (offset == 0)
+    return op;
+
+  if (oend - op < 2)
+    return NULL;
+  *op++ = offset & 0xff;
+  *op++ = offset >> 8;
+
+  *token |= match < 15 ? match : 15;
+  if (match >= 15 && (op = lz_length(op, oend, match)) == NULL)
+    return NULL;
+
+  return op;
+}
+
+/**
+ * Compresse un bloc.
+ *
+ * @param cap place disponible dans dst : LZ_BOUND(len) suffit toujours.
+ * Une place plus petite que len permet de renoncer aux blocs que la
+ * compression ne rduit pas.
+ * @return la taille compresse, 0 si elle dpasse cap
+ */
+size_t lz_compress(const void *src, size_t len, void *dst, size_t cap)
+{
+  const uint8_t *base = src, *end = base + len;
+  const uint8_t *ip = base, *anchor = base;
+  uint8_t *op = dst;
+  const uint8_t *oend = op + cap;
+  uint32_t table[1 << LZ_HASH_BITS];
+
+  memset(table, 0, sizeof table);
+
+  /* Une copie commence au plus LZ_MIN_MATCH octets avant la fin */
+  while (len >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH)
+    {
+      uint32_t seq = read32(ip);
+      unsigned h = lz_hash(seq);
+      const uint8_t *ref = base + table[h];
+
+      table[h] = ip - base;
+      if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != seq)
+	{
+	  ip++;
+	  continue;
+	}
+
+      const uint8_t *mp = ip + LZ_MIN_MATCH;
+      ref += LZ_MIN_MATCH;
+      while (mp < end && *mp == *ref)
+	mp++, ref++;
+
+      if ((op = lz_sequence(op, oend, anchor, ip - anchor, mp - ref,
+			    mp - ip - LZ_MIN_MATCH)) == NULL)
+	return 0;
+
+      ip = anchor = mp;
+    }
+
+  if ((op = lz_sequence(op, oend, anchor, end - anchor, 0, 0)) == NULL)
+    return 0;
+
+  return op - (uint8_t *) dst;
+}
+
+/**
+ * Lit la suite d'une longueur.
+ *
+ * @return false si le bloc est tronqu
+ */
+static bool lz_read_length(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+  unsigned b;
+
+  do
+    {
+      if (*ip >= iend)
+	return false;
+      b = *(*ip)++;
+      *len += b;
+    }
+  while (b == 255);
+
+  return true;
+}
+
+/**
+ * Dcompresse un bloc produit par lz_compress. Un bloc invalide (venant
+ * du rseau) ne fait jamais lire ou crire hors des buffers.
+ *
+ * @return la taille dcompresse, -1 si le bloc est invalide ou ne tient
+ * pas dans cap
+ */
+long lz_decompress(const void *src, size_t len, void *dst, size_t cap)
+{
+  const uint8_t *ip = src, *iend = ip + len;
+  uint8_t *op = dst, *oend = op + cap;
+
+  while (ip < iend)
+    {
+      unsigned token = *ip++;
+      size_t lit = token >> 4;
+
+      if (lit == 15 && !lz_read_length(&ip, iend, &lit))
+	return -1;
+      if ((size_t) (iend - ip) < lit || (size_t) (oend - op) < lit)
+	return -1;
+      memcpy(op, ip, lit);
+      op += lit;
+      ip += lit;
+
+      /* La dernire squence n'a que des littraux */
+      if (ip == iend)
+	break;
+
+      if (iend - ip < 2)
+	return -1;
+      size_t offset = ip[0] | ip[1] << 8;
+      ip += 2;
+      if (offset == 0 || offset > (size_t) (op - (uint8_t *) dst))
+	return -1;
+
+      size_t match = token & 15;
+      if (match == 15 && !lz_read_length(&ip, iend, &match))
+	return -1;
+      match += LZ_MIN_MATCH;
+      if ((size_t) (oend - op) < match)
+	return -1;
+
+      /* Octet par octet : la copie peut recouvrir ce qu'elle crit */
+      for (const uint8_t *ref = op - offset; match > 0; match--)
+	*op++ = *ref++;
+    }
+
+  return op - (uint8_t *) dst;
+}
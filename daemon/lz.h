@@ -0,0 +1,25 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+/*
+ * Codec LZ77 rapide, par blocs indpendants, au format des blocs LZ4 :
+ * chaque squence est un jeton (longueur des littraux sur 4 bits,
+ * longueur de la copie moins LZ_MIN_MATCH sur 4 bits), la suite de la
+ * longueur des littraux (octets ajouts tant qu'ils valent 255), les
+ * littraux, la distance de la copie (2 octets, petit-boutiste) et la
+ * suite de la longueur de la copie. La dernire squence n'a pas de
+ * copie. Aucune dpendance, aucune allocation.
+ */
+
+/* Longueur minimale d'une copie */
+#define LZ_MIN_MATCH 4
+
+/* Taille maximale d'un bloc compress, mme incompressible */
+#define LZ_BOUND(len) ((len) + (len) / 255 + 16)
+
+extern size_t lz_compress(const void *, size_t, void *, size_t);
+extern long lz_decompress(const void *, size_t, void *, size_t);
+
+#endif
@@ -0,0 +1,387 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "output.h"
+#include "process.h"
+#include "state.h"
+#include "pool.h"
+
+/** Octets des fichiers de dbordement */
+static size_t spilled;
+
+void outbuf_init(outbuf_t *buf)
+{
+  memset(buf, 0, sizeof *buf);
+  buf->spill = -1;
+}
+
+/**
+ * Rend les morceaux d'une sortie scelle.
+ */
+static void outbuf_release_chunks(outbuf_t *buf)
+{
+  for (size_t i = 0; i < buf->nchunks; i++)
+    chunk_put(buf->chunks[i].chunk);
+  free(buf->chunks);
+  buf->chunks = NULL;
+  buf->nchunks = 0;
+}
+
+void outbuf_free(outbuf_t *buf)
+{
+  outbuf_release_chunks(buf);
+  if (buf->spill != -1)
+    {
+      munmap(buf->data, buf->cap);
+      close(buf->spill);
+      spilled -= buf->cap;
+    }
+  else
+    pool_free(buf->data, buf->cap);
+  pool_free(buf->lines, buf->lines_cap * sizeof *buf->lines);
+  outbuf_init(buf);
+}
+
+/**
+ * Scelle une sortie complte : elle est dcoupe selon son contenu, et
+ * chaque morceau dj connu n'est gard qu'une fois. Les sorties
+ * identiques d'une mme commande lance n fois ne cotent plus qu'une.
+ * Une sortie qui a dbord sur disque y reste : la sceller la ramnerait
+ * en mmoire.
+ *
+ * @return false si la mmoire manque (la sortie reste telle quelle)
+ */
+bool outbuf_seal(outbuf_t *buf)
+{
+  size_t n = 0;
+
+  if (buf->chunks != NULL || buf->len == 0 || buf->spill != -1)
+    return true;
+
+  if ((buf->chunks = malloc((buf->len / CHUNK_MIN_SIZE + 1) * sizeof *buf->chunks)) == NULL)
+    return false;
+
+  for (size_t start = 0, len; start < buf->len; start += len)
+    {
+      len = chunk_cut(buf->data + start, buf->len - start);
+      if ((buf->chunks[n].chunk = chunk_get(buf->data + start, len)) == NULL)
+	{
+	  buf->nchunks = n;
+	  outbuf_release_chunks(buf);
+	  return false;
+	}
+      buf->chunks[n++].start = start;
+    }
+
+  buf->nchunks = n;
+  pool_free(buf->data, buf->cap);
+  buf->data = NULL;
+  buf->cap = 0;
+  return true;
+}
+
+/**
+ * Donne accs aux octets contigus d'une sortie  partir d'une position :
+ * toute la fin de la sortie, ou la fin du morceau pour une sortie scelle.
+ *
+ * @param offset position dans la sortie
+ * @param data reoit l'adresse de l'octet  offset
+ * @return le nombre d'octets contigus, 0 au-del de la fin
+ */
+size_t outbuf_span(const outbuf_t *buf, size_t offset, const char **data)
+{
+  if (offset >= buf->len)
+    return 0;
+
+  if (buf->chunks == NULL)
+    {
+      *data = buf->data + offset;
+      return buf->len - offset;
+    }
+
+  /* Le dernier morceau commenant avant offset */
+  size_t lo = 0, hi = buf->nchunks;
+  while (hi - lo > 1)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (buf->chunks[mid].start <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  const outchunk_t *c = buf->chunks + lo;
+  *data = c->chunk->data + (offset - c->start);
+  return c->chunk->len - (offset - c->start);
+}
+
+/**
+ * Recopie une sortie scelle dans un buffer  elle, pour y ajouter.
+ *
+ * @return false si la mmoire manque
+ */
+static bool outbuf_unseal(outbuf_t *buf)
+{
+  size_t cap = buf->len;
+  char *data = pool_alloc(&cap);
+
+  if (data == NULL)
+    return false;
+
+  for (size_t i = 0; i < buf->nchunks; i++)
+    memcpy(data + buf->chunks[i].start, buf->chunks[i].chunk->data, buf->chunks[i].chunk->len);
+
+  outbuf_release_chunks(buf);
+  buf->data = data;
+  buf->cap = cap;
+  return true;
+}
+
+/**
+ * Agrandit un buffer projet sur son fichier de dbordement, ou l'y fait
+ * passer. Les blocs sont rservs sur disque avant d'tre projets : un
+ * disque plein fait chouer l'agrandissement, pas l'criture (SIGBUS).
+ *
+ * @return false si le fichier n'a pas pu tre cr ou agrandi
+ */
+static bool outbuf_spill(outbuf_t *buf, size_t cap)
+{
+  size_t from = buf->spill == -1 ? 0 : buf->cap;
+  int fd = buf->spill;
+  char *data;
+  int err;
+
+  if (fd == -1 && (fd = open(OUTBUF_SPILL_DIR, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600)) == -1)
+    {
+      perror("open " OUTBUF_SPILL_DIR);
+      return false;
+    }
+
+  if ((err = posix_fallocate(fd, from, cap - from)) != 0)
+    {
+      errno = err;
+      perror("posix_fallocate");
+    }
+  else if (buf->spill != -1)
+    {
+      if ((data = mremap(buf->data, buf->cap, cap, MREMAP_MAYMOVE)) != MAP_FAILED)
+	{
+	  spilled += cap - buf->cap;
+	  buf->data = data;
+	  buf->cap = cap;
+	  return true;
+	}
+      perror("mremap");
+    }
+  else if ((data = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) != MAP_FAILED)
+    {
+      /* Le dbut de la sortie rejoint le fichier, le pool rcupre sa place */
+      memcpy(data, buf->data, buf->len);
+      pool_free(buf->data, buf->cap);
+      spilled += cap;
+      buf->data = data;
+      buf->cap = cap;
+      buf->spill = fd;
+      return true;
+    }
+  else
+    perror("mmap");
+
+  if (buf->spill == -1)
+    close(fd);
+  return false;
+}
+
+/**
+ * Agrandit le buffer pour qu'il puisse recevoir au moins min octets de
+ * plus : dans le pool tant que le budget n'est pas atteint, dans son
+ * fichier de dbordement ensuite.
+ *
+ * @return false si la mmoire manque
+ */
+static bool outbuf_reserve(outbuf_t *buf, size_t min)
+{
+  if (buf->chunks != NULL && !outbuf_unseal(buf))
+    return false;
+
+  if (buf->cap - buf->len >= min)
+    return true;
+
+  size_t cap = buf->cap ? buf->cap : STDOUT_BUFFER_SIZE;
+  while (cap - buf->len < min)
+    cap *= 2;
+
+  if (buf->spill != -1 || pool_over_budget())
+    return outbuf_spill(buf, cap);
+
+  char *data = pool_realloc(buf->data, buf->cap, &cap);
+  if (data == NULL)
+    return false;
+
+  buf->data = data;
+  buf->cap = cap;
+  return true;
+}
+
+/**
+ * Lit tout ce qui est disponible sur le descripteur (non bloquant)
+ * directement  la suite du buffer.
+ *
+ * @param buf le buffer de sortie
+ * @param fd descripteur  vider, ignor s'il vaut -1
+ * @return le nombre d'octets lus, 0 en fin de fichier, -1 si rien n'a t lu
+ */
+ssize_t outbuf_fill(outbuf_t *buf, int fd)
+{
+  ssize_t total = 0, n = -1;
+
+  if (fd == -1)
+    return 0;
+
+  while (outbuf_reserve(buf, STDOUT_BUFFER_SIZE))
+    {
+      size_t room = buf->cap - buf->len;
+
+      if ((n = read(fd, buf->data + buf->len, room)) <= 0)
+	break;
+
+      buf->len += n;
+      total += n;
+
+      /* Lecture incomplte : le pipe est vide, inutile de relire */
+      if ((size_t) n < room)
+	break;
+    }
+
+  if (n == -1 && errno != EAGAIN)
+    perror("read");
+
+  return total > 0 ? total : n;
+}
+
+/**
+ * Ajoute des donnes  la fin du buffer.
+ *
+ * @return false si la mmoire manque
+ */
+bool outbuf_append(outbuf_t *buf, const void *data, size_t len)
+{
+  if (!outbuf_reserve(buf, len))
+    return false;
+
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  return true;
+}
+
+/**
+ * Complte l'index des fins de ligne avec les octets arrivs depuis
+ * le dernier appel, et retourne le nombre de lignes du buffer (une
+ * dernire ligne sans '\n' compte pour une ligne).
+ */
+size_t outbuf_count_lines(outbuf_t *buf)
+{
+  const char *span, *p, *end;
+  size_t n;
+
+  /* Morceau par morceau si la sortie est scelle */
+  for (; (n = outbuf_span(buf, buf->indexed, &span)) > 0; buf->indexed += n)
+    {
+      p = span;
+      end = span + n;
+
+      /* memchr est vectoris par la libc, bien plus rapide qu'une boucle */
+      while (p < end && (p = memchr(p, '\n', end - p)) != NULL)
+	{
+	  if (buf->nlines == buf->lines_cap)
+	    {
+	      size_t size = (buf->lines_cap ? buf->lines_cap * 2 : 64) * sizeof *buf->lines;
+	      size_t *lines = pool_realloc(buf->lines, buf->lines_cap * sizeof *lines, &size);
+
+	      if (lines == NULL)
+		return buf->nlines;
+
+	      buf->lines = lines;
+	      buf->lines_cap = size / sizeof *lines;
+	    }
+
+	  buf->lines[buf->nlines++] = buf->indexed + (p - span);
+	  p++;
+	}
+    }
+
+  if (buf->len > 0 && (buf->nlines == 0 || buf->lines[buf->nlines - 1] != buf->len - 1))
+    return buf->nlines + 1;
+
+  return buf->nlines;
+}
+
+/**
+ * Sauvegarde le contenu du buffer pour Reexec. L'index des lignes n'en
+ * fait pas partie, il sera reconstruit  la demande.
+ */
+void outbuf_save(state_t *state, const outbuf_t *buf)
+{
+  const char *span;
+  size_t n;
+
+  state_put_int(state, buf->len);
+  state_put_int(state, buf->sent);
+  for (size_t offset = 0; (n = outbuf_span(buf, offset, &span)) > 0; offset += n)
+    state_put(state, span, n);
+}
+
+/**
+ * Relit un buffer sauvegard par outbuf_save.
+ *
+ * @return false en cas d'erreur
+ */
+bool outbuf_restore(state_t *state, outbuf_t *buf)
+{
+  outbuf_init(buf);
+  size_t len = state_get_int(state);
+  buf->sent = state_get_int(state);
+
+  if (len > 0 && outbuf_reserve(buf, len) && state_get(state, buf->data, len))
+    buf->len = len;
+  else
+    {
+      /* Mmoire insuffisante : les donnes sont sautes */
+      if (len > 0 && buf->data == NULL)
+	free(state_get_data(state, len));
+      buf->sent = 0;
+    }
+  return state->ok;
+}
+
+/**
+ * Donne les bornes de la ligne i (sans le '\n'). L'index doit avoir t
+ * mis  jour par outbuf_count_lines.
+ *
+ * @param buf le buffer de sortie
+ * @param i numro de la ligne,  partir de 0
+ * @param start reoit la position du premier caractre de la ligne
+ * @param end reoit la position suivant le dernier caractre de la ligne
+ */
+void outbuf_line(const outbuf_t *buf, size_t i, size_t *start, size_t *end)
+{
+  *start = i == 0 ? 0 : buf->lines[i - 1] + 1;
+  *end = i < buf->nlines ? buf->lines[i] : buf->len;
+}
+
+/**
+ * Octets projets sur les fichiers de dbordement, pour Stats.
+ */
+size_t outbuf_spilled()
+{
+  return spilled;
+}
@@ -0,0 +1,60 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "state.h"
+#include "chunk.h"
+
+/* Rpertoire des fichiers o dbordent les sorties au-del du budget (-M) */
+#define OUTBUF_SPILL_DIR "/tmp"
+
+/* Un morceau d'une sortie scelle, et sa position dans la sortie */
+typedef struct
+{
+
+  chunk_t *chunk;
+  size_t start;
+
+} outchunk_t;
+
+/*
+ * Sortie bufferise d'un processus, avec un index des fins de ligne
+ * construit au fur et  mesure des lectures. Une sortie complte peut
+ * tre scelle : ses octets passent alors dans des morceaux partags
+ * avec les autres sorties (chunk.h), et data est NULL. Un buffer qui
+ * grandit une fois le budget des buffers atteint dborde sur disque :
+ * data projette alors un fichier anonyme de OUTBUF_SPILL_DIR, et la
+ * lecture des sorties continue.
+ */
+typedef struct
+{
+
+  char *data;
+  size_t len;       /* Octets reus */
+  size_t cap;       /* Taille alloue pour data */
+  size_t sent;      /* Octets dj transmis par GetOutput/GetError */
+  size_t *lines;    /* Position des '\n' dans data */
+  size_t nlines;
+  size_t lines_cap;
+  size_t indexed;   /* Octets dj parcourus par l'index */
+  outchunk_t *chunks; /* Sortie scelle, ou NULL */
+  size_t nchunks;
+  int spill;        /* Fichier projet par data, ou -1 si data vient du pool */
+
+} outbuf_t;
+
+extern void outbuf_init(outbuf_t *);
+extern void outbuf_free(outbuf_t *);
+extern ssize_t outbuf_fill(outbuf_t *, int);
+extern bool outbuf_append(outbuf_t *, const void *, size_t);
+extern bool outbuf_seal(outbuf_t *);
+extern size_t outbuf_span(const outbuf_t *, size_t, const char **);
+extern size_t outbuf_count_lines(outbuf_t *);
+extern void outbuf_line(const outbuf_t *, size_t, size_t *, size_t *);
+extern size_t outbuf_spilled();
+extern void outbuf_save(state_t *, const outbuf_t *);
+extern bool outbuf_restore(state_t *, outbuf_t *);
+
+#endif
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "pool.h"
+
+/* Place rserve  l'en-tte au dbut de chaque slab */
+#define SLAB_HEADER 64
+
+/** Une slab : morceaux d'une mme classe */
+typedef struct slab
+{
+
+  struct slab *prev, *next; /* Slabs de la classe ayant des morceaux libres */
+  void *free;               /* Morceaux rendus, chans par leur premier mot */
+  char *fresh;              /* Premier morceau jamais servi */
+  unsigned used;
+  unsigned cls;
+  bool partial;             /* Prsente dans la liste des slabs non pleines */
+
+} slab_t;
+
+/** Une classe de morceaux */
+typedef struct
+{
+
+  slab_t *partial;
+  unsigned slabs;
+  unsigned used;
+
+} class_t;
+
+static class_t classes[POOL_CLASSES];
+
+/** Gros blocs projets directement */
+static unsigned large_blocks;
+
+static size_t in_use, mapped, peak;
+static size_t budget = POOL_DEFAULT_BUDGET;
+
+/**
+ * Fixe le budget des buffers.
+ *
+ * @param bytes taille maximale, 0 pour ne pas limiter
+ */
+void pool_set_budget(size_t bytes)
+{
+  budget = bytes;
+}
+
+/**
+ * Indique si le budget est atteint : les sorties qui grandissent
+ * dbordent alors sur disque (output.c), jusqu' ce que de la mmoire
+ * soit libre (DestroyProcess).
+ */
+bool pool_over_budget()
+{
+  return budget > 0 && in_use >= budget;
+}
+
+static size_t chunk_size(unsigned cls)
+{
+  return (size_t) 1 << (POOL_MIN_SHIFT + cls);
+}
+
+/**
+ * Classe d'une taille.
+ *
+ * @return POOL_CLASSES pour un gros bloc
+ */
+static unsigned class_of(size_t size)
+{
+  unsigned cls = 0;
+
+  while (cls < POOL_CLASSES && chunk_size(cls) < size)
+    cls++;
+  return cls;
+}
+
+static char *slab_end(const slab_t *slab)
+{
+  return (char *) slab + SLAB_HEADER
+    + (POOL_SLAB_SIZE - SLAB_HEADER) / chunk_size(slab->cls) * chunk_size(slab->cls);
+}
+
+static void served(size_t size)
+{
+  in_use += size;
+  if (in_use > peak)
+    peak = in_use;
+}
+
+static void partial_add(class_t *c, slab_t *slab)
+{
+  slab->prev = NULL;
+  slab->next = c->partial;
+  if (c->partial != NULL)
+    c->partial->prev = slab;
+  c->partial = slab;
+  slab->partial = true;
+}
+
+static void partial_remove(class_t *c, slab_t *slab)
+{
+  if (slab->prev != NULL)
+    slab->prev->next = slab->next;
+  else
+    c->partial = slab->next;
+  if (slab->next != NULL)
+    slab->next->prev = slab->prev;
+  slab->partial = false;
+}
+
+/**
+ * Projette une nouvelle slab, aligne sur sa taille pour retrouver
+ * l'en-tte depuis n'importe lequel de ses morceaux.
+ */
+static slab_t *slab_new(unsigned cls)
+{
+  char *map = mmap(NULL, 2 * POOL_SLAB_SIZE, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED)
+    {
+      perror("mmap");
+      return NULL;
+    }
+
+  char *aligned = (char *) (((uintptr_t) map + POOL_SLAB_SIZE - 1)
+			    & ~(uintptr_t) (POOL_SLAB_SIZE - 1));
+  size_t head = aligned - map;
+  if (head > 0)
+    munmap(map, head);
+  munmap(aligned + POOL_SLAB_SIZE, POOL_SLAB_SIZE - head);
+
+  /* Les pages ne sont touches qu'au service de leurs morceaux */
+  slab_t *slab = (slab_t *) aligned;
+  memset(slab, 0, sizeof *slab);
+  slab->cls = cls;
+  slab->fresh = aligned + SLAB_HEADER;
+
+  classes[cls].slabs++;
+  mapped += POOL_SLAB_SIZE;
+  partial_add(classes + cls, slab);
+  return slab;
+}
+
+/**
+ * Alloue un morceau.
+ *
+ * @param size taille demande, reoit la taille rellement servie (
+ * rendre telle quelle  pool_free)
+ * @return NULL si la mmoire manque
+ */
+void *pool_alloc(size_t *size)
+{
+  unsigned cls = class_of(*size);
+
+  if (cls == POOL_CLASSES)
+    {
+      size_t len = (*size + chunk_size(0) - 1) & ~(chunk_size(0) - 1);
+      void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED)
+	{
+	  perror("mmap");
+	  return NULL;
+	}
+
+      large_blocks++;
+      mapped += len;
+      served(len);
+      *size = len;
+      return p;
+    }
+
+  class_t *c = classes + cls;
+  slab_t *slab = c->partial;
+  if (slab == NULL && (slab = slab_new(cls)) == NULL)
+    return NULL;
+
+  void *p;
+  if (slab->free != NULL)
+    {
+      p = slab->free;
+      slab->free = *(void **) p;
+    }
+  else
+    {
+      p = slab->fresh;
+      slab->fresh += chunk_size(cls);
+    }
+
+  slab->used++;
+  c->used++;
+  if (slab->free == NULL && slab->fresh == slab_end(slab))
+    partial_remove(c, slab);
+
+  served(chunk_size(cls));
+  *size = chunk_size(cls);
+  return p;
+}
+
+/**
+ * Rend un morceau.
+ *
+ * @param size taille servie par pool_alloc ou pool_realloc
+ */
+void pool_free(void *p, size_t size)
+{
+  if (p == NULL)
+    return;
+
+  unsigned cls = class_of(size);
+
+  if (cls == POOL_CLASSES)
+    {
+      if (munmap(p, size) == -1)
+	perror("munmap");
+      large_blocks--;
+      mapped -= size;
+      in_use -= size;
+      return;
+    }
+
+  class_t *c = classes + cls;
+  slab_t *slab = (slab_t *) ((uintptr_t) p & ~(uintptr_t) (POOL_SLAB_SIZE - 1));
+
+  *(void **) p = slab->free;
+  slab->free = p;
+  slab->used--;
+  c->used--;
+  in_use -= chunk_size(cls);
+
+  if (!slab->partial)
+    partial_add(c, slab);
+
+  /* Slab vide : rendue au systme, sauf si c'est la seule disponible */
+  if (slab->used == 0 && (slab->prev != NULL || slab->next != NULL))
+    {
+      partial_remove(c, slab);
+      c->slabs--;
+      mapped -= POOL_SLAB_SIZE;
+      if (munmap(slab, POOL_SLAB_SIZE) == -1)
+	perror("munmap");
+    }
+}
+
+/**
+ * Agrandit (ou rduit) un morceau, en gardant son contenu.
+ *
+ * @param p morceau servi, ou NULL
+ * @param old sa taille servie
+ * @param size taille voulue, reoit la taille servie
+ * @return le nouveau morceau, NULL si la mmoire manque (p reste valide)
+ */
+void *pool_realloc(void *p, size_t old, size_t *size)
+{
+  if (p == NULL)
+    return pool_alloc(size);
+
+  /* Deux gros blocs : le noyau dplace les pages sans les copier */
+  if (class_of(old) == POOL_CLASSES && class_of(*size) == POOL_CLASSES)
+    {
+      size_t len = (*size + chunk_size(0) - 1) & ~(chunk_size(0) - 1);
+      void *q = mremap(p, old, len, MREMAP_MAYMOVE);
+      if (q == MAP_FAILED)
+	{
+	  perror("mremap");
+	  return NULL;
+	}
+
+      mapped += len - old;
+      in_use -= old;
+      served(len);
+      *size = len;
+      return q;
+    }
+
+  void *q = pool_alloc(size);
+  if (q == NULL)
+    return NULL;
+
+  memcpy(q, p, old < *size ? old : *size);
+  pool_free(p, old);
+  return q;
+}
+
+/**
+ * Relve l'occupation des classes, pour la commande Stats.
+ */
+void pool_stats(pool_stats_t *stats)
+{
+  memset(stats, 0, sizeof *stats);
+
+  for (unsigned cls = 0; cls < POOL_CLASSES; cls++)
+    {
+      pool_class_t *s = stats->classes + cls;
+      s->size = chunk_size(cls);
+      s->slabs = classes[cls].slabs;
+      s->used = classes[cls].used;
+      s->free = s->slabs * ((POOL_SLAB_SIZE - SLAB_HEADER) / s->size) - s->used;
+    }
+
+  stats->classes[POOL_CLASSES].used = large_blocks;
+  stats->in_use = in_use;
+  stats->mapped = mapped;
+  stats->peak = peak;
+  stats->budget = budget;
+}
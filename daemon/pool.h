@@ -0,0 +1,57 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Plus petit morceau servi : 4 Ko */
+#define POOL_MIN_SHIFT 12
+
+/* Plus grand morceau pris dans une slab : 64 Ko, au-del mmap direct */
+#define POOL_MAX_SHIFT 16
+
+/* Nombre de classes de morceaux (puissances de 2) */
+#define POOL_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+
+/* Taille d'une slab, qui est aussi son alignement */
+#define POOL_SLAB_SIZE (1 << 20)
+
+/* Budget par dfaut des buffers de sortie, en octets */
+#define POOL_DEFAULT_BUDGET (256 << 20)
+
+/*
+ * Mmoire des buffers (sorties, entres en attente, index des lignes).
+ * Les morceaux jusqu' 64 Ko sont dcoups dans des slabs de 1 Mo, une
+ * classe par puissance de 2 : un morceau rendu sert au suivant de la
+ * mme taille, et une slab vide est rendue au systme. Les plus gros
+ * sont projets un par un et agrandis par mremap, sans copie.
+ */
+typedef struct
+{
+
+  size_t size;        /* Taille des morceaux, 0 pour les gros blocs */
+  unsigned slabs;
+  unsigned used;      /* Morceaux servis (gros blocs : blocs projets) */
+  unsigned free;      /* Morceaux libres dans les slabs existantes */
+
+} pool_class_t;
+
+typedef struct
+{
+
+  pool_class_t classes[POOL_CLASSES + 1];  /* La dernire : gros blocs */
+  size_t in_use;      /* Octets servis */
+  size_t mapped;      /* Octets demands au systme */
+  size_t peak;        /* Maximum de in_use */
+  size_t budget;      /* 0 : illimit */
+
+} pool_stats_t;
+
+extern void pool_set_budget(size_t);
+extern bool pool_over_budget();
+extern void *pool_alloc(size_t *);
+extern void *pool_realloc(void *, size_t, size_t *);
+extern void pool_free(void *, size_t);
+extern void pool_stats(pool_stats_t *);
+
+#endif
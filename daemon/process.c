@@ -1,22 +1,45 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <regex.h>
 
 #include "process.h"
+#include "output.h"
+#include "cache.h"
+#include "shmring.h"
+#include "trace.h"
+#include "fdlimit.h"
 #include "cadid.h"
 
 #define WRITE 1
 #define READ  0
 
+/*
+ * Premier id des processus servis depuis le cache. Il est au-del de
+ * PID_MAX_LIMIT, et ne peut donc pas tre le pid d'un vrai processus.
+ */
+#define CACHED_ID_BASE (1 << 22)
+
+/* Sorties d'un processus qui vient de finir, pas encore demandes */
+#define UNFETCHED (1 << STREAM_OUT | 1 << STREAM_ERR)
+
 extern int kill(pid_t pid, int sig);
+extern int killpg(pid_t pgrp, int sig);
+extern int setpgid(pid_t pid, pid_t pgid);
+extern char *strdup(const char *);
+extern int fexecve(int fd, char *const argv[], char *const envp[]);
+extern char **environ;
 
 /** La structure utilise en interne pour contenir les infos d'un processus */
 typedef struct
@@ -27,13 +50,63 @@ typedef struct
   int in[2]; /* parent -> child */
   int out[2]; /* child -> parent */
   int err[2]; /* child -> parent */
+  outbuf_t out_buf; /* Sortie standard lue depuis out */
+  outbuf_t err_buf; /* Sortie d'erreur lue depuis err */
+  outbuf_t in_buf;  /* Entre en attente d'criture sur in */
+  bool in_closing;  /* CloseInput demand, on ferme une fois in_buf vid */
+  unsigned gen;     /* Incrment  chaque rutilisation de l'emplacement */
   char *command;
+  unsigned long seq; /* Numro du dernier changement (cration, fin) */
+  cachekey_t key;    /* Cl sous laquelle enregistrer le rsultat, ou data  NULL */
+  shmring_t ring;    /* Copie partage de la sortie, pour les clients locaux */
+  char *tag;         /* Groupe du processus (CreateProcess --tag), ou NULL */
+  bool group_leader; /* Le fils a son propre groupe de processus (pgid = pid) */
+  unsigned pipe_size[3]; /* Capacit des pipes de sortie, 0 si pas encore releve */
+  unsigned full_reads[3]; /* Lectures de suite d'un pipe plein */
+  time_t exited;     /* Heure  laquelle la fin a t releve, 0 avant */
+  time_t reported;   /* Heure  laquelle WaitAny ou WaitGroup a annonc la fin, 0 avant */
+  unsigned unfetched; /* Sorties pas encore demandes depuis la fin (1 << STREAM_OUT, 1 << STREAM_ERR) */
+  pid_t child;       /* Pid du fils, 0 sans fils (cache, attente de --after) */
+  after_t after[MAX_AFTER]; /* Dpendances (--after) */
+  unsigned nafter;
+  char **waiting;    /* Arguments d'un processus attendant ses dpendances, ou NULL */
+  redirect_t waiting_redir; /* Ses redirections, chemins allous */
 
 } processinfo_t;
 
+/** Trace d'un processus dtruit, pour ListChanges */
+typedef struct
+{
+
+  unsigned long seq;
+  pid_t pid;
+  int ret;
+  bool swept;   /* Retir par la rtention : GetReturnCode rpond encore */
+
+} tombstone_t;
+
 /** Liste des processus */
 static processinfo_t processes[MAX_PROCESS];
 
+/** Numro du dernier changement de la table des processus */
+static unsigned long change_seq;
+
+/** Les dernires destructions (tampon circulaire) */
+static tombstone_t tombstones[MAX_CHANGES];
+static unsigned next_tombstone;
+
+/** Numro de la plus rcente destruction oublie */
+static unsigned long lost_seq;
+
+/** Prochain id d'un processus sans pid  lui (servi depuis le cache, --after) */
+static pid_t next_cached_id = CACHED_ID_BASE;
+
+/** Nombre de pipes agrandis, pour Stats */
+static unsigned long pipes_grown;
+
+/** Nombre de processus retirs par la rtention, pour Stats */
+static unsigned long processes_swept;
+
 /**
  * Retourne l'index du process ayant un pid prcis.
  *
@@ -42,6 +115,10 @@ static processinfo_t processes[MAX_PROCESS];
  */
 static int index_of_process(pid_t pid)
 {
+  /* 0 est le pid des emplacements libres, et waitpid(0) attend n'importe quel fils */
+  if (pid <= 0)
+    return -1;
+
   for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
     if (processes[i].pid == pid)
       return i;
@@ -49,6 +126,24 @@ static int index_of_process(pid_t pid)
   return -1;
 }
 
+/**
+ * Retourne l'index du process dont le fils a un pid prcis. C'est le
+ * mme que l'id, sauf pour un processus lanc aprs ses dpendances.
+ *
+ * @return -1 si aucun fils n'a ce pid, l'index sinon
+ */
+static int index_of_child(pid_t pid)
+{
+  if (pid <= 0)
+    return -1;
+
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
+    if (processes[i].pid && processes[i].child == pid)
+      return i;
+
+  return -1;
+}
+
 /**
  * Retourne l'index o l'insertion d'un nouveau process est possible.
  *
@@ -63,10 +158,54 @@ static int get_next_new_process_index()
   return -1;
 }
 
+/**
+ * Ferme les pipes d'un processus qui n'a pas pu tre lanc.
+ */
+static void release_pipes(processinfo_t *p)
+{
+  for (unsigned end = 0; end < 2; end++)
+    {
+      if (p->in[end] != -1)
+	close(p->in[end]);
+      if (p->out[end] != -1)
+	close(p->out[end]);
+      if (p->err[end] != -1)
+	close(p->err[end]);
+      p->in[end] = p->out[end] = p->err[end] = -1;
+    }
+}
+
+/**
+ * Ouvre les pipes d'un processus, sauf pour ses flux redirigs.
+ *
+ * @param redir redirections du processus, ou NULL
+ * @return false en cas d'erreur, aucun pipe n'tant alors ouvert
+ */
+static bool open_pipes(processinfo_t *p, const redirect_t *redir)
+{
+  /* Close-on-exec : les autres processus lancs n'en hritent pas */
+  if (((redir == NULL || redir->in == NULL) && pipe2(p->in, O_CLOEXEC) == -1)
+      || ((redir == NULL || redir->out == NULL) && pipe2(p->out, O_CLOEXEC) == -1)
+      || ((redir == NULL || (redir->err == NULL && !redir->merge_err))
+	  && pipe2(p->err, O_CLOEXEC) == -1))
+    {
+      perror("pipe");
+      release_pipes(p);
+      return false;
+    }
+
+  return true;
+}
+
 /**
  * Initialise un nouveau processus.
+ *
+ * @param with_pipes false pour un processus servi depuis le cache, qui
+ * n'a ni entre ni sorties  lire
+ * @param redir redirections du processus (pas de pipe pour un flux
+ * redirig), ou NULL
  */
-static processinfo_t *add_process()
+static processinfo_t *add_process(bool with_pipes, const redirect_t *redir)
 {
   int proc_index = get_next_new_process_index();
   if (proc_index == -1)
@@ -74,19 +213,44 @@ static processinfo_t *add_process()
 
   processes[proc_index].ret = PROCESS_NOT_TERMINATED;
   processes[proc_index].command = NULL;
-  
-  if (pipe(processes[proc_index].in) == -1
-      || pipe(processes[proc_index].out) == -1
-      || pipe(processes[proc_index].err) == -1)
-    {
-      perror("pipe");
-      return NULL;
-    }
-  
+  processes[proc_index].in_closing = false;
+  processes[proc_index].gen++;
+  outbuf_init(&processes[proc_index].out_buf);
+  outbuf_init(&processes[proc_index].err_buf);
+  outbuf_init(&processes[proc_index].in_buf);
+  memset(&processes[proc_index].key, 0, sizeof processes[proc_index].key);
+  shmring_init(&processes[proc_index].ring);
+  processes[proc_index].tag = NULL;
+  processes[proc_index].group_leader = false;
+  memset(processes[proc_index].pipe_size, 0, sizeof processes[proc_index].pipe_size);
+  memset(processes[proc_index].full_reads, 0, sizeof processes[proc_index].full_reads);
+  processes[proc_index].exited = 0;
+  processes[proc_index].reported = 0;
+  processes[proc_index].unfetched = 0;
+  processes[proc_index].child = 0;
+  processes[proc_index].nafter = 0;
+  processes[proc_index].waiting = NULL;
+
+  processes[proc_index].in[READ] = processes[proc_index].in[WRITE] = -1;
+  processes[proc_index].out[READ] = processes[proc_index].out[WRITE] = -1;
+  processes[proc_index].err[READ] = processes[proc_index].err[WRITE] = -1;
+
+  if (with_pipes && !open_pipes(processes + proc_index, redir))
+    return NULL;
+
   return processes + proc_index;
 }
 
-void list_process(int socket) {
+/**
+ * Ferme un descripteur s'il est ouvert.
+ */
+static void close_fd(int fd)
+{
+  if (fd != -1)
+    close(fd);
+}
+
+void list_process(int socket, int filter, unsigned offset, unsigned count) {
   char msg[MESSAGE_BUFFER_SIZE];
 
   /* Header */
@@ -98,242 +262,1885 @@ void list_process(int socket) {
     {
       if (!processes[i].pid)
 	continue;
-	
-      snprintf(msg, sizeof msg, "%3d\t%d\t%s\n", get_return_code(processes[i].pid), processes[i].pid, processes[i].command);
+
+      int ret = get_return_code(processes[i].pid);
+      if ((filter == LIST_RUNNING && ret != PROCESS_NOT_TERMINATED)
+	  || (filter == LIST_EXITED && ret == PROCESS_NOT_TERMINATED))
+	continue;
+
+      /* Pagination */
+      if (offset > 0)
+	{
+	  offset--;
+	  continue;
+	}
+
+      snprintf(msg, sizeof msg, "%3d\t%d\t%s\n", ret, processes[i].pid, processes[i].command);
       send_basic(socket, msg, strlen(msg));
+
+      if (count > 0 && --count == 0)
+	break;
     }
 }
 
-void destroy_all_process() {
-  int i = 0;
-  while (processes[i].pid)
-    destroy_process(processes[i++].pid);
+/**
+ * Nombre de processus enregistrs, termins ou non.
+ */
+unsigned process_count()
+{
+  unsigned n = 0;
+
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
+    if (processes[i].pid)
+      n++;
+  return n;
 }
 
 /**
- * Supprime le process avec le pid spcifi. Si le pid n'existe pas dans la liste, ne fait rien.
- *
- * @param pid pid  killer
+ * Nombre de pipes de sortie agrandis depuis le dmarrage.
  */
-void destroy_process(pid_t pid)
+unsigned long process_pipes_grown()
 {
-  int index = index_of_process(pid);
-  if (index < 0)
-    return;
+  return pipes_grown;
+}
 
-  /* On le tue s'il n'est pas dj termin */
-  if (get_return_code(pid) == PROCESS_NOT_TERMINATED
-      && kill(processes[index].pid, SIGHUP) == -1
-      && kill(processes[index].pid, SIGKILL) == -1)
-    perror("kill");
-  
-  close_input(pid);
-  close(processes[index].out[READ]);
-  close(processes[index].err[READ]);
-  free(processes[index].command);
+/**
+ * Recopie la table des processus dans la page d'tat, entre
+ * status_begin et status_end.
+ */
+void process_status(status_page_t *page)
+{
+  unsigned n = 0;
 
-  processes[index].pid = 0;
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0] && n < STATUS_MAX_PROCESS; i++)
+    {
+      processinfo_t *p = processes + i;
+      if (!p->pid)
+	continue;
+
+      status_process_t *s = page->processes + n++;
+      s->pid = p->pid;
+      s->ret = p->ret;
+      s->out_len = p->out_buf.len;
+      s->err_len = p->err_buf.len;
+      snprintf(s->tag, sizeof s->tag, "%s", p->tag != NULL ? p->tag : "");
+      snprintf(s->command, sizeof s->command, "%s", p->command != NULL ? p->command : "");
+    }
+
+  page->nprocesses = n;
 }
 
-pid_t create_process(const char *prog, char *const args[])
+bool list_changes(int socket, unsigned long since)
 {
-  processinfo_t *procinfo;
-  
-  if (prog == NULL || (procinfo = add_process()) == NULL)
-    return -1;
-  
-  pid_t proc;
-  switch (proc = fork()) {
-    
-  case -1: /* Erreur */
+  char msg[MESSAGE_BUFFER_SIZE];
+
+  /* Des destructions postrieures  since ont t oublies */
+  if (since < lost_seq)
+    return false;
+
+  /* On relve les processus termins depuis le dernier appel */
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
+    if (processes[i].pid)
+      get_return_code(processes[i].pid);
+
+  snprintf(msg, sizeof msg, "Seq.\tEvn.\tRet.\tPID\tCommande\n");
+  send_basic(socket, msg, strlen(msg));
+
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
     {
-      perror("fork");
-      return -1;
+      if (!processes[i].pid || processes[i].seq <= since)
+	continue;
+
+      int ret = processes[i].ret;
+      snprintf(msg, sizeof msg, "%lu\t%s\t%3d\t%d\t%s\n", processes[i].seq,
+	       ret == PROCESS_NOT_TERMINATED ? "cr" : "termin",
+	       ret, processes[i].pid, processes[i].command);
+      send_basic(socket, msg, strlen(msg));
     }
 
-  case 0: /* Fils */
+  for (unsigned i = 0; i < sizeof tombstones / sizeof tombstones[0]; i++)
     {
-      fflush(stdin); fflush(stdout); fflush(stderr);
-      setbuf(stdin, NULL); setbuf(stdout, NULL); setbuf(stderr, NULL);
+      if (tombstones[i].seq <= since)
+	continue;
 
-      dup2(procinfo->in[READ], STDIN_FILENO);
-      dup2(procinfo->out[WRITE], STDOUT_FILENO);      
-      dup2(procinfo->err[WRITE], STDERR_FILENO);
-      
-      close(procinfo->in[READ]); close(procinfo->in[WRITE]);
-      close(procinfo->out[READ]); close(procinfo->out[WRITE]);
-      close(procinfo->err[READ]); close(procinfo->err[WRITE]);
-      
-      execvp(prog, args);
-      perror("execvp");
-      exit(-1);
+      snprintf(msg, sizeof msg, "%lu\tdtruit\t%3d\t%d\t\n", tombstones[i].seq,
+	       tombstones[i].ret, tombstones[i].pid);
+      send_basic(socket, msg, strlen(msg));
     }
-    
-  default: /* Pre */
-    {
-      close(procinfo->in[READ]);
-      close(procinfo->out[WRITE]);
-      close(procinfo->err[WRITE]);
 
-      if (fcntl(procinfo->out[READ], F_SETFL, O_NONBLOCK) == -1 ||
-	  fcntl(procinfo->err[READ], F_SETFL, O_NONBLOCK) == -1)
-	perror("fcntl");
-      
-      char *cmd = malloc(MESSAGE_BUFFER_SIZE);
+  return true;
+}
 
-      /* Si le malloc a foir, cmd reste  NULL, donc NP */
-      if (cmd != NULL)
-	for (int i = 0; args[i] != NULL; i++)
-	  {
-	    strcat(cmd, args[i]);
-	    strcat(cmd, " ");
-	  }
+unsigned long last_change()
+{
+  return change_seq;
+}
 
-      else
-	perror("malloc");
+void destroy_all_process() {
+  /* Les emplacements libres peuvent tre n'importe o dans la table */
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
+    if (processes[i].pid)
+      destroy_process(processes[i].pid);
+}
 
-      procinfo->command = cmd;
+/**
+ * Libre ce que garde un processus en attente de ses dpendances pour
+ * tre lanc.
+ */
+static void free_waiting(processinfo_t *p)
+{
+  if (p->waiting == NULL)
+    return;
 
-      return procinfo->pid = proc;
-    }
-  }
+  for (char **arg = p->waiting; *arg != NULL; arg++)
+    free(*arg);
+  free(p->waiting);
+  free((char *) p->waiting_redir.in);
+  free((char *) p->waiting_redir.out);
+  free((char *) p->waiting_redir.err);
+  p->waiting = NULL;
 }
 
-
 /**
- * Indique si le processus d'id pid a t cre.
+ * Libre l'emplacement d'un processus, ses pipes et ses buffers, et n'en
+ * garde qu'une trace pour ListChanges.
  *
- * @param pid un id
- * @return true si le processus id existe, false sinon
+ * @param index l'emplacement du processus
+ * @param swept true s'il est retir par la rtention
  */
-bool process_exists(pid_t pid)
+static void remove_process(int index, bool swept)
 {
-  return index_of_process(pid) == -1 ? false : true;
-}
+  pid_t pid = processes[index].pid;
 
-void send_input(pid_t pid, const char *input)
-{
-  int index;
-  if ((index = index_of_process(pid)) < 0)
-    return;
+  /* L'entre en attente est abandonne */
+  outbuf_free(&processes[index].in_buf);
+  close_input(pid);
 
-  char *buf;
-  if ((buf = malloc(strlen(input) + 1 + 1)) == NULL)
-    {
-      perror("malloc");
-      return;
-    }
-  
-  sprintf(buf, "%s\n", input);
-  
-  if (write(processes[index].in[WRITE], buf, strlen(buf)) == -1)
-    perror("write");
-  
-  free(buf);
-}
+  close_fd(processes[index].out[READ]);
+  close_fd(processes[index].err[READ]);
+  processes[index].out[READ] = processes[index].err[READ] = -1;
 
-void close_input(pid_t pid)
-{
-  int index;
-  if ((index = index_of_process(pid)) < 0)
-    return;
+  /* Les lectures io_uring encore en cours ne concernent plus ce processus */
+  processes[index].gen++;
+  outbuf_free(&processes[index].out_buf);
+  outbuf_free(&processes[index].err_buf);
+  free(processes[index].command);
+  free(processes[index].tag);
+  free_waiting(processes + index);
+  cache_key_free(&processes[index].key);
+  shmring_free(&processes[index].ring);
 
-  /* Dj ferm ? */
-  if (processes[index].in[WRITE] == -1)
-    return;
-  
-  /* On ferme sinon ! */
-  if (close(processes[index].in[WRITE]) == -1)
-    perror("close");
-  else 
-    /* On le marque comme ferm, pour que input_open le sache */
-    processes[index].in[WRITE] = -1;
+  /* On garde une trace de la destruction pour ListChanges */
+  tombstone_t *tomb = tombstones + next_tombstone;
+  if (tomb->seq > lost_seq)
+    lost_seq = tomb->seq;
+
+  tomb->seq = ++change_seq;
+  tomb->pid = pid;
+  tomb->ret = processes[index].ret;
+  tomb->swept = swept;
+  next_tombstone = (next_tombstone + 1) % MAX_CHANGES;
+
+  processes[index].pid = 0;
 }
 
-void get_output(int socket, pid_t pid)
+/**
+ * Supprime le process avec le pid spcifi. Si le pid n'existe pas dans la liste, ne fait rien.
+ *
+ * @param pid pid  killer
+ */
+void destroy_process(pid_t pid)
 {
-  int index;
-  index = index_of_process(pid);
+  int index = index_of_process(pid);
   if (index < 0)
     return;
 
-  char buffer[STDOUT_BUFFER_SIZE];
-  bool must_n = false;
-  int n;
+  /* On le tue s'il n'est pas dj termin (un processus en attente n'a pas de fils) */
+  if (get_return_code(pid) == PROCESS_NOT_TERMINATED && processes[index].child > 0
+      && kill(processes[index].child, SIGHUP) == -1
+      && kill(processes[index].child, SIGKILL) == -1)
+    perror("kill");
 
-  while ((n = read(processes[index].out[READ], buffer, sizeof buffer)) > 0)
-    {
-      send_basic(socket, buffer, n);
-      must_n = true;
-    }
-  
-  if (n == -1)
-    perror("read");
-  
-  if (must_n)
-    send_basic(socket, "\n", 1);
+  remove_process(index, false);
 }
 
-void get_error(int socket, pid_t pid)
+/**
+ * Fin du dlai laiss au client pour demander les sorties d'un processus
+ * termin, compt depuis sa fin ou depuis son annonce.
+ *
+ * @return 0 si elles ont toutes deux t demandes
+ */
+static time_t claim_end(const processinfo_t *p)
 {
-  int index = index_of_process(pid);
-  if (index < 0)
-    return;
-  
-  char buffer[STDOUT_BUFFER_SIZE];
-  int n;
-  bool must_n = false;
-  
-  while ((n = read(processes[index].err[READ], buffer, sizeof buffer)) > 0) {
-    send_basic(socket, buffer, n);
-    must_n = true;
-  }
-  
-  if (n == -1)
-    perror("read");
-  
-  if (must_n)
-    send_basic(socket, "\n", 1);
+  if (p->unfetched == 0)
+    return 0;
+
+  return (p->reported > p->exited ? p->reported : p->exited) + RETENTION_GRACE;
 }
 
-int get_return_code(pid_t pid)
+/**
+ * Sorties pas encore demandes, dlai pas encore coul : le client va
+ * venir les chercher, la rtention ne compte ni ne retire le processus.
+ */
+static bool claimed(const processinfo_t *p, time_t now)
 {
-  int index = index_of_process(pid);
+  return claim_end(p) > now;
+}
 
-  if (index < 0) /* N'arrivera normalement jamais */
-    return PROCESS_NOT_TERMINATED;
+/**
+ * Le processus le plus anciennement termin parmi ceux que la rtention
+ * peut retirer.
+ *
+ * @return son emplacement, -1 s'il n'y en a pas
+ */
+static int oldest_finished(const pid_t busy[], unsigned nbusy)
+{
+  time_t now = time(NULL);
+  int oldest = -1;
 
-  /*
-   * Si on a dj rcup' le rc du process, on le renvoie, sinon, on
-   * tente de le rcup' 
-   */
-  if (processes[index].ret == PROCESS_NOT_TERMINATED)
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
     {
-      int status, i;
-      
-      switch (i = waitpid(pid, &status, WNOHANG))
-	{
+      processinfo_t *p = processes + i;
+      unsigned b = 0;
 
-	case -1: /* On passe en 0 galement */
-	  perror("waitpid");
-	  
-	case 0:
-	  return PROCESS_NOT_TERMINATED;
-	  
-        default:
-	  processes[index].ret = WEXITSTATUS(status);
-        }
+      if (!p->pid || p->ret == PROCESS_NOT_TERMINATED || claimed(p, now))
+	continue;
+      while (b < nbusy && busy[b] != p->pid)
+	b++;
+      if (b < nbusy)
+	continue;
+
+      if (oldest == -1 || p->exited < processes[oldest].exited
+	  || (p->exited == processes[oldest].exited && p->seq < processes[oldest].seq))
+	oldest = i;
     }
 
-  return processes[index].ret;
+  return oldest;
 }
 
-bool input_open(pid_t pid)
+/**
+ * Applique la politique de rtention aux processus termins : ceux dont
+ * la fin date de plus de ttl secondes sont retirs, puis les plus anciens
+ * tant qu'il en reste plus de max_finished ou que leurs sorties dpassent
+ * max_output. Seul le code de retour survit, dans les traces de
+ * destruction. Appel  chaque tour de boucle.
+ *
+ * Un processus dont les sorties n'ont pas t demandes depuis sa fin
+ * attend d'abord RETENTION_GRACE secondes, hors des limites.
+ *
+ * @param busy processus  garder quoi qu'il arrive (sortie en cours d'envoi)
+ * @param nbusy taille de busy
+ * @return le dlai avant la prochaine expiration en secondes, -1 s'il n'y en a pas
+ */
+int process_sweep(const retention_t *retention, const pid_t busy[], unsigned nbusy)
 {
-  int index = index_of_process(pid);
+  time_t now = time(NULL);
+  int i;
 
-  if (index < 0) /* N'arrivera normalement jamais */
-    return false;
+  if (retention->ttl == 0 && retention->max_finished == 0 && retention->max_output == 0)
+    return -1;
+
+  /* Relve les fins, et retire les plus anciens tant qu'une limite est dpasse */
+  for (;;)
+    {
+      unsigned finished = 0;
+      size_t output = 0;
+
+      for (unsigned j = 0; j < sizeof processes / sizeof processes[0]; j++)
+	if (processes[j].pid && get_return_code(processes[j].pid) != PROCESS_NOT_TERMINATED
+	    && !claimed(processes + j, now))
+	  {
+	    finished++;
+	    output += processes[j].out_buf.len + processes[j].err_buf.len;
+	  }
 
-  return processes[index].in[WRITE] == -1 ? false : true;
+      if ((i = oldest_finished(busy, nbusy)) == -1)
+	break;
+
+      if ((retention->ttl == 0 || processes[i].exited + (time_t) retention->ttl > now)
+	  && (retention->max_finished == 0 || finished <= retention->max_finished)
+	  && (retention->max_output == 0 || output <= retention->max_output))
+	break;
+
+      remove_process(i, true);
+      processes_swept++;
+    }
+
+  /* Le plus ancien restant expire le premier, sauf si un dlai de collecte finit avant */
+  int wait = i == -1 || retention->ttl == 0 ? -1 : (int) (processes[i].exited + retention->ttl - now);
+
+  for (unsigned j = 0; j < sizeof processes / sizeof processes[0]; j++)
+    if (processes[j].pid && claimed(processes + j, now)
+	&& (wait == -1 || claim_end(processes + j) - now < wait))
+      wait = claim_end(processes + j) - now;
+
+  return wait;
+}
+
+/**
+ * La fin d'un processus vient d'tre annonce  un client (WaitAny) : le
+ * dlai de RETENTION_GRACE secondes pour demander ses sorties repart.
+ *
+ * @param pid un pid, sans effet s'il a dj t retir
+ */
+void process_reported(pid_t pid)
+{
+  int index = index_of_process(pid);
+  if (index < 0)
+    return;
+
+  processes[index].reported = time(NULL);
+}
+
+/**
+ * La sortie d'un processus a t demande : elle ne le retient plus.
+ *
+ * @param stream STREAM_OUT ou STREAM_ERR
+ */
+static void output_fetched(int index, int stream)
+{
+  processes[index].unfetched &= ~(1u << stream);
+}
+
+/**
+ * La plus rcente trace de destruction d'un id.
+ *
+ * @return NULL si l'id n'en a pas, ou si elle a t recouverte
+ */
+static tombstone_t *find_tombstone(pid_t pid)
+{
+  for (unsigned n = 1; n <= MAX_CHANGES; n++)
+    {
+      tombstone_t *tomb = tombstones + (next_tombstone + MAX_CHANGES - n) % MAX_CHANGES;
+
+      if (tomb->seq != 0 && tomb->pid == pid)
+	return tomb;
+    }
+
+  return NULL;
+}
+
+/**
+ * Code de retour d'un processus retir par la rtention, tant que sa
+ * trace n'a pas t recouverte.
+ *
+ * @param ret reoit le code de retour
+ * @return false si pid n'a pas t retir par la rtention
+ */
+bool process_tombstone(pid_t pid, int *ret)
+{
+  tombstone_t *tomb = find_tombstone(pid);
+
+  if (tomb == NULL)
+    return false;
+
+  *ret = tomb->ret;
+  return tomb->swept;
+}
+
+/**
+ * Nombre de processus retirs par la rtention depuis le dmarrage.
+ */
+unsigned long process_swept()
+{
+  return processes_swept;
+}
+
+/**
+ * Construit la ligne de commande affiche par ListProcess.
+ *
+ * @return la ligne, NULL si l'allocation a chou
+ */
+static char *command_line(char *const args[])
+{
+  char *cmd = malloc(MESSAGE_BUFFER_SIZE);
+
+  /* Si le malloc a foir, cmd reste  NULL, donc NP */
+  if (cmd == NULL)
+    {
+      perror("malloc");
+      return NULL;
+    }
+
+  cmd[0] = '\0';
+  for (int i = 0; args[i] != NULL; i++)
+    {
+      strncat(cmd, args[i], MESSAGE_BUFFER_SIZE - strlen(cmd) - 1);
+      strncat(cmd, " ", MESSAGE_BUFFER_SIZE - strlen(cmd) - 1);
+    }
+
+  return cmd;
+}
+
+/**
+ * Dans le fils : branche un flux standard sur un fichier si le flux est
+ * redirig, sur son pipe sinon. En cas d'chec, le fils se termine.
+ *
+ * @param path fichier de la redirection, ou NULL
+ * @param flags mode d'ouverture du fichier
+ * @param pipe_fd extrmit du pipe rserve au fils
+ * @param std_fd STDIN_FILENO, STDOUT_FILENO ou STDERR_FILENO
+ */
+static void redirect_stream(const char *path, int flags, int pipe_fd, int std_fd)
+{
+  int fd = pipe_fd;
+
+  if (path != NULL && (fd = open(path, flags, 0666)) == -1)
+    {
+      perror(path);
+      exit(-1);
+    }
+
+  if (fd != std_fd)
+    {
+      dup2(fd, std_fd);
+      close(fd);
+    }
+
+  /* Le pipe tait dj  sa place : il doit survivre  l'exec */
+  else if (fd != -1)
+    fcntl(fd, F_SETFD, 0);
+}
+
+/**
+ * Lance le fils d'un processus dont les pipes sont ouverts (voir
+ * spawn_process).
+ *
+ * @return le pid du fils, -1 en cas d'erreur, les pipes tant alors ferms
+ */
+static pid_t fork_process(processinfo_t *procinfo, int exec_fd, const char *prog, char *const args[],
+			  const redirect_t *redir)
+{
+  pid_t proc;
+  TRACE_BEGIN(forking, fork, 0);
+  switch (proc = fork()) {
+
+  case -1: /* Erreur */
+    {
+      TRACE_END(forking, fork, -1);
+      perror("fork");
+      release_pipes(procinfo);
+      return -1;
+    }
+
+  case 0: /* Fils */
+    {
+      fflush(stdin); fflush(stdout); fflush(stderr);
+      setbuf(stdin, NULL); setbuf(stdout, NULL); setbuf(stderr, NULL);
+
+      if (procinfo->tag != NULL)
+	setpgid(0, 0);
+
+      close_fd(procinfo->in[WRITE]);
+      close_fd(procinfo->out[READ]);
+      close_fd(procinfo->err[READ]);
+
+      /* L'erreur d'abord, pour que les checs d'ouverture suivants y aillent */
+      if (!redir->merge_err)
+	redirect_stream(redir->err, O_WRONLY | O_CREAT | (redir->err_append ? O_APPEND : O_TRUNC),
+			procinfo->err[WRITE], STDERR_FILENO);
+      redirect_stream(redir->out, O_WRONLY | O_CREAT | (redir->out_append ? O_APPEND : O_TRUNC),
+		      procinfo->out[WRITE], STDOUT_FILENO);
+      if (redir->merge_err)
+	dup2(STDOUT_FILENO, STDERR_FILENO);
+      redirect_stream(redir->in, O_RDONLY, procinfo->in[READ], STDIN_FILENO);
+
+      /* La limite releve pour le dmon ne concerne pas le fils */
+      fd_restore_limit();
+
+      /* Le fils n'a plus que les sondes USDT : son traceur est une copie perdue */
+      TRACE_PROBE(exec, prog);
+
+      if (exec_fd != -1)
+	{
+	  /*
+	   * fexecve choue sur un script si le descripteur est
+	   * close-on-exec : on se rabat alors sur le chemin rsolu.
+	   */
+	  fexecve(exec_fd, args, environ);
+	  execv(prog, args);
+	  perror("execv");
+	  exit(-1);
+	}
+
+      execvp(prog, args);
+      perror("execvp");
+      exit(-1);
+    }
+    
+  default: /* Pre */
+    {
+      TRACE_END(forking, fork, proc);
+      close_fd(procinfo->in[READ]);
+      close_fd(procinfo->out[WRITE]);
+      close_fd(procinfo->err[WRITE]);
+
+      /* Aussi dans le pre : DestroyGroup peut arriver avant que le fils s'excute */
+      if (procinfo->tag != NULL)
+	{
+	  setpgid(proc, proc);
+	  procinfo->group_leader = true;
+	}
+
+      /* Les flux redirigs n'ont pas de pipe : rien  surveiller */
+      TRACE_BEGIN(nonblock, fcntl, proc);
+      if ((procinfo->out[READ] != -1 && fcntl(procinfo->out[READ], F_SETFL, O_NONBLOCK) == -1) ||
+	  (procinfo->err[READ] != -1 && fcntl(procinfo->err[READ], F_SETFL, O_NONBLOCK) == -1) ||
+	  (procinfo->in[WRITE] != -1 && fcntl(procinfo->in[WRITE], F_SETFL, O_NONBLOCK) == -1))
+	perror("fcntl");
+      TRACE_END(nonblock, fcntl, proc);
+
+      return proc;
+    }
+  }
+}
+
+/**
+ * Lance un processus. Si exec_fd est valide, l'excutable est lanc
+ * directement depuis ce descripteur (fexecve) sans parcourir le $PATH ;
+ * prog est alors le chemin absolu de secours, sinon c'est un nom cherch
+ * dans le $PATH par execvp.
+ *
+ * @param exec_fd descripteur O_PATH de l'excutable ou -1
+ * @param prog nom ou chemin du programme
+ * @param args arguments (args[0] compris), termins par NULL
+ * @param redir redirections vers des fichiers, ou NULL
+ * @param tag groupe du processus, ou NULL. Un processus d'un groupe a son
+ * propre groupe de processus, pour que DestroyGroup atteigne ses fils.
+ * @return le pid du processus, -1 en cas d'erreur
+ */
+static pid_t spawn_process(int exec_fd, const char *prog, char *const args[], const redirect_t *redir,
+			   const char *tag)
+{
+  static const redirect_t no_redirection = { NULL, NULL, NULL, false, false, false };
+  processinfo_t *procinfo;
+
+  if (redir == NULL)
+    redir = &no_redirection;
+
+  if (prog == NULL)
+    return -1;
+
+  TRACE_BEGIN(pipes, pipe, 0);
+  procinfo = add_process(true, redir);
+  TRACE_END(pipes, pipe, 0);
+  if (procinfo == NULL)
+    return -1;
+
+  if (tag != NULL && (procinfo->tag = strdup(tag)) == NULL)
+    {
+      perror("strdup");
+      release_pipes(procinfo);
+      return -1;
+    }
+
+  pid_t proc = fork_process(procinfo, exec_fd, prog, args, redir);
+  if (proc == -1)
+    {
+      free(procinfo->tag);
+      procinfo->tag = NULL;
+      return -1;
+    }
+
+  procinfo->command = command_line(args);
+  procinfo->seq = ++change_seq;
+
+  return procinfo->pid = procinfo->child = proc;
+}
+
+pid_t create_process(const char *prog, char *const args[], const redirect_t *redir, const char *tag)
+{
+  return spawn_process(-1, prog, args, redir, tag);
+}
+
+pid_t create_process_fd(int exec_fd, const char *path, char *const args[])
+{
+  return spawn_process(exec_fd, path, args, NULL, NULL);
+}
+
+/**
+ * Cre un processus dont le rsultat peut tre servi depuis le cache. Sur
+ * un succs du cache, aucun fork n'a lieu : le processus est cr dj
+ * termin, avec les sorties et le code de retour enregistrs. Sinon la
+ * commande est lance et son rsultat sera enregistr  sa fin.
+ *
+ * @param args arguments (args[0] compris), termins par NULL
+ * @param redir seule l'entre peut tre redirige : sans elle, la commande
+ * n'a pas d'entre (une entre par SendInput ne ferait pas partie de la cl)
+ * @param inputs fichiers lus par la commande, termins par NULL
+ * @param tag groupe du processus, ou NULL
+ * @return l'id du processus, -1 en cas d'erreur
+ */
+pid_t create_cached_process(char *const args[], const redirect_t *redir, char *const inputs[],
+			    const char *tag)
+{
+  redirect_t stdin_only = { "/dev/null", NULL, NULL, false, false, false };
+  processinfo_t *procinfo;
+  outbuf_t out, err;
+  cachekey_t key;
+  int ret;
+
+  if (redir->out != NULL || redir->err != NULL)
+    return -1;
+  if (redir->in != NULL)
+    stdin_only.in = redir->in;
+
+  if (args[0] == NULL || !cache_key(&key, args, redir->in, inputs))
+    return -1;
+
+  outbuf_init(&out);
+  outbuf_init(&err);
+
+  if (!cache_lookup(&key, &ret, &out, &err))
+    {
+      outbuf_free(&out);
+      outbuf_free(&err);
+
+      pid_t pid = spawn_process(-1, args[0], args, &stdin_only, tag);
+      if (pid == -1)
+	cache_key_free(&key);
+      else
+	processes[index_of_process(pid)].key = key;
+      return pid;
+    }
+
+  cache_key_free(&key);
+  if ((procinfo = add_process(false, NULL)) == NULL)
+    {
+      outbuf_free(&out);
+      outbuf_free(&err);
+      return -1;
+    }
+
+  procinfo->ret = ret;
+  procinfo->exited = time(NULL);
+  procinfo->unfetched = UNFETCHED;
+  procinfo->out_buf = out;
+  procinfo->err_buf = err;
+  if (!outbuf_seal(&procinfo->out_buf) || !outbuf_seal(&procinfo->err_buf))
+    perror("outbuf_seal");
+  if (tag != NULL && (procinfo->tag = strdup(tag)) == NULL)
+    {
+      /* L'emplacement reste libre tant que son pid est nul */
+      perror("strdup");
+      outbuf_free(&procinfo->out_buf);
+      outbuf_free(&procinfo->err_buf);
+      return -1;
+    }
+  procinfo->command = command_line(args);
+  procinfo->seq = ++change_seq;
+
+  return procinfo->pid = next_cached_id++;
+}
+
+/**
+ * Enregistre le rsultat d'un processus dans le cache, s'il le faut et si
+ * le processus est termin et ses sorties entirement lues. Seule une fin
+ * par exit est enregistre : un processus annul ou dont le code peut
+ * venir d'un signal (PROCESS_SIGNALED et au-del) n'est pas rejou.
+ */
+static void cache_result(processinfo_t *p)
+{
+  if (p->key.data == NULL || p->out[READ] != -1 || p->err[READ] != -1)
+    return;
+
+  if (p->ret < 0 || p->ret >= PROCESS_SIGNALED)
+    {
+      if (p->ret != PROCESS_NOT_TERMINATED)
+	cache_key_free(&p->key);
+      return;
+    }
+
+  cache_store(&p->key, p->ret, &p->out_buf, &p->err_buf);
+  cache_key_free(&p->key);
+}
+
+/**
+ * Relve la fin des processus dont le rsultat est  mettre en cache et
+ * dont les sorties sont entirement lues. Appel  chaque tour de boucle,
+ * le SIGCHLD d'un fils interrompant l'attente.
+ */
+void cache_finished()
+{
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
+    if (processes[i].pid && processes[i].key.data != NULL
+	&& processes[i].out[READ] == -1 && processes[i].err[READ] == -1)
+      get_return_code(processes[i].pid);
+}
+
+
+/**
+ * Sauvegarde la table des processus pour Reexec. Les pipes restent
+ * ouverts  travers l'exec, et les fils restent nos fils : ils ne voient
+ * rien du changement de binaire.
+ */
+void process_save(state_t *state)
+{
+  unsigned n = 0;
+
+  state_put_int(state, change_seq);
+  state_put_int(state, lost_seq);
+  state_put_int(state, next_cached_id);
+  state_put_int(state, next_tombstone);
+  for (unsigned i = 0; i < sizeof tombstones / sizeof tombstones[0]; i++)
+    {
+      state_put_int(state, tombstones[i].seq);
+      state_put_int(state, tombstones[i].pid);
+      state_put_int(state, tombstones[i].ret);
+      state_put_int(state, tombstones[i].swept);
+    }
+
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
+    if (processes[i].pid)
+      n++;
+
+  state_put_int(state, n);
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
+    {
+      processinfo_t *p = processes + i;
+
+      if (!p->pid)
+	continue;
+
+      state_put_int(state, p->pid);
+      state_put_int(state, p->ret);
+      state_put_fd(state, p->in[WRITE]);
+      state_put_fd(state, p->out[READ]);
+      state_put_fd(state, p->err[READ]);
+      outbuf_save(state, &p->out_buf);
+      outbuf_save(state, &p->err_buf);
+      outbuf_save(state, &p->in_buf);
+      state_put_int(state, p->in_closing);
+      state_put_str(state, p->command);
+      state_put_int(state, p->seq);
+      state_put_int(state, p->key.len);
+      state_put(state, p->key.data, p->key.len);
+      state_put_int(state, p->key.hash);
+      state_put_fd(state, p->ring.fd);
+      state_put_str(state, p->tag);
+      state_put_int(state, p->group_leader);
+      state_put_int(state, p->exited);
+      state_put_int(state, p->reported);
+      state_put_int(state, p->unfetched);
+      state_put_int(state, p->child);
+      state_put_int(state, p->nafter);
+      for (unsigned a = 0; a < p->nafter; a++)
+	{
+	  state_put_int(state, p->after[a].id);
+	  state_put_int(state, p->after[a].any);
+	}
+
+      /* Un processus en attente : de quoi le lancer */
+      unsigned nargs = 0;
+      while (p->waiting != NULL && p->waiting[nargs] != NULL)
+	nargs++;
+      state_put_int(state, p->waiting != NULL ? (long long) nargs : -1);
+      for (unsigned a = 0; a < nargs; a++)
+	state_put_str(state, p->waiting[a]);
+      if (p->waiting != NULL)
+	{
+	  state_put_str(state, p->waiting_redir.in);
+	  state_put_str(state, p->waiting_redir.out);
+	  state_put_str(state, p->waiting_redir.err);
+	  state_put_int(state, p->waiting_redir.out_append);
+	  state_put_int(state, p->waiting_redir.err_append);
+	  state_put_int(state, p->waiting_redir.merge_err);
+	}
+    }
+}
+
+/**
+ * Relit la table des processus sauvegarde par process_save.
+ *
+ * @return false en cas d'erreur
+ */
+bool process_restore(state_t *state)
+{
+  change_seq = state_get_int(state);
+  lost_seq = state_get_int(state);
+  next_cached_id = state_get_int(state);
+  next_tombstone = state_get_int(state) % MAX_CHANGES;
+  for (unsigned i = 0; i < sizeof tombstones / sizeof tombstones[0]; i++)
+    {
+      tombstones[i].seq = state_get_int(state);
+      tombstones[i].pid = state_get_int(state);
+      tombstones[i].ret = state_get_int(state);
+      tombstones[i].swept = state_get_int(state);
+    }
+
+  for (long long n = state_get_int(state); n > 0 && state->ok; n--)
+    {
+      processinfo_t *p = add_process(false, NULL);
+      int ring_fd;
+
+      if (p == NULL)
+	return false;
+
+      p->pid = state_get_int(state);
+      p->ret = state_get_int(state);
+      p->in[WRITE] = state_get_fd(state);
+      p->out[READ] = state_get_fd(state);
+      p->err[READ] = state_get_fd(state);
+      outbuf_restore(state, &p->out_buf);
+      outbuf_restore(state, &p->err_buf);
+      outbuf_restore(state, &p->in_buf);
+      p->in_closing = state_get_int(state);
+      p->command = state_get_str(state);
+      p->seq = state_get_int(state);
+      p->key.len = state_get_int(state);
+      p->key.data = state_get_data(state, p->key.len);
+      p->key.hash = state_get_int(state);
+      if ((ring_fd = state_get_fd(state)) != -1 && !shmring_attach(&p->ring, ring_fd))
+	close(ring_fd);
+      p->tag = state_get_str(state);
+      p->group_leader = state_get_int(state);
+      p->exited = state_get_int(state);
+      p->reported = state_get_int(state);
+      p->unfetched = state_get_int(state);
+      p->child = state_get_int(state);
+      p->nafter = state_get_int(state) % (MAX_AFTER + 1);
+      for (unsigned a = 0; a < p->nafter; a++)
+	{
+	  p->after[a].id = state_get_int(state);
+	  p->after[a].any = state_get_int(state);
+	}
+
+      long long nargs = state_get_int(state);
+      if (nargs >= 0 && state->ok)
+	{
+	  if ((p->waiting = calloc(nargs + 1, sizeof *p->waiting)) == NULL)
+	    return false;
+	  for (long long a = 0; a < nargs; a++)
+	    p->waiting[a] = state_get_str(state);
+	  p->waiting_redir.in = state_get_str(state);
+	  p->waiting_redir.out = state_get_str(state);
+	  p->waiting_redir.err = state_get_str(state);
+	  p->waiting_redir.out_append = state_get_int(state);
+	  p->waiting_redir.err_append = state_get_int(state);
+	  p->waiting_redir.merge_err = state_get_int(state);
+	}
+
+      /* Les sorties compltes retrouvent leurs morceaux partags */
+      if (p->out[READ] == -1)
+	outbuf_seal(&p->out_buf);
+      if (p->err[READ] == -1)
+	outbuf_seal(&p->err_buf);
+    }
+
+  return state->ok;
+}
+
+/**
+ * Indique si le processus d'id pid a t cre.
+ *
+ * @param pid un id
+ * @return true si le processus id existe, false sinon
+ */
+bool process_exists(pid_t pid)
+{
+  return index_of_process(pid) == -1 ? false : true;
+}
+
+void send_input(pid_t pid, const char *input)
+{
+  int index;
+  if ((index = index_of_process(pid)) < 0)
+    return;
+
+  /*
+   * L'criture se fait depuis la boucle d'vnements, quand le pipe est
+   * prt : un fils qui ne lit pas son entre ne bloque pas le dmon.
+   */
+  outbuf_t *buf = &processes[index].in_buf;
+  if (!outbuf_append(buf, input, strlen(input)) || !outbuf_append(buf, "\n", 1))
+    perror("send_input");
+}
+
+void close_input(pid_t pid)
+{
+  int index;
+  if ((index = index_of_process(pid)) < 0)
+    return;
+
+  /* Dj ferm ? */
+  if (processes[index].in[WRITE] == -1)
+    return;
+
+  /* Il reste de l'entre  crire : on fermera aprs */
+  if (processes[index].in_buf.sent < processes[index].in_buf.len)
+    {
+      processes[index].in_closing = true;
+      return;
+    }
+
+  /* On ferme sinon ! */
+  if (close(processes[index].in[WRITE]) == -1)
+    perror("close");
+  else 
+    /* On le marque comme ferm, pour que input_open le sache */
+    processes[index].in[WRITE] = -1;
+}
+
+/**
+ * Envoie les octets [start, end[ d'une sortie, morceau par morceau si
+ * elle est scelle.
+ */
+static void send_range(int socket, const outbuf_t *buf, size_t start, size_t end)
+{
+  const char *data;
+  size_t n;
+
+  for (; start < end && (n = outbuf_span(buf, start, &data)) > 0; start += n)
+    {
+      if (n > end - start)
+	n = end - start;
+      send_basic(socket, data, n);
+    }
+}
+
+/**
+ * Vide le pipe dans le buffer, puis envoie ce qui n'a pas encore t
+ * transmis au client.
+ */
+static void send_new_output(int socket, outbuf_t *buf)
+{
+  if (buf->sent == buf->len)
+    return;
+
+  send_range(socket, buf, buf->sent, buf->len);
+  buf->sent = buf->len;
+  send_basic(socket, "\n", 1);
+}
+
+void get_output(int socket, pid_t pid)
+{
+  int index;
+  index = index_of_process(pid);
+  if (index < 0)
+    return;
+
+  output_fetched(index, STREAM_OUT);
+  send_new_output(socket, &processes[index].out_buf);
+}
+
+void get_error(int socket, pid_t pid)
+{
+  int index = index_of_process(pid);
+  if (index < 0)
+    return;
+
+  output_fetched(index, STREAM_ERR);
+  send_new_output(socket, &processes[index].err_buf);
+}
+
+/**
+ * Retourne le buffer d'un flux de sortie d'un processus.
+ */
+static outbuf_t *output_buffer(pid_t pid, int stream)
+{
+  int index = index_of_process(pid);
+  if (index < 0)
+    return NULL;
+
+  return stream == STREAM_OUT ? &processes[index].out_buf : &processes[index].err_buf;
+}
+
+/**
+ * Comme get_output/get_error, mais sans rien envoyer : la sortie pas
+ * encore transmise est marque comme envoye, et ses bornes retournes
+ * pour un transfert par trames.
+ *
+ * @param stream STREAM_OUT ou STREAM_ERR
+ * @param start reoit la position du premier octet  transmettre
+ * @param end reoit la position qui suit le dernier
+ * @return false si le processus n'existe pas
+ */
+bool take_output(pid_t pid, int stream, size_t *start, size_t *end)
+{
+  outbuf_t *buf = output_buffer(pid, stream);
+  if (buf == NULL)
+    return false;
+
+  output_fetched(index_of_process(pid), stream);
+  *start = buf->sent;
+  *end = buf->sent = buf->len;
+  return true;
+}
+
+/**
+ * Donne accs  la sortie d'un processus  partir d'une position, sans
+ * copie. Le pointeur n'est valable que jusqu' la prochaine lecture du
+ * pipe. Une sortie scelle est donne morceau par morceau.
+ *
+ * @param stream STREAM_OUT ou STREAM_ERR
+ * @param offset position dans la sortie
+ * @param data reoit l'adresse de l'octet  offset
+ * @return le nombre d'octets disponibles  partir de offset, 0 si le
+ * processus a disparu
+ */
+size_t output_at(pid_t pid, int stream, size_t offset, const char **data)
+{
+  outbuf_t *buf = output_buffer(pid, stream);
+  if (buf == NULL)
+    return 0;
+
+  return outbuf_span(buf, offset, data);
+}
+
+/**
+ * Envoie les lignes [first, last[ de la sortie standard d'un processus.
+ */
+static void send_output_lines(int socket, outbuf_t *buf, size_t first, size_t last)
+{
+  size_t start, end;
+
+  for (size_t i = first; i < last; i++)
+    {
+      outbuf_line(buf, i, &start, &end);
+      send_range(socket, buf, start, end);
+      send_basic(socket, "\n", 1);
+    }
+}
+
+/**
+ * Donne accs  la sortie standard d'un processus par un anneau en
+ * mmoire partage. L'anneau est cr  la premire demande, avec la
+ * sortie dj reue, puis suit la sortie au fil des lectures.
+ *
+ * @param pid un id de processus
+ * @return un descripteur en lecture seule du memfd,  fermer par
+ * l'appelant, ou -1
+ */
+int export_output(pid_t pid)
+{
+  int index = index_of_process(pid);
+  if (index < 0)
+    return -1;
+
+  processinfo_t *p = processes + index;
+  if (p->ring.fd == -1)
+    {
+      if (!shmring_open(&p->ring))
+	return -1;
+
+      const char *data;
+      for (size_t offset = 0, n; (n = outbuf_span(&p->out_buf, offset, &data)) > 0; offset += n)
+	shmring_write(&p->ring, data, n);
+      if (p->out[READ] == -1)
+	shmring_close(&p->ring);
+    }
+
+  return shmring_export(&p->ring);
+}
+
+bool grep_output(int socket, pid_t pid, const char *pattern)
+{
+  int index = index_of_process(pid);
+  if (index < 0)
+    return false;
+
+  regex_t re;
+  if (regcomp(&re, pattern, REG_EXTENDED | REG_NOSUB | REG_NEWLINE) != 0)
+    return false;
+
+  outbuf_t *buf = &processes[index].out_buf;
+  size_t n = outbuf_count_lines(buf);
+  char *copy = NULL;
+  size_t copy_size = 0;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      regmatch_t match;
+      const char *line;
+      size_t start, end;
+
+      /*
+       * REG_STARTEND : on cherche en place, sans recopier la ligne, sauf
+       * si elle est  cheval sur deux morceaux d'une sortie scelle
+       */
+      outbuf_line(buf, i, &start, &end);
+      if (start == end)
+	line = "";
+      else if (outbuf_span(buf, start, &line) < end - start)
+	{
+	  if (end - start > copy_size)
+	    {
+	      char *bigger = realloc(copy, end - start);
+	      if (bigger == NULL)
+		continue;
+	      copy = bigger;
+	      copy_size = end - start;
+	    }
+	  for (size_t at = start, k; at < end; at += k)
+	    {
+	      const char *span;
+	      k = outbuf_span(buf, at, &span);
+	      if (k > end - at)
+		k = end - at;
+	      memcpy(copy + (at - start), span, k);
+	    }
+	  line = copy;
+	}
+
+      match.rm_so = 0;
+      match.rm_eo = end - start;
+      if (regexec(&re, line, 1, &match, REG_STARTEND) == 0)
+	send_output_lines(socket, buf, i, i + 1);
+    }
+
+  free(copy);
+  regfree(&re);
+  return true;
+}
+
+void head_output(int socket, pid_t pid, size_t count)
+{
+  int index = index_of_process(pid);
+  if (index < 0)
+    return;
+
+  outbuf_t *buf = &processes[index].out_buf;
+  size_t n = outbuf_count_lines(buf);
+  send_output_lines(socket, buf, 0, count < n ? count : n);
+}
+
+void tail_output(int socket, pid_t pid, size_t count)
+{
+  int index = index_of_process(pid);
+  if (index < 0)
+    return;
+
+  outbuf_t *buf = &processes[index].out_buf;
+  size_t n = outbuf_count_lines(buf);
+  send_output_lines(socket, buf, count < n ? n - count : 0, n);
+}
+
+/**
+ * Note la fin d'un processus, releve par waitpid.
+ */
+static void process_exited(processinfo_t *p, int status)
+{
+  p->ret = WIFEXITED(status) ? WEXITSTATUS(status) : PROCESS_SIGNALED + WTERMSIG(status);
+  p->seq = ++change_seq;
+  p->exited = time(NULL);
+  p->unfetched = UNFETCHED;
+
+  /* Tu par un signal : le rsultat n'est pas celui de la commande */
+  if (!WIFEXITED(status))
+    cache_key_free(&p->key);
+  cache_result(p);
+}
+
+int get_return_code(pid_t pid)
+{
+  int index = index_of_process(pid);
+
+  if (index < 0) /* N'arrivera normalement jamais */
+    return PROCESS_NOT_TERMINATED;
+
+  /*
+   * Si on a dj rcup' le rc du process, on le renvoie, sinon, on
+   * tente de le rcup' 
+   */
+  if (processes[index].ret == PROCESS_NOT_TERMINATED && processes[index].child > 0)
+    {
+      int status, i;
+
+      switch (i = waitpid(processes[index].child, &status, WNOHANG))
+	{
+
+	case -1: /* On passe en 0 galement */
+	  perror("waitpid");
+	  
+	case 0:
+	  return PROCESS_NOT_TERMINATED;
+	  
+	default:
+	  process_exited(processes + index, status);
+	}
+    }
+
+  return processes[index].ret;
+}
+
+/**
+ * Indique si un processus fait partie d'un groupe.
+ */
+static bool in_group(const processinfo_t *p, const char *tag)
+{
+  return p->pid && p->tag != NULL && !strcmp(p->tag, tag);
+}
+
+/**
+ * Issue d'une dpendance (--after).
+ *
+ * @return son code de retour, PROCESS_NOT_TERMINATED si elle n'est pas
+ * finie, PROCESS_CANCELLED si elle a t dtruite avant sa fin ou si sa
+ * trace a t recouverte
+ */
+static int after_result(pid_t id)
+{
+  tombstone_t *tomb;
+
+  if (index_of_process(id) >= 0)
+    return get_return_code(id);
+
+  if ((tomb = find_tombstone(id)) == NULL || tomb->ret == PROCESS_NOT_TERMINATED)
+    return PROCESS_CANCELLED;
+  return tomb->ret;
+}
+
+/**
+ * Lance un processus dont les dpendances sont finies, ou l'annule. Un
+ * processus qui n'a pas pu tre lanc est annul lui aussi.
+ *
+ * @param launch false pour l'annuler
+ */
+static void finish_waiting(processinfo_t *p, bool launch)
+{
+  pid_t proc = -1;
+
+  if (launch && open_pipes(p, &p->waiting_redir))
+    proc = fork_process(p, -1, p->waiting[0], p->waiting, &p->waiting_redir);
+
+  if (proc == -1)
+    {
+      p->ret = PROCESS_CANCELLED;
+      p->exited = time(NULL);
+      p->unfetched = UNFETCHED;
+      cache_key_free(&p->key);
+    }
+  else
+    p->child = proc;
+
+  p->seq = ++change_seq;
+  free_waiting(p);
+}
+
+/**
+ * Lance les processus en attente dont toutes les dpendances sont
+ * finies, et annule ceux dont une dpendance exige a chou. Une
+ * annulation peut en entraner d'autres : on recommence jusqu' ce que
+ * plus rien ne change.
+ */
+static void graph_advance()
+{
+  bool changed = true;
+
+  while (changed)
+    {
+      changed = false;
+
+      for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
+	{
+	  processinfo_t *p = processes + i;
+	  bool ready = true, failed = false;
+
+	  if (!p->pid || p->waiting == NULL)
+	    continue;
+
+	  for (unsigned a = 0; a < p->nafter && !failed; a++)
+	    {
+	      int ret = after_result(p->after[a].id);
+
+	      if (ret == PROCESS_NOT_TERMINATED)
+		ready = false;
+	      else if (ret != 0 && !p->after[a].any)
+		failed = true;
+	    }
+
+	  /* Faute de descripteurs, le lancement attend un prochain tour */
+	  if (failed || (ready && fd_available(FD_PER_PROCESS)))
+	    {
+	      finish_waiting(p, !failed);
+	      changed = true;
+	    }
+	}
+    }
+}
+
+/**
+ * Duplique une chane qui peut tre NULL.
+ *
+ * @return false si la mmoire manque
+ */
+static bool copy_path(const char **dst, const char *src)
+{
+  return src == NULL || (*dst = strdup(src)) != NULL;
+}
+
+/**
+ * Cre un processus qui ne sera lanc qu' la fin de ses dpendances
+ * (CreateProcess --after). En attendant, il a un id sans fils, comme un
+ * processus servi depuis le cache, et fait dj partie de son groupe.
+ *
+ * @param args arguments (args[0] compris), termins par NULL
+ * @param redir redirections vers des fichiers
+ * @param tag groupe du processus, ou NULL
+ * @param after les dpendances, voir resolve_after
+ * @return l'id du processus, -1 en cas d'erreur
+ */
+pid_t create_after_process(char *const args[], const redirect_t *redir, const char *tag,
+			   const after_t *after, unsigned nafter)
+{
+  processinfo_t *p;
+  unsigned nargs = 0;
+  bool ok;
+
+  if (args[0] == NULL || nafter == 0 || nafter > MAX_AFTER
+      || (p = add_process(false, NULL)) == NULL)
+    return -1;
+
+  while (args[nargs] != NULL)
+    nargs++;
+
+  ok = (p->waiting = calloc(nargs + 1, sizeof *p->waiting)) != NULL;
+  for (unsigned i = 0; ok && i < nargs; i++)
+    ok = (p->waiting[i] = strdup(args[i])) != NULL;
+
+  p->waiting_redir = *redir;
+  p->waiting_redir.in = p->waiting_redir.out = p->waiting_redir.err = NULL;
+  ok = ok && copy_path(&p->waiting_redir.in, redir->in) && copy_path(&p->waiting_redir.out, redir->out)
+    && copy_path(&p->waiting_redir.err, redir->err)
+    && copy_path((const char **) &p->tag, tag)
+    && (p->command = command_line(args)) != NULL;
+
+  if (!ok)
+    {
+      perror("create_after_process");
+      free_waiting(p);
+      free(p->tag);
+      free(p->command);
+      return -1;
+    }
+
+  memcpy(p->after, after, nafter * sizeof *after);
+  p->nafter = nafter;
+  p->seq = ++change_seq;
+  p->pid = next_cached_id++;
+
+  /* Les dpendances sont peut-tre dj finies */
+  graph_advance();
+  return p->pid;
+}
+
+/**
+ * Ajoute des dpendances : un id (processus de la table ou dj dtruit),
+ * ou un groupe, dont les membres du moment sont repris un par un.
+ *
+ * @param target un id ou un nom de groupe
+ * @param any true pour dpendre de la fin, russie ou non
+ * @param after les dpendances dj notes
+ * @param n leur nombre
+ * @return le nouveau nombre de dpendances, -1 si target est inconnu ou
+ * s'il y en a plus de MAX_AFTER
+ */
+int resolve_after(const char *target, bool any, after_t *after, unsigned n)
+{
+  char *end;
+  long id = strtol(target, &end, 10);
+  unsigned first = n;
+
+  if (*target != '\0' && *end == '\0')
+    {
+      if (n == MAX_AFTER || (index_of_process(id) < 0 && find_tombstone(id) == NULL))
+	return -1;
+
+      after[n].id = id;
+      after[n++].any = any;
+      return n;
+    }
+
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
+    if (in_group(processes + i, target))
+      {
+	if (n == MAX_AFTER)
+	  return -1;
+	after[n].id = processes[i].pid;
+	after[n++].any = any;
+      }
+
+  return n == first ? -1 : (int) n;
+}
+
+/**
+ * Indique si un processus est une dpendance d'un autre.
+ */
+static bool is_after(pid_t id)
+{
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
+    for (unsigned a = 0; processes[i].pid && a < processes[i].nafter; a++)
+      if (processes[i].after[a].id == id)
+	return true;
+
+  return false;
+}
+
+/**
+ * Liste les processus lis par --after : ceux qui ont des dpendances,
+ * et ces dpendances, avec leur tat.
+ *
+ * @return le nombre de processus lists
+ */
+unsigned graph_status(int socket)
+{
+  char msg[MESSAGE_BUFFER_SIZE];
+  unsigned n = 0;
+
+  snprintf(msg, sizeof msg, "Id\ttat\tRet.\tAprs\tCommande\n");
+  send_basic(socket, msg, strlen(msg));
+
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
+    {
+      processinfo_t *p = processes + i;
+      char after[MAX_AFTER * 24] = "";
+      size_t len = 0;
+
+      if (!p->pid || (p->nafter == 0 && !is_after(p->pid)))
+	continue;
+
+      for (unsigned a = 0; a < p->nafter; a++)
+	len += snprintf(after + len, sizeof after - len, "%s%d:%s", a ? "," : "",
+			p->after[a].id, p->after[a].any ? AFTER_ANY : AFTER_SUCCESS);
+
+      int ret = get_return_code(p->pid);
+      snprintf(msg, sizeof msg, "%d\t%s\t%3d\t%s\t%s\n", p->pid,
+	       p->waiting != NULL ? "attente"
+	       : ret == PROCESS_NOT_TERMINATED ? "en cours"
+	       : ret == PROCESS_CANCELLED ? "annul" : "termin",
+	       ret, len > 0 ? after : "-", p->command);
+      send_basic(socket, msg, strlen(msg));
+      n++;
+    }
+
+  return n;
+}
+
+/**
+ * Rcolte les fils termins. Ceux de la table y gardent leur code de
+ * retour ; ceux qui en ont t retirs avant leur fin (DestroyProcess
+ * sur un processus en cours) ne resteraient sinon zombies. Appel 
+ * chaque tour de boucle, le SIGCHLD d'un fils interrompant l'attente :
+ * les processus attendant ces fils (--after) sont alors lancs.
+ */
+void reap_children()
+{
+  pid_t pid;
+  int status;
+
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+      int index = index_of_child(pid);
+
+      if (index >= 0 && processes[index].ret == PROCESS_NOT_TERMINATED)
+	process_exited(processes + index, status);
+    }
+
+  graph_advance();
+}
+
+/**
+ * Dtruit tous les processus d'un groupe. Chacun ayant son propre groupe
+ * de processus, les fils qu'il a lancs sont tus avec lui.
+ *
+ * @param tag un groupe
+ * @return le nombre de processus dtruits
+ */
+unsigned destroy_group(const char *tag)
+{
+  unsigned n = 0;
+
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
+    {
+      if (!in_group(processes + i, tag))
+	continue;
+
+      /* Mme termin, le processus a pu laisser des fils dans son groupe */
+      if (processes[i].group_leader && killpg(processes[i].child, SIGHUP) == -1
+	  && errno != ESRCH)
+	perror("killpg");
+
+      destroy_process(processes[i].pid);
+      n++;
+    }
+
+  return n;
+}
+
+/**
+ * Relve la fin des processus d'un groupe.
+ *
+ * @param tag un groupe
+ * @param failed reoit le nombre de processus termins avec un code non nul
+ * @return le nombre de processus encore en cours, -1 si le groupe est vide
+ */
+int wait_group(const char *tag, unsigned *failed)
+{
+  int running = -1;
+
+  *failed = 0;
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
+    {
+      if (!in_group(processes + i, tag))
+	continue;
+
+      if (running == -1)
+	running = 0;
+
+      int ret = get_return_code(processes[i].pid);
+      if (ret == PROCESS_NOT_TERMINATED)
+	running++;
+      else if (ret != 0)
+	(*failed)++;
+    }
+
+  return running;
+}
+
+/**
+ * La fin d'un groupe vient d'tre annonce (WaitGroup) : ses processus
+ * attendent leur collecte comme aprs process_reported.
+ */
+void group_reported(const char *tag)
+{
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
+    if (in_group(processes + i, tag))
+      process_reported(processes[i].pid);
+}
+
+/**
+ * Indique si un processus est termin et si ses sorties ont t lues
+ * jusqu'au bout : GetOutput et GetError renverront alors tout.
+ *
+ * @return son code de retour, PROCESS_NOT_TERMINATED sinon
+ */
+int process_finished(pid_t pid)
+{
+  int index = index_of_process(pid);
+  if (index < 0)
+    return PROCESS_NOT_TERMINATED;
+
+  int ret = get_return_code(pid);
+  if (processes[index].out[READ] != -1 || processes[index].err[READ] != -1)
+    return PROCESS_NOT_TERMINATED;
+
+  return ret;
+}
+
+/**
+ * Liste les processus d'un groupe, comme ListProcess.
+ *
+ * @return le nombre de processus du groupe
+ */
+unsigned list_group(int socket, const char *tag)
+{
+  char msg[MESSAGE_BUFFER_SIZE];
+  unsigned n = 0;
+
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
+    {
+      if (!in_group(processes + i, tag))
+	continue;
+
+      /* Header, si le groupe existe */
+      if (n == 0)
+	{
+	  snprintf(msg, sizeof msg, "Ret.\tPID\tCommande\n");
+	  send_basic(socket, msg, strlen(msg));
+	}
+
+      snprintf(msg, sizeof msg, "%3d\t%d\t%s\n", get_return_code(processes[i].pid),
+	       processes[i].pid, processes[i].command);
+      send_basic(socket, msg, strlen(msg));
+      n++;
+    }
+
+  return n;
+}
+
+/**
+ * Envoie la sortie standard pas encore transmise de chaque processus d'un
+ * groupe, prcde d'une ligne "<pid>\t<ret>\t<taille>".
+ *
+ * @return le nombre de processus du groupe
+ */
+unsigned collect_group_output(int socket, const char *tag)
+{
+  char msg[MESSAGE_BUFFER_SIZE];
+  unsigned n = 0;
+
+  for (unsigned i = 0; i < sizeof processes / sizeof processes[0]; i++)
+    {
+      outbuf_t *buf = &processes[i].out_buf;
+
+      if (!in_group(processes + i, tag))
+	continue;
+
+      snprintf(msg, sizeof msg, "%d\t%d\t%lu\n", processes[i].pid,
+	       get_return_code(processes[i].pid), (unsigned long) (buf->len - buf->sent));
+      send_basic(socket, msg, strlen(msg));
+      send_range(socket, buf, buf->sent, buf->len);
+      buf->sent = buf->len;
+      output_fetched(i, STREAM_OUT);
+      n++;
+    }
+
+  return n;
+}
+
+bool input_open(pid_t pid)
+{
+  int index = index_of_process(pid);
+
+  if (index < 0) /* N'arrivera normalement jamais */
+    return false;
+
+  return processes[index].in[WRITE] == -1 || processes[index].in_closing ? false : true;
+}
+
+/*
+ * Accs aux pipes des processus pour la boucle d'vnements. Un flux est
+ * dsign par l'emplacement du processus dans la table et STREAM_IN,
+ * STREAM_OUT ou STREAM_ERR.
+ */
+
+/**
+ * Retourne le descripteur  surveiller pour un flux : la lecture d'une
+ * sortie encore ouverte, ou l'criture de l'entre s'il y a quelque chose
+ *  y crire. Au-del du budget mmoire des buffers, les sorties
+ * continuent d'tre lues : elles dbordent sur disque (output.h).
+ *
+ * @return -1 s'il n'y a rien  surveiller
+ */
+int stream_fd(unsigned slot, int stream)
+{
+  processinfo_t *p = processes + slot;
+
+  if (!p->pid)
+    return -1;
+
+  switch (stream)
+    {
+    case STREAM_OUT:
+      return p->out[READ];
+
+    case STREAM_ERR:
+      return p->err[READ];
+
+    default:
+      if (p->in_buf.sent < p->in_buf.len || p->in_closing)
+	return p->in[WRITE];
+      return -1;
+    }
+}
+
+unsigned stream_generation(unsigned slot)
+{
+  return processes[slot].gen;
+}
+
+/**
+ * Ferme la lecture d'une sortie (fin de fichier ou erreur).
+ */
+static void stream_close(processinfo_t *p, int stream)
+{
+  int *fd = stream == STREAM_OUT ? &p->out[READ] : &p->err[READ];
+
+  if (*fd != -1 && close(*fd) == -1)
+    perror("close");
+  *fd = -1;
+
+  if (stream == STREAM_OUT)
+    shmring_close(&p->ring);
+
+  /* Le processus peut avoir fini avant que ses sorties soient lues */
+  if (p->out[READ] == -1 && p->err[READ] == -1)
+    {
+      get_return_code(p->pid);
+      cache_result(p);
+    }
+
+  /* La sortie est complte : ses morceaux peuvent tre partags */
+  if (!outbuf_seal(stream == STREAM_OUT ? &p->out_buf : &p->err_buf))
+    perror("outbuf_seal");
+}
+
+/**
+ * Capacit d'un pipe de sortie, releve au premier besoin.
+ */
+static unsigned pipe_size(processinfo_t *p, int stream, int fd)
+{
+  if (p->pipe_size[stream] == 0)
+    {
+      int size = fcntl(fd, F_GETPIPE_SZ);
+      p->pipe_size[stream] = size > 0 ? (unsigned) size : PIPE_MAX_SIZE;
+    }
+
+  return p->pipe_size[stream];
+}
+
+/**
+ * Relve si une lecture a trouv un pipe de sortie plein. Aprs
+ * PIPE_GROW_AFTER fois de suite, sa capacit double.
+ */
+static void stream_pressure(processinfo_t *p, int stream, int fd, bool full)
+{
+  if (!full || fd == -1)
+    {
+      p->full_reads[stream] = 0;
+      return;
+    }
+
+  if (++p->full_reads[stream] < PIPE_GROW_AFTER || pipe_size(p, stream, fd) >= PIPE_MAX_SIZE)
+    return;
+
+  p->full_reads[stream] = 0;
+
+  /* Au-del de /proc/sys/fs/pipe-max-size ou du quota de l'utilisateur : on n'insiste pas */
+  int size = fcntl(fd, F_SETPIPE_SZ, p->pipe_size[stream] * 2);
+  if (size == -1)
+    p->pipe_size[stream] = PIPE_MAX_SIZE;
+  else
+    {
+      p->pipe_size[stream] = size;
+      pipes_grown++;
+    }
+}
+
+/**
+ * Le descripteur d'un flux est prt : on lit la sortie dans son buffer,
+ * ou on crit l'entre en attente.
+ */
+void stream_ready(unsigned slot, int stream)
+{
+  processinfo_t *p = processes + slot;
+
+  if (stream != STREAM_IN)
+    {
+      outbuf_t *buf = stream == STREAM_OUT ? &p->out_buf : &p->err_buf;
+      int fd = stream == STREAM_OUT ? p->out[READ] : p->err[READ];
+      size_t old_len = buf->len;
+      TRACE_BEGIN(reading, read, p->pid);
+      ssize_t n = outbuf_fill(buf, fd);
+      TRACE_END(reading, read, n);
+
+      if (n > 0)
+	stream_pressure(p, stream, fd, (size_t) n >= pipe_size(p, stream, fd));
+
+      if (stream == STREAM_OUT)
+	shmring_write(&p->ring, buf->data + old_len, buf->len - old_len);
+
+      if (n == 0 || (n == -1 && errno != EAGAIN))
+	stream_close(p, stream);
+      return;
+    }
+
+  const char *data;
+  bool close_after;
+  size_t len = stream_input(slot, &data, &close_after);
+
+  if (len > 0)
+    {
+      TRACE_BEGIN(writing, write, p->pid);
+      ssize_t n = write(p->in[WRITE], data, len);
+      TRACE_END(writing, write, n);
+
+      if (n == -1 && errno == EAGAIN)
+	return;
+
+      /* Le fils a ferm son entre : ce qui reste est perdu */
+      if (n == -1)
+	{
+	  perror("write");
+	  n = len;
+	}
+
+      stream_input_written(slot, n);
+    }
+
+  if (close_after && p->in_buf.sent == p->in_buf.len)
+    {
+      p->in_closing = false;
+      close_input(p->pid);
+    }
+}
+
+/**
+ * Donnes lues sur une sortie par le backend io_uring.
+ *
+ * @param n nombre d'octets de data, 0 en fin de fichier, -1 sur erreur
+ */
+void stream_received(unsigned slot, int stream, const char *data, ssize_t n)
+{
+  processinfo_t *p = processes + slot;
+
+  if (n <= 0)
+    {
+      stream_close(p, stream);
+      return;
+    }
+
+  /* Un buffer rempli : le pipe en avait au moins autant en attente */
+  stream_pressure(p, stream, stream == STREAM_OUT ? p->out[READ] : p->err[READ],
+		  n == URING_BUFFER_SIZE);
+
+  TRACE_BEGIN(appending, received, p->pid);
+  if (!outbuf_append(stream == STREAM_OUT ? &p->out_buf : &p->err_buf, data, n))
+    perror("stream_received");
+  else if (stream == STREAM_OUT)
+    shmring_write(&p->ring, data, n);
+  TRACE_END(appending, received, n);
+}
+
+/**
+ * Donne l'entre en attente d'un processus.
+ *
+ * @param data reoit l'adresse des donnes  crire
+ * @param close_after reoit true s'il faut fermer l'entre une fois crite
+ * @return le nombre d'octets  crire
+ */
+size_t stream_input(unsigned slot, const char **data, bool *close_after)
+{
+  outbuf_t *buf = &processes[slot].in_buf;
+
+  *data = buf->data + buf->sent;
+  *close_after = processes[slot].in_closing;
+  return buf->len - buf->sent;
+}
+
+void stream_input_written(unsigned slot, size_t n)
+{
+  outbuf_t *buf = &processes[slot].in_buf;
+
+  buf->sent += n;
+
+  /* Tout est crit : on repart du dbut du buffer */
+  if (buf->sent == buf->len)
+    buf->sent = buf->len = 0;
+}
+
+/**
+ * Le backend io_uring se charge de fermer lui mme l'entre (par une
+ * opration lie  la dernire criture) : le processus n'en est plus
+ * propritaire.
+ *
+ * @return le descripteur dtach
+ */
+int stream_detach_input(unsigned slot)
+{
+  int fd = processes[slot].in[WRITE];
+
+  processes[slot].in[WRITE] = -1;
+  processes[slot].in_closing = false;
+  return fd;
+}
+
+/**
+ * Rend au processus une entre dtache qui n'a pas t ferme (Reexec
+ * pendant la dernire criture) : la fermeture reste  faire.
+ */
+void stream_attach_input(unsigned slot, int fd)
+{
+  processes[slot].in[WRITE] = fd;
+  processes[slot].in_closing = true;
 }
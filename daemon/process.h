@@ -3,25 +3,148 @@
 
 #include <stdbool.h>
 
+#include "state.h"
+#include "status.h"
+
 /* Nombre de processus maximum */
 #define MAX_PROCESS 10
 
-/* Taille du buffer de sortie des process's excuts */
-#define STDOUT_BUFFER_SIZE 10
+/* Taille minimale des lectures sur la sortie des process's excuts */
+#define STDOUT_BUFFER_SIZE 4096
+
+/*
+ * Un pipe de sortie vid alors qu'il tait plein PIPE_GROW_AFTER fois de
+ * suite voit sa capacit doubler (F_SETPIPE_SZ), jusqu' PIPE_MAX_SIZE :
+ * moins de rveils pour un producteur rapide.
+ */
+#define PIPE_GROW_AFTER 4
+#define PIPE_MAX_SIZE (1024 * 1024)
 
 /* Le process n'a pas encore retourn */
 #define PROCESS_NOT_TERMINATED -1
 
+/* Le processus n'a jamais t lanc : une dpendance (--after) a chou */
+#define PROCESS_CANCELLED -2
+
+/* Tu par un signal : code 128 + numro du signal, comme le shell */
+#define PROCESS_SIGNALED 128
+
+/*
+ * Un processus termin chappe  la rtention jusqu' ce que ses deux
+ * sorties soient demandes, au plus RETENTION_GRACE secondes aprs sa
+ * fin ou aprs son annonce par WaitAny ou WaitGroup : le client qui
+ * l'attend a le temps de les rapatrier, celui qui ne les demande jamais
+ * ne le garde pas indfiniment.
+ */
+#define RETENTION_GRACE 10
+
+/* Dpendances d'un processus au plus (CreateProcess --after) */
+#define MAX_AFTER MAX_PROCESS
+
+/* Nombre de destructions mmorises pour ListChanges */
+#define MAX_CHANGES 64
+
+/* Flux d'un processus, pour la boucle d'vnements */
+#define STREAM_IN  0
+#define STREAM_OUT 1
+#define STREAM_ERR 2
+
+/* Filtres de list_process */
+#define LIST_ALL     0
+#define LIST_RUNNING 1
+#define LIST_EXITED  2
+
+/*
+ * Redirections d'un processus vers des fichiers du serveur : un flux
+ * redirig n'a pas de pipe, sa sortie ne passe pas par le dmon.
+ */
+typedef struct
+{
+
+  const char *in;   /* Fichier lu en entre standard, ou NULL */
+  const char *out;  /* Fichier recevant la sortie standard, ou NULL */
+  const char *err;  /* Fichier recevant la sortie d'erreur, ou NULL */
+  bool out_append;  /* >> : ajout  la fin plutt que troncature */
+  bool err_append;
+  bool merge_err;   /* 2>&1 : sortie d'erreur dans la sortie standard, un seul pipe */
+
+} redirect_t;
+
+/*
+ * Politique de rtention des processus termins (0 : pas de limite). Un
+ * processus retir libre son emplacement, ses pipes et ses sorties ; son
+ * code de retour reste lisible par GetReturnCode tant que sa trace dure.
+ */
+typedef struct
+{
+
+  unsigned ttl;          /* Secondes de conservation aprs la fin */
+  unsigned max_finished; /* Processus termins conservs au plus */
+  size_t max_output;     /* Octets de sortie conservs au plus */
+
+} retention_t;
+
+/*
+ * Dpendance d'un processus : il attend la fin de id, et n'est lanc
+ * que si elle a russi, sauf si any.
+ */
+typedef struct
+{
+
+  pid_t id;
+  bool any;
+
+} after_t;
+
 extern bool process_exists(pid_t);
 extern void destroy_all_process();
 extern void destroy_process(pid_t);
-extern pid_t create_process(const char *, char *const[]);
+extern int process_sweep(const retention_t *, const pid_t[], unsigned);
+extern void process_reported(pid_t);
+extern void group_reported(const char *);
+extern bool process_tombstone(pid_t, int *);
+extern unsigned long process_swept();
+extern pid_t create_process(const char *, char *const[], const redirect_t *, const char *);
+extern pid_t create_process_fd(int, const char *, char *const[]);
+extern pid_t create_cached_process(char *const[], const redirect_t *, char *const[], const char *);
+extern pid_t create_after_process(char *const[], const redirect_t *, const char *, const after_t *, unsigned);
+extern int resolve_after(const char *, bool, after_t *, unsigned);
+extern unsigned graph_status(int);
 extern void send_input(pid_t, const char *);
 extern void close_input(pid_t);
 extern void get_output(int socket, pid_t);
 extern void get_error(int socket, pid_t);
+extern bool take_output(pid_t, int, size_t *, size_t *);
+extern size_t output_at(pid_t, int, size_t, const char **);
+extern int export_output(pid_t);
+extern bool grep_output(int socket, pid_t, const char *);
+extern void head_output(int socket, pid_t, size_t);
+extern void tail_output(int socket, pid_t, size_t);
 extern int get_return_code(pid_t);
 extern bool input_open(pid_t);
-extern void list_process(int);
+extern void list_process(int, int, unsigned, unsigned);
+extern unsigned process_count();
+extern unsigned long process_pipes_grown();
+extern void process_status(status_page_t *);
+extern bool list_changes(int, unsigned long);
+extern unsigned long last_change();
+extern void cache_finished();
+extern void reap_children();
+extern void process_save(state_t *);
+extern bool process_restore(state_t *);
+extern unsigned destroy_group(const char *);
+extern int wait_group(const char *, unsigned *);
+extern int process_finished(pid_t);
+extern unsigned list_group(int, const char *);
+extern unsigned collect_group_output(int, const char *);
+
+extern int stream_fd(unsigned, int);
+extern unsigned stream_generation(unsigned);
+extern void stream_ready(unsigned, int);
+extern void stream_received(unsigned, int, const char *, ssize_t);
+extern size_t stream_input(unsigned, const char **, bool *);
+extern void stream_input_written(unsigned, size_t);
+extern int stream_detach_input(unsigned);
+extern void stream_attach_input(unsigned, int);
 
 #endif
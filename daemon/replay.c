@@ -0,0 +1,569 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+
+#include "cadid.h"
+#include "capture.h"
+#include "config.h"
+#include "libcadi.h"
+
+/*
+ * cadi-replay : rejoue une capture faite par cadid -r contre un dmon.
+ *
+ * Les commandes sont envoyes dans l'ordre de la capture, une connection
+ * par connection enregistre, au rythme d'origine (divis par -x) ou au
+ * plus vite (-m). Une commande n'est envoye qu'une fois la rponse  la
+ * prcdente de sa connection reue.
+ *
+ * Le temps enregistr est le temps de traitement mesur par le dmon ;
+ * le temps rejou est mesur ici, de l'envoi  la rponse : l'cart
+ * comprend donc le rseau et ce client. Les connections passent par
+ * libcadi, donc en mode Framed : GetOutput et GetError y comptent tout
+ * le transfert de la sortie.
+ */
+
+/** Une commande de la capture */
+typedef struct
+{
+
+  capture_record_t rec;
+  char *cmd;
+  char *reply;
+
+  unsigned replay;    /* Temps de rponse rejou, en s */
+  char *result;       /* Ligne OK/ERR obtenue */
+
+} command_t;
+
+/** Une connection rejoue */
+typedef struct
+{
+
+  uint32_t conn;      /* Numro dans la capture */
+  int index;          /* Dans pool, -1 si pas encore ouverte */
+  long pending;       /* Commande en attente de rponse, -1 sinon, -2 pour l'accueil */
+  uint64_t sent;
+
+} connection_t;
+
+/** Un identifiant de processus renumrot */
+typedef struct
+{
+
+  char *from;
+  char *to;
+
+} remap_t;
+
+/** L'adresse du serveur */
+static in_addr_t server_in_addr;
+
+/** Le port de connection sur le serveur */
+static unsigned port;
+
+/** Diviseur du rythme d'origine, 0 pour enchaner au plus vite */
+static double scale = 1;
+
+/** Les connections au dmon */
+static cadi_pool_t *pool;
+
+static command_t *commands;
+static size_t ncommands;
+
+static connection_t **connections;
+static size_t nconnections;
+
+static remap_t *remaps;
+static size_t nremaps;
+
+/**
+ * Affiche l'aide.
+ *
+ * @param prog nom du programme (argv[0])
+ */
+static void usage(const char *prog)
+{
+  printf("Usage : %s [ -h | -s adresse_serveur | -p port | -x facteur | -m ] fichier\n", prog);
+  puts("\t-s adresse_serveur . . l'adresse du serveur o se connecter (dfaut: localhost)");
+  printf("\t-p port  . . . . . . . le port sur lequel se connecter (dfaut: %d)\n", DEFAULT_PORT);
+  puts("\t-x facteur . . . . . . rejouer facteur fois plus vite que la capture");
+  puts("\t-m . . . . . . . . . . rejouer au plus vite, sans respecter le rythme");
+  puts("\t-h . . . . . . . . . . afficher cette aide");
+}
+
+/**
+ * Heure de l'horloge monotone, en ns.
+ */
+static uint64_t now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Lit une chane de la capture.
+ *
+ * @return la chane alloue, NULL si le fichier est tronqu
+ */
+static char *read_string(FILE *f, size_t len)
+{
+  char *s = malloc(len + 1);
+  if (s == NULL || (len > 0 && fread(s, len, 1, f) != 1))
+    {
+      free(s);
+      return NULL;
+    }
+  s[len] = '\0';
+  return s;
+}
+
+/**
+ * Charge toute la capture en mmoire.
+ *
+ * @return false si le fichier n'est pas une capture
+ */
+static bool load_capture(const char *path)
+{
+  FILE *f;
+  if ((f = fopen(path, "rb")) == NULL)
+    {
+      perror(path);
+      return false;
+    }
+
+  char magic[sizeof CAPTURE_MAGIC - 1];
+  if (fread(magic, sizeof magic, 1, f) != 1 || memcmp(magic, CAPTURE_MAGIC, sizeof magic))
+    {
+      fprintf(stderr, "%s : ce n'est pas une capture cadid\n", path);
+      fclose(f);
+      return false;
+    }
+
+  size_t cap = 0;
+  capture_record_t rec;
+  while (fread(&rec, sizeof rec, 1, f) == 1)
+    {
+      if (ncommands == cap)
+	{
+	  cap = cap ? 2 * cap : 64;
+	  command_t *bigger = realloc(commands, cap * sizeof *commands);
+	  if (bigger == NULL)
+	    {
+	      perror("realloc");
+	      exit(EXIT_FAILURE);
+	    }
+	  commands = bigger;
+	}
+
+      command_t *c = &commands[ncommands];
+      memset(c, 0, sizeof *c);
+      c->rec = rec;
+      if ((c->cmd = read_string(f, rec.cmd_len)) == NULL
+	  || (c->reply = read_string(f, rec.reply_len)) == NULL)
+	{
+	  fprintf(stderr, "%s : capture tronque aprs %lu commandes\n", path,
+		  (unsigned long) ncommands);
+	  free(c->cmd);
+	  break;
+	}
+      ncommands++;
+    }
+
+  fclose(f);
+  return true;
+}
+
+/**
+ * Trouve la connection rejouant une connection de la capture, en la
+ * crant au besoin (sans l'ouvrir).
+ */
+static connection_t *find_connection(uint32_t conn)
+{
+  for (size_t i = 0; i < nconnections; i++)
+    if (connections[i]->conn == conn)
+      return connections[i];
+
+  /* Chacune est alloue  part : les rappels de libcadi la dsignent */
+  connection_t **bigger = realloc(connections, (nconnections + 1) * sizeof *connections);
+  connection_t *c = calloc(1, sizeof *c);
+  if (bigger != NULL)
+    connections = bigger;
+  if (bigger == NULL || c == NULL)
+    {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+
+  connections[nconnections++] = c;
+  c->conn = conn;
+  c->index = -1;
+  c->pending = -1;
+  return c;
+}
+
+/**
+ * Ouvre une connection sur le serveur. Les commandes n'y partent
+ * qu'une fois l'accueil reu, pour ne pas compter son ouverture.
+ *
+ * @return false si la connection est impossible
+ */
+static bool open_connection(connection_t *c)
+{
+  if ((c->index = cadi_connect(pool)) == -1)
+    {
+      perror("cadi_connect");
+      return false;
+    }
+
+  c->pending = -2;
+  return true;
+}
+
+/**
+ * Remplace dans une commande les numros de processus de la capture par
+ * ceux obtenus en rejouant.
+ *
+ * @return la commande  envoyer ( librer)
+ */
+static char *remap_command(const char *cmd)
+{
+  size_t cap = strlen(cmd) + 1, len = 0;
+  char *out = malloc(cap);
+  const char *p = cmd;
+
+  while (out != NULL && *p)
+    {
+      size_t word = strcspn(p, " ");
+      const char *subst = NULL;
+      for (size_t i = 0; i < nremaps && subst == NULL; i++)
+	if (strlen(remaps[i].from) == word && !strncmp(p, remaps[i].from, word))
+	  subst = remaps[i].to;
+      size_t n = subst ? strlen(subst) : word;
+
+      if (len + n + 2 > cap)
+	{
+	  cap = 2 * (len + n + 2);
+	  char *bigger = realloc(out, cap);
+	  if (bigger == NULL)
+	    free(out);
+	  out = bigger;
+	  if (out == NULL)
+	    break;
+	}
+      memcpy(out + len, subst ? subst : p, n);
+      len += n;
+      p += word;
+      if (*p == ' ')
+	out[len++] = *p++;
+    }
+
+  if (out == NULL)
+    {
+      perror("malloc");
+      exit(EXIT_FAILURE);
+    }
+  out[len] = '\0';
+  return out;
+}
+
+/**
+ * Retient la renumrotation d'un processus : la capture rpondait "OK x"
+ *  une cration, le rejeu rpond "OK y".
+ */
+static void learn_remap(const char *recorded, const char *replayed)
+{
+  if (strncmp(recorded, "OK ", 3) || strncmp(replayed, "OK ", 3))
+    return;
+  recorded += 3;
+  replayed += 3;
+  if (!*recorded || strspn(recorded, "0123456789") != strlen(recorded)
+      || strspn(replayed, "0123456789") != strlen(replayed) || !strcmp(recorded, replayed))
+    return;
+
+  for (size_t i = 0; i < nremaps; i++)
+    if (!strcmp(remaps[i].from, recorded))
+      {
+	free(remaps[i].to);
+	remaps[i].to = strdup(replayed);
+	return;
+      }
+
+  remap_t *bigger = realloc(remaps, (nremaps + 1) * sizeof *remaps);
+  if (bigger == NULL)
+    return;
+  remaps = bigger;
+  remaps[nremaps].from = strdup(recorded);
+  remaps[nremaps].to = strdup(replayed);
+  nremaps++;
+}
+
+/**
+ * La rponse  une commande est arrive : on la mesure et on en garde
+ * la ligne OK/ERR.
+ */
+static void reply_done(void *arg, unsigned id, const cadi_result_t *result)
+{
+  connection_t *c = arg;
+  command_t *cmd = &commands[c->pending];
+  size_t len = strlen(result->reply) + 5;
+
+  id = id;
+  cmd->replay = (now() - c->sent) / 1000;
+  if ((cmd->result = malloc(len)) != NULL)
+    {
+      snprintf(cmd->result, len, "%s%s%s", result->ok ? "OK" : "ERR",
+	       *result->reply ? " " : "", result->reply);
+      learn_remap(cmd->reply, cmd->result);
+    }
+  else
+    cmd->result = strdup("");
+
+  printf("%5lu %4u %9u %9u %+9ld  %s\n", (unsigned long) c->pending, cmd->rec.conn,
+	 cmd->rec.service, cmd->replay, (long) cmd->replay - (long) cmd->rec.service, cmd->cmd);
+  if (strcmp(cmd->result, cmd->reply) && strncmp(cmd->result, cmd->reply, 2))
+    printf("      rponse diffrente : \"%s\" au lieu de \"%s\"\n", cmd->result, cmd->reply);
+
+  c->pending = -1;
+}
+
+/**
+ * Les sorties (GetOutput, GetError) ne sont pas gardes.
+ */
+static void discard(void *arg, unsigned id, const char *data, size_t len)
+{
+  arg = arg;
+  id = id;
+  data = data;
+  len = len;
+}
+
+/**
+ * Envoie une commande de la capture sur sa connection, ouverte et dont
+ * l'accueil a t reu.
+ */
+static void send_command(connection_t *c, size_t index)
+{
+  char *line = remap_command(commands[index].cmd);
+
+  /* La rponse peut venir ds l'envoi, si la connection est perdue */
+  c->pending = index;
+  c->sent = now();
+  if (cadi_send_on(pool, c->index, line, reply_done, discard, c) == 0)
+    {
+      perror("cadi_send_on");
+      exit(EXIT_FAILURE);
+    }
+  free(line);
+}
+
+static int compare_unsigned(const void *a, const void *b)
+{
+  unsigned x = *(const unsigned *) a, y = *(const unsigned *) b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Affiche moyenne et percentiles d'une srie de temps.
+ */
+static void summary(const char *label, unsigned *times, size_t n)
+{
+  if (n == 0)
+    return;
+
+  qsort(times, n, sizeof *times, compare_unsigned);
+  double mean = 0;
+  for (size_t i = 0; i < n; i++)
+    mean += times[i];
+  mean /= n;
+  printf("%-10s moyenne %9.0f s   p50 %9u s   p99 %9u s   max %9u s\n", label, mean,
+	 times[n / 2], times[(n * 99) / 100], times[n - 1]);
+}
+
+/**
+ * Parse la ligne de commande.
+ *
+ * @return le fichier de capture
+ */
+static const char *parse_command_line(char *argv[])
+{
+  const char *prog = argv[0];
+  const char *path = NULL;
+
+  server_in_addr = htonl(INADDR_ANY);
+  port = DEFAULT_PORT;
+
+  while (*++argv)
+    {
+      if (!strcmp(*argv, "-h"))
+	{
+	  usage(prog);
+	  exit(EXIT_SUCCESS);
+	}
+
+      else if (!strcmp(*argv, "-m"))
+	scale = 0;
+
+      else if (!strcmp(*argv, "-p") || !strcmp(*argv, "-s") || !strcmp(*argv, "-x"))
+	{
+	  if (*(argv + 1) == NULL)
+	    {
+	      usage(prog);
+	      exit(EXIT_FAILURE);
+	    }
+	  const char *opt = *argv++;
+
+	  if (opt[1] == 'p')
+	    port = atoi(*argv);
+	  else if (opt[1] == 'x')
+	    {
+	      if ((scale = atof(*argv)) <= 0)
+		{
+		  fprintf(stderr, "Facteur \"%s\" invalide\n", *argv);
+		  exit(EXIT_FAILURE);
+		}
+	    }
+	  else
+	    {
+	      struct hostent *h;
+	      if (!(h = gethostbyname(*argv)))
+		{
+		  herror("gethostbyname");
+		  exit(EXIT_FAILURE);
+		}
+	      server_in_addr = ((struct in_addr *) h->h_addr_list[0])->s_addr;
+	    }
+	}
+
+      else if (**argv != '-' && path == NULL)
+	path = *argv;
+
+      else
+	{
+	  fprintf(stderr, "Option \"%s\" inconnue\n\n", *argv);
+	  usage(prog);
+	  exit(EXIT_FAILURE);
+	}
+    }
+
+  if (path == NULL)
+    {
+      usage(prog);
+      exit(EXIT_FAILURE);
+    }
+  return path;
+}
+
+/**
+ * Point d'entre du programme.
+ */
+int main(int argc, char *argv[])
+{
+  argc = argc; /* Evite un warning */
+  if (!load_capture(parse_command_line(argv)))
+    return EXIT_FAILURE;
+
+  if (ncommands == 0)
+    {
+      puts("Capture vide");
+      return EXIT_SUCCESS;
+    }
+
+  printf("%5s %4s %9s %9s %9s  %s\n", "n", "conn", "captur", "rejou", "cart", "commande");
+
+  if ((pool = cadi_open(server_in_addr, port, 0, 0)) == NULL)
+    {
+      perror("cadi_open");
+      return EXIT_FAILURE;
+    }
+
+  uint64_t start = now(), first = commands[0].rec.time;
+  size_t next = 0;
+  bool failed = false;
+
+  for (;;)
+    {
+      /* Envoi des commandes dues, dans l'ordre de la capture */
+      int timeout = -1;
+      while (next < ncommands && !failed)
+	{
+	  connection_t *c = find_connection(commands[next].rec.conn);
+
+	  /* Accueil reu, ou connection impossible */
+	  if (c->pending == -2 && cadi_ready(pool, c->index))
+	    c->pending = -1;
+	  else if (c->pending == -2 && cadi_error(pool, c->index) != NULL)
+	    {
+	      fprintf(stderr, "connect : %s\n", cadi_error(pool, c->index));
+	      failed = true;
+	    }
+	  if (c->pending != -1)
+	    break;
+
+	  uint64_t due = start;
+	  if (scale > 0)
+	    due += (commands[next].rec.time - first) / scale;
+	  uint64_t t = now();
+	  if (due > t)
+	    {
+	      timeout = (due - t) / 1000000 + 1;
+	      break;
+	    }
+
+	  /* Connection ouverte  sa premire commande : on attend l'accueil */
+	  if (c->index == -1)
+	    {
+	      if (!open_connection(c))
+		failed = true;
+	      break;
+	    }
+
+	  send_command(c, next++);
+	}
+
+      /* Attente des rponses et des accueils */
+      bool opening = false;
+      for (size_t i = 0; i < nconnections && !failed; i++)
+	opening |= connections[i]->pending == -2;
+
+      if (!opening && cadi_pending(pool) == 0 && (next == ncommands || failed))
+	break;
+
+      if (cadi_poll(pool, timeout) == -1)
+	{
+	  perror("poll");
+	  break;
+	}
+    }
+
+  /* Rsum */
+  unsigned recorded[ncommands], replayed[ncommands];
+  size_t n = 0, different = 0;
+  for (size_t i = 0; i < ncommands; i++)
+    if (commands[i].result != NULL)
+      {
+	recorded[n] = commands[i].rec.service;
+	replayed[n] = commands[i].replay;
+	if (strncmp(commands[i].result, commands[i].reply, 2))
+	  different++;
+	n++;
+      }
+
+  printf("\n%lu/%lu commandes rejoues, %lu rponses diffrentes\n", (unsigned long) n,
+	 (unsigned long) ncommands, (unsigned long) different);
+  summary("captur", recorded, n);
+  summary("rejou", replayed, n);
+
+  cadi_close(pool);
+  for (size_t i = 0; i < nconnections; i++)
+    free(connections[i]);
+  free(connections);
+
+  return failed || different ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,401 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "runner.h"
+#include "cadid.h"
+
+extern char *strdup(const char *);
+
+/*
+ * Lanceur de tches (cadi -j) : chaque ligne d'un fichier est passe 
+ * CreateProcess, avec au plus N processus en cours sur le dmon. La fin
+ * d'une tche est attendue par WaitAny, sans scrutation ; ses sorties
+ * sont alors rapatries par trames, puis le processus est dtruit.
+ *
+ * Tout passe par libcadi, sans attendre les rponses : pendant qu'un
+ * WaitAny bloque une connection, les crations et les rapatriements
+ * avancent sur les autres.
+ */
+
+/** tats d'une tche */
+#define JOB_WAITING    0 /* Pas encore lance */
+#define JOB_CREATING   1 /* CreateProcess envoy */
+#define JOB_RUNNING    2
+#define JOB_COLLECTING 3 /* Sorties en cours de rapatriement, puis destruction */
+#define JOB_DONE       4
+
+/** Un texte extensible */
+typedef struct
+{
+
+  char *data;
+  size_t len;
+  size_t cap;
+
+} text_t;
+
+/** Une tche, une ligne du fichier */
+typedef struct
+{
+
+  char *command;
+  int state;
+  pid_t pid;        /* Processus sur le dmon */
+  int ret;          /* -1 si la tche n'a pas pu tre lance */
+  unsigned collecting;
+  text_t out;
+  text_t err;
+  text_t failures;  /* checs du rapatriement, une ligne chacun */
+
+} job_t;
+
+/** Les connections au dmon */
+static cadi_pool_t *pool;
+
+static job_t *job;
+static size_t njobs;
+
+/** Premire tche peut-tre pas encore lance */
+static size_t next;
+
+/**
+ * Tches qui occupent une place dans la table du dmon (de CreateProcess
+ *  la fin de leur DestroyProcess), et leur maximum
+ */
+static unsigned running, limit;
+
+static size_t printed, finished, failed;
+static bool keep_order;
+
+/** Un WaitAny est en cours */
+static bool waiting;
+
+/**
+ * Quitte sur une erreur de communication avec le dmon.
+ */
+static void fatal(const char *msg)
+{
+  fprintf(stderr, "cadi : %s\n", msg);
+  exit(EXIT_FAILURE);
+}
+
+static void text_append(text_t *text, const void *data, size_t len)
+{
+  if (text->len + len + 1 > text->cap)
+    {
+      size_t cap = text->cap ? text->cap : MESSAGE_BUFFER_SIZE;
+      while (cap < text->len + len + 1)
+	cap *= 2;
+
+      char *p = realloc(text->data, cap);
+      if (p == NULL)
+	fatal("mmoire insuffisante");
+
+      text->data = p;
+      text->cap = cap;
+    }
+
+  memcpy(text->data + text->len, data, len);
+  text->len += len;
+  text->data[text->len] = '\0';
+}
+
+static void text_free(text_t *text)
+{
+  free(text->data);
+  memset(text, 0, sizeof *text);
+}
+
+/**
+ * Affiche le rsultat d'une tche : ses sorties, puis son chec
+ * ventuel sur la sortie d'erreur.
+ */
+static void report(job_t *job)
+{
+  fwrite(job->out.data != NULL ? job->out.data : "", 1, job->out.len, stdout);
+  fflush(stdout);
+
+  if (job->ret == -1)
+    fprintf(stderr, "cadi : %s : %s\n", job->err.data, job->command);
+  else
+    {
+      fwrite(job->err.data != NULL ? job->err.data : "", 1, job->err.len, stderr);
+      if (job->ret != 0)
+	fprintf(stderr, "cadi : code %d : %s\n", job->ret, job->command);
+    }
+  fwrite(job->failures.data != NULL ? job->failures.data : "", 1, job->failures.len, stderr);
+
+  text_free(&job->out);
+  text_free(&job->err);
+  text_free(&job->failures);
+}
+
+/**
+ * Une tche est termine : on l'affiche si son tour est venu.
+ */
+static void job_done(job_t *j)
+{
+  j->state = JOB_DONE;
+  finished++;
+  if (j->ret != 0)
+    failed++;
+  if (!keep_order)
+    report(j);
+
+  /* Dans l'ordre du fichier, on affiche ce qui peut l'tre */
+  while (keep_order && printed < njobs && job[printed].state == JOB_DONE)
+    report(job + printed++);
+}
+
+/**
+ * Fin de DestroyProcess ou du rapatriement d'une sortie.
+ */
+static void collected(void *arg, unsigned id, const cadi_result_t *result)
+{
+  job_t *j = arg;
+  char cmd[MESSAGE_BUFFER_SIZE];
+
+  id = id;
+  /* Comme report : "cadi : <raison> : <commande>" */
+  if (!result->ok)
+    {
+      text_append(&j->failures, "cadi : ", strlen("cadi : "));
+      text_append(&j->failures, result->reply, strlen(result->reply));
+      text_append(&j->failures, " : ", strlen(" : "));
+      text_append(&j->failures, j->command, strlen(j->command));
+      text_append(&j->failures, "\n", 1);
+    }
+
+  /* Le processus n'est dtruit qu'une fois ses deux sorties reues */
+  if (--j->collecting == 1)
+    {
+      snprintf(cmd, sizeof cmd, CMD_DESTROY_PROCESS " %d", j->pid);
+      cadi_send(pool, cmd, collected, NULL, j);
+    }
+  else if (j->collecting == 0)
+    {
+      running--;
+      job_done(j);
+    }
+}
+
+static void output_data(void *arg, unsigned id, const char *data, size_t len)
+{
+  id = id;
+  text_append(&((job_t *) arg)->out, data, len);
+}
+
+static void error_data(void *arg, unsigned id, const char *data, size_t len)
+{
+  id = id;
+  text_append(&((job_t *) arg)->err, data, len);
+}
+
+/**
+ * Rponse  WaitAny : une tche a fini, on rapatrie ses sorties.
+ */
+static void finished_one(void *arg, unsigned id, const cadi_result_t *result)
+{
+  char cmd[MESSAGE_BUFFER_SIZE];
+  pid_t pid;
+  int ret;
+  job_t *j;
+
+  arg = arg;
+  id = id;
+  waiting = false;
+
+  if (!result->ok || sscanf(result->reply, "%d %d", &pid, &ret) != 2)
+    {
+      fprintf(stderr, "cadi : %s\n", result->reply);
+      fatal("une tche a disparu du dmon");
+    }
+
+  for (j = job + printed; j < job + njobs && (j->state != JOB_RUNNING || j->pid != pid); j++)
+    ;
+  if (j == job + njobs)
+    fatal("rponse inattendue  " CMD_WAIT_ANY);
+
+  j->ret = ret;
+  j->state = JOB_COLLECTING;
+  j->collecting = 3;
+
+  snprintf(cmd, sizeof cmd, CMD_GET_OUTPUT " %d", pid);
+  cadi_send(pool, cmd, collected, output_data, j);
+  snprintf(cmd, sizeof cmd, CMD_GET_ERROR " %d", pid);
+  cadi_send(pool, cmd, collected, error_data, j);
+}
+
+/**
+ * Rponse  CreateProcess.
+ */
+static void created(void *arg, unsigned id, const cadi_result_t *result)
+{
+  job_t *j = arg;
+
+  id = id;
+  if (result->ok)
+    {
+      j->pid = atoi(result->reply);
+      j->state = JOB_RUNNING;
+      return;
+    }
+
+  running--;
+
+  /* Table des processus pleine : on attend une fin pour relancer */
+  if (running > 0 && (!strcmp(result->reply, DETAIL_RET_PROCESS_TABLE_FULL)
+		      || !strcmp(result->reply, DETAIL_RET_FD_BUDGET)))
+    {
+      limit = running;
+      j->state = JOB_WAITING;
+      if (j - job < (long) next)
+	next = j - job;
+      return;
+    }
+
+  j->ret = -1;
+  text_append(&j->err, result->reply, strlen(result->reply));
+  job_done(j);
+}
+
+/**
+ * Lance des tches jusqu' en avoir limit en cours.
+ */
+static void launch()
+{
+  char cmd[MESSAGE_BUFFER_SIZE];
+
+  while (running < limit && next < njobs)
+    {
+      job_t *j = job + next++;
+
+      if (j->state != JOB_WAITING)
+	continue;
+
+      if (strlen(j->command) + sizeof CMD_CREATE_PROCESS + 1 > sizeof cmd)
+	{
+	  j->ret = -1;
+	  text_append(&j->err, "commande trop longue", strlen("commande trop longue"));
+	  job_done(j);
+	  continue;
+	}
+
+      snprintf(cmd, sizeof cmd, CMD_CREATE_PROCESS " %s", j->command);
+      j->state = JOB_CREATING;
+      running++;
+      if (cadi_send(pool, cmd, created, NULL, j) == 0)
+	fatal("mmoire insuffisante");
+    }
+}
+
+/**
+ * Attend la fin de l'une des tches en cours, si aucun WaitAny ne
+ * l'attend dj. Une tche lance pendant un WaitAny attend le suivant.
+ */
+static void wait_any()
+{
+  char cmd[MESSAGE_BUFFER_SIZE];
+  size_t len = snprintf(cmd, sizeof cmd, CMD_WAIT_ANY);
+  bool any = false;
+
+  if (waiting)
+    return;
+
+  for (size_t i = printed; i < njobs && len < sizeof cmd; i++)
+    if (job[i].state == JOB_RUNNING)
+      {
+	len += snprintf(cmd + len, sizeof cmd - len, " %d", job[i].pid);
+	any = true;
+      }
+  if (!any)
+    return;
+  if (len >= sizeof cmd)
+    fatal("trop de tches en cours");
+
+  waiting = true;
+  cadi_send(pool, cmd, finished_one, NULL, NULL);
+}
+
+/**
+ * Lit les tches, une par ligne. Les lignes vides et celles commenant
+ * par '#' sont ignores.
+ *
+ * @return le nombre de tches
+ */
+static size_t load_jobs(FILE *file, job_t **jobs)
+{
+  char line[MESSAGE_BUFFER_SIZE * 4];
+  size_t n = 0, cap = 0;
+
+  *jobs = NULL;
+  while (fgets(line, sizeof line, file))
+    {
+      line[strcspn(line, "\r\n")] = '\0';
+
+      char *p = line + strspn(line, " \t");
+      if (*p == '\0' || *p == '#')
+	continue;
+
+      if (n == cap)
+	{
+	  cap = cap ? 2 * cap : 64;
+	  job_t *bigger = realloc(*jobs, cap * sizeof **jobs);
+	  if (bigger == NULL)
+	    fatal("mmoire insuffisante");
+	  *jobs = bigger;
+	}
+
+      memset(*jobs + n, 0, sizeof **jobs);
+      if (((*jobs)[n++].command = strdup(p)) == NULL)
+	fatal("mmoire insuffisante");
+    }
+
+  return n;
+}
+
+/**
+ * Lance toutes les tches d'un fichier sur le dmon, au plus jobs  la
+ * fois, et affiche leurs rsultats.
+ *
+ * @param connections connections au dmon, au moins deux pour qu'un
+ * WaitAny n'arrte pas le reste
+ * @param file les commandes, une par ligne (options de CreateProcess comprises)
+ * @param jobs nombre maximum de tches en cours
+ * @param order true pour afficher les rsultats dans l'ordre du
+ * fichier, false pour les afficher ds leur fin
+ * @return EXIT_SUCCESS si toutes les tches ont russi
+ */
+int run_jobs(cadi_pool_t *connections, FILE *file, unsigned jobs, bool order)
+{
+  pool = connections;
+  njobs = load_jobs(file, &job);
+  limit = jobs;
+  keep_order = order;
+
+  /* Les rappels ne font que noter ; lancements et attentes partent d'ici */
+  for (;;)
+    {
+      launch();
+      wait_any();
+      if (finished == njobs)
+	break;
+      if (cadi_pending(pool) == 0 || cadi_poll(pool, -1) == -1)
+	fatal("connection au dmon perdue");
+    }
+
+  if (limit < jobs)
+    fprintf(stderr, "cadi : le dmon n'a accept que %u tches  la fois\n", limit);
+  if (failed > 0)
+    fprintf(stderr, "cadi : %lu tche(s) en chec sur %lu\n", (unsigned long) failed,
+	    (unsigned long) njobs);
+
+  for (size_t i = 0; i < njobs; i++)
+    free(job[i].command);
+  free(job);
+
+  return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
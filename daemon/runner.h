@@ -0,0 +1,14 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "libcadi.h"
+
+/* Connections du lanceur : un WaitAny en occupe une, les sorties arrivent sur les autres */
+#define RUNNER_CONNECTIONS 4
+
+extern int run_jobs(cadi_pool_t *, FILE *, unsigned, bool);
+
+#endif
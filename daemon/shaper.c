@@ -0,0 +1,114 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <time.h>
+
+#include "shaper.h"
+#include "cadid.h"
+
+/**
+ * Heure de l'horloge monotone, en ns.
+ */
+uint64_t shaper_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Taille de la rafale d'un seau.
+ */
+static uint64_t bucket_burst(const bucket_t *bucket)
+{
+  uint64_t burst = bucket->rate * SHAPER_BURST_MS / 1000;
+  return burst < FRAME_SIZE ? FRAME_SIZE : burst;
+}
+
+/**
+ * Envoi minimal d'un seau : une trame, ou un dixime de seconde de
+ * dbit s'il est plus faible. Attendre d'avoir de quoi l'envoyer vite
+ * de rveiller la boucle pour quelques octets.
+ */
+static uint64_t bucket_step(const bucket_t *bucket)
+{
+  return bucket->rate < FRAME_SIZE * 10 ? bucket->rate / 10 + 1 : FRAME_SIZE;
+}
+
+/**
+ * Initialise un seau, plein.
+ *
+ * @param rate dbit en octets par seconde, 0 pour ne pas limiter
+ */
+void bucket_init(bucket_t *bucket, uint64_t rate)
+{
+  bucket->rate = rate;
+  bucket->tokens = bucket_burst(bucket);
+  bucket->last = shaper_now();
+}
+
+/**
+ * Remplit le seau du temps coul, et donne ce qui peut tre envoy.
+ *
+ * @param want octets  envoyer
+ * @return au plus want, 0 s'il faut attendre des jetons
+ */
+size_t bucket_available(bucket_t *bucket, size_t want)
+{
+  if (bucket->rate == 0)
+    return want;
+
+  uint64_t now = shaper_now();
+  uint64_t burst = bucket_burst(bucket);
+
+  /* Au-del d'une seconde, le seau est plein de toute faon */
+  uint64_t elapsed = now - bucket->last;
+  if (elapsed > 1000000000)
+    elapsed = 1000000000;
+
+  /* Les ns sans jeton entier restent acquises : last n'avance que du temps converti */
+  uint64_t earned = elapsed * bucket->rate / 1000000000;
+  if (earned > 0)
+    {
+      bucket->tokens = bucket->tokens + earned > burst ? burst : bucket->tokens + earned;
+      bucket->last = bucket->tokens == burst ? now
+	: bucket->last + earned * 1000000000 / bucket->rate;
+    }
+
+  if (bucket->tokens < want && bucket->tokens < bucket_step(bucket))
+    return 0;
+
+  return want < bucket->tokens ? want : bucket->tokens;
+}
+
+void bucket_take(bucket_t *bucket, size_t n)
+{
+  if (bucket->rate > 0)
+    bucket->tokens = n < bucket->tokens ? bucket->tokens - n : 0;
+}
+
+/**
+ * Rend des jetons pris pour un envoi qui n'est pas parti en entier.
+ */
+void bucket_give(bucket_t *bucket, size_t n)
+{
+  uint64_t burst = bucket_burst(bucket);
+
+  if (bucket->rate > 0)
+    bucket->tokens = bucket->tokens + n > burst ? burst : bucket->tokens + n;
+}
+
+/**
+ * Temps avant que le seau permette un envoi minimal.
+ *
+ * @return en ms, 0 s'il le permet dj
+ */
+int bucket_delay(const bucket_t *bucket)
+{
+  uint64_t step = bucket_step(bucket);
+
+  if (bucket->rate == 0 || bucket->tokens >= step)
+    return 0;
+
+  return (step - bucket->tokens) * 1000 / bucket->rate + 1;
+}
@@ -0,0 +1,36 @@
+#ifndef SHAPER_H
+#define SHAPER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Crdit donn  chaque tour  une connection ayant des envois en attente */
+#define SHAPER_QUANTUM (64 * 1024)
+
+/* Le crdit d'une connection qui n'envoie pas ne dpasse pas 4 quanta */
+#define SHAPER_MAX_DEFICIT (4 * SHAPER_QUANTUM)
+
+/* Un seau accumule au plus ce temps de dbit (et au moins une trame) */
+#define SHAPER_BURST_MS 100
+
+/*
+ * Seau  jetons : rate octets par seconde, accumuls jusqu' une rafale
+ * de SHAPER_BURST_MS. Un dbit nul ne limite rien.
+ */
+typedef struct
+{
+
+  uint64_t rate;
+  uint64_t tokens;
+  uint64_t last;    /* Dernier remplissage, en ns */
+
+} bucket_t;
+
+extern uint64_t shaper_now();
+extern void bucket_init(bucket_t *, uint64_t);
+extern size_t bucket_available(bucket_t *, size_t);
+extern void bucket_take(bucket_t *, size_t);
+extern void bucket_give(bucket_t *, size_t);
+extern int bucket_delay(const bucket_t *);
+
+#endif
@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include "shmring.h"
+
+/* L'en-tte occupe une page, les donnes commencent  la suivante */
+#define SHMRING_HEADER_SIZE 4096
+
+void shmring_init(shmring_t *ring)
+{
+  ring->fd = -1;
+  ring->header = NULL;
+  ring->data = NULL;
+}
+
+/**
+ * Cre l'anneau : un memfd scell  sa taille, pour qu'un lecteur qui
+ * l'a mapp ne puisse jamais recevoir de SIGBUS.
+ *
+ * @return false en cas d'erreur
+ */
+bool shmring_open(shmring_t *ring)
+{
+  size_t total = SHMRING_HEADER_SIZE + SHMRING_SIZE;
+  void *map;
+
+  if ((ring->fd = memfd_create("cadid-output", MFD_CLOEXEC | MFD_ALLOW_SEALING)) == -1)
+    {
+      perror("memfd_create");
+      return false;
+    }
+
+  if (ftruncate(ring->fd, total) == -1
+      || fcntl(ring->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1
+      || (map = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0)) == MAP_FAILED)
+    {
+      perror("shmring_open");
+      close(ring->fd);
+      ring->fd = -1;
+      return false;
+    }
+
+  ring->header = map;
+  ring->data = (char *) map + SHMRING_HEADER_SIZE;
+  ring->header->data_offset = SHMRING_HEADER_SIZE;
+  ring->header->size = SHMRING_SIZE;
+  __atomic_store_n(&ring->header->magic, SHMRING_MAGIC, __ATOMIC_RELEASE);
+  return true;
+}
+
+/**
+ * Reprend un anneau existant (Reexec)  partir de son memfd.
+ *
+ * @return false en cas d'erreur
+ */
+bool shmring_attach(shmring_t *ring, int fd)
+{
+  void *map = mmap(NULL, SHMRING_HEADER_SIZE + SHMRING_SIZE, PROT_READ | PROT_WRITE,
+		   MAP_SHARED, fd, 0);
+
+  if (map == MAP_FAILED)
+    {
+      perror("mmap");
+      return false;
+    }
+
+  ring->fd = fd;
+  ring->header = map;
+  ring->data = (char *) map + SHMRING_HEADER_SIZE;
+  return true;
+}
+
+/**
+ * Ajoute des donnes  l'anneau, en crasant les plus anciennes si besoin.
+ */
+void shmring_write(shmring_t *ring, const void *data, size_t len)
+{
+  const char *p = data;
+
+  if (ring->fd == -1 || len == 0)
+    return;
+
+  uint64_t head = ring->header->head;
+
+  /* Seule la fin compte si les donnes sont plus grandes que l'anneau */
+  if (len > SHMRING_SIZE)
+    {
+      head += len - SHMRING_SIZE;
+      p += len - SHMRING_SIZE;
+      len = SHMRING_SIZE;
+    }
+
+  /* On annonce d'abord ce qui va tre cras */
+  if (head + len > SHMRING_SIZE)
+    __atomic_store_n(&ring->header->tail, head + len - SHMRING_SIZE, __ATOMIC_RELEASE);
+
+  size_t offset = head % SHMRING_SIZE;
+  size_t first = SHMRING_SIZE - offset < len ? SHMRING_SIZE - offset : len;
+
+  memcpy(ring->data + offset, p, first);
+  memcpy(ring->data, p + first, len - first);
+
+  __atomic_store_n(&ring->header->head, head + len, __ATOMIC_RELEASE);
+}
+
+/**
+ * Signale aux lecteurs la fin de la sortie.
+ */
+void shmring_close(shmring_t *ring)
+{
+  if (ring->fd != -1)
+    __atomic_store_n(&ring->header->closed, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Libre l'anneau ct dmon. Les lecteurs qui l'ont mapp le gardent.
+ */
+void shmring_free(shmring_t *ring)
+{
+  if (ring->fd == -1)
+    return;
+
+  shmring_close(ring);
+  munmap(ring->header, SHMRING_HEADER_SIZE + SHMRING_SIZE);
+  close(ring->fd);
+  shmring_init(ring);
+}
+
+/**
+ * Ouvre l'anneau en lecture seule, pour le transmettre  un client : il
+ * ne pourra le mapper qu'en lecture.
+ *
+ * @return un nouveau descripteur,  fermer par l'appelant, ou -1
+ */
+int shmring_export(const shmring_t *ring)
+{
+  char path[64];
+  int fd;
+
+  snprintf(path, sizeof path, "/proc/self/fd/%d", ring->fd);
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+    perror(path);
+
+  return fd;
+}
@@ -0,0 +1,56 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* "CADI" : un anneau initialis */
+#define SHMRING_MAGIC 0x43414449
+
+/* Taille des donnes d'un anneau */
+#define SHMRING_SIZE (1024 * 1024)
+
+/*
+ * En-tte d'un anneau de sortie partag, au dbut du memfd ; les donnes
+ * suivent  l'offset data_offset. Le dmon est le seul crivain. Un
+ * lecteur qui a mapp le memfd en lecture seule suit la sortie ainsi :
+ *
+ *   - head (acquire) : nombre total d'octets crits, l'octet n tant 
+ *     data[n % size] ;
+ *   - tail (acquire) : plus ancien octet encore prsent. Il est publi
+ *     avant que les donnes ne soient crases : une copie de [p, head[
+ *     n'est valide que si tail <= p quand on le relit aprs la copie ;
+ *   - closed : plus rien ne sera crit (fin de la sortie).
+ */
+typedef struct
+{
+
+  uint32_t magic;
+  uint32_t data_offset;
+  uint64_t size;
+  uint64_t head;
+  uint64_t tail;
+  uint32_t closed;
+
+} shmring_header_t;
+
+/* Un anneau ct dmon */
+typedef struct
+{
+
+  int fd;                   /* memfd, -1 si l'anneau n'existe pas */
+  shmring_header_t *header;
+  char *data;
+
+} shmring_t;
+
+extern void shmring_init(shmring_t *);
+extern bool shmring_open(shmring_t *);
+extern bool shmring_attach(shmring_t *, int);
+extern void shmring_write(shmring_t *, const void *, size_t);
+extern void shmring_close(shmring_t *);
+extern void shmring_free(shmring_t *);
+extern int shmring_export(const shmring_t *);
+
+#endif
@@ -0,0 +1,112 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+/* Pas de <sys/socket.h> : accept y est dclare avec une union transparente */
+struct sockaddr;
+
+/*
+ * Injection de pannes pour make soak, charge dans cadid par LD_PRELOAD :
+ * un appel sur SOAK_FAULT_EVERY de accept, pipe2, fork et strdup choue
+ * comme le ferait un systme  court de ressources (EMFILE, EAGAIN,
+ * ENOMEM). Chaque panne est note sur la sortie d'erreur, que soak.sh
+ * compte. Les fils du dmon hritent de LD_PRELOAD : seul cadid est
+ * touch.
+ */
+
+extern char *program_invocation_short_name;
+
+/** Un appel sur every choue, 0 pour aucun */
+static unsigned every;
+
+static void faults_init(void) __attribute__ ((constructor));
+
+static void faults_init(void)
+{
+  const char *e = getenv("SOAK_FAULT_EVERY");
+
+  if (e != NULL && !strcmp(program_invocation_short_name, "cadid"))
+    every = atoi(e);
+}
+
+/**
+ * Dcide si cet appel choue ; si oui, errno reoit err.
+ *
+ * @param calls compteur d'appels de la fonction
+ * @param name nom de la fonction, pour la trace
+ */
+static bool inject(unsigned *calls, const char *name, int err)
+{
+  if (every == 0 || ++*calls % every != 0)
+    return false;
+
+  /* Pas de stdio : elle pourrait allouer, et strdup est peut-tre en train d'chouer */
+  char line[64] = "soak-faults : ";
+  strncat(line, name, sizeof line - strlen(line) - 2);
+  strcat(line, "\n");
+  write(STDERR_FILENO, line, strlen(line));
+
+  errno = err;
+  return true;
+}
+
+/**
+ * La fonction suivante de ce nom (celle de la libc).
+ */
+static void *next(const char *name)
+{
+  return dlsym(RTLD_NEXT, name);
+}
+
+int accept(int fd, struct sockaddr *addr, socklen_t *len)
+{
+  static int (*real)(int, struct sockaddr *, socklen_t *);
+  static unsigned calls;
+
+  if (inject(&calls, "accept", EMFILE))
+    return -1;
+  if (real == NULL)
+    *(void **) &real = next("accept");
+  return real(fd, addr, len);
+}
+
+int pipe2(int fds[2], int flags)
+{
+  static int (*real)(int[2], int);
+  static unsigned calls;
+
+  if (inject(&calls, "pipe2", EMFILE))
+    return -1;
+  if (real == NULL)
+    *(void **) &real = next("pipe2");
+  return real(fds, flags);
+}
+
+pid_t fork(void)
+{
+  static pid_t (*real)(void);
+  static unsigned calls;
+
+  if (inject(&calls, "fork", EAGAIN))
+    return -1;
+  if (real == NULL)
+    *(void **) &real = next("fork");
+  return real();
+}
+
+char *strdup(const char *s)
+{
+  static unsigned calls;
+  size_t len = strlen(s) + 1;
+  char *copy;
+
+  if (inject(&calls, "strdup", ENOMEM) || (copy = malloc(len)) == NULL)
+    return NULL;
+  return memcpy(copy, s, len);
+}
@@ -0,0 +1,232 @@
+#!/bin/bash
+#
+# Endurance de cadid (make soak) : le dmon tourne sous des charges
+# hostiles pendant la dure donne, avec des pannes injectes par
+# faults.so (LD_PRELOAD). Chaque seconde, on relve la latence d'une
+# commande, la mmoire (RSS) et les descripteurs ouverts du dmon, qui
+# doivent rester borns. On vrifie ensuite que les dfauts dj
+# corrigs ne reviennent pas : fils zombies, acceptations abandonnes
+# sur EMFILE, arguments de CreateProcess jamais librs.
+#
+# Usage : soak/soak.sh [secondes]   (dfaut 60 ; quelques heures pour une vraie endurance)
+#
+# Variables :
+#   SOAK_PORT         port du dmon (dfaut : au hasard)
+#   SOAK_BACKEND      options du dmon en plus, -u pour io_uring (accept n'y est pas inject)
+#   SOAK_FAULT_EVERY  un appel sur n de accept, pipe2, fork et strdup choue (dfaut 50, 0 sans pannes)
+#   SOAK_LATENCY_MS   latence maximale d'une commande (dfaut 500)
+#   SOAK_RSS_KB       mmoire maximale du dmon (dfaut 131072)
+#   SOAK_LEAK_KB      croissance maximale de la mmoire sur 3000 CreateProcess (dfaut 1024)
+
+cd "$(dirname "$0")/.." || exit 1
+
+DURATION=${1:-60}
+PORT=${SOAK_PORT:-$((20000 + RANDOM % 20000))}
+FAULT_EVERY=${SOAK_FAULT_EVERY:-50}
+LATENCY_MS=${SOAK_LATENCY_MS:-500}
+RSS_KB=${SOAK_RSS_KB:-131072}
+LEAK_KB=${SOAK_LEAK_KB:-1024}
+
+# Limite de descripteurs donne au dmon (-F), que les relevs ne doivent pas dpasser
+FD_MAX=128
+
+LOG=$(mktemp /tmp/cadi-soak.XXXXXX)
+failures=0
+
+fail()
+{
+  echo "soak : CHEC : $*" >&2
+  failures=$((failures + 1))
+}
+
+# Un dmon bloqu fait chouer les vrifications au lieu de bloquer soak
+TIMEOUT=10
+
+# Une session cadi : commandes sur l'entre, rponses sur la sortie
+session()
+{
+  timeout $TIMEOUT ./cadi -p "$PORT" 2> /dev/null
+}
+
+# Lance une commande, affiche son pid (rien si CreateProcess a chou)
+create()
+{
+  echo "CreateProcess $*" | session | sed -n 's/.*OK \([0-9][0-9]*\)$/\1/p' | head -1
+}
+
+# Dtruit tous les processus du dmon
+destroy_all()
+{
+  echo ListProcess | session | awk '$2 ~ /^[0-9]+$/ { print "DestroyProcess " $2 }' | session > /dev/null
+}
+
+running()
+{
+  [ "$(date +%s)" -lt "$END" ]
+}
+
+# Fils qui inondent leur sortie standard, dtruits en pleine production
+flood()
+{
+  while running; do
+    pid=$(create yes soak-flood)
+    sleep 1
+    [ -n "$pid" ] && echo "DestroyProcess $pid" | session > /dev/null
+  done
+}
+
+# Fils qui ne lisent jamais leur entre : SendInput remplit le pipe, puis le fils part
+deaf()
+{
+  local data
+  data=$(head -c 1000 /dev/zero | tr '\0' x)
+  while running; do
+    pid=$(create sleep 2)
+    [ -n "$pid" ] && for i in $(seq 200); do echo "SendInput $pid $data"; done | session > /dev/null
+    sleep 1
+  done
+}
+
+# Rafales de crations au-del de la table des processus
+bomb()
+{
+  while running; do
+    { for i in $(seq 15); do echo "CreateProcess sleep 1"; done
+      echo "CreateProcessBatch 20 sleep 1"; } | session > /dev/null
+    sleep 2
+  done
+}
+
+# Clients qui lisent  peine, puis partent en plein transfert
+slow()
+{
+  local fd
+  while running; do
+    pid=$(create seq 1 2000000)
+    sleep 1
+    [ -z "$pid" ] && continue
+    if exec {fd}<> "/dev/tcp/127.0.0.1/$PORT"; then
+      printf 'GetOutput %s\n' "$pid" >&$fd
+      timeout $TIMEOUT head -c 4096 <&$fd > /dev/null
+      sleep 2
+      exec {fd}>&-
+    fi
+    echo "DestroyProcess $pid" | session > /dev/null
+  done 2> /dev/null
+}
+
+# Transferts par trames abandonns : le lecteur de cadi -j s'en va
+framed()
+{
+  while running; do
+    printf 'seq 1 300000\nseq 1 300000\n' | timeout $TIMEOUT ./cadi -p "$PORT" -j 2 2> /dev/null \
+      | { sleep 1; head -c 10000 > /dev/null; }
+  done
+}
+
+# Taille de la mmoire rsidente du dmon, en Ko
+rss()
+{
+  awk '/^VmRSS/ { print $2 }' "/proc/$DAEMON/status" 2> /dev/null || echo 0
+}
+
+zombies()
+{
+  ps -o stat= --ppid "$DAEMON" | grep -c '^Z'
+}
+
+LD_PRELOAD=$PWD/soak/faults.so SOAK_FAULT_EVERY=$FAULT_EVERY \
+  ./cadid -p "$PORT" -F $FD_MAX -M 64 -n 8 -t 5 $SOAK_BACKEND > "$LOG" 2>&1 &
+DAEMON=$!
+trap 'kill $DAEMON $(jobs -p) 2> /dev/null; wait 2> /dev/null; rm -f "$LOG"' EXIT
+
+for i in $(seq 50); do
+  echo ListProcess | session | grep -q '^OK' && break
+  sleep 0.1
+done
+if ! kill -0 $DAEMON 2> /dev/null; then
+  cat "$LOG" >&2
+  echo "soak : le dmon n'a pas dmarr" >&2
+  exit 1
+fi
+
+echo "soak : $DURATION s sur le port $PORT, une panne tous les $FAULT_EVERY appels"
+
+# Arguments de CreateProcess : la mmoire ne doit pas crotre avec les crations.
+# Mesur sur le dmon neuf : aprs les charges, une fuite comblerait
+# d'abord les trous laisss dans le tas sans faire monter la RSS.
+args=$(for i in $(seq 40); do printf ' %020d' $i; done)
+leak_round()
+{
+  for n in $(seq "$1"); do
+    for i in $(seq 10); do echo "CreateProcess true$args"; done | session \
+      | sed -n 's/.*OK \([0-9][0-9]*\)$/DestroyProcess \1/p' | session > /dev/null
+  done
+}
+leak_round 30
+base=$(rss)
+leak_round 300
+grown=$(($(rss) - base))
+[ $grown -gt $LEAK_KB ] && fail "mmoire en hausse de $grown Ko sur 3000 CreateProcess (au plus $LEAK_KB)"
+
+END=$(($(date +%s) + DURATION))
+for load in flood deaf bomb slow framed; do
+  $load &
+done
+
+max_latency=0
+max_rss=0
+max_fds=0
+while running; do
+  start=$(date +%s%N)
+  if ! echo ListProcess | session | grep -q '^OK'; then
+    kill -0 $DAEMON 2> /dev/null || break
+    fail "ListProcess sans rponse"
+  fi
+  latency=$((($(date +%s%N) - start) / 1000000))
+  [ $latency -gt $max_latency ] && max_latency=$latency
+
+  r=$(rss)
+  fds=$(ls "/proc/$DAEMON/fd" | wc -l)
+  [ "${r:-0}" -gt $max_rss ] && max_rss=$r
+  [ $fds -gt $max_fds ] && max_fds=$fds
+  sleep 1
+done
+wait $(jobs -p | grep -v "^$DAEMON\$") 2> /dev/null
+
+if ! kill -0 $DAEMON 2> /dev/null; then
+  tail -20 "$LOG" >&2
+  fail "le dmon est mort"
+  exit 1
+fi
+
+[ $max_latency -gt $LATENCY_MS ] && fail "latence de $max_latency ms (au plus $LATENCY_MS)"
+[ $max_rss -gt $RSS_KB ] && fail "mmoire de $max_rss Ko (au plus $RSS_KB)"
+[ $max_fds -gt $FD_MAX ] && fail "$max_fds descripteurs ouverts (au plus $FD_MAX)"
+
+# Zombies : un processus dtruit en cours d'excution doit tre attendu
+destroy_all
+pid=$(create sleep 30)
+[ -n "$pid" ] && echo "DestroyProcess $pid" | session > /dev/null
+sleep 1
+destroy_all
+sleep 1
+[ "$(zombies)" -gt 0 ] && fail "$(zombies) fils zombies"
+
+# EMFILE : le dmon doit continuer d'accepter aprs une acceptation refuse
+if [ "$FAULT_EVERY" -gt 0 ] && [ -z "$SOAK_BACKEND" ]; then
+  before=$(grep -c 'soak-faults : accept' "$LOG")
+  for i in $(seq $((FAULT_EVERY * 2))); do
+    echo ListProcess | session | grep -q '^OK' || { fail "connection refuse aprs un EMFILE"; break; }
+  done
+  [ "$(grep -c 'soak-faults : accept' "$LOG")" -gt "$before" ] || fail "aucun EMFILE inject sur accept"
+fi
+
+echo "soak : latence max $max_latency ms, mmoire max $max_rss Ko, descripteurs max $max_fds," \
+  "$(grep -c '^soak-faults' "$LOG") pannes injectes, mmoire +$grown Ko sur 3000 CreateProcess"
+
+if [ $failures -gt 0 ]; then
+  echo "soak : $failures vrification(s) en chec" >&2
+  exit 1
+fi
+echo "soak : OK"
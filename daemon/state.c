@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include "state.h"
+
+/**
+ * Cre le memfd recevant l'tat.
+ *
+ * @return false en cas d'erreur
+ */
+bool state_create(state_t *state)
+{
+  state->ok = false;
+  state->keep = NULL;
+  state->nkeep = 0;
+
+  if ((state->fd = memfd_create("cadid-state", MFD_CLOEXEC)) == -1)
+    {
+      perror("memfd_create");
+      return false;
+    }
+
+  if ((state->f = fdopen(state->fd, "w+")) == NULL)
+    {
+      perror("fdopen");
+      close(state->fd);
+      return false;
+    }
+
+  state->ok = true;
+  state_put(state, STATE_MAGIC, strlen(STATE_MAGIC));
+  return true;
+}
+
+/**
+ * Termine l'criture de l'tat.
+ *
+ * @return un descripteur de l'tat, qui sera gard  l'exec, ou -1 en
+ * cas d'erreur
+ */
+int state_finish(state_t *state)
+{
+  int fd;
+
+  if (fflush(state->f) == EOF || !state->ok
+      || (fd = dup(state->fd)) == -1)
+    {
+      perror("state");
+      fclose(state->f);
+      free(state->keep);
+      return -1;
+    }
+
+  fclose(state->f);
+
+  /* Le nouveau binaire relit depuis le dbut */
+  if (lseek(fd, 0, SEEK_SET) == -1)
+    {
+      perror("lseek");
+      close(fd);
+      free(state->keep);
+      return -1;
+    }
+
+  return fd;
+}
+
+/**
+ * Lance le nouveau binaire. Les descripteurs crits dans l'tat restent
+ * ouverts  l'exec ; ils redeviennent close-on-exec si l'exec choue.
+ *
+ * @param args ligne de commande du nouveau binaire, args[0] tant cherch
+ * dans le $PATH s'il ne contient pas de '/'
+ */
+void state_exec(state_t *state, char *const args[])
+{
+  for (size_t i = 0; i < state->nkeep; i++)
+    fcntl(state->keep[i], F_SETFD, 0);
+
+  execvp(args[0], args);
+  perror(args[0]);
+
+  for (size_t i = 0; i < state->nkeep; i++)
+    fcntl(state->keep[i], F_SETFD, FD_CLOEXEC);
+
+  free(state->keep);
+}
+
+/**
+ * Ouvre l'tat laiss par l'ancien binaire.
+ *
+ * @return false si fd n'est pas un tat lisible
+ */
+bool state_open(state_t *state, int fd)
+{
+  char magic[sizeof STATE_MAGIC];
+
+  state->fd = fd;
+  state->ok = (state->f = fdopen(fd, "r")) != NULL;
+  if (!state->ok)
+    {
+      perror("fdopen");
+      return false;
+    }
+
+  return state_get(state, magic, strlen(STATE_MAGIC))
+    && !memcmp(magic, STATE_MAGIC, strlen(STATE_MAGIC));
+}
+
+void state_close(state_t *state)
+{
+  fclose(state->f);
+}
+
+void state_put(state_t *state, const void *data, size_t len)
+{
+  if (state->ok && len > 0 && fwrite(data, len, 1, state->f) != 1)
+    state->ok = false;
+}
+
+void state_put_int(state_t *state, long long n)
+{
+  state_put(state, &n, sizeof n);
+}
+
+/**
+ * crit une chane, NULL compris.
+ */
+void state_put_str(state_t *state, const char *s)
+{
+  state_put_int(state, s == NULL ? -1 : (long long) strlen(s));
+  if (s != NULL)
+    state_put(state, s, strlen(s));
+}
+
+/**
+ * crit un descripteur. S'il est close-on-exec, state_exec le gardera
+ * ouvert pour le nouveau binaire, et il le redeviendra  sa lecture.
+ */
+void state_put_fd(state_t *state, int fd)
+{
+  int flags = fd == -1 ? 0 : fcntl(fd, F_GETFD);
+
+  if (flags == -1)
+    {
+      perror("fcntl");
+      state->ok = false;
+    }
+
+  else if (flags & FD_CLOEXEC)
+    {
+      int *keep = realloc(state->keep, (state->nkeep + 1) * sizeof *keep);
+      if (keep == NULL)
+	{
+	  perror("realloc");
+	  state->ok = false;
+	}
+      else
+	{
+	  state->keep = keep;
+	  state->keep[state->nkeep++] = fd;
+	}
+    }
+
+  state_put_int(state, fd);
+  state_put_int(state, flags & FD_CLOEXEC);
+}
+
+bool state_get(state_t *state, void *data, size_t len)
+{
+  if (state->ok && len > 0 && fread(data, len, 1, state->f) != 1)
+    state->ok = false;
+
+  return state->ok;
+}
+
+long long state_get_int(state_t *state)
+{
+  long long n = 0;
+  state_get(state, &n, sizeof n);
+  return n;
+}
+
+/**
+ * Lit len octets dans un buffer allou,  librer par l'appelant.
+ *
+ * @return le buffer, NULL si len est nul ou en cas d'erreur
+ */
+char *state_get_data(state_t *state, size_t len)
+{
+  char *data;
+
+  if (len == 0 || !state->ok)
+    return NULL;
+
+  if ((data = malloc(len)) == NULL)
+    {
+      perror("malloc");
+      state->ok = false;
+      return NULL;
+    }
+
+  if (!state_get(state, data, len))
+    {
+      free(data);
+      return NULL;
+    }
+
+  return data;
+}
+
+/**
+ * Lit une chane,  librer par l'appelant.
+ *
+ * @return la chane, NULL si c'tait NULL ou en cas d'erreur
+ */
+char *state_get_str(state_t *state)
+{
+  long long len = state_get_int(state);
+  char *s;
+
+  if (len < 0 || !state->ok || (s = malloc(len + 1)) == NULL)
+    return NULL;
+
+  if (!state_get(state, s, len))
+    {
+      free(s);
+      return NULL;
+    }
+
+  s[len] = '\0';
+  return s;
+}
+
+int state_get_fd(state_t *state)
+{
+  int fd = state_get_int(state);
+
+  if (state_get_int(state) && fd != -1)
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  return fd;
+}
@@ -0,0 +1,44 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* Dbut de l'tat sauvegard, chang  chaque modification du format */
+#define STATE_MAGIC "CADISTATE9\n"
+
+/*
+ * tat du dmon sauvegard pour Reexec, dans un memfd que le nouveau
+ * binaire relit. Les descripteurs n'ont pas besoin d'tre transmis :
+ * execve les garde, il suffit de ne pas les fermer  l'exec.
+ */
+typedef struct
+{
+
+  FILE *f;
+  int fd;
+  bool ok;          /* Passe  false  la premire erreur */
+  int *keep;        /* Descripteurs crits,  garder ouverts  l'exec */
+  size_t nkeep;
+
+} state_t;
+
+extern bool state_create(state_t *);
+extern int state_finish(state_t *);
+extern void state_exec(state_t *, char *const[]);
+extern bool state_open(state_t *, int);
+extern void state_close(state_t *);
+
+extern void state_put(state_t *, const void *, size_t);
+extern void state_put_int(state_t *, long long);
+extern void state_put_str(state_t *, const char *);
+extern void state_put_fd(state_t *, int);
+
+extern bool state_get(state_t *, void *, size_t);
+extern long long state_get_int(state_t *);
+extern char *state_get_str(state_t *);
+extern char *state_get_data(state_t *, size_t);
+extern int state_get_fd(state_t *);
+
+#endif
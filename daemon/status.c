@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "status.h"
+
+/**
+ * Chemin de la page d'tat d'un port.
+ */
+static void status_path(char *path, size_t size, unsigned port)
+{
+  snprintf(path, size, STATUS_PATH_FORMAT, port);
+}
+
+/**
+ * Cre la page d'tat du dmon. Elle est lisible par tous, seul le dmon
+ * peut l'crire.
+ *
+ * @param port le port du dmon
+ * @param keep true pour reprendre la page existante et ses compteurs
+ * (aprs un Reexec), false pour la remettre  zro
+ * @return la page mappe, NULL si elle n'a pas pu tre cre
+ */
+status_page_t *status_create(unsigned port, bool keep)
+{
+  char path[64];
+  status_path(path, sizeof path, port);
+
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd == -1)
+    {
+      perror(path);
+      return NULL;
+    }
+
+  status_page_t *page = NULL;
+  if (fchmod(fd, 0644) == -1 || ftruncate(fd, sizeof *page) == -1)
+    perror(path);
+  else if ((page = mmap(NULL, sizeof *page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))
+	   == MAP_FAILED)
+    {
+      perror("mmap");
+      page = NULL;
+    }
+  close(fd);
+
+  if (page == NULL)
+    return NULL;
+
+  /* Dmon arrt au milieu d'une mise  jour */
+  if (page->seq & 1)
+    status_end(page);
+
+  /* seq n'est pas remis  zro : il doit rester pair pour les lecteurs */
+  if (!keep || page->magic != STATUS_MAGIC || page->version != STATUS_VERSION)
+    {
+      status_begin(page);
+      memset(&page->daemon_pid, 0, sizeof *page - offsetof(status_page_t, daemon_pid));
+      page->magic = STATUS_MAGIC;
+      page->version = STATUS_VERSION;
+      status_end(page);
+    }
+  return page;
+}
+
+/**
+ * Dbut d'une mise  jour : les lecteurs attendront status_end.
+ */
+void status_begin(status_page_t *page)
+{
+  __atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void status_end(status_page_t *page)
+{
+  __atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Supprime la page d'tat  l'arrt du dmon. Les lecteurs qui l'ont
+ * mappe gardent la dernire version.
+ */
+void status_remove(unsigned port)
+{
+  char path[64];
+  status_path(path, sizeof path, port);
+  unlink(path);
+}
+
+/**
+ * Mappe en lecture seule la page d'tat d'un dmon.
+ *
+ * @return NULL si le dmon ne publie pas de page
+ */
+const status_page_t *status_map(unsigned port)
+{
+  char path[64];
+  status_path(path, sizeof path, port);
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    {
+      perror(path);
+      return NULL;
+    }
+
+  struct stat st;
+  const status_page_t *page = NULL;
+  if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof *page)
+    fprintf(stderr, "%s : page d'tat incomplte\n", path);
+  else if ((page = mmap(NULL, sizeof *page, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+      perror("mmap");
+      page = NULL;
+    }
+  close(fd);
+  return page;
+}
+
+/**
+ * Copie cohrente de la page d'tat, sans appel systme.
+ *
+ * @return false si la page n'est pas (ou plus) dans un format connu
+ */
+bool status_snapshot(const status_page_t *page, status_page_t *copy)
+{
+  uint32_t before, after;
+
+  do
+    {
+      while ((before = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE)) & 1)
+	;
+      memcpy(copy, (const void *) page, sizeof *copy);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      after = __atomic_load_n(&page->seq, __ATOMIC_RELAXED);
+    }
+  while (before != after);
+
+  return copy->magic == STATUS_MAGIC && copy->version == STATUS_VERSION;
+}
@@ -0,0 +1,76 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* "CADS" : une page d'tat initialise */
+#define STATUS_MAGIC 0x43414453
+
+/* Chang  chaque modification de status_page_t */
+#define STATUS_VERSION 1
+
+/* Chemin de la page d'tat d'un dmon, selon son port */
+#define STATUS_PATH_FORMAT "/dev/shm/cadid.%u"
+
+/* Nombre de processus publis (MAX_PROCESS ne concerne que le dmon) */
+#define STATUS_MAX_PROCESS 64
+
+/* Dbut de la commande et du groupe publis */
+#define STATUS_COMMAND_SIZE 64
+#define STATUS_TAG_SIZE 16
+
+/* Un processus de la page d'tat */
+typedef struct
+{
+
+  int32_t pid;
+  int32_t ret;
+  uint64_t out_len;   /* Sortie standard reue, en octets */
+  uint64_t err_len;
+  char tag[STATUS_TAG_SIZE];
+  char command[STATUS_COMMAND_SIZE];
+
+} status_process_t;
+
+/*
+ * Page d'tat publie par le dmon dans STATUS_PATH_FORMAT, relue 
+ * chaque tour de boucle. Les moniteurs la mappent en lecture seule et
+ * la lisent sans appel systme ni change avec le dmon.
+ *
+ * Le dmon est le seul crivain et la protge par un seqlock : seq est
+ * impair pendant une mise  jour. Un lecteur copie la page entre deux
+ * lectures de seq (acquire), et recommence si elles diffrent ou si la
+ * premire est impaire (status_snapshot).
+ */
+typedef struct
+{
+
+  uint32_t magic;
+  uint32_t version;
+  uint32_t seq;
+  int32_t daemon_pid;
+
+  uint64_t updated;       /* Dernire mise  jour, en s depuis l'Epoch */
+  uint64_t started;
+  uint64_t commands;      /* Commandes traites */
+  uint64_t connections;   /* Connections acceptes */
+  uint32_t clients;       /* Clients connects */
+  uint32_t max_process;
+  uint64_t change_seq;    /* Comme ListChanges */
+  uint64_t buffered;      /* Mmoire des buffers (Stats) */
+  uint64_t budget;
+  uint32_t suspended;     /* Budget atteint : les sorties dbordent sur disque */
+  uint32_t nprocesses;
+  status_process_t processes[STATUS_MAX_PROCESS];
+
+} status_page_t;
+
+extern status_page_t *status_create(unsigned, bool);
+extern void status_begin(status_page_t *);
+extern void status_end(status_page_t *);
+extern void status_remove(unsigned);
+extern const status_page_t *status_map(unsigned);
+extern bool status_snapshot(const status_page_t *, status_page_t *);
+
+#endif
@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#include "template.h"
+#include "process.h"
+#include "cadid.h"
+#include "state.h"
+
+/**
+ * Un modle de commande : la ligne de commande fige et l'excutable
+ * rsolu une fois pour toutes, gard ouvert en O_PATH.
+ */
+typedef struct
+{
+
+  char *name;
+  char *args[MAX_ARGS];
+  int nargs;
+  char path[PATH_MAX];  /* Chemin rsolu de l'excutable */
+  int fd;               /* Descripteur O_PATH sur path */
+  dev_t dev;            /* Identit du fichier lors de la rsolution, */
+  ino_t ino;            /* pour dtecter son remplacement */
+  struct timespec mtime;
+
+} template_t;
+
+/** Liste des modles */
+static template_t templates[MAX_TEMPLATE];
+
+/**
+ * Retourne l'index du modle portant un nom prcis.
+ *
+ * @param name un nom de modle
+ * @return -1 si le modle n'existe pas, l'index sinon
+ */
+static int index_of_template(const char *name)
+{
+  for (unsigned i = 0; i < sizeof templates / sizeof templates[0]; i++)
+    if (templates[i].name != NULL && !strcmp(templates[i].name, name))
+      return i;
+
+  return -1;
+}
+
+/**
+ * Cherche prog dans le $PATH comme le ferait execvp.
+ *
+ * @param prog nom ou chemin du programme
+ * @param path buffer de PATH_MAX caractres recevant le chemin trouv
+ * @param st reoit les informations du fichier trouv
+ * @return true si un excutable a t trouv
+ */
+bool resolve_executable(const char *prog, char *path, struct stat *st)
+{
+  if (strchr(prog, '/') != NULL)
+    {
+      snprintf(path, PATH_MAX, "%s", prog);
+      return stat(path, st) == 0 && S_ISREG(st->st_mode)
+	&& access(path, X_OK) == 0;
+    }
+
+  const char *dirs = getenv("PATH");
+  if (dirs == NULL)
+    dirs = "/bin:/usr/bin";
+
+  while (*dirs)
+    {
+      size_t len = strcspn(dirs, ":");
+
+      /* Un lment vide dsigne le rpertoire courant */
+      if (len == 0)
+	snprintf(path, PATH_MAX, "%s", prog);
+      else
+	snprintf(path, PATH_MAX, "%.*s/%s", (int) len, dirs, prog);
+
+      if (stat(path, st) == 0 && S_ISREG(st->st_mode)
+	  && access(path, X_OK) == 0)
+	return true;
+
+      dirs += len;
+      if (*dirs == ':')
+	dirs++;
+    }
+
+  return false;
+}
+
+/**
+ * (Re)rsout l'excutable d'un modle et ouvre le descripteur associ.
+ *
+ * @return true si l'excutable a pu tre rsolu
+ */
+static bool bind_template(template_t *t)
+{
+  struct stat st;
+
+  if (t->fd != -1)
+    {
+      close(t->fd);
+      t->fd = -1;
+    }
+
+  if (!resolve_executable(t->args[0], t->path, &st))
+    return false;
+
+  if ((t->fd = open(t->path, O_PATH | O_CLOEXEC)) == -1)
+    {
+      perror("open");
+      return false;
+    }
+
+  t->dev = st.st_dev;
+  t->ino = st.st_ino;
+  t->mtime = st.st_mtim;
+  return true;
+}
+
+/**
+ * Libre un modle et son emplacement.
+ */
+static void release_template(template_t *t)
+{
+  if (t->fd != -1)
+    close(t->fd);
+
+  for (int i = 0; i < t->nargs; i++)
+    free(t->args[i]);
+
+  free(t->name);
+  memset(t, 0, sizeof *t);
+}
+
+/**
+ * Dfinit (ou redfinit) un modle de commande.
+ *
+ * @param name nom du modle
+ * @param args ligne de commande (args[0] = programme), termine par NULL
+ * @return le chemin de l'excutable rsolu, NULL en cas d'chec
+ */
+const char *define_template(const char *name, char *const args[])
+{
+  int index = index_of_template(name);
+
+  if (index == -1)
+    for (unsigned i = 0; i < sizeof templates / sizeof templates[0]; i++)
+      if (templates[i].name == NULL)
+	{
+	  index = i;
+	  break;
+	}
+
+  if (index == -1 || args[0] == NULL)
+    return NULL;
+
+  template_t *t = templates + index;
+  if (t->name != NULL)
+    release_template(t);
+
+  t->fd = -1;
+  if ((t->name = strdup(name)) == NULL)
+    {
+      perror("strdup");
+      return NULL;
+    }
+
+  for (t->nargs = 0; args[t->nargs] != NULL && t->nargs < MAX_ARGS - 1; t->nargs++)
+    if ((t->args[t->nargs] = strdup(args[t->nargs])) == NULL)
+      {
+	perror("strdup");
+	release_template(t);
+	return NULL;
+      }
+
+  if (!bind_template(t))
+    {
+      release_template(t);
+      return NULL;
+    }
+
+  return t->path;
+}
+
+bool template_exists(const char *name)
+{
+  return index_of_template(name) != -1;
+}
+
+/**
+ * Lance une instance d'un modle, avec des arguments supplmentaires.
+ * L'excutable n'est rsolu  nouveau que s'il a chang sur le disque.
+ *
+ * @param name nom du modle
+ * @param extra arguments ajouts  la suite du modle, termins par NULL
+ * @return le pid du processus, -1 en cas d'erreur
+ */
+pid_t run_template(const char *name, char *const extra[])
+{
+  int index = index_of_template(name);
+  if (index == -1)
+    return -1;
+
+  template_t *t = templates + index;
+  struct stat st;
+
+  /* Le fichier a t remplac ou modifi : on invalide la rsolution */
+  if (stat(t->path, &st) == -1
+      || st.st_dev != t->dev || st.st_ino != t->ino
+      || st.st_mtim.tv_sec != t->mtime.tv_sec
+      || st.st_mtim.tv_nsec != t->mtime.tv_nsec)
+    if (!bind_template(t))
+      return -1;
+
+  char *args[MAX_ARGS];
+  int n = 0;
+
+  for (int i = 0; i < t->nargs; i++)
+    args[n++] = t->args[i];
+
+  for (int i = 0; extra[i] != NULL && n < MAX_ARGS - 1; i++)
+    args[n++] = extra[i];
+
+  args[n] = NULL;
+
+  return create_process_fd(t->fd, t->path, args);
+}
+
+/**
+ * Sauvegarde les modles pour Reexec : leur ligne de commande seulement,
+ * l'excutable sera rsolu  nouveau.
+ */
+void template_save(state_t *state)
+{
+  unsigned n = 0;
+
+  for (unsigned i = 0; i < sizeof templates / sizeof templates[0]; i++)
+    if (templates[i].name != NULL)
+      n++;
+
+  state_put_int(state, n);
+  for (unsigned i = 0; i < sizeof templates / sizeof templates[0]; i++)
+    {
+      if (templates[i].name == NULL)
+	continue;
+
+      state_put_str(state, templates[i].name);
+      state_put_int(state, templates[i].nargs);
+      for (int j = 0; j < templates[i].nargs; j++)
+	state_put_str(state, templates[i].args[j]);
+    }
+}
+
+/**
+ * Redfinit les modles sauvegards par template_save. Un modle dont
+ * l'excutable a disparu est perdu.
+ *
+ * @return false en cas d'erreur
+ */
+bool template_restore(state_t *state)
+{
+  for (long long n = state_get_int(state); n > 0 && state->ok; n--)
+    {
+      char *name = state_get_str(state);
+      char *args[MAX_ARGS];
+      int nargs = state_get_int(state);
+
+      if (nargs < 0 || nargs >= MAX_ARGS)
+	{
+	  free(name);
+	  return false;
+	}
+
+      for (int i = 0; i < nargs; i++)
+	args[i] = state_get_str(state);
+      args[nargs] = NULL;
+
+      if (name != NULL && define_template(name, args) == NULL)
+	fprintf(stderr, "Modle %s perdu\n", name);
+
+      free(name);
+      for (int i = 0; args[i] != NULL; i++)
+	free(args[i]);
+    }
+
+  return state->ok;
+}
+
+void destroy_all_templates()
+{
+  for (unsigned i = 0; i < sizeof templates / sizeof templates[0]; i++)
+    if (templates[i].name != NULL)
+      release_template(templates + i);
+}
@@ -0,0 +1,21 @@
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "state.h"
+
+/* Nombre de modles de commande maximum */
+#define MAX_TEMPLATE 32
+
+extern bool resolve_executable(const char *, char *, struct stat *);
+extern const char *define_template(const char *, char *const[]);
+extern bool template_exists(const char *);
+extern pid_t run_template(const char *, char *const[]);
+extern void destroy_all_templates();
+extern void template_save(state_t *);
+extern bool template_restore(state_t *);
+
+#endif
@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "status.h"
+#include "config.h"
+
+/*
+ * cadi-top : affiche la page d'tat d'un dmon (status.h). La page est
+ * mappe une fois, chaque rafrachissement n'est qu'une copie mmoire :
+ * surveiller le dmon, mme trs souvent, ne lui cote rien.
+ */
+
+/** Le port du dmon surveill */
+static unsigned port;
+
+/** Intervalle entre deux affichages, en ms */
+static unsigned interval = 1000;
+
+/** Nombre d'affichages, 0 pour ne pas s'arrter */
+static unsigned count;
+
+/**
+ * Affiche l'aide.
+ *
+ * @param prog nom du programme (argv[0])
+ */
+static void usage(const char *prog)
+{
+  printf("Usage : %s [ -h | -p port | -i ms | -n nombre ]\n", prog);
+  printf("\t-p port  . . . . . . . le port du dmon  surveiller (dfaut: %d)\n", DEFAULT_PORT);
+  puts("\t-i ms  . . . . . . . . intervalle entre deux affichages (dfaut: 1000)");
+  puts("\t-n nombre  . . . . . . s'arrter aprs nombre affichages (dfaut: jamais)");
+  puts("\t-h . . . . . . . . . . afficher cette aide");
+}
+
+/**
+ * Parse la ligne de commande.
+ */
+static void parse_command_line(char *argv[])
+{
+  const char *prog = argv[0];
+
+  port = DEFAULT_PORT;
+
+  while (*++argv)
+    {
+      if (!strcmp(*argv, "-h"))
+	{
+	  usage(prog);
+	  exit(EXIT_SUCCESS);
+	}
+
+      else if (!strcmp(*argv, "-p") || !strcmp(*argv, "-i") || !strcmp(*argv, "-n"))
+	{
+	  if (*(argv + 1) == NULL)
+	    {
+	      usage(prog);
+	      exit(EXIT_FAILURE);
+	    }
+
+	  char opt = argv[0][1];
+	  unsigned value = atoi(*++argv);
+	  if (opt == 'p')
+	    port = value;
+	  else if (opt == 'i')
+	    interval = value;
+	  else
+	    count = value;
+	}
+
+      else
+	{
+	  fprintf(stderr, "Option \"%s\" inconnue\n\n", *argv);
+	  usage(prog);
+	  exit(EXIT_FAILURE);
+	}
+    }
+}
+
+/**
+ * Formate une taille en octets.
+ */
+static const char *human(char *buf, size_t size, uint64_t bytes)
+{
+  static const char *units[] = { "o", "Ko", "Mo", "Go", "To" };
+  double value = bytes;
+  unsigned unit = 0;
+
+  while (value >= 1024 && unit < sizeof units / sizeof units[0] - 1)
+    {
+      value /= 1024;
+      unit++;
+    }
+
+  snprintf(buf, size, unit ? "%.1f %s" : "%.0f %s", value, units[unit]);
+  return buf;
+}
+
+/**
+ * Affiche une copie de la page d'tat.
+ */
+static void show(const status_page_t *page)
+{
+  char a[32], b[32];
+  uint64_t now = time(NULL);
+  uint64_t up = now > page->started ? now - page->started : 0;
+
+  printf("cadid %d, port %u : en service depuis %luh%02lum%02lus, mis  jour il y a %lus\n",
+	 page->daemon_pid, port, (unsigned long) (up / 3600), (unsigned long) (up / 60 % 60),
+	 (unsigned long) (up % 60),
+	 (unsigned long) (now > page->updated ? now - page->updated : 0));
+  printf("Clients %u   Connections %lu   Commandes %lu   Changements %lu\n", page->clients,
+	 (unsigned long) page->connections, (unsigned long) page->commands,
+	 (unsigned long) page->change_seq);
+  printf("Buffers %s / %s   sorties %s\n", human(a, sizeof a, page->buffered),
+	 page->budget ? human(b, sizeof b, page->budget) : "illimit",
+	 page->suspended ? "sur disque" : "en mmoire");
+  printf("Processus %u/%u\n\n", page->nprocesses, page->max_process);
+
+  printf("%8s %5s %10s %10s  %-*s %s\n", "PID", "Ret.", "Sortie", "Erreur",
+	 STATUS_TAG_SIZE - 1, "Groupe", "Commande");
+  for (unsigned i = 0; i < page->nprocesses && i < STATUS_MAX_PROCESS; i++)
+    {
+      const status_process_t *p = page->processes + i;
+      char ret[16];
+
+      if (p->ret == -1)
+	strcpy(ret, "-");
+      else
+	snprintf(ret, sizeof ret, "%d", p->ret);
+
+      printf("%8d %5s %10s %10s  %-*.*s %.*s\n", p->pid, ret, human(a, sizeof a, p->out_len),
+	     human(b, sizeof b, p->err_len), STATUS_TAG_SIZE - 1, STATUS_TAG_SIZE - 1, p->tag,
+	     STATUS_COMMAND_SIZE, p->command);
+    }
+}
+
+/**
+ * Point d'entre du programme.
+ */
+int main(int argc, char *argv[])
+{
+  argc = argc; /* Evite un warning */
+  parse_command_line(argv);
+
+  const status_page_t *page = status_map(port);
+  if (page == NULL)
+    return EXIT_FAILURE;
+
+  /* Rafrachissement en place sur un terminal */
+  bool clear = isatty(STDOUT_FILENO) && count != 1;
+  static status_page_t copy;
+
+  for (unsigned n = 0; count == 0 || n < count; n++)
+    {
+      if (n > 0)
+	{
+	  struct timespec ts = { interval / 1000, (long) (interval % 1000) * 1000000 };
+	  nanosleep(&ts, NULL);
+	}
+
+      if (!status_snapshot(page, &copy))
+	{
+	  fputs("Page d'tat dans un format inconnu\n", stderr);
+	  return EXIT_FAILURE;
+	}
+
+      if (clear)
+	fputs("\033[H\033[2J", stdout);
+      else if (n > 0)
+	putchar('\n');
+      show(&copy);
+      fflush(stdout);
+    }
+
+  return EXIT_SUCCESS;
+}
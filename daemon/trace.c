@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "trace.h"
+
+/** Anneau des intervalles, allou  l'activation, et nombre d'enregistrs */
+static trace_event_t *events;
+static uint64_t recorded;
+
+/**
+ * Heure de l'horloge monotone, en ns.
+ */
+static uint64_t trace_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Active ou arrte le traceur intgr. L'arrter libre les intervalles
+ * enregistrs.
+ *
+ * @return false si la mmoire manque
+ */
+bool trace_enable(bool on)
+{
+  if (on && events == NULL)
+    {
+      if ((events = malloc(TRACE_EVENTS * sizeof *events)) == NULL)
+	{
+	  perror("malloc");
+	  return false;
+	}
+      recorded = 0;
+    }
+  else if (!on)
+    {
+      free(events);
+      events = NULL;
+    }
+
+  return true;
+}
+
+bool trace_enabled()
+{
+  return events != NULL;
+}
+
+/**
+ * Dbut d'un intervalle.
+ *
+ * @return l'heure, 0 si le traceur est arrt
+ */
+uint64_t trace_begin()
+{
+  return events != NULL ? trace_now() : 0;
+}
+
+/**
+ * Fin d'un intervalle : il est enregistr,  la place du plus ancien si
+ * l'anneau est plein.
+ *
+ * @param name nom de l'tape, coup au premier espace (une commande)
+ * @param start retour de trace_begin
+ */
+void trace_end(const char *name, uint64_t start, long arg)
+{
+  /* Activ en cours d'intervalle : il est ignor */
+  if (events == NULL || start == 0)
+    return;
+
+  trace_event_t *e = events + recorded++ % TRACE_EVENTS;
+  size_t len = strcspn(name, " ");
+
+  if (len >= TRACE_NAME_SIZE)
+    len = TRACE_NAME_SIZE - 1;
+
+  e->start = start;
+  e->duration = trace_now() - start;
+  e->arg = arg;
+  memcpy(e->name, name, len);
+  e->name[len] = '\0';
+}
+
+unsigned trace_count()
+{
+  return recorded < TRACE_EVENTS ? recorded : TRACE_EVENTS;
+}
+
+/**
+ * crit les intervalles enregistrs, du plus ancien au plus rcent, au
+ * format Chrome trace (JSON, lisible par chrome://tracing ou Perfetto).
+ * L'anneau est ensuite vid.
+ *
+ * @return le nombre d'intervalles crits, -1 en cas d'erreur
+ */
+int trace_dump(const char *path)
+{
+  FILE *f;
+  unsigned count = trace_count();
+  pid_t pid = getpid();
+
+  if (events == NULL)
+    return 0;
+
+  if ((f = fopen(path, "w")) == NULL)
+    {
+      perror(path);
+      return -1;
+    }
+
+  fputs("{\"traceEvents\":[\n", f);
+  for (unsigned i = 0; i < count; i++)
+    {
+      const trace_event_t *e = events + (recorded - count + i) % TRACE_EVENTS;
+
+      /* Les noms viennent des clients : on ne garde que l'ASCII qui n'a pas  tre chapp */
+      fputs("{\"name\":\"", f);
+      for (const unsigned char *c = (const unsigned char *) e->name; *c; c++)
+	fputc(*c == '"' || *c == '\\' || *c < ' ' || *c > '~' ? '?' : *c, f);
+      fprintf(f, "\",\"cat\":\"cadid\",\"ph\":\"X\",\"ts\":%llu.%03u,\"dur\":%llu.%03u,"
+	      "\"pid\":%d,\"tid\":0,\"args\":{\"arg\":%ld}}%s\n",
+	      (unsigned long long) (e->start / 1000), (unsigned) (e->start % 1000),
+	      (unsigned long long) (e->duration / 1000), (unsigned) (e->duration % 1000),
+	      (int) pid, e->arg, i + 1 < count ? "," : "");
+    }
+  fputs("],\"displayTimeUnit\":\"ms\"}\n", f);
+
+  if (fclose(f) == EOF)
+    {
+      perror(path);
+      return -1;
+    }
+
+  recorded = 0;
+  return count;
+}
@@ -0,0 +1,61 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Sondes USDT (provider cadid), pour perf, bpftrace ou SystemTap :
+ * compiles seulement si <sys/sdt.h> est disponible (le Makefile dfinit
+ * alors HAVE_SDT), sinon elles ne cotent rien. Chaque tape a une sonde
+ * <tape>__begin et une sonde <tape>__end.
+ */
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+#define TRACE_PROBE(name, arg) DTRACE_PROBE1(cadid, name, arg)
+#define TRACE_PROBE2(name, arg1, arg2) DTRACE_PROBE2(cadid, name, arg1, arg2)
+#else
+#define TRACE_PROBE(name, arg) ((void) 0)
+#define TRACE_PROBE2(name, arg1, arg2) ((void) 0)
+#endif
+
+/*
+ * Une tape trace : sondes USDT, et intervalle enregistr par le
+ * traceur intgr s'il est actif. span est une variable locale qui
+ * garde l'heure de dbut.
+ */
+#define TRACE_BEGIN(span, name, arg) \
+  uint64_t span = trace_begin(); TRACE_PROBE(name##__begin, arg)
+#define TRACE_END(span, name, arg) \
+  do { TRACE_PROBE(name##__end, arg); trace_end(#name, span, arg); } while (0)
+
+/* Intervalles gards par le traceur intgr (les plus anciens sont perdus) */
+#define TRACE_EVENTS 65536
+
+/* Taille maximale d'un nom d'intervalle, '\0' compris */
+#define TRACE_NAME_SIZE 24
+
+/* Fichier de la trace, si aucun n'est donn */
+#define TRACE_DEFAULT_PATH "/tmp/cadid-trace.json"
+
+/*
+ * Un intervalle du traceur intgr.
+ */
+typedef struct
+{
+
+  uint64_t start;     /* En ns (CLOCK_MONOTONIC) */
+  uint64_t duration;  /* En ns */
+  long arg;           /* Socket, pid ou taille, selon l'tape */
+  char name[TRACE_NAME_SIZE];
+
+} trace_event_t;
+
+extern bool trace_enable(bool);
+extern bool trace_enabled();
+extern uint64_t trace_begin();
+extern void trace_end(const char *, uint64_t, long);
+extern unsigned trace_count();
+extern int trace_dump(const char *);
+
+#endif
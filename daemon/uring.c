@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "uring.h"
+
+/* Les appels systme io_uring n'ont pas d'enveloppe dans la glibc */
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * Cre une instance io_uring et projette ses files en mmoire.
+ *
+ * @param ring l'instance  initialiser
+ * @param entries taille de la file de soumission
+ * @return false si le noyau ne supporte pas io_uring (ou l'interdit)
+ */
+bool uring_init(uring_t *ring, unsigned entries)
+{
+  struct io_uring_params p;
+
+  memset(ring, 0, sizeof *ring);
+  memset(&p, 0, sizeof p);
+
+  if ((ring->fd = sys_io_uring_setup(entries, &p)) == -1)
+    return false;
+
+  /* Les deux files partagent la mme projection depuis le 5.4 */
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+      close(ring->fd);
+      errno = ENOSYS;
+      return false;
+    }
+
+  size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  if (cq_size > ring->sq_size)
+    ring->sq_size = cq_size;
+
+  ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ptr == MAP_FAILED)
+    {
+      close(ring->fd);
+      return false;
+    }
+
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    {
+      munmap(ring->sq_ptr, ring->sq_size);
+      close(ring->fd);
+      return false;
+    }
+
+  char *sq = ring->sq_ptr;
+  ring->sq_head = (unsigned *) (sq + p.sq_off.head);
+  ring->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *) (sq + p.sq_off.array);
+
+  char *cq = ring->sq_ptr;
+  ring->cq_head = (unsigned *) (cq + p.cq_off.head);
+  ring->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+  return true;
+}
+
+void uring_exit(uring_t *ring)
+{
+  if (ring->br != NULL)
+    {
+      munmap(ring->br, ring->br_entries * sizeof(struct io_uring_buf));
+      free(ring->br_data);
+    }
+
+  munmap(ring->sqes, ring->sqes_size);
+  munmap(ring->sq_ptr, ring->sq_size);
+  close(ring->fd);
+}
+
+/**
+ * Retourne une SQE libre, mise  zro. Si la file est pleine, ce qui a
+ * t prpar est soumis d'abord.
+ *
+ * @return NULL si aucune SQE n'a pu tre libre
+ */
+struct io_uring_sqe *uring_get_sqe(uring_t *ring)
+{
+  unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  unsigned tail = *ring->sq_tail + ring->sq_queued;
+
+  if (tail - head > *ring->sq_mask)
+    {
+      if (uring_submit_and_wait(ring, 0) == -1)
+	return NULL;
+
+      head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+      tail = *ring->sq_tail;
+      if (tail - head > *ring->sq_mask)
+	return NULL;
+    }
+
+  unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = ring->sqes + index;
+
+  memset(sqe, 0, sizeof *sqe);
+  ring->sq_array[index] = index;
+  ring->sq_queued++;
+  return sqe;
+}
+
+/**
+ * S'assure que n SQE sont libres, en soumettant d'abord ce qui a t
+ * prpar s'il le faut. Une chane d'oprations lies (IOSQE_IO_LINK)
+ * doit tenir en entier dans la file : une soumission au milieu, ou une
+ * SQE manquante, laisserait le lien porter sur l'opration suivante.
+ *
+ * @return false si la place n'a pas pu tre libre
+ */
+bool uring_reserve(uring_t *ring, unsigned n)
+{
+  unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  unsigned tail = *ring->sq_tail + ring->sq_queued;
+
+  if (tail - head + n <= *ring->sq_mask + 1)
+    return true;
+
+  if (uring_submit_and_wait(ring, 0) == -1)
+    return false;
+
+  head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  return *ring->sq_tail - head + n <= *ring->sq_mask + 1;
+}
+
+/**
+ * Soumet les SQE prpares et attend au moins wait compltions, le tout
+ * en un seul appel systme.
+ *
+ * @return le nombre de SQE soumises, -1 en cas d'erreur
+ */
+int uring_submit_and_wait(uring_t *ring, unsigned wait)
+{
+  __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->sq_queued, __ATOMIC_RELEASE);
+  ring->sq_queued = 0;
+
+  /* Y compris les SQE qu'un appel interrompu par un signal n'a pas consommes */
+  unsigned submit = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+  int ret;
+  do
+    ret = sys_io_uring_enter(ring->fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+  while (ret == -1 && errno == EINTR && wait == 0);
+
+  if (ret == -1 && errno != EINTR)
+    perror("io_uring_enter");
+
+  return ret;
+}
+
+/**
+ * Retourne la prochaine compltion disponible, sans attendre.
+ *
+ * @return NULL si la file de compltion est vide
+ */
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring)
+{
+  unsigned head = *ring->cq_head;
+
+  if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    return NULL;
+
+  return ring->cqes + (head & *ring->cq_mask);
+}
+
+void uring_cqe_seen(uring_t *ring)
+{
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Enregistre des buffers auprs du noyau, utilisables ensuite par
+ * READ_FIXED / WRITE_FIXED sans qu'il ait  les pingler  chaque appel.
+ */
+bool uring_register_buffers(uring_t *ring, const struct iovec *iov, unsigned n)
+{
+  if (sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, iov, n) == -1)
+    {
+      perror("io_uring_register");
+      return false;
+    }
+
+  return true;
+}
+
+/**
+ * Fournit au noyau un anneau de buffers dans lequel il choisit o
+ * dposer les donnes des rceptions (IOSQE_BUFFER_SELECT).
+ *
+ * @param ring l'instance io_uring
+ * @param group identifiant du groupe de buffers
+ * @param entries nombre de buffers (puissance de 2)
+ * @param size taille de chaque buffer
+ */
+bool uring_setup_buf_ring(uring_t *ring, unsigned group, unsigned entries, unsigned size)
+{
+  struct io_uring_buf_reg reg;
+  size_t ring_size = entries * sizeof(struct io_uring_buf);
+
+  ring->br = mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring->br == MAP_FAILED)
+    {
+      ring->br = NULL;
+      return false;
+    }
+
+  if ((ring->br_data = malloc(entries * size)) == NULL)
+    {
+      munmap(ring->br, ring_size);
+      ring->br = NULL;
+      return false;
+    }
+
+  memset(&reg, 0, sizeof reg);
+  reg.ring_addr = (unsigned long) ring->br;
+  reg.ring_entries = entries;
+  reg.bgid = group;
+
+  if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+    {
+      munmap(ring->br, ring_size);
+      free(ring->br_data);
+      ring->br = NULL;
+      return false;
+    }
+
+  ring->br_entries = entries;
+  ring->br_size = size;
+  ring->br->tail = 0;
+
+  for (unsigned i = 0; i < entries; i++)
+    uring_buf_recycle(ring, i);
+
+  return true;
+}
+
+char *uring_buf(uring_t *ring, unsigned id)
+{
+  return ring->br_data + (size_t) id * ring->br_size;
+}
+
+/**
+ * Rend un buffer au noyau une fois ses donnes consommes.
+ */
+void uring_buf_recycle(uring_t *ring, unsigned id)
+{
+  unsigned short tail = ring->br->tail;
+  struct io_uring_buf *buf = ring->br->bufs + (tail & (ring->br_entries - 1));
+
+  buf->addr = (unsigned long) uring_buf(ring, id);
+  buf->len = ring->br_size;
+  buf->bid = id;
+  __atomic_store_n(&ring->br->tail, (unsigned short) (tail + 1), __ATOMIC_RELEASE);
+}
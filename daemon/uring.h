@@ -0,0 +1,55 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/*
+ * Une instance io_uring, manipule directement par les appels systme
+ * (pas de liburing) : files de soumission et de compltion projetes en
+ * mmoire, et ventuellement un anneau de buffers fournis au noyau pour
+ * les rceptions multishot.
+ */
+typedef struct
+{
+
+  int fd;
+
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned sq_queued;  /* SQE prpares, pas encore soumises */
+
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ptr;  /* Projection commune des deux files */
+  size_t sq_size;
+  size_t sqes_size;
+
+  struct io_uring_buf_ring *br;  /* Buffers fournis pour les rceptions */
+  char *br_data;
+  unsigned br_entries;
+  unsigned br_size;
+
+} uring_t;
+
+extern bool uring_init(uring_t *, unsigned);
+extern void uring_exit(uring_t *);
+extern struct io_uring_sqe *uring_get_sqe(uring_t *);
+extern bool uring_reserve(uring_t *, unsigned);
+extern int uring_submit_and_wait(uring_t *, unsigned);
+extern struct io_uring_cqe *uring_peek_cqe(uring_t *);
+extern void uring_cqe_seen(uring_t *);
+extern bool uring_register_buffers(uring_t *, const struct iovec *, unsigned);
+extern bool uring_setup_buf_ring(uring_t *, unsigned, unsigned, unsigned);
+extern char *uring_buf(uring_t *, unsigned);
+extern void uring_buf_recycle(uring_t *, unsigned);
+
+#endif